@@ -236,15 +236,12 @@ public:
     std::vector<std::string> passes;
 
     if (blob.size()) {
-      passes[0] = std::string();
-
-      unsigned num_passes = 0;
+      passes.push_back(std::string());
       for (auto c : blob) {
         if (c == ',') {
-          num_passes++;
-          passes[num_passes] = std::string();
+          passes.push_back(std::string());
         } else {
-          passes[num_passes].push_back(static_cast<char>(c));
+          passes.back().push_back(static_cast<char>(c));
         }
       }
     }
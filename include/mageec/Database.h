@@ -37,17 +37,101 @@
 #include "sqlite3.h"
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
 #define MAGEEC_DATABASE_VERSION_MAJOR 1
-#define MAGEEC_DATABASE_VERSION_MINOR 0
+#define MAGEEC_DATABASE_VERSION_MINOR 4
 #define MAGEEC_DATABASE_VERSION_PATCH 0
 
 namespace mageec {
 
 class IMachineLearner;
 
+/// \struct DecisionCacheKey
+///
+/// \brief Identifies the decisions made for a set of features by a trained
+/// machine learner.
+struct DecisionCacheKey {
+  /// Features the decisions were made for
+  FeatureSetID feature_set_id;
+  /// Hash of the parameters taken by native decisions
+  uint64_t native_hash;
+  /// Name of the machine learner, and the metric it was trained against
+  std::string ml;
+  std::string metric;
+  /// Digest of the trained model which made the decisions
+  uint64_t ml_digest;
+};
+
+/// \struct SourceFeatureSet
+///
+/// \brief The set of features extracted for a program unit of a source file
+struct SourceFeatureSet {
+  /// Name of the program unit, which is the module name or the mangled
+  /// function name
+  std::string unit_name;
+  /// Class of the features, which is also the kind of program unit
+  FeatureClass feature_class;
+  /// The features of the program unit
+  FeatureSetID feature_set_id;
+  /// Whether the feature set holds only some of the features of the
+  /// program unit. This is ignored when the feature sets are recorded.
+  bool partial;
+};
+
+/// \struct UnitCompilation
+///
+/// \brief The compilation of a single program unit, to be recorded in the
+/// database
+struct UnitCompilation {
+  /// Name of the program unit. This is used for debug.
+  std::string name;
+  /// The features of the program unit
+  FeatureSetID feature_set_id;
+};
+
+/// \struct ModuleCompilation
+///
+/// \brief The compilation of a module and the functions within it, all of
+/// which were compiled with the same parameters.
+struct ModuleCompilation {
+  UnitCompilation module;
+  std::vector<UnitCompilation> functions;
+  /// Parameters the module was compiled with
+  ParameterSet parameters;
+  /// If provided, the parameters are cached as the decisions made for the
+  /// features of the module under this key.
+  util::Option<DecisionCacheKey> decision_cache_key;
+};
+
+/// \struct ModuleCompilationIDs
+///
+/// \brief The identifiers recorded in the database for a ModuleCompilation
+struct ModuleCompilationIDs {
+  ParameterSetID parameter_set_id;
+  CompilationID module;
+  /// Compilations of the functions, in the same order as the functions of
+  /// the ModuleCompilation
+  std::vector<CompilationID> functions;
+};
+
+/// \struct TrainedMLDesc
+///
+/// \brief Description of a trained machine learner in the database, without
+/// its training blob.
+struct TrainedMLDesc {
+  /// Name of the machine learner
+  std::string ml;
+  /// Class of features and metric the machine learner was trained against
+  FeatureClass feature_class;
+  std::string metric;
+  /// Size of the training blob in bytes
+  uint64_t blob_size;
+};
+
 /// \class Database
 ///
 /// \brief Main class for accessing the MAGEEC database
@@ -151,6 +235,41 @@ public:
   /// \return All machine learners in the database which are trained.
   std::vector<TrainedML> getTrainedMachineLearners(void);
 
+  /// \brief Get a single trained machine learner from the database
+  ///
+  /// Only the training blob of the requested machine learner is read.
+  ///
+  /// \param ml  Name of the machine learner
+  /// \param feature_class  The class of features it was trained against
+  /// \param metric  The metric it was trained against
+  ///
+  /// \return The trained machine learner, or nullptr if the machine learner
+  /// is not registered, or is not trained for the class of features and
+  /// metric.
+  std::unique_ptr<TrainedML>
+  getTrainedMachineLearner(std::string ml, FeatureClass feature_class,
+                           std::string metric);
+
+  /// \brief Describe the trained machine learners in the database, without
+  /// reading their training blobs.
+  ///
+  /// \return A description of each machine learner in the database which
+  /// is trained, and is registered with the database.
+  std::vector<TrainedMLDesc> getTrainedMachineLearnerDescs(void);
+
+  /// \brief Get the features used by the trained machine learners for a
+  /// class of features
+  ///
+  /// This is recorded when each machine learner is trained, so that feature
+  /// extraction can skip the features which no machine learner uses.
+  ///
+  /// \param feature_class  The class of features
+  ///
+  /// \return The identifiers of the features used by any machine learner
+  /// trained for the class of features, or nothing if there are no such
+  /// machine learners, or one of them may use any feature.
+  util::Option<std::set<unsigned>> getUsedFeatures(FeatureClass feature_class);
+
   /// \brief Garbage collect any entries in the database which are
   /// unreachable from the results.
   void garbageCollect(void);
@@ -182,6 +301,18 @@ public:
   /// \return The identifier of the new feature set in the database
   FeatureSetID newFeatureSet(FeatureSet features);
 
+  /// \brief Add a new set of features to the database, which holds only
+  /// some of the features of its program unit
+  ///
+  /// Such a feature set is enough to make decisions with the machine
+  /// learners which use just those features, but its compilations are not
+  /// used to train or evaluate machine learners.
+  ///
+  /// \param features  The features to be added
+  ///
+  /// \return The identifier of the new feature set in the database
+  FeatureSetID newPartialFeatureSet(FeatureSet features);
+
   /// \brief Retrieve the provided set of features
   ///
   /// \param feature_set_id  The id of the set of features to be extracted
@@ -189,6 +320,24 @@ public:
   /// \return The corresponding features
   FeatureSet getFeatureSetFeatures(FeatureSetID feature_set_id);
 
+  /// \brief Record the sets of features extracted from a source file
+  ///
+  /// This replaces any sets of features previously recorded for the source
+  /// file, so that they can be found when the file is compiled.
+  ///
+  /// \param source_path  Full path of the source file
+  /// \param feature_sets  The features of each program unit in the file
+  void setSourceFeatureSets(std::string source_path,
+                            const std::vector<SourceFeatureSet> &feature_sets);
+
+  /// \brief Get the sets of features recorded for a source file
+  ///
+  /// \param source_path  Full path of the source file
+  ///
+  /// \return The features of each program unit in the file, which is empty
+  /// if none have been recorded.
+  std::vector<SourceFeatureSet> getSourceFeatureSets(std::string source_path);
+
   /// \brief Retrieve the provided set of parameters in a ParameterSet
   ///
   /// \param param_set_id  The id of the set of parameters to be extracted
@@ -225,6 +374,51 @@ public:
   /// \return The identifier of the new parameter set in the database
   ParameterSetID newParameterSet(ParameterSet parameters);
 
+  /// \brief Record the compilations of several modules and their functions
+  ///
+  /// This is equivalent to calling newParameterSet and newCompilation for
+  /// each module and function, and cacheDecisions for each module with a
+  /// decision cache key, but everything is written in a single transaction.
+  ///
+  /// \param compilations  The modules which were compiled
+  ///
+  /// \return The identifiers of the compilations, in the same order as the
+  /// provided modules
+  std::vector<ModuleCompilationIDs>
+  newCompilations(const std::vector<ModuleCompilation> &compilations);
+
+//===--------------------- Decision cache interface -----------------------===//
+
+  /// \brief Get the digest of the model of a trained machine learner
+  ///
+  /// The digest changes whenever the machine learner is retrained, so that
+  /// decisions cached for the old model are not used.
+  ///
+  /// \param ml  Identifier of the machine learner
+  /// \param feature_class  The class of features it was trained against
+  /// \param metric  The metric it was trained against
+  ///
+  /// \return The digest, or nothing if the machine learner is not trained
+  /// for the class of features and metric.
+  util::Option<uint64_t> getMachineLearnerDigest(std::string ml,
+                                                 FeatureClass feature_class,
+                                                 std::string metric);
+
+  /// \brief Get the parameters previously decided for a set of features
+  ///
+  /// \param key  The features, and the model which decided the parameters
+  ///
+  /// \return The decided parameters, or nothing if no decisions have been
+  /// cached.
+  util::Option<ParameterSetID> getCachedDecisions(const DecisionCacheKey &key);
+
+  /// \brief Cache the parameters decided for a set of features
+  ///
+  /// \param key  The features, and the model which decided the parameters
+  /// \param parameter_set_id  The decided parameters
+  void cacheDecisions(const DecisionCacheKey &key,
+                      ParameterSetID parameter_set_id);
+
 //===------------------------ Results interface ---------------------------===//
 
   /// \brief Add results entries to the database for previously
@@ -247,6 +441,30 @@ public:
   void trainMachineLearner(std::string ml, FeatureClass feature_class,
                            std::string metric);
 
+  /// \brief Get the descriptions of the features, parameters and passes
+  /// which machine learners are trained against.
+  ///
+  /// This includes every feature and parameter type in the database, even
+  /// if some of them don't occur in the results for a given metric.
+  ///
+  /// \param feature_descs  Filled with the description of every feature
+  /// \param parameter_descs  Filled with the description of every parameter
+  /// \param passes  Filled with the name of every pass in a pass sequence
+  void getTrainingDescs(std::set<FeatureDesc> &feature_descs,
+                        std::set<ParameterDesc> &parameter_descs,
+                        std::set<std::string> &passes);
+
+  /// \brief Get every result for a class of features and a metric
+  ///
+  /// These are the results provided to a machine learner when it is trained
+  /// against the metric, in the same order.
+  ///
+  /// \param feature_class  The class of features of the results
+  /// \param metric  The metric of the results
+  /// \return The results
+  std::vector<Result> getResults(FeatureClass feature_class,
+                                 std::string metric);
+
 private:
   /// Handle to the underlying sqlite3 database
   sqlite3 *m_db;
@@ -261,6 +479,26 @@ private:
   /// \param db  The database to be initialized
   static void init_db(sqlite3 &db);
 
+  /// \brief Upgrade a database created by an earlier minor version
+  ///
+  /// The tables and columns added since the version of the database are
+  /// created, so that databases remain usable as the schema is extended.
+  ///
+  /// \return True if the database is now the current version, false if it
+  /// has a different major version or a later minor version.
+  bool upgrade(void);
+
+  /// \brief Find or insert a parameter set, probing for a free identifier
+  /// if there is a different set with the same hash.
+  ///
+  /// This must be called within a transaction which holds a write lock on
+  /// the database, so that no other process can insert a conflicting set.
+  ///
+  /// \param parameters  The parameters composing this set
+  ///
+  /// \return The identifier of the parameter set in the database
+  ParameterSetID insertParameterSet(const ParameterSet &parameters);
+
   /// \brief Validate the contents of the database
   ///
   /// This is used to check that a database is valid and well formed, and to
@@ -282,6 +520,15 @@ public:
   ResultIterator(Database &db, sqlite3 &raw_db, FeatureClass feature_class,
                  std::string metric);
 
+  /// \brief Construct an iterator over results which have already been
+  /// retrieved from the database
+  ///
+  /// This allows a machine learner to be trained on a subset of the results,
+  /// for example when cross-validating it.
+  ///
+  /// \param results  Results to iterate over, in order
+  explicit ResultIterator(std::vector<Result> results);
+
   ResultIterator() = delete;
   ResultIterator(const ResultIterator &other) = delete;
   ResultIterator(ResultIterator &&other);
@@ -295,6 +542,11 @@ private:
   Database *m_db;
   std::unique_ptr<SQLQuery> m_query;
   std::unique_ptr<SQLQueryIterator> m_result_iter;
+
+  /// Results iterated over when not retrieving them from the database, and
+  /// the position of the current result.
+  std::vector<Result> m_results;
+  size_t m_pos;
 };
 
 /// \class SQLTransaction
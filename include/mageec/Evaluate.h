@@ -0,0 +1,123 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===------------------ MAGEEC machine learner evaluation -----------------===//
+//
+// This defines a k-fold cross-validation harness for machine learners. The
+// results are split into folds by feature set, and the machine learner is
+// trained on all but one fold and asked to decide the best parameters of the
+// held-out fold, measuring both the quality and the cost of its decisions.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MAGEEC_EVALUATE_H
+#define MAGEEC_EVALUATE_H
+
+#include "mageec/Result.h"
+#include "mageec/Types.h"
+#include "mageec/Util.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace mageec {
+
+class IMachineLearner;
+
+/// \struct DecisionAccuracy
+///
+/// \brief Accuracy of the decisions made for a single parameter or pass
+struct DecisionAccuracy {
+  /// Number of held-out feature sets whose best result has a value for the
+  /// parameter or pass
+  uint64_t total = 0;
+  /// Number of those for which the machine learner made a decision
+  uint64_t decided = 0;
+  /// Number of those for which the decision matched the best result
+  uint64_t correct = 0;
+};
+
+/// \struct FoldEvaluation
+///
+/// \brief Cost of training and preparing the model of a single fold
+struct FoldEvaluation {
+  /// Seconds taken to train the machine learner
+  double train_seconds = 0.0;
+  /// Seconds taken to prepare the trained model for decisions
+  double prepare_seconds = 0.0;
+  /// Size of the training blob in bytes
+  uint64_t model_bytes = 0;
+  /// Number of feature sets held out from training
+  uint64_t n_held_out = 0;
+};
+
+/// \struct Evaluation
+///
+/// \brief Result of cross-validating a machine learner
+struct Evaluation {
+  /// Cost of each fold
+  std::vector<FoldEvaluation> folds;
+  /// Accuracy of the decisions for each parameter, by parameter id
+  std::map<unsigned, DecisionAccuracy> parameters;
+  /// Accuracy of the decisions for each pass, by pass name
+  std::map<std::string, DecisionAccuracy> passes;
+  /// Seconds taken to make each decision, in ascending order
+  std::vector<double> decision_seconds;
+
+  /// \brief Get a percentile of the time taken to make a decision
+  ///
+  /// \param percentile  Percentile between 0 and 100
+  /// \return The time in seconds, or 0 if no decisions were made
+  double decisionPercentile(double percentile) const;
+};
+
+/// \brief Cross-validate a machine learner with k folds
+///
+/// Results for the same feature set are always placed in the same fold, so
+/// the machine learner never sees the feature sets it is asked to decide.
+/// For each held-out feature set, the parameters of its best result are the
+/// expected decisions.
+///
+/// Each fold trains the machine learner from scratch. Folds are run in
+/// separate processes, so machine learners which are not thread-safe may be
+/// evaluated in parallel. When they are, the caller should limit the threads
+/// each fold trains on with IMachineLearner::setThreadBudget.
+///
+/// \param ml  The machine learner to evaluate, configured for training
+/// \param feature_descs  Features to train against
+/// \param parameter_descs  Parameters to train against
+/// \param passes  Passes to train against
+/// \param results  Results to train on and evaluate against
+/// \param n_folds  Number of folds, at least 2
+/// \param jobs  Maximum number of folds to run at once
+///
+/// \return The evaluation, or nothing if there are fewer feature sets than
+/// folds, or a fold failed
+util::Option<Evaluation>
+evaluateMachineLearner(const IMachineLearner &ml,
+                       const std::set<FeatureDesc> &feature_descs,
+                       const std::set<ParameterDesc> &parameter_descs,
+                       const std::set<std::string> &passes,
+                       const std::vector<Result> &results, unsigned n_folds,
+                       unsigned jobs);
+
+} // end of namespace mageec
+
+#endif // MAGEEC_EVALUATE_H
@@ -32,6 +32,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #if !defined(MAGEEC_VERSION_MAJOR) || !defined(MAGEEC_VERSION_MINOR) ||        \
     !defined(MAGEEC_VERSION_PATCH)
@@ -86,6 +87,10 @@ public:
 
   /// \brief Load a machine learner from a provided plugin
   ///
+  /// The plugin is a shared object holding a native model, as generated by
+  /// the standalone driver. The machine learner is registered with the
+  /// framework, using the path as its string identifier.
+  ///
   /// \param ml_path  Path to the machine learner plugin
   /// \return The string identifier of the machine learner if it was loaded
   /// successfully, an empty string otherwise.
@@ -133,6 +138,10 @@ private:
   /// A map of machine learner interfaces registers with the framework, keyed
   /// based on their string identifiers.
   std::map<std::string, IMachineLearner *> m_mls;
+
+  /// Handles of the shared objects loaded by loadMachineLearner. These are
+  /// closed once the machine learners have been deleted.
+  std::vector<void *> m_handles;
 };
 
 } // end of namespace MAGEEC
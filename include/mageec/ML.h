@@ -31,6 +31,10 @@
 #include "mageec/Result.h"
 #include "mageec/Util.h"
 
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -38,6 +42,64 @@ namespace mageec {
 
 class DecisionRequestBase;
 
+/// \struct NativeModelSource
+///
+/// \brief C++ source for a trained machine learner, to be compiled into a
+/// native model.
+///
+/// The source is completed by emitNativeModel, which wraps it in the
+/// interface expected by the NativeMachineLearner. The generated code
+/// receives a row of feature values, with a column for each feature in
+/// the order of 'features', and writes a value for each parameter in the
+/// order of 'parameters'.
+struct NativeModelSource {
+  /// Features read by the model, in the order of the columns of a row.
+  /// Boolean features are 1.0 when true and 0.0 when false, integer
+  /// features hold their value, and missing features are NaN.
+  std::vector<unsigned> features;
+
+  /// Parameters decided by the model, in the order of the values written
+  std::vector<unsigned> parameters;
+
+  /// Definitions emitted ahead of the decision function. These are placed
+  /// in an anonymous namespace, so that they are not exported from the
+  /// model.
+  std::string definitions;
+
+  /// Body of the decision function, which has the signature:
+  ///   void decide(const double *row, int64_t *values,
+  ///               unsigned char *decided)
+  /// For each parameter it decides, the body should write its value and set
+  /// the corresponding entry of 'decided' to 1. 'decided' is zeroed before
+  /// the function is called.
+  std::string decide;
+};
+
+/// \class IPreparedModel
+///
+/// \brief Abstract interface to a trained model, prepared from a blob of
+/// training data so that it can make repeated decisions without
+/// interpreting the blob again.
+class IPreparedModel {
+public:
+  virtual ~IPreparedModel(void) = 0;
+
+  /// \brief Make a decision for each of a set of requests, based on the
+  /// features of a program unit.
+  ///
+  /// \param requests  The decisions to be made
+  /// \param features  A set of features to be used to make the decisions.
+  ///
+  /// \return The resultant decision for each request, in the same order as
+  /// the requests, which are the same as those made by the machine learner
+  /// with the blob the model was prepared from.
+  virtual std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features) const = 0;
+};
+
+inline IPreparedModel::~IPreparedModel() {}
+
 /// \class IMachineLearner
 ///
 /// \brief Abstract interface to a machine learner
@@ -85,6 +147,15 @@ public:
   /// \return True if the config was set successfully.
   virtual bool setDecisionConfig(std::string config_path) = 0;
 
+  /// \brief Limit the number of threads used when training
+  ///
+  /// Machine learners which train on several threads use at most this many
+  /// when their training configuration leaves the number of threads to be
+  /// chosen automatically. This is used when several trainings run at once.
+  ///
+  /// \param threads  Maximum number of threads, or 0 for no limit
+  virtual void setThreadBudget(unsigned threads) { (void)threads; }
+
   /// \brief Get the type of decisions which can be requested of this machine
   /// learner.
   ///
@@ -109,6 +180,45 @@ public:
   makeDecision(const DecisionRequestBase &request, const FeatureSet &features,
                const std::vector<uint8_t> &blob) const = 0;
 
+  /// \brief Make a decision for each of a set of requests, based on the
+  /// features of a program unit and a blob of training data.
+  ///
+  /// This is equivalent to calling makeDecision for each request in turn,
+  /// but allows machine learners to deserialize the blob and prepare the
+  /// features only once for all of the requests.
+  ///
+  /// \param requests  The decisions to be made
+  /// \param features  A set of features to be used by the machine learner to
+  /// make the decisions.
+  /// \param blob  A blob of training data appropriate to the machine learner.
+  ///
+  /// \return The resultant decision for each request, in the same order as
+  /// the requests.
+  virtual std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features,
+                const std::vector<uint8_t> &blob) const {
+    std::vector<std::unique_ptr<DecisionBase>> decisions;
+    decisions.reserve(requests.size());
+    for (const auto *request : requests) {
+      decisions.push_back(makeDecision(*request, features, blob));
+    }
+    return decisions;
+  }
+
+  /// \brief Prepare a model from a blob of training data, which can be used
+  /// to make repeated decisions without interpreting the blob each time.
+  ///
+  /// \param blob  A blob of training data appropriate to the machine learner.
+  ///
+  /// \return The prepared model, or nullptr if the machine learner does not
+  /// support prepared models, in which case decisions should be made
+  /// using the blob directly.
+  virtual std::unique_ptr<IPreparedModel>
+  prepare(const std::vector<uint8_t> &blob) const {
+    (void)blob;
+    return nullptr;
+  }
 
   /// \brief Train the machine learner using a complete set of provided
   /// results.
@@ -130,10 +240,78 @@ public:
   train(std::set<FeatureDesc> feature_descs,
         std::set<ParameterDesc> parameter_descs, std::set<std::string> passes,
         ResultIterator results) const = 0;
+
+  /// \brief Generate C++ source which makes the same decisions as this
+  /// machine learner does with the provided training blob.
+  ///
+  /// This is used to compile a trained machine learner into a native
+  /// model, avoiding interpretation of the blob when making decisions.
+  /// Parameters which the generated source does not decide fall back to
+  /// the native decision.
+  ///
+  /// \param blob  A blob of training data produced by this machine learner
+  ///
+  /// \return The generated source, or nothing if this machine learner
+  /// cannot be compiled to a native model.
+  virtual util::Option<NativeModelSource>
+  generateNativeModel(const std::vector<uint8_t> &blob) const {
+    (void)blob;
+    return nullptr;
+  }
+
+  /// \brief Get the features which this machine learner uses to make
+  /// decisions with the provided training blob.
+  ///
+  /// This is recorded alongside the blob when it is trained, so that only
+  /// the features which are used need to be extracted for later
+  /// decisions.
+  ///
+  /// \param blob  A blob of training data produced by this machine learner
+  ///
+  /// \return The identifiers of the features used, or nothing if any
+  /// feature may be used.
+  virtual util::Option<std::set<unsigned>>
+  getUsedFeatures(const std::vector<uint8_t> &blob) const {
+    (void)blob;
+    return nullptr;
+  }
 };
 
 inline IMachineLearner::~IMachineLearner() {}
 
+/// \brief Merge the pass sequences of a training set into a single order
+///
+/// Machine learners which gate each pass separately use this order to build
+/// a pass sequence from their pass gate decisions. Each pass is placed after
+/// the passes which precede it in the sequences. Where the sequences leave
+/// the order open, or disagree, the pass which appears first goes first.
+///
+/// \param pass_seqs  Pass sequences of the training set
+/// \param passes  Passes to order. Passes which are not in any sequence
+/// follow the others, in the order of the set, and passes in the sequences
+/// which are not in the set are dropped.
+/// \return The order of the passes
+std::vector<std::string>
+mergePassSequences(const std::vector<PassSeq> &pass_seqs,
+                   const std::set<std::string> &passes);
+
+/// \brief Encode the values of a feature set into a dense row
+///
+/// Integer features hold their value, and boolean features one of the
+/// provided values. Features without a column are ignored, and columns
+/// without a value in the feature set are left untouched, so the row should
+/// be filled with NaN beforehand to mark those values as missing.
+///
+/// \param features  The feature set to encode
+/// \param feature_column  Column of each feature in the row
+/// \param row  Start of the row to be written
+/// \param true_value  Value of a true boolean feature
+/// \param false_value  Value of a false boolean feature
+void encodeFeatures(const FeatureSet &features,
+                    const std::map<unsigned, size_t> &feature_column,
+                    std::vector<double>::iterator row, double true_value,
+                    double false_value);
+
 } // end of namespace MAGEEC
 
 #endif // MAGEEC_ML_H
@@ -48,7 +48,14 @@ class DecisionRequestBase;
 ///
 /// This machine learner makes decision by finding the closest set of
 /// features in the training set, and then using the best set of parameters
-/// used to compile that set of features to make decisions.
+/// used to compile that set of features to make decisions. The training set
+/// is indexed by a k-d tree, so that the closest set of features can be found
+/// without comparing against every point. For very large training sets, a
+/// hierarchical navigable small world graph can also be built to find a
+/// close, but not necessarily the closest, set of features. Decisions can be
+/// made by a weighted vote of several of the closest sets of features. Pass
+/// sequences and pass gates are decided from the pass sequences of the same
+/// sets of features, so every request of a batch shares a single search.
 class OneNN : public IMachineLearner {
 public:
   OneNN();
@@ -58,31 +65,93 @@ public:
 
   bool requiresTraining(void) const override { return true; }
 
-  bool requiresTrainingConfig(void) const override { return false; }
-  bool setTrainingConfig(std::string) override {
-    assert(0 && "OneNN should not be provided a training config");
-    return false;
-  }
-  bool requiresDecisionConfig(void) const override { return false; }
-  bool setDecisionConfig(std::string) override {
-    assert(0 && "OneNN should not be provided a decision config");
-    return false;
-  }
+  /// The training configuration is optional, and options which it does not
+  /// set take their defaults. It accepts:
+  ///
+  ///   index = kdtree | hnsw   Whether to also build a navigable small world
+  ///                           graph for approximate search. (kdtree)
+  ///   hnsw_m = N              Links per point in each layer of the graph,
+  ///                           doubled in the bottom layer. (16)
+  ///   hnsw_ef_construction = N
+  ///                           Candidates considered when linking each
+  ///                           point into the graph. (200)
+  ///   hnsw_seed = N           Seed for the layer of each point. (48879)
+  bool requiresTrainingConfig(void) const override { return true; }
+  bool setTrainingConfig(std::string config_path) override;
+
+  /// The decision configuration is optional, and options which it does not
+  /// set take their defaults. It accepts:
+  ///
+  ///   search = exact | approximate
+  ///                           Whether to search the graph, where one was
+  ///                           built, rather than the k-d tree.
+  ///                           (approximate)
+  ///   ef = N                  Candidates considered when searching the
+  ///                           graph. (64)
+  ///   k = N                   Neighbours which vote on each decision,
+  ///                           weighted by their inverse distance. (1)
+  ///
+  /// Native models generated from this machine learner ignore the decision
+  /// configuration, and always use the single nearest point.
+  bool requiresDecisionConfig(void) const override { return true; }
+  bool setDecisionConfig(std::string config_path) override;
 
   std::unique_ptr<DecisionBase>
   makeDecision(const DecisionRequestBase &request, const FeatureSet &features,
                const std::vector<uint8_t> &blob) const override;
 
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features,
+                const std::vector<uint8_t> &blob) const override;
+
+  std::unique_ptr<IPreparedModel>
+  prepare(const std::vector<uint8_t> &blob) const override;
+
   const std::vector<uint8_t> train(std::set<FeatureDesc> feature_descs,
                                    std::set<ParameterDesc> parameter_descs,
                                    std::set<std::string> passes,
                                    ResultIterator results) const override;
 
+  util::Option<NativeModelSource>
+  generateNativeModel(const std::vector<uint8_t> &blob) const override;
+
+  util::Option<std::set<unsigned>>
+  getUsedFeatures(const std::vector<uint8_t> &blob) const override;
+
 private:
-  /// \struct Point
+  /// \struct TrainingConfig
   ///
-  /// \brief Represents a point in N-dimensional space, where N is the number
-  /// of distinct features.
+  /// \brief Options controlling how the training data is indexed
+  struct TrainingConfig {
+    /// Whether to build a graph for approximate search
+    bool build_graph = false;
+    /// Links per point in each layer of the graph
+    unsigned graph_links = 16;
+    /// Candidates considered when linking each point into the graph
+    unsigned graph_ef_construction = 200;
+    /// Seed used to choose the layer of each point in the graph
+    uint64_t graph_seed = 0xBEEF;
+  };
+
+  /// \struct DecisionConfig
+  ///
+  /// \brief Options controlling how the neighbours of a query are found
+  struct DecisionConfig {
+    /// Whether to search the k-d tree even where there is a graph
+    bool exact = false;
+    /// Candidates considered when searching the graph
+    unsigned ef = 64;
+    /// Neighbours which vote on each decision
+    unsigned k = 1;
+  };
+
+  TrainingConfig m_training_config;
+  DecisionConfig m_decision_config;
+
+  /// \struct TrainingData
+  ///
+  /// \brief The points of the training set, laid out densely
   ///
   /// Each distinct feature is a separate axis in N-dimensional space. The
   /// distance between two points is calculated by calculating the Euclidean
@@ -93,10 +162,67 @@ private:
   /// a point is determined to be the closest to an input feature set, then
   /// this parameter set corresponds to the decisions which should be made
   /// for each parameter.
-  struct Point {
-    std::map<unsigned, double>  features;
-    std::map<unsigned, int64_t> parameters;
+  struct TrainingData {
+    /// Range of each feature, used to normalize the features of a query.
+    /// Each feature with a range has a column, in ascending order of id.
+    std::map<unsigned, std::pair<double, double>> feature_max_min;
+
+    /// Number of points in the training set
+    size_t n_points;
+
+    /// Row-major matrix of the normalized features of each point, with NaN
+    /// where the feature is missing from the point.
+    std::vector<double> features;
+
+    /// Identifier of each column of the parameters, in ascending order
+    std::vector<unsigned> parameter_ids;
+
+    /// Row-major matrices of the parameters of each point, and whether each
+    /// parameter is present in the point.
+    std::vector<int64_t> parameter_values;
+    std::vector<uint8_t> parameter_present;
+
+    /// Names of the passes in the pass sequences of the points
+    std::vector<std::string> pass_names;
+
+    /// Identifier of each column of the pass sequences, in ascending order
+    std::vector<unsigned> pass_seq_ids;
+
+    /// Row-major matrices of the pass sequence of each point for each pass
+    /// sequence parameter, as indices into the pass names, and whether each
+    /// pass sequence is present in the point. These are empty if the blob
+    /// predates pass sequences.
+    std::vector<std::vector<uint32_t>> pass_seqs;
+    std::vector<uint8_t> pass_seq_present;
+
+    /// Serialized search index over the points, or empty if there is none
+    std::vector<uint8_t> index;
+
+    /// Serialized graph for approximate search over the points, or empty if
+    /// there is none
+    std::vector<uint8_t> graph;
   };
+
+  /// \class PreparedModel
+  ///
+  /// \brief Model holding the points deserialized from a training blob
+  class PreparedModel;
+
+  /// \brief Deserialize the training data from a blob
+  ///
+  /// This accepts both containers produced by writeBlob and the unversioned
+  /// blobs produced by earlier versions of this machine learner.
+  ///
+  /// \param blob  The blob produced by train
+  /// \return The training data, or nothing if the blob is malformed
+  static util::Option<TrainingData> readBlob(const std::vector<uint8_t> &blob);
+
+  /// \brief Deserialize the training data from an unversioned blob
+  static util::Option<TrainingData>
+  readLegacyBlob(const std::vector<uint8_t> &blob);
+
+  /// \brief Serialize the training data to a blob
+  static std::vector<uint8_t> writeBlob(const TrainingData &data);
 };
 
 } // end of namespace mageec
@@ -17,9 +17,9 @@
 
 //===------------------------ MAGEEC C5.0 Driver --------------------------===//
 //
-// This defines a machine learner interface which uses a driver to drive an
-// external C5.0 machine learner. It calls out to the C5.0 command line in
-// order to make decisions and train.
+// This defines a machine learner interface which uses a driver to drive the
+// C5.0 machine learner. Classifiers are trained in-process by the bundled
+// C5.0 library, and decisions are made from the trained classifier trees.
 //
 //===----------------------------------------------------------------------===//
 
@@ -43,7 +43,11 @@ class DecisionRequestBase;
 
 /// \class C5Driver
 ///
-/// \brief Machine learner which drives an external C5.0 classifier
+/// \brief Machine learner which drives the bundled C5.0 classifier
+///
+/// A classifier is trained for each parameter and for each pass. A pass
+/// sequence is built from the classifiers of the passes, in the order the
+/// passes were run in the training set.
 class C5Driver : public IMachineLearner {
 public:
   C5Driver();
@@ -53,11 +57,26 @@ public:
 
   bool requiresTraining(void) const override { return true; }
 
-  bool requiresTrainingConfig(void) const override { return false; }
-  bool setTrainingConfig(std::string) override {
-    assert(0 && "C5.0 should not be provided a training config");
-    return false;
-  }
+  /// The training configuration is optional, and options which it does not
+  /// set take their defaults. It accepts:
+  ///
+  ///   sample = F      Train each classifier on a random fraction of the
+  ///                   training cases, between 0 and 1. (0, every case)
+  ///   minCases = N    Minimum number of cases in at least two branches of
+  ///                   each split. (1 for parameters, 2 for passes)
+  ///   CF = F          Confidence factor used when pruning, between 0 and
+  ///                   1. Smaller values prune more heavily. (0.25)
+  ///   winnow = B      Whether to winnow features before building each
+  ///                   classifier, true or false. Features which are
+  ///                   winnowed from every classifier are not recorded as
+  ///                   used by the trained machine learner. (false)
+  ///   trials = N      Number of boosting trials, between 1 and 100. Every
+  ///                   trial of a boosted classifier is kept, and votes on
+  ///                   each decision. (1)
+  ///   jobs = N        Number of classifiers to train at once, each in a
+  ///                   separate process, between 1 and 256. (1)
+  bool requiresTrainingConfig(void) const override { return true; }
+  bool setTrainingConfig(std::string config_path) override;
   bool requiresDecisionConfig(void) const override { return false; }
   bool setDecisionConfig(std::string) override {
     assert(0 && "C5.0 should not be provided a decision config");
@@ -68,10 +87,46 @@ public:
   makeDecision(const DecisionRequestBase &request, const FeatureSet &features,
                const std::vector<uint8_t> &blob) const override;
 
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features,
+                const std::vector<uint8_t> &blob) const override;
+
+  std::unique_ptr<IPreparedModel>
+  prepare(const std::vector<uint8_t> &blob) const override;
+
   const std::vector<uint8_t> train(std::set<FeatureDesc> feature_descs,
                                    std::set<ParameterDesc> parameter_descs,
                                    std::set<std::string> passes,
                                    ResultIterator results) const override;
+
+  util::Option<NativeModelSource>
+  generateNativeModel(const std::vector<uint8_t> &blob) const override;
+
+  util::Option<std::set<unsigned>>
+  getUsedFeatures(const std::vector<uint8_t> &blob) const override;
+
+private:
+  /// \struct TrainingConfig
+  ///
+  /// \brief Options passed to the C5.0 classifier when training
+  struct TrainingConfig {
+    /// Fraction of the cases to train on, or 0 to train on every case
+    double sample = 0.0;
+    /// Minimum cases in at least two branches of a split, or 0 to use the
+    /// default for each classifier
+    unsigned min_cases = 0;
+    /// Confidence factor used when pruning
+    double cf = 0.25;
+    /// Whether to winnow features before building each classifier
+    bool winnow = false;
+    /// Number of boosting trials
+    unsigned trials = 1;
+    /// Number of classifiers to train at once
+    unsigned jobs = 1;
+  };
+
+  TrainingConfig m_training_config;
 };
 
 } // end of namespace mageec
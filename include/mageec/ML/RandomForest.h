@@ -0,0 +1,148 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===------------------ MAGEEC Random Forest Classifier -------------------===//
+//
+// This implements a random forest machine learner. A forest of decision
+// trees is grown for each parameter and pass, each tree from a bootstrap
+// sample of the training set, and decisions are made by a majority vote of
+// the trees of the forest.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MAGEEC_RANDOM_FOREST_H
+#define MAGEEC_RANDOM_FOREST_H
+
+#include "mageec/AttributeSet.h"
+#include "mageec/ML.h"
+#include "mageec/Result.h"
+#include "mageec/Types.h"
+#include "mageec/Util.h"
+
+#include <cassert>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace mageec {
+
+class DecisionRequestBase;
+
+/// \class RandomForest
+///
+/// \brief Random forest machine learner
+///
+/// Each boolean parameter, range parameter and pass has its own forest. The
+/// classes of a range parameter are the distinct values it takes in the
+/// training set. The trees split on thresholds chosen from histograms of
+/// the binned values of each feature, and missing features are sent down
+/// whichever side of a split best separates them. A pass sequence is built
+/// from the forest of each pass, in the order the passes were run in the
+/// training set. Trees are grown in parallel, and are seeded individually so
+/// that the trained forest does not depend on the number of threads used to
+/// grow it.
+class RandomForest : public IMachineLearner {
+public:
+  RandomForest();
+  ~RandomForest() override;
+
+  std::string getName(void) const override { return "forest"; }
+
+  bool requiresTraining(void) const override { return true; }
+
+  /// The training configuration is optional, and options which it does not
+  /// set take their defaults. It accepts:
+  ///
+  ///   trees = N               Trees in the forest of each parameter and
+  ///                           pass. (64)
+  ///   max_depth = N           Maximum depth of each tree. (16)
+  ///   min_leaf = N            Minimum cases on each side of a split. (5)
+  ///   split_features = N      Features considered at each split, or 0 for
+  ///                           the square root of the number of features.
+  ///                           (0)
+  ///   bins = N                Maximum histogram bins of each feature. (64)
+  ///   threads = N             Threads growing trees, or 0 for one per
+  ///                           core. (0)
+  ///   seed = N                Seed for the samples and splits. (48879)
+  bool requiresTrainingConfig(void) const override { return true; }
+  bool setTrainingConfig(std::string config_path) override;
+
+  void setThreadBudget(unsigned threads) override {
+    m_thread_budget = threads;
+  }
+
+  bool requiresDecisionConfig(void) const override { return false; }
+  bool setDecisionConfig(std::string) override {
+    assert(0 && "The random forest should not be provided a decision config");
+    return false;
+  }
+
+  std::unique_ptr<DecisionBase>
+  makeDecision(const DecisionRequestBase &request, const FeatureSet &features,
+               const std::vector<uint8_t> &blob) const override;
+
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features,
+                const std::vector<uint8_t> &blob) const override;
+
+  std::unique_ptr<IPreparedModel>
+  prepare(const std::vector<uint8_t> &blob) const override;
+
+  const std::vector<uint8_t> train(std::set<FeatureDesc> feature_descs,
+                                   std::set<ParameterDesc> parameter_descs,
+                                   std::set<std::string> passes,
+                                   ResultIterator results) const override;
+
+  util::Option<NativeModelSource>
+  generateNativeModel(const std::vector<uint8_t> &blob) const override;
+
+  util::Option<std::set<unsigned>>
+  getUsedFeatures(const std::vector<uint8_t> &blob) const override;
+
+private:
+  /// \struct TrainingConfig
+  ///
+  /// \brief Options controlling how the trees of each forest are grown
+  struct TrainingConfig {
+    /// Trees in each forest
+    unsigned trees = 64;
+    /// Maximum depth of each tree
+    unsigned max_depth = 16;
+    /// Minimum cases on each side of a split
+    unsigned min_leaf = 5;
+    /// Features considered at each split, or 0 for the square root of the
+    /// number of features
+    unsigned split_features = 0;
+    /// Maximum histogram bins of each feature
+    unsigned bins = 64;
+    /// Threads growing trees, or 0 for one per core
+    unsigned threads = 0;
+    /// Seed for the bootstrap samples and the features of each split
+    uint64_t seed = 0xBEEF;
+  };
+
+  TrainingConfig m_training_config;
+  /// Maximum threads used when the number of threads is not configured, or
+  /// 0 for one per core
+  unsigned m_thread_budget;
+};
+
+} // end of namespace mageec
+
+#endif // MAGEEC_RANDOM_FOREST_H
@@ -0,0 +1,161 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===---------------------- MAGEEC native models --------------------------===//
+//
+// This defines the interface to a trained machine learner which has been
+// compiled into a shared object. The shared object exports a single function
+// returning a description of the model, which is wrapped in a machine learner
+// interface so that it can be used in place of the original machine learner
+// and its training blob.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MAGEEC_NATIVE_ML_H
+#define MAGEEC_NATIVE_ML_H
+
+#include "mageec/AttributeSet.h"
+#include "mageec/ML.h"
+#include "mageec/Util.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Version of the mageec_native_model structure. This must be bumped
+/// whenever the layout of the structure, or the encoding of the rows passed
+/// to the model, changes.
+#define MAGEEC_NATIVE_MODEL_VERSION 1
+
+/// Name of the function exported by a native model shared object
+#define MAGEEC_NATIVE_MODEL_SYMBOL "mageec_get_native_model"
+
+extern "C" {
+
+/// \struct mageec_native_model
+///
+/// \brief Description of a native model, as exported by its shared object.
+///
+/// This must match the definition emitted by emitNativeModel.
+struct mageec_native_model {
+  /// MAGEEC_NATIVE_MODEL_VERSION of the model
+  unsigned version;
+  /// Name of the machine learner the model was generated from
+  const char *ml_name;
+  /// Metric the machine learner was trained against
+  const char *metric;
+  /// Feature id for each column of the row passed to decide
+  unsigned n_features;
+  const unsigned *feature_ids;
+  /// Parameter id for each value written by decide
+  unsigned n_parameters;
+  const unsigned *parameter_ids;
+  /// Decide every parameter for a row of features
+  void (*decide)(const double *row, int64_t *values, unsigned char *decided);
+};
+
+} // end of extern "C"
+
+namespace mageec {
+
+/// \class NativeMachineLearner
+///
+/// \brief Machine learner which makes decisions using a native model
+///
+/// The native model has its training data compiled in, so this does not
+/// require training, and ignores any blob it is provided.
+class NativeMachineLearner : public IMachineLearner {
+public:
+  /// \brief Wrap a native model loaded from a shared object
+  ///
+  /// \param model  Description of the model. This must outlive the machine
+  /// learner.
+  /// \param name  Identifying name of the machine learner
+  NativeMachineLearner(const mageec_native_model &model, std::string name);
+  ~NativeMachineLearner() override;
+
+  std::string getName(void) const override { return m_name; }
+
+  bool requiresTraining(void) const override { return false; }
+
+  bool requiresTrainingConfig(void) const override { return false; }
+  bool setTrainingConfig(std::string) override {
+    assert(0 && "Native model should not be provided a training config");
+    return false;
+  }
+  bool requiresDecisionConfig(void) const override { return false; }
+  bool setDecisionConfig(std::string) override {
+    assert(0 && "Native model should not be provided a decision config");
+    return false;
+  }
+
+  std::unique_ptr<DecisionBase>
+  makeDecision(const DecisionRequestBase &request, const FeatureSet &features,
+               const std::vector<uint8_t> &blob) const override;
+
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features,
+                const std::vector<uint8_t> &blob) const override;
+
+  const std::vector<uint8_t> train(std::set<FeatureDesc> feature_descs,
+                                   std::set<ParameterDesc> parameter_descs,
+                                   std::set<std::string> passes,
+                                   ResultIterator results) const override;
+
+  /// \brief Get the name of the machine learner the model was generated from
+  std::string getSourceName(void) const { return m_model.ml_name; }
+
+  /// \brief Get the metric the model was trained against
+  std::string getMetric(void) const { return m_model.metric; }
+
+private:
+  /// Description of the model exported by the shared object
+  const mageec_native_model &m_model;
+
+  /// Identifying name of the machine learner
+  const std::string m_name;
+
+  /// Column of each feature in the row passed to the model
+  std::map<unsigned, size_t> m_feature_column;
+
+  /// Index of each parameter in the values written by the model
+  std::map<unsigned, size_t> m_parameter_index;
+};
+
+/// \brief Emit the complete source of a native model
+///
+/// \param source  Source generated by the machine learner
+/// \param ml_name  Name of the machine learner the source was generated from
+/// \param metric  Metric the machine learner was trained against
+///
+/// \return C++ source which can be compiled into a shared object and loaded
+/// by Framework::loadMachineLearner
+std::string emitNativeModel(const NativeModelSource &source,
+                            const std::string &ml_name,
+                            const std::string &metric);
+
+/// \brief Format a double as a C++ literal which reproduces it exactly
+std::string nativeDoubleLiteral(double value);
+
+/// \brief Format a float as a C++ literal which reproduces it exactly
+std::string nativeFloatLiteral(float value);
+
+} // end of namespace mageec
+
+#endif // MAGEEC_NATIVE_ML_H
@@ -39,6 +39,8 @@
 namespace mageec {
 
 class IMachineLearner;
+class IPreparedModel;
+struct NativeModelSource;
 
 /// \class TrainedML
 ///
@@ -100,7 +102,9 @@ public:
   ///
   /// This forwards a request to the underlying machine learner to make a
   /// decision, based on the input parameters, as well as the training blob
-  /// stored in the database for this machine learner.
+  /// stored in the database for this machine learner. The first decision
+  /// prepares a model from the blob where the machine learner supports it,
+  /// which is reused by subsequent decisions.
   ///
   /// \param request  The request made to the machine learner
   /// \param features  The features which the machine learner uses to make its
@@ -111,6 +115,29 @@ public:
   std::unique_ptr<DecisionBase> makeDecision(const DecisionRequestBase &request,
                                              const FeatureSet &features);
 
+  /// \brief Make a decision for each of a set of requests using the machine
+  /// learner interface
+  ///
+  /// This forwards all of the requests to the underlying machine learner at
+  /// once, so that the training blob is only interpreted once.
+  ///
+  /// \param requests  The requests made to the machine learner
+  /// \param features  The features which the machine learner uses to make its
+  /// decisions.
+  ///
+  /// \return The decision made for each request, in the same order as the
+  /// requests.
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features);
+
+  /// \brief Generate C++ source for a native model of this trained machine
+  /// learner, using the training blob stored in the database.
+  ///
+  /// \return The generated source, or nothing if the underlying machine
+  /// learner cannot be compiled to a native model.
+  util::Option<NativeModelSource> generateNativeModel(void) const;
+
   /// \brief Print information about this trained machine learner to the
   /// provided output stream
   void print(std::ostream &os) const;
@@ -132,6 +159,20 @@ private:
 
   /// Blob of training data for this machine learner
   const std::vector<uint8_t> m_blob;
+
+  /// Model prepared from the blob, shared between copies of this trained
+  /// machine learner. This is null until the first decision is made, or if
+  /// the machine learner does not support prepared models.
+  std::shared_ptr<const IPreparedModel> m_prepared;
+
+  /// Whether the machine learner has been asked to prepare a model
+  bool m_prepare_attempted;
+
+  /// \brief Get the prepared model, preparing it if this has not been
+  /// attempted already.
+  ///
+  /// \return The prepared model, or null if there is none.
+  const IPreparedModel *getPreparedModel(void);
 };
 
 } // end of namespace mageec
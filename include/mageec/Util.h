@@ -27,7 +27,14 @@
 #include "mageec/Types.h"
 
 #include <array>
+#include <map>
+#include <ostream>
+#include <string>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
 #include <vector>
 
 namespace mageec {
@@ -204,17 +211,370 @@ uint64_t read64LE(std::vector<uint8_t>::const_iterator &it);
 /// \brief Write a 64-bit little endian value to the end of a byte vector
 void write64LE(std::vector<uint8_t> &buf, uint64_t value);
 
+/// \brief Read a double stored as its 64-bit little endian IEEE-754
+/// representation from a byte vector, advancing the iterator in the process.
+///
+/// \param it The iterator to read the value from. This iterator will be
+/// advanced by 8 bytes during the read
+///
+/// \return The double extracted from the buffer
+double readDoubleLE(std::vector<uint8_t>::const_iterator &it);
+
+/// \brief Write a double as its 64-bit little endian IEEE-754 representation
+/// to the end of a byte vector
+void writeDoubleLE(std::vector<uint8_t> &buf, double value);
+
+/// \brief Write a 32-bit little endian value to the end of a byte vector
+void write32LE(std::vector<uint8_t> &buf, uint32_t value);
+
+/// \brief Write an array of doubles to the end of a byte vector, each as its
+/// 64-bit little endian IEEE-754 representation
+void writeDoublesLE(std::vector<uint8_t> &buf, const double *values,
+                    size_t n);
+
+/// \brief Write a string of bytes to the end of a byte vector, preceded by
+/// its 64-bit little endian length
+void writeBytes(std::vector<uint8_t> &buf, const uint8_t *data, size_t n);
+
 /// \brief Calculate the crc64 code for a blob of data
 ///
 /// \param message Buffer containing the blob of data
 /// \param len Length of the buffer in bytes
 ///
 /// \return The crc64 for the buffer
-uint64_t crc64(uint8_t *message, unsigned len);
+uint64_t crc64(const uint8_t *message, size_t len);
+
+/// \class SHA256
+///
+/// \brief Calculates the SHA-256 digest of data provided in pieces
+///
+/// Unlike a crc64, this can be used to identify data where a collision
+/// would go unnoticed, such as the keys of a cache.
+class SHA256 {
+public:
+  SHA256();
+
+  /// \brief Add data to the end of that already digested
+  void update(const uint8_t *data, size_t len);
+  void update(const std::string &data);
+
+  /// \brief Finish the digest, after which no more data may be added
+  ///
+  /// \return The digest as 64 lower case hexadecimal digits
+  std::string finish();
+
+private:
+  /// \brief Digest a complete 64 byte block
+  void processBlock(const uint8_t *block);
+
+  std::array<uint32_t, 8> m_state;
+  /// Data which does not yet fill a block
+  std::array<uint8_t, 64> m_block;
+  size_t m_block_len;
+  /// Length of all of the data added, in bytes
+  uint64_t m_len;
+  bool m_finished;
+};
+
+/// \brief Build the identifier of a kind of container from four characters
+constexpr uint32_t fourCC(char a, char b, char c, char d) {
+  return static_cast<uint32_t>(static_cast<uint8_t>(a)) |
+         static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8 |
+         static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16 |
+         static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24;
+}
+
+/// \class SectionReader
+///
+/// \brief Bounds checked reader of little endian values from a section of a
+/// container
+///
+/// A read past the end of the section yields zero and marks the reader as
+/// failed, so that a sequence of reads only needs to be checked once, by
+/// calling failed or atEnd once they are complete.
+class SectionReader {
+public:
+  SectionReader() : m_data(nullptr), m_size(0), m_pos(0), m_failed(false) {}
+  SectionReader(const uint8_t *data, size_t size)
+      : m_data(data), m_size(size), m_pos(0), m_failed(false) {}
+
+  unsigned read16();
+  uint32_t read32();
+  uint64_t read64();
+  double readDouble();
+
+  /// \brief Read a 64-bit count of elements which follow in the section
+  ///
+  /// \param element_size  The minimum size in bytes of each element
+  /// \return The count, or zero and marks the reader as failed if the rest
+  /// of the section is too small to hold that many elements
+  size_t readCount(size_t element_size);
+
+  /// \brief Read an array of doubles, as written by writeDoublesLE
+  ///
+  /// \return True if the whole array was read
+  bool readDoubles(double *values, size_t n);
+
+  /// \brief Read a string of bytes, as written by writeBytes
+  std::vector<uint8_t> readBytes();
+
+  /// \brief Read a string of n bytes, which is not preceded by its length
+  std::vector<uint8_t> readBytes(size_t n);
+
+  /// \brief Read a string, as written by writeBytes
+  std::string readString();
+
+  /// \brief Whether any read has run past the end of the section
+  bool failed() const { return m_failed; }
+
+  /// \brief Whether the whole section has been read without failure
+  bool atEnd() const { return !m_failed && m_pos == m_size; }
+
+private:
+  /// \brief Take the next n bytes of the section
+  ///
+  /// \return The bytes, or nullptr and marks the reader as failed if the
+  /// section has fewer than n bytes remaining
+  const uint8_t *take(size_t n);
+
+  const uint8_t *m_data;
+  size_t m_size;
+  size_t m_pos;
+  bool m_failed;
+};
+
+/// Magic number identifying a container, as opposed to a blob written before
+/// containers were introduced
+const std::array<uint8_t, 8> kContainerMagic = {
+    {'M', 'A', 'G', 'E', 'E', 'C', 0x1A, 0x0A}};
+
+/// Version of the layout of a container
+const unsigned kContainerVersion = 1;
+
+/// \class ContainerWriter
+///
+/// \brief Builds a versioned binary container of tagged sections
+///
+/// The container consists of a header, a table of sections, and the data
+/// of each section. Each section is aligned to kAlignment bytes from the
+/// start of the container, and the header and every section carry a crc64
+/// checksum. All values are little endian.
+///
+/// \verbatim
+/// | magic | container version | kind | version | n_sections | checksum |
+/// |   8   |        32         |  32  |   32    |     32     |    64    |
+///
+/// | tag | reserved | offset | size | checksum |...
+/// | 32  |    32    |   64   |  64  |    64    |...
+/// \endverbatim
+class ContainerWriter {
+public:
+  /// Alignment of each section from the start of the container
+  static const size_t kAlignment = 64;
+
+  /// \brief Create a container
+  ///
+  /// \param kind  Identifier of the kind of data held by the container
+  /// \param version  Version of the layout of the sections of that kind
+  ContainerWriter(uint32_t kind, uint32_t version)
+      : m_kind(kind), m_version(version), m_sections() {}
+
+  /// \brief Add a section to the container
+  ///
+  /// \param tag  Identifies the section to readers. Several sections may
+  /// have the same tag
+  /// \param data  Contents of the section
+  void addSection(uint32_t tag, std::vector<uint8_t> data);
+
+  /// \brief Serialize the container
+  std::vector<uint8_t> finish() const;
+
+private:
+  uint32_t m_kind;
+  uint32_t m_version;
+  std::vector<std::pair<uint32_t, std::vector<uint8_t>>> m_sections;
+};
+
+/// \class ContainerReader
+///
+/// \brief Reader of a container produced by ContainerWriter
+///
+/// The reader refers to the blob it was parsed from, which must outlive it.
+class ContainerReader {
+public:
+  /// \brief Whether a blob starts with the magic number of a container
+  static bool isContainer(const std::vector<uint8_t> &blob);
+
+  /// \brief Parse and validate a container
+  ///
+  /// \return The reader, or nothing if the blob is not a container, has a
+  /// different container version, or is truncated or corrupt
+  static Option<ContainerReader> parse(const std::vector<uint8_t> &blob);
+
+  /// \brief Get the kind of data held by the container
+  uint32_t getKind() const { return m_kind; }
+
+  /// \brief Get the version of the layout of the sections
+  uint32_t getVersion() const { return m_version; }
+
+  /// \brief Get the first section with the provided tag
+  Option<SectionReader> getSection(uint32_t tag) const;
+
+  /// \brief Get every section with the provided tag, in the order they were
+  /// added
+  std::vector<SectionReader> getSections(uint32_t tag) const;
+
+private:
+  struct Section {
+    uint32_t tag;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  ContainerReader() : m_data(nullptr), m_kind(0), m_version(0), m_sections() {}
+
+  const uint8_t *m_data;
+  uint32_t m_kind;
+  uint32_t m_version;
+  std::vector<Section> m_sections;
+};
+
+/// \brief Read a configuration file made up of 'key = value' lines
+///
+/// Blank lines, and anything following a '#' on a line, are ignored.
+/// Whitespace surrounding each key and value is removed.
+///
+/// \param path  Path to the configuration file
+/// \return The value of each key, or nothing if the file could not be read
+/// or a line is malformed.
+Option<std::map<std::string, std::string>>
+readConfigFile(const std::string &path);
+
+/// \brief Parse a string holding a non-negative decimal integer
+///
+/// \return The integer, or nothing if the string holds anything else
+Option<uint64_t> parseUnsigned(const std::string &str);
+
+/// \brief Parse a string holding a decimal floating point number
+///
+/// \return The number, or nothing if the string holds anything else
+Option<double> parseDouble(const std::string &str);
+
+/// \brief Parse a configuration value which must be an integer in a range
+///
+/// An error naming the configuration file and key is reported if the value
+/// is not an integer in the range.
+///
+/// \param path  Path to the configuration file, for the error
+/// \param key  Key of the value, for the error
+/// \param value  The value to parse
+/// \param min  Smallest allowed value
+/// \param max  Largest allowed value
+/// \return The value, or nothing if it is not an integer in the range
+Option<unsigned> parseConfigCount(const std::string &path,
+                                  const std::string &key,
+                                  const std::string &value, unsigned min,
+                                  unsigned max);
+
+/// \brief Run a number of tasks, several at once, each in a child process
+///
+/// Each task runs in a process forked from this one, and the data it returns
+/// is sent back to this process through a pipe. This allows tasks which use
+/// state that is not thread-safe, such as the C5.0 library, to run in
+/// parallel. The child must not use resources shared with this process, such
+/// as an open database. When jobs is at most 1, the tasks are run in this
+/// process instead.
+///
+/// \param n_tasks  Number of tasks to run
+/// \param jobs  Maximum number of tasks to run at once
+/// \param task  Runs the task with the given index
+/// \return The data returned by each task, in order of index, or nothing
+/// for a task whose process could not be started or failed.
+std::vector<Option<std::vector<uint8_t>>>
+runInProcesses(size_t n_tasks, unsigned jobs,
+               const std::function<std::vector<uint8_t>(size_t)> &task);
+
+/// \struct CommandResult
+///
+/// \brief Outcome of a command run by runCommands, which is spawned directly
+/// from its arguments rather than through a shell
+struct CommandResult {
+  /// Whether the command was run. Once a command fails, the commands which
+  /// have not yet been started are not run.
+  bool run = false;
+  /// Exit code of the command, 128 plus the signal number if it was killed
+  /// by a signal, or -1 if it could not be started
+  int status = -1;
+  /// Standard output of the command, if it was captured
+  std::string out;
+  /// Standard error of the command, if it was captured
+  std::string err;
+};
+
+/// \brief Run a number of commands, several at once
+///
+/// Each command is the program to run followed by its arguments. The program
+/// is searched for in PATH and started directly with posix_spawn, so the
+/// arguments are passed exactly as given, without a shell. When more than
+/// one command may run at once, the standard output and error of each are
+/// captured rather than interleaved, so that the caller can print them in
+/// order. Otherwise the commands share the output of this process.
+///
+/// Once a command fails, no further commands are started, though those
+/// already running are allowed to finish.
+///
+/// \param commands  Commands to run, started in order
+/// \param jobs  Maximum number of commands to run at once. If 0, this is
+/// limited by the jobserver of a parent GNU make, or 1 if there is none.
+/// \param capture  Whether to capture the standard output and error of the
+/// commands even if only one runs at a time
+/// \return The outcome of each command, in the same order as the commands
+std::vector<CommandResult>
+runCommands(const std::vector<std::vector<std::string>> &commands,
+            unsigned jobs, bool capture);
+
+/// \brief Run a single command, as runCommands does
+///
+/// \param args  The program to run followed by its arguments
+/// \param capture  Whether to capture the standard output and error of the
+/// command
+/// \return The outcome of the command
+CommandResult runCommand(const std::vector<std::string> &args, bool capture);
+
+/// \brief Find the executable which is run for a command
+///
+/// Commands containing a slash are not searched for, otherwise each
+/// directory in PATH is searched in turn, as with execvp.
+///
+/// \param command  The program to be run
+/// \return The path of the executable, or nothing if it was not found
+util::Option<std::string> findProgram(const std::string &command);
+
+/// \brief Append data to the end of a file, creating it if needed
+///
+/// The data is appended with a single write to a file opened with O_APPEND,
+/// so data appended by several processes at once is never interleaved. If
+/// the write falls short, for example because the disk is full, the rest of
+/// the data is not appended, and the file ends with part of the data.
+///
+/// \return true if all of the data was appended
+bool appendToFile(const std::string &path, const std::string &data);
+
+/// \brief Write a file, replacing any existing file
+///
+/// The data is written to a temporary file which is then renamed, so that
+/// a reader never sees a partially written file.
+///
+/// \return true if the file was written
+bool writeFileAtomically(const std::string &path, const std::string &data);
+
+/// \brief Check whether a file exists
+bool fileExists(const std::string &path);
 
 /// \brief Get the full, canonical path for a given file
 ///
-/// This also elimates any symbolic links in the process
+/// This also elimates any symbolic links in the process. The file must
+/// exist.
 std::string getFullPath(std::string filename);
 
 /// \brief Get the basename of a file for a given path
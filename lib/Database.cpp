@@ -37,6 +37,7 @@
 #include <cstdio>
 #include <fstream>
 #include <map>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -70,6 +71,21 @@ static const char *const create_feature_set_feature_table =
     "FOREIGN KEY(feature_id) REFERENCES FeatureType(feature_id)"
     ")";
 
+// source feature set table creation strings
+static const char *const create_source_feature_set_table =
+    "CREATE TABLE SourceFeatureSet("
+    "source_path       TEXT NOT NULL, "
+    "feature_class_id  INTEGER NOT NULL, "
+    "unit_name         TEXT NOT NULL, "
+    "feature_set_id    INTEGER NOT NULL, "
+    "PRIMARY KEY(source_path, feature_class_id, unit_name)"
+    ")";
+
+static const char *const create_partial_feature_set_table =
+    "CREATE TABLE PartialFeatureSet("
+    "feature_set_id INTEGER PRIMARY KEY"
+    ")";
+
 // database parameter table creation strings
 static const char *const create_parameter_type_table =
     "CREATE TABLE ParameterType("
@@ -112,9 +128,23 @@ static const char *const create_machine_learner_table =
     "feature_class_id  INTEGER NOT NULL, "
     "metric            TEXT, "
     "ml_blob           BLOB NOT NULL, "
+    "ml_digest         INTEGER NOT NULL, "
+    "used_features     BLOB, "
     "UNIQUE(ml_id, metric, feature_class_id)"
     ")";
 
+// decision cache table creation strings
+static const char *const create_decision_cache_table =
+    "CREATE TABLE DecisionCache("
+    "feature_set_id    INTEGER NOT NULL, "
+    "native_hash       INTEGER NOT NULL, "
+    "ml_id             TEXT NOT NULL, "
+    "metric            TEXT NOT NULL, "
+    "ml_digest         INTEGER NOT NULL, "
+    "parameter_set_id  INTEGER NOT NULL, "
+    "PRIMARY KEY(feature_set_id, native_hash, ml_id, metric, ml_digest)"
+    ")";
+
 // debug table creation
 static const char *const create_compilation_debug_table =
     "CREATE TABLE CompilationDebug("
@@ -235,7 +265,7 @@ Database::Database(sqlite3 &db, std::map<std::string, IMachineLearner *> mls,
     init_db(*m_db);
     validate();
   } else {
-    if (!isCompatible()) {
+    if (!isCompatible() && !upgrade()) {
       // TODO: trigger exception
       assert(0 && "Loaded incompatible database");
     }
@@ -262,6 +292,8 @@ void Database::init_db(sqlite3 &db) {
   // Create tables to hold features
   SQLQuery(db, create_feature_type_table).exec().assertDone();
   SQLQuery(db, create_feature_set_feature_table).exec().assertDone();
+  SQLQuery(db, create_source_feature_set_table).exec().assertDone();
+  SQLQuery(db, create_partial_feature_set_table).exec().assertDone();
 
   // Tables to hold parameters
   SQLQuery(db, create_parameter_type_table).exec().assertDone();
@@ -275,6 +307,7 @@ void Database::init_db(sqlite3 &db) {
 
   // Machine learner
   SQLQuery(db, create_machine_learner_table).exec().assertDone();
+  SQLQuery(db, create_decision_cache_table).exec().assertDone();
 
   // Debug tables
   SQLQuery(db, create_compilation_debug_table).exec().assertDone();
@@ -300,6 +333,73 @@ void Database::init_db(sqlite3 &db) {
   MAGEEC_DEBUG("Empty database created");
 }
 
+bool Database::upgrade(void) {
+  // Hold an exclusive lock for the whole upgrade, and check the version
+  // again once it is held, as another process may have upgraded the
+  // database first.
+  SQLTransaction transaction(m_db, SQLTransaction::kExclusive);
+  util::Version db_version = getVersion();
+  if (db_version == Database::version) {
+    return true;
+  }
+  if (db_version.getMajor() != Database::version.getMajor() ||
+      db_version.getMinor() > Database::version.getMinor()) {
+    MAGEEC_ERR("Database version " << std::string(db_version)
+               << " is not compatible with version "
+               << std::string(Database::version));
+    return false;
+  }
+  MAGEEC_STATUS("Upgrading database from version "
+                << std::string(db_version) << " to "
+                << std::string(Database::version));
+
+  unsigned minor = db_version.getMinor();
+  if (minor < 1) {
+    // 1.1 records the features used by each trained machine learner
+    SQLQuery(*m_db, "ALTER TABLE MachineLearner "
+                    "ADD COLUMN used_features BLOB").exec().assertDone();
+  }
+  if (minor < 2) {
+    // 1.2 caches decisions, keyed by the digest of the trained blob
+    SQLQuery(*m_db, "ALTER TABLE MachineLearner "
+                    "ADD COLUMN ml_digest INTEGER NOT NULL DEFAULT 0")
+        .exec().assertDone();
+    SQLQuery select_blobs(*m_db, "SELECT rowid, ml_blob FROM MachineLearner");
+    SQLQuery update_digest =
+        SQLQueryBuilder(*m_db)
+        << "UPDATE MachineLearner SET ml_digest = " << SQLType::kInteger
+        << " WHERE rowid = " << SQLType::kInteger;
+    for (auto res = select_blobs.exec(); !res.done(); res = res.next()) {
+      std::vector<uint8_t> blob = res.getBlob(1);
+      update_digest.clearAllBindings();
+      update_digest << static_cast<int64_t>(
+                           util::crc64(blob.data(), blob.size()))
+                    << res.getInteger(0);
+      update_digest.exec().assertDone();
+    }
+    SQLQuery(*m_db, create_decision_cache_table).exec().assertDone();
+  }
+  if (minor < 3) {
+    // 1.3 records the feature sets of each source file
+    SQLQuery(*m_db, create_source_feature_set_table).exec().assertDone();
+  }
+  if (minor < 4) {
+    // 1.4 marks the feature sets which are not used for training
+    SQLQuery(*m_db, create_partial_feature_set_table).exec().assertDone();
+  }
+
+  SQLQuery update_version =
+      SQLQueryBuilder(*m_db)
+      << "UPDATE Metadata SET value = " << SQLType::kText
+      << " WHERE field = " << SQLType::kInteger;
+  update_version << std::string(Database::version)
+                 << static_cast<int64_t>(MetadataField::kDatabaseVersion);
+  update_version.exec().assertDone();
+
+  transaction.commit();
+  return true;
+}
+
 bool Database::appendDatabase(Database &other) {
   assert(this->isCompatible());
   assert(other.isCompatible());
@@ -384,9 +484,20 @@ bool Database::appendDatabase(Database &other) {
     assert(res.numColumns() == 1);
     feature_set_ids.push_back(static_cast<FeatureSetID>(res.getInteger(0)));
   }
+  SQLQuery select_partial_feature_set_id(*other.m_db,
+      "SELECT feature_set_id FROM PartialFeatureSet");
+  std::set<FeatureSetID> partial_feature_set_ids;
+  for (auto res = select_partial_feature_set_id.exec(); !res.done();
+       res = res.next()) {
+    assert(res.numColumns() == 1);
+    partial_feature_set_ids.insert(
+        static_cast<FeatureSetID>(res.getInteger(0)));
+  }
   for (auto id : feature_set_ids) {
     FeatureSet features = other.getFeatureSetFeatures(id);
-    FeatureSetID new_id = this->newFeatureSet(features);
+    FeatureSetID new_id = partial_feature_set_ids.count(id)
+                              ? this->newPartialFeatureSet(features)
+                              : this->newFeatureSet(features);
     feature_set_id_remapping.emplace(id, new_id);
   }
 
@@ -509,22 +620,39 @@ bool Database::appendDatabase(Database &other) {
   // already exist
   MAGEEC_DEBUG("Merging machine learners");
   SQLQuery select_ml(*other.m_db,
-      "SELECT ml_id, feature_class_id, metric, ml_blob FROM MachineLearner");
+      "SELECT ml_id, feature_class_id, metric, ml_blob, ml_digest, "
+             "used_features "
+      "FROM MachineLearner");
   SQLQuery insert_ml =
       SQLQueryBuilder(*m_db)
       << "INSERT OR IGNORE INTO MachineLearner(ml_id, feature_class_id, "
-                                              "metric, ml_blob) "
+                                              "metric, ml_blob, ml_digest, "
+                                              "used_features) "
          "VALUES (" << SQLType::kText << ", " << SQLType::kInteger << ", "
-                    << SQLType::kText << ", " << SQLType::kBlob << ")";
+                    << SQLType::kText << ", " << SQLType::kBlob << ", "
+                    << SQLType::kInteger << ", " << SQLType::kBlob << ")";
   for (auto res = select_ml.exec(); !res.done(); res = res.next()) {
-    assert(res.numColumns() == 4);
+    assert(res.numColumns() == 6);
     insert_ml.clearAllBindings();
     insert_ml << res.getText(0);
     insert_ml << res.getInteger(1);
     insert_ml << res.getText(2);
     insert_ml << res.getBlob(3);
+    insert_ml << res.getInteger(4);
+    if (res.isNull(5)) {
+      insert_ml << nullptr;
+    } else {
+      insert_ml << res.getBlob(5);
+    }
     insert_ml.exec().assertDone();
   }
+
+  // The features recorded for source files are not merged either, as
+  // they describe the most recent build of each file.
+  //
+  // The decision cache is not merged. Its entries refer to parameter sets
+  // by identifier, which may differ between the databases, and are simply
+  // made again when they are missing.
   return true;
 }
 
@@ -585,6 +713,90 @@ std::vector<TrainedML> Database::getTrainedMachineLearners(void) {
   return trained_mls;
 }
 
+std::unique_ptr<TrainedML>
+Database::getTrainedMachineLearner(std::string ml, FeatureClass feature_class,
+                                   std::string metric) {
+  assert(isCompatible());
+
+  auto ml_iter = m_mls.find(ml);
+  if (ml_iter == m_mls.end()) {
+    return nullptr;
+  }
+
+  SQLQuery query =
+      SQLQueryBuilder(*m_db)
+      << "SELECT ml_blob FROM MachineLearner "
+         "WHERE ml_id = " << SQLType::kText << " "
+           "AND feature_class_id = " << SQLType::kInteger << " "
+           "AND metric = " << SQLType::kText;
+  query << ml << static_cast<int64_t>(feature_class) << metric;
+
+  auto res = query.exec();
+  if (res.done()) {
+    return nullptr;
+  }
+  assert(res.numColumns() == 1);
+  return std::unique_ptr<TrainedML>(new TrainedML(
+      *ml_iter->second, feature_class, metric, res.getBlob(0)));
+}
+
+std::vector<TrainedMLDesc> Database::getTrainedMachineLearnerDescs(void) {
+  assert(isCompatible());
+
+  SQLQuery query(*m_db,
+      "SELECT ml_id, feature_class_id, metric, length(ml_blob) "
+      "FROM MachineLearner ORDER BY ml_id, metric, feature_class_id");
+
+  std::vector<TrainedMLDesc> descs;
+  for (auto res = query.exec(); !res.done(); res = res.next()) {
+    assert(res.numColumns() == 4);
+    TrainedMLDesc desc;
+    desc.ml = res.getText(0);
+    if (!m_mls.count(desc.ml)) {
+      continue;
+    }
+    desc.feature_class = static_cast<FeatureClass>(res.getInteger(1));
+    desc.metric = res.getText(2);
+    desc.blob_size = static_cast<uint64_t>(res.getInteger(3));
+    descs.push_back(desc);
+  }
+  return descs;
+}
+
+util::Option<std::set<unsigned>>
+Database::getUsedFeatures(FeatureClass feature_class) {
+  SQLQuery query =
+      SQLQueryBuilder(*m_db)
+      << "SELECT used_features FROM MachineLearner "
+         "WHERE feature_class_id = " << SQLType::kInteger;
+  query << static_cast<int64_t>(feature_class);
+
+  // | n_features | feature_id |...
+  std::set<unsigned> used;
+  bool found = false;
+  for (auto res = query.exec(); !res.done(); res = res.next()) {
+    assert(res.numColumns() == 1);
+    if (res.isNull(0)) {
+      return nullptr;
+    }
+    std::vector<uint8_t> blob = res.getBlob(0);
+    util::SectionReader reader(blob.data(), blob.size());
+    size_t n_features = reader.readCount(4);
+    for (size_t i = 0; i < n_features; ++i) {
+      used.insert(reader.read32());
+    }
+    if (reader.failed() || !reader.atEnd()) {
+      MAGEEC_WARN("Malformed list of used features in the database");
+      return nullptr;
+    }
+    found = true;
+  }
+  if (!found) {
+    return nullptr;
+  }
+  return used;
+}
+
 void Database::garbageCollect() {
   // Delete everything which is not reachable through a result value.
   // If a compilation does not have a result, then all of its features can
@@ -610,9 +822,87 @@ void Database::garbageCollect() {
              "(SELECT DISTINCT parameter_set_id FROM Compilation)");
   gc_parameters.exec().assertDone();
 
+  MAGEEC_DEBUG("Deleting unreachable cached decisions")
+  SQLQuery gc_decisions(*m_db,
+      "DELETE FROM DecisionCache WHERE parameter_set_id NOT IN "
+             "(SELECT DISTINCT parameter_set_id FROM ParameterSetParameter) "
+          "OR feature_set_id NOT IN "
+             "(SELECT DISTINCT feature_set_id FROM FeatureSetFeature)");
+  gc_decisions.exec().assertDone();
+
+  MAGEEC_DEBUG("Deleting unreachable source features")
+  SQLQuery gc_source_features(*m_db,
+      "DELETE FROM SourceFeatureSet WHERE feature_set_id NOT IN "
+             "(SELECT DISTINCT feature_set_id FROM FeatureSetFeature)");
+  gc_source_features.exec().assertDone();
+
+  MAGEEC_DEBUG("Deleting unreachable partial feature marks")
+  SQLQuery gc_partial_features(*m_db,
+      "DELETE FROM PartialFeatureSet WHERE feature_set_id NOT IN "
+             "(SELECT DISTINCT feature_set_id FROM FeatureSetFeature)");
+  gc_partial_features.exec().assertDone();
+
   transaction.commit();
 }
 
+util::Option<uint64_t>
+Database::getMachineLearnerDigest(std::string ml, FeatureClass feature_class,
+                                  std::string metric) {
+  SQLQuery query =
+      SQLQueryBuilder(*m_db)
+      << "SELECT ml_digest FROM MachineLearner "
+         "WHERE ml_id = " << SQLType::kText << " "
+           "AND feature_class_id = " << SQLType::kInteger << " "
+           "AND metric = " << SQLType::kText;
+  query << ml << static_cast<int64_t>(feature_class) << metric;
+
+  auto res = query.exec();
+  if (res.done()) {
+    return nullptr;
+  }
+  assert(res.numColumns() == 1);
+  return static_cast<uint64_t>(res.getInteger(0));
+}
+
+util::Option<ParameterSetID>
+Database::getCachedDecisions(const DecisionCacheKey &key) {
+  SQLQuery query =
+      SQLQueryBuilder(*m_db)
+      << "SELECT parameter_set_id FROM DecisionCache "
+         "WHERE feature_set_id = " << SQLType::kInteger << " "
+           "AND native_hash = " << SQLType::kInteger << " "
+           "AND ml_id = " << SQLType::kText << " "
+           "AND metric = " << SQLType::kText << " "
+           "AND ml_digest = " << SQLType::kInteger;
+  query << static_cast<int64_t>(key.feature_set_id)
+        << static_cast<int64_t>(key.native_hash) << key.ml << key.metric
+        << static_cast<int64_t>(key.ml_digest);
+
+  auto res = query.exec();
+  if (res.done()) {
+    return nullptr;
+  }
+  assert(res.numColumns() == 1);
+  return static_cast<ParameterSetID>(res.getInteger(0));
+}
+
+void Database::cacheDecisions(const DecisionCacheKey &key,
+                              ParameterSetID parameter_set_id) {
+  SQLQuery insert_decisions =
+      SQLQueryBuilder(*m_db)
+      << "INSERT OR REPLACE INTO DecisionCache(feature_set_id, native_hash, "
+                                              "ml_id, metric, ml_digest, "
+                                              "parameter_set_id) "
+         "VALUES (" << SQLType::kInteger << ", " << SQLType::kInteger << ", "
+                    << SQLType::kText << ", " << SQLType::kText << ", "
+                    << SQLType::kInteger << ", " << SQLType::kInteger << ")";
+  insert_decisions << static_cast<int64_t>(key.feature_set_id)
+                   << static_cast<int64_t>(key.native_hash) << key.ml
+                   << key.metric << static_cast<int64_t>(key.ml_digest)
+                   << static_cast<int64_t>(parameter_set_id);
+  insert_decisions.exec().assertDone();
+}
+
 std::string Database::getMetadata(MetadataField field) {
   std::string value;
 
@@ -747,6 +1037,18 @@ FeatureSetID Database::newFeatureSet(FeatureSet features) {
   return feature_set_id;
 }
 
+FeatureSetID Database::newPartialFeatureSet(FeatureSet features) {
+  FeatureSetID feature_set_id = newFeatureSet(features);
+
+  SQLQuery insert_partial =
+      SQLQueryBuilder(*m_db)
+      << "INSERT OR IGNORE INTO PartialFeatureSet(feature_set_id) "
+         "VALUES (" << SQLType::kInteger << ")";
+  insert_partial << static_cast<int64_t>(feature_set_id);
+  insert_partial.exec().assertDone();
+  return feature_set_id;
+}
+
 FeatureSet Database::getFeatureSetFeatures(FeatureSetID feature_set) {
   // Get all of the features in a feature set
   SQLQuery select_features =
@@ -783,6 +1085,59 @@ FeatureSet Database::getFeatureSetFeatures(FeatureSetID feature_set) {
   return features;
 }
 
+void Database::setSourceFeatureSets(
+    std::string source_path,
+    const std::vector<SourceFeatureSet> &feature_sets) {
+  SQLQuery delete_feature_sets =
+      SQLQueryBuilder(*m_db)
+      << "DELETE FROM SourceFeatureSet "
+         "WHERE source_path = " << SQLType::kText;
+  SQLQuery insert_feature_set =
+      SQLQueryBuilder(*m_db)
+      << "INSERT OR REPLACE INTO SourceFeatureSet(source_path, "
+                                                 "feature_class_id, "
+                                                 "unit_name, feature_set_id) "
+         "VALUES (" << SQLType::kText << ", " << SQLType::kInteger << ", "
+                    << SQLType::kText << ", " << SQLType::kInteger << ")";
+
+  SQLTransaction transaction(m_db, SQLTransaction::kImmediate);
+  delete_feature_sets << source_path;
+  delete_feature_sets.exec().assertDone();
+  for (const auto &feature_set : feature_sets) {
+    insert_feature_set.clearAllBindings();
+    insert_feature_set << source_path
+                       << static_cast<int64_t>(feature_set.feature_class)
+                       << feature_set.unit_name
+                       << static_cast<int64_t>(feature_set.feature_set_id);
+    insert_feature_set.exec().assertDone();
+  }
+  transaction.commit();
+}
+
+std::vector<SourceFeatureSet>
+Database::getSourceFeatureSets(std::string source_path) {
+  SQLQuery select_feature_sets =
+      SQLQueryBuilder(*m_db)
+      << "SELECT feature_class_id, unit_name, feature_set_id, "
+                "feature_set_id IN "
+                  "(SELECT feature_set_id FROM PartialFeatureSet) "
+         "FROM SourceFeatureSet WHERE source_path = " << SQLType::kText;
+  select_feature_sets << source_path;
+
+  std::vector<SourceFeatureSet> feature_sets;
+  for (auto res = select_feature_sets.exec(); !res.done(); res = res.next()) {
+    assert(res.numColumns() == 4);
+    SourceFeatureSet feature_set;
+    feature_set.feature_class = static_cast<FeatureClass>(res.getInteger(0));
+    feature_set.unit_name = res.getText(1);
+    feature_set.feature_set_id =
+        static_cast<FeatureSetID>(res.getInteger(2));
+    feature_set.partial = res.getInteger(3) != 0;
+    feature_sets.push_back(feature_set);
+  }
+  return feature_sets;
+}
+
 ParameterSet Database::getParameters(ParameterSetID param_set) {
   // Get all of the parameters in a parameter set
   SQLQuery select_parameters =
@@ -887,6 +1242,42 @@ ParameterSetID Database::newParameterSet(ParameterSet parameters) {
       << "SELECT parameter_set_id FROM ParameterSetParameter "
          "WHERE parameter_set_id = " << SQLType::kInteger;
 
+  // The hash of the parameter set forms its identifier in the database
+  ParameterSetID param_set_id = static_cast<ParameterSetID>(parameters.hash());
+
+  // Do a first check to see if the same parameter set already exists. If so
+  // we don't have to do any expensive probing
+  //
+  // If it doesn't exist, then we have to gain an exlusive lock to the database,
+  // do a linear probe for the first available id, and then insert the new
+  // parameter set. This is really expensive.
+  get_parameter_set << static_cast<int64_t>(param_set_id);
+  if (!get_parameter_set.exec().done()) {
+    // There is already a parameter set with that id. Do a full check to
+    // see if it is equal
+    if (parameters == getParameters(param_set_id))
+      return param_set_id;
+  }
+
+  // The quick test did not find an equal parameter set, so we now need
+  // to probe to either find an equal set, or find somewhere to insert
+  // the new parameter set.
+  //
+  // The probe + insert must be done atomically without any other process
+  // writing to the database in the meantime, so we require an exclusive
+  // lock to the database.
+  SQLTransaction transaction(m_db, SQLTransaction::kExclusive);
+  param_set_id = insertParameterSet(parameters);
+  transaction.commit();
+  return param_set_id;
+}
+
+ParameterSetID Database::insertParameterSet(const ParameterSet &parameters) {
+  SQLQuery get_parameter_set =
+      SQLQueryBuilder(*m_db)
+      << "SELECT parameter_set_id FROM ParameterSetParameter "
+         "WHERE parameter_set_id = " << SQLType::kInteger;
+
   // FIXME: This should check that the values are identical if a conflict arises
   SQLQuery insert_parameter_type =
       SQLQueryBuilder(*m_db)
@@ -906,80 +1297,173 @@ ParameterSetID Database::newParameterSet(ParameterSet parameters) {
       << "INSERT OR IGNORE INTO ParameterDebug(parameter_id, name) "
          "VALUES (" << SQLType::kInteger << ", " << SQLType::kText << ")";
 
-  // The hash of the parameter set forms its identifier in the database
   ParameterSetID param_set_id = static_cast<ParameterSetID>(parameters.hash());
+  while (true) {
+    get_parameter_set.clearAllBindings();
+    get_parameter_set << static_cast<int64_t>(param_set_id);
+    auto param_iter = get_parameter_set.exec();
 
-  // Do a first check to see if the same parameter set already exists. If so
-  // we don't have to do any expensive probing
-  //
-  // If it doesn't exist, then we have to gain an exlusive lock to the database,
-  // do a linear probe for the first available id, and then insert the new
-  // parameter set. This is really expensive.
-  get_parameter_set << static_cast<int64_t>(param_set_id);
-  bool param_set_id_found = false;
+    if (param_iter.done())
+      break;
 
-  if (!get_parameter_set.exec().done()) {
-    // There is already a parameter set with that id. Do a full check to
-    // see if it is equal
+    // Check if the parameter set with the given id is equal. If it is
+    // we're done, otherwise continuing probing
     if (parameters == getParameters(param_set_id))
-      param_set_id_found = true;
+      return param_set_id;
+
+    mageec::ID tmp = static_cast<mageec::ID>(param_set_id);
+    param_set_id = static_cast<ParameterSetID>(tmp + 1);
   }
 
-  if (!param_set_id_found) {
-    // The quick test did not find an equal parameter set, so we now need
-    // to probe to either find an equal set, or find somewhere to insert
-    // the new parameter set.
-    //
-    // The probe + insert must be done atomically without any other process
-    // writing to the database in the meantime, so we require an exclusive
-    // lock to the database.
-    SQLTransaction transaction(m_db, SQLTransaction::kExclusive);
+  // The parameter set does not already exist, and we have found a free
+  // identifier for it. Do the insertion now
+  for (auto I : parameters) {
+    // clear parameters bindings for all queries
+    insert_parameter_type.clearAllBindings();
+    insert_parameter.clearAllBindings();
+    insert_parameter_debug.clearAllBindings();
+
+    // add parameter type first if not present
+    insert_parameter_type << static_cast<int64_t>(I->getID())
+                          << static_cast<int64_t>(I->getType());
+    insert_parameter_type.exec().assertDone();
+
+    // parameter insertion
+    insert_parameter << static_cast<int64_t>(param_set_id)
+                     << static_cast<int64_t>(I->getID())
+                     << I->toBlob();
+    insert_parameter.exec().assertDone();
+
+    // debug table
+    insert_parameter_debug << static_cast<int64_t>(I->getID())
+                           << I->getName();
+    insert_parameter_debug.exec().assertDone();
+  }
+  return param_set_id;
+}
 
-    while (!param_set_id_found) {
-      get_parameter_set.clearAllBindings();
-      get_parameter_set << static_cast<int64_t>(param_set_id);
-      auto param_iter = get_parameter_set.exec();
+std::vector<ModuleCompilationIDs>
+Database::newCompilations(const std::vector<ModuleCompilation> &compilations) {
+  SQLQuery get_parameter_set =
+      SQLQueryBuilder(*m_db)
+      << "SELECT parameter_set_id FROM ParameterSetParameter "
+         "WHERE parameter_set_id = " << SQLType::kInteger;
 
-      if (param_iter.done()) {
-        // The parameter set does not already exist, and we have found a free
-        // identifier for it. Do the insertion now
-        for (auto I : parameters) {
-          // clear parameters bindings for all queries
-          insert_parameter_type.clearAllBindings();
-          insert_parameter.clearAllBindings();
-          insert_parameter_debug.clearAllBindings();
-
-          // add parameter type first if not present
-          insert_parameter_type << static_cast<int64_t>(I->getID())
-                                << static_cast<int64_t>(I->getType());
-          insert_parameter_type.exec().assertDone();
-
-          // parameter insertion
-          insert_parameter << static_cast<int64_t>(param_set_id)
-                           << static_cast<int64_t>(I->getID())
-                           << I->toBlob();
-          insert_parameter.exec().assertDone();
+  SQLQuery insert_into_compilation =
+      SQLQueryBuilder(*m_db)
+      << "INSERT INTO Compilation(feature_set_id, feature_class_id, "
+                                 "parameter_set_id) "
+         "VALUES (" << SQLType::kInteger << ", " << SQLType::kInteger << ", "
+                    << SQLType::kInteger << ")";
 
-          // debug table
-          insert_parameter_debug << static_cast<int64_t>(I->getID())
-                                 << I->getName();
-          insert_parameter_debug.exec().assertDone();
-        }
-        param_set_id_found = true;
+  SQLQuery insert_compilation_debug =
+      SQLQueryBuilder(*m_db)
+      << "INSERT INTO CompilationDebug(compilation_id, name, type, command, "
+                                      "parent_id) "
+         "VALUES(" << SQLType::kInteger << ", "
+                   << SQLType::kText << ", "
+                   << SQLType::kText << ", "
+                   << SQLType::kText << ", "
+                   << SQLType::kInteger << ")";
+
+  SQLQuery insert_decisions =
+      SQLQueryBuilder(*m_db)
+      << "INSERT OR REPLACE INTO DecisionCache(feature_set_id, native_hash, "
+                                              "ml_id, metric, ml_digest, "
+                                              "parameter_set_id) "
+         "VALUES (" << SQLType::kInteger << ", " << SQLType::kInteger << ", "
+                    << SQLType::kText << ", " << SQLType::kText << ", "
+                    << SQLType::kInteger << ", " << SQLType::kInteger << ")";
+
+  // Insert a single compilation, reusing the prepared statements
+  auto insertCompilation = [&](const UnitCompilation &unit,
+                               FeatureClass feature_class,
+                               ParameterSetID param_set_id,
+                               util::Option<CompilationID> parent) {
+    const char *type =
+        (feature_class == FeatureClass::kModule) ? "module" : "function";
+
+    insert_into_compilation.clearAllBindings();
+    insert_into_compilation << static_cast<int64_t>(unit.feature_set_id)
+                            << static_cast<int64_t>(feature_class)
+                            << static_cast<int64_t>(param_set_id);
+    insert_into_compilation.exec().assertDone();
+
+    int64_t row_id = sqlite3_last_insert_rowid(m_db);
+    CompilationID compilation_id = static_cast<CompilationID>(row_id);
+    assert(row_id != 0 && "compilation_id overflow");
+
+    // FIXME: The compilation command takes up a lot of space so it is not
+    // stored for now.
+    insert_compilation_debug.clearAllBindings();
+    insert_compilation_debug << static_cast<int64_t>(compilation_id)
+                             << unit.name << std::string(type) << nullptr;
+    if (parent) {
+      insert_compilation_debug << static_cast<int64_t>(parent.get());
+    } else {
+      insert_compilation_debug << nullptr;
+    }
+    insert_compilation_debug.exec().assertDone();
+    return compilation_id;
+  };
+
+  // Parameter sets are looked up and inserted within the same transaction
+  // as the compilations, so the write lock is taken up front. Modules are
+  // frequently compiled with the same parameters, so parameter sets which
+  // have already been resolved are reused.
+  std::vector<ModuleCompilationIDs> ids;
+  std::vector<std::pair<const ParameterSet *, ParameterSetID>> param_sets;
+
+  SQLTransaction transaction(m_db, SQLTransaction::kImmediate);
+  for (const auto &compilation : compilations) {
+    const ParameterSet &parameters = compilation.parameters;
+
+    util::Option<ParameterSetID> param_set_id;
+    for (const auto &param_set : param_sets) {
+      if (*param_set.first == parameters) {
+        param_set_id = param_set.second;
+        break;
+      }
+    }
+    if (!param_set_id) {
+      // Do the same quick check as newParameterSet before probing
+      ParameterSetID hash_id = static_cast<ParameterSetID>(parameters.hash());
+      get_parameter_set.clearAllBindings();
+      get_parameter_set << static_cast<int64_t>(hash_id);
+      if (!get_parameter_set.exec().done() &&
+          parameters == getParameters(hash_id)) {
+        param_set_id = hash_id;
       } else {
-        // Check if the parameter set with the given id is equal. If it is
-        // we're done, otherwise continuing probing
-        if (parameters == getParameters(param_set_id)) {
-          param_set_id_found = true;
-        } else {
-          mageec::ID tmp = static_cast<mageec::ID>(param_set_id);
-          param_set_id = static_cast<ParameterSetID>(tmp + 1);
-        }
+        param_set_id = insertParameterSet(parameters);
       }
+      param_sets.push_back({&parameters, param_set_id.get()});
     }
-    transaction.commit();
+
+    ModuleCompilationIDs module_ids;
+    module_ids.parameter_set_id = param_set_id.get();
+    module_ids.module = insertCompilation(compilation.module,
+                                          FeatureClass::kModule,
+                                          module_ids.parameter_set_id,
+                                          nullptr);
+    for (const auto &function : compilation.functions) {
+      module_ids.functions.push_back(
+          insertCompilation(function, FeatureClass::kFunction,
+                            module_ids.parameter_set_id, module_ids.module));
+    }
+
+    if (compilation.decision_cache_key) {
+      const DecisionCacheKey key = compilation.decision_cache_key.get();
+      insert_decisions.clearAllBindings();
+      insert_decisions << static_cast<int64_t>(key.feature_set_id)
+                       << static_cast<int64_t>(key.native_hash) << key.ml
+                       << key.metric << static_cast<int64_t>(key.ml_digest)
+                       << static_cast<int64_t>(module_ids.parameter_set_id);
+      insert_decisions.exec().assertDone();
+    }
+    ids.push_back(module_ids);
   }
-  return param_set_id;
+  transaction.commit();
+  return ids;
 }
 
 //===------------------------ Results interface ---------------------------===//
@@ -1036,6 +1520,82 @@ addResults(std::map<std::pair<CompilationID, std::string>, double> results) {
 
 void Database::trainMachineLearner(std::string ml, FeatureClass feature_class,
                                    std::string metric) {
+  // Insert a blob for the provided machine learner and metric
+  // This will fail if there is already training data
+  SQLQuery insert_blob =
+      SQLQueryBuilder(*m_db)
+      << "INSERT OR REPLACE INTO MachineLearner(ml_id, feature_class_id, "
+                                               "metric, ml_blob, ml_digest, "
+                                               "used_features) "
+         "VALUES (" << SQLType::kText << ", " << SQLType::kInteger << ", "
+                    << SQLType::kText << ", " << SQLType::kBlob << ", "
+                    << SQLType::kInteger << ", " << SQLType::kBlob << ")";
+
+  // Get the machine learner interface
+  auto res = m_mls.find(ml);
+  assert(res != m_mls.end() && "Cannot train an unregistered machine learner");
+  const IMachineLearner &i_ml = *res->second;
+
+  std::set<FeatureDesc> feature_descs;
+  std::set<ParameterDesc> parameter_descs;
+  std::set<std::string> pass_names;
+  getTrainingDescs(feature_descs, parameter_descs, pass_names);
+
+  // Iterator to select each set of results in turn
+  ResultIterator results(*this, *m_db, feature_class, metric);
+
+  // Retrieve the blob and then insert it into the database
+  auto blob = i_ml.train(feature_descs, parameter_descs, pass_names,
+                         std::move(results));
+
+  // FIXME: Handle case where the blob is empty. (causes a failure when
+  // running the database query).
+
+  // The digest of the blob identifies the trained model in the decision
+  // cache, so decisions cached for an earlier model are not reused.
+  uint64_t digest = util::crc64(blob.data(), blob.size());
+  insert_blob << ml << static_cast<int64_t>(feature_class) << metric << blob
+              << static_cast<int64_t>(digest);
+
+  // Record which features the trained machine learner uses, so that the
+  // others need not be extracted.
+  auto used_features = i_ml.getUsedFeatures(blob);
+  if (used_features) {
+    MAGEEC_DEBUG("Trained machine learner uses "
+                 << used_features.get().size() << " of "
+                 << feature_descs.size() << " features");
+    // | n_features | feature_id |...
+    std::vector<uint8_t> used_blob;
+    util::write64LE(used_blob, used_features.get().size());
+    for (unsigned feature_id : used_features.get()) {
+      util::write32LE(used_blob, feature_id);
+    }
+    insert_blob << used_blob;
+  } else {
+    insert_blob << nullptr;
+  }
+
+  SQLTransaction transaction(m_db);
+  insert_blob.exec().assertDone();
+
+  // Decisions cached for the previous model can never be used again
+  SQLQuery delete_decisions =
+      SQLQueryBuilder(*m_db)
+      << "DELETE FROM DecisionCache "
+         "WHERE ml_id = " << SQLType::kText << " "
+           "AND metric = " << SQLType::kText << " "
+           "AND ml_digest NOT IN "
+             "(SELECT ml_digest FROM MachineLearner "
+              "WHERE ml_id = DecisionCache.ml_id "
+                "AND metric = DecisionCache.metric)";
+  delete_decisions << ml << metric;
+  delete_decisions.exec().assertDone();
+  transaction.commit();
+}
+
+void Database::getTrainingDescs(std::set<FeatureDesc> &feature_descs,
+                                std::set<ParameterDesc> &parameter_descs,
+                                std::set<std::string> &passes) {
   // Get all of the feature types and parameter types, even if some of them
   // don't occur for this metric. These will all be distinct.
   SQLQuery select_feature_types(
@@ -1051,27 +1611,9 @@ void Database::trainMachineLearner(std::string ml, FeatureClass feature_class,
          "WHERE ParameterSetParameter.parameter_id = ParameterType.parameter_id "
            "AND ParameterType.parameter_type = " << param_type;
 
-  // Insert a blob for the provided machine learner and metric
-  // This will fail if there is already training data
-  SQLQuery insert_blob =
-      SQLQueryBuilder(*m_db)
-      << "INSERT OR REPLACE INTO MachineLearner(ml_id, feature_class_id, "
-                                               "metric, ml_blob) "
-         "VALUES (" << SQLType::kText << ", " << SQLType::kInteger << ", "
-                    << SQLType::kText << ", " << SQLType::kBlob << ")";
-
-  // Get the machine learner interface
-  auto res = m_mls.find(ml);
-  assert(res != m_mls.end() && "Cannot train an unregistered machine learner");
-  const IMachineLearner &i_ml = *res->second;
-
   // Collect all information in a single transaction
   SQLTransaction transaction(m_db);
 
-  std::set<FeatureDesc> feature_descs;
-  std::set<ParameterDesc> parameter_descs;
-  std::set<std::string> pass_names;
-
   for (auto feat_iter = select_feature_types.exec(); !feat_iter.done();
        feat_iter = feat_iter.next()) {
     assert(feat_iter.numColumns() == 2);
@@ -1092,33 +1634,35 @@ void Database::trainMachineLearner(std::string ml, FeatureClass feature_class,
        pass_seq_iter = pass_seq_iter.next()) {
     assert(pass_seq_iter.numColumns() == 1);
 
-    // Split on commas, add each encountered pass to the set
+    // Split on commas, add each encountered pass to the set. An empty
+    // sequence has no passes.
     std::vector<uint8_t> blob = pass_seq_iter.getBlob(0);
+    if (blob.empty()) {
+      continue;
+    }
     std::string pass;
     for (auto c : blob) {
       if (c == ',') {
-        pass_names.insert(pass);
+        passes.insert(pass);
         pass = std::string();
       } else {
         pass.push_back(static_cast<char>(c));
       }
     }
-    pass_names.insert(pass);
+    passes.insert(pass);
   }
   transaction.commit();
+}
 
-  // Iterator to select each set of results in turn
-  ResultIterator results(*this, *m_db, feature_class, metric);
-
-  // Retrieve the blob and then insert it into the database
-  auto blob = i_ml.train(feature_descs, parameter_descs, pass_names,
-                         std::move(results));
-
-  // FIXME: Handle case where the blob is empty. (causes a failure when
-  // running the database query).
-
-  insert_blob << ml << static_cast<int64_t>(feature_class) << metric << blob;
-  insert_blob.exec().assertDone();
+std::vector<Result> Database::getResults(FeatureClass feature_class,
+                                         std::string metric) {
+  std::vector<Result> results;
+  for (ResultIterator result_iter(*this, *m_db, feature_class, metric);
+       util::Option<Result> result = *result_iter;
+       result_iter = result_iter.next()) {
+    results.push_back(result.get());
+  }
+  return results;
 }
 
 //===------------------------ Result Iterator -----------------------------===//
@@ -1126,7 +1670,7 @@ void Database::trainMachineLearner(std::string ml, FeatureClass feature_class,
 ResultIterator::ResultIterator(Database &db, sqlite3 &raw_db,
                                FeatureClass feature_class,
                                std::string metric)
-    : m_db(&db) {
+    : m_db(&db), m_results(), m_pos(0) {
   // Get each compilation and its accompanying results
   SQLQueryBuilder select_compilation_result =
       SQLQueryBuilder(raw_db)
@@ -1136,6 +1680,8 @@ ResultIterator::ResultIterator(Database &db, sqlite3 &raw_db,
          "WHERE Compilation.compilation_id = Result.compilation_id "
            "AND Compilation.feature_class_id = " << SQLType::kInteger << " "
            "AND Result.metric = " << SQLType::kText << " "
+           "AND Compilation.feature_set_id NOT IN "
+             "(SELECT feature_set_id FROM PartialFeatureSet) "
          "ORDER BY Compilation.compilation_id";
   m_query.reset(new SQLQuery(select_compilation_result));
   *m_query << static_cast<int64_t>(feature_class);
@@ -1144,10 +1690,16 @@ ResultIterator::ResultIterator(Database &db, sqlite3 &raw_db,
   m_result_iter.reset(new SQLQueryIterator(m_query->exec()));
 }
 
+ResultIterator::ResultIterator(std::vector<Result> results)
+    : m_db(nullptr), m_query(), m_result_iter(), m_results(std::move(results)),
+      m_pos(0) {}
+
 ResultIterator::ResultIterator(ResultIterator &&other)
     : m_db(other.m_db),
       m_query(std::move(other.m_query)),
-      m_result_iter(std::move(other.m_result_iter)) {
+      m_result_iter(std::move(other.m_result_iter)),
+      m_results(std::move(other.m_results)),
+      m_pos(other.m_pos) {
   other.m_db = nullptr;
 }
 
@@ -1155,12 +1707,21 @@ ResultIterator &ResultIterator::operator=(ResultIterator &&other) {
   m_db = other.m_db;
   m_query = std::move(other.m_query);
   m_result_iter = std::move(other.m_result_iter);
+  m_results = std::move(other.m_results);
+  m_pos = other.m_pos;
 
   other.m_db = nullptr;
   return *this;
 }
 
 util::Option<Result> ResultIterator::operator*() {
+  // Results which were already retrieved from the database
+  if (!m_result_iter) {
+    if (m_pos >= m_results.size())
+      return util::Option<Result>();
+    return m_results[m_pos];
+  }
+
   if (m_result_iter->done())
     return util::Option<Result>();
 
@@ -1184,7 +1745,12 @@ util::Option<Result> ResultIterator::operator*() {
 }
 
 ResultIterator ResultIterator::next() {
-  if (m_result_iter->done()) {
+  if (!m_result_iter) {
+    if (m_pos < m_results.size()) {
+      ++m_pos;
+    }
+    return std::move(*this);
+  } else if (m_result_iter->done()) {
     return std::move(*this);
   } else {
     *m_result_iter = m_result_iter->next();
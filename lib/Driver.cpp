@@ -24,15 +24,26 @@
 //===----------------------------------------------------------------------===//
 
 #include "mageec/Database.h"
+#include "mageec/Evaluate.h"
 #include "mageec/Framework.h"
 #include "mageec/ML/C5.h"
 #include "mageec/ML/1NN.h"
+#include "mageec/ML/RandomForest.h"
+#include "mageec/NativeML.h"
 #include "mageec/Util.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <iomanip>
 #include <memory>
 #include <set>
 #include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
 
 namespace mageec {
 
@@ -51,7 +62,11 @@ enum class DriverMode {
   /// Mode to add results from a file
   kAddResults,
   /// Mode to garbage collect stale entries in the file
-  kGarbageCollect
+  kGarbageCollect,
+  /// Mode to compile a trained machine learner into a native model
+  kExportNative,
+  /// Mode to cross-validate machine learners
+  kEvaluate
 };
 
 } // end of namespace mageec
@@ -99,6 +114,16 @@ static void printHelp()
 "                          associated with a result\n"
 "  --add-results <arg>     Add results from the provided file into the\n"
 "                          database\n"
+"  --export-native <ml> <metric> <out>\n"
+"                          Compile the machine learner trained against the\n"
+"                          metric into a native model, which can be loaded\n"
+"                          in place of the machine learner by providing its\n"
+"                          path via --ml. The compiler is taken from the CXX\n"
+"                          environment variable, defaulting to c++\n"
+"  --evaluate              Cross-validate the machine learners provided via\n"
+"                          the --ml flag against each metric, reporting the\n"
+"                          accuracy of their decisions for module features,\n"
+"                          and the cost of training and decisions\n"
 "\n"
 "options:\n"
 "  --help                  Print this help information\n"
@@ -113,14 +138,27 @@ static void printHelp()
 "  --print-mls             Print information about the machine learners\n"
 "                          available to make compiler configuration\n"
 "                          decisions\n"
-// FIXME: ml-config
+"  --ml-config <arg>       Configuration file provided to each machine\n"
+"                          learner when training\n"
 "  --metric <arg>          Adds a new metric which the provided machine\n"
 "                          learners should be trained with\n"
+"  --folds <arg>           Number of folds to split the results into when\n"
+"                          evaluating, defaults to 5\n"
+"  -j <arg>                Number of folds to evaluate at once, each in a\n"
+"                          separate process, defaults to 1\n"
+"  --merge-compilation-ids <in> <out>\n"
+"                          Merge the compilation ids output by mageec-gcc\n"
+"                          into a single file. The input is either a file,\n"
+"                          or a directory of shard files\n"
 "\n"
 "examples:\n"
 "  mageec --help --version\n"
 "  mageec foo.db --create\n"
 "  mageec bar.db --train --ml path/to/ml_plugin.so\n"
+"  mageec bar.db --train --ml 1nn --metric size --ml-config 1nn.cfg\n"
+"  mageec bar.db --export-native c50 size path/to/ml_plugin.so\n"
+"  mageec bar.db --evaluate --ml c50 --metric size --folds 10 -j 4\n"
+"  mageec --merge-compilation-ids path/to/shards compilations.csv\n"
 "  mageec baz.db --train --ml deadbeef-ca75-4096-a935-15cabba9e5\n";
 }
 
@@ -144,14 +182,15 @@ getMachineLearners(Framework &framework, std::set<std::string> ml_strs) {
       MAGEEC_DEBUG("Found machine learner '" << str << "'");
     } else {
       // Not a string identifier, try and load as a shared object
-      str = framework.loadMachineLearner(str);
-      if (str != "") {
+      std::string loaded = framework.loadMachineLearner(str);
+      if (loaded != "") {
         MAGEEC_DEBUG("Loading machine learner from library");
       } else {
         MAGEEC_WARN("Unable to load machine learner '" << str
                     << "'. This machine learner will be ignored");
         continue;
       }
+      str = loaded;
     }
     assert(str != "");
 
@@ -178,15 +217,16 @@ getMachineLearners(Framework &framework, std::set<std::string> ml_strs) {
 /// \return true on success
 static bool printTrainedMLs(Framework &framework,
                             const util::Option<std::string> db_path) {
-  // Add any machine learners which do not require training (and therefore
-  // do not have any entry in the database)
-  std::vector<TrainedML> trained_mls;
+  // Print any machine learners which do not require training (and therefore
+  // do not have any entry in the database, or a metric)
   for (const auto ml : framework.getMachineLearners()) {
     if (!ml->requiresTraining()) {
-      trained_mls.push_back(TrainedML(*ml));
+      util::out() << ml->getName() << "\n\n";
     }
   }
 
+  std::vector<TrainedMLDesc> trained_mls;
+
   if (db_path) {
     std::unique_ptr<Database> db = framework.getDatabase(db_path.get(), false);
     if (!db) {
@@ -194,16 +234,15 @@ static bool printTrainedMLs(Framework &framework,
                  "or you may not have sufficient permissions to read it");
       return false;
     }
-    // Add trained machine learners from the database
-    for (const auto &ml : db->getTrainedMachineLearners()) {
-      trained_mls.push_back(ml);
-    }
+    // Describe the trained machine learners in the database, their training
+    // blobs are not needed
+    trained_mls = db->getTrainedMachineLearnerDescs();
   }
 
   // Print out the trained machine learners
   for (auto &ml : trained_mls) {
-    util::out() << ml.getName() << '\n'
-                << ml.getMetric() << "\n\n";
+    util::out() << ml.ml << '\n'
+                << ml.metric << "\n\n";
   }
   return true;
 }
@@ -264,19 +303,62 @@ static bool appendDatabase(Framework &framework,
   return db->appendDatabase(*append_db);
 }
 
+/// \brief Provide the training configuration to machine learners
+///
+/// \param framework Framework holding the machine learners
+/// \param mls Machine learners to configure
+/// \param ml_config Path of the configuration to provide to the machine
+/// learners, if any
+///
+/// \return true on success, false if the configuration was invalid
+static bool
+configureMachineLearners(Framework &framework,
+                         const std::set<std::string> &mls,
+                         const util::Option<std::string> &ml_config) {
+  if (!ml_config) {
+    return true;
+  }
+  for (auto ml : framework.getMachineLearners()) {
+    if (mls.count(ml->getName()) == 0) {
+      continue;
+    }
+    if (!ml->requiresTrainingConfig()) {
+      MAGEEC_WARN("Machine learner '" << ml->getName() << "' does not "
+                  "accept a training config, --ml-config will be ignored");
+      continue;
+    }
+    MAGEEC_DEBUG("Configuring machine learner '" << ml->getName()
+                 << "' from '" << ml_config.get() << "'");
+    if (!ml->setTrainingConfig(ml_config.get())) {
+      MAGEEC_ERR("Invalid training config for machine learner '"
+                 << ml->getName() << "'");
+      return false;
+    }
+  }
+  return true;
+}
+
 /// \brief Train a database
 ///
 /// \param framework Framework instance to load the database
 /// \param db_path Path of the database to train
 /// \param mls Machine learners to train
 /// \param metric_strs Metrics to train for
+/// \param ml_config Path of the configuration to provide to the machine
+/// learners, if any
 ///
 /// \return true on success, false if the database could not be trained.
 static bool trainDatabase(Framework &framework, const std::string &db_path,
                           const std::set<std::string> mls,
-                          const std::set<std::string> &metric_strs) {
+                          const std::set<std::string> &metric_strs,
+                          const util::Option<std::string> &ml_config) {
   assert(metric_strs.size() > 0);
 
+  // Configure the machine learners before any of them are trained
+  if (!configureMachineLearners(framework, mls, ml_config)) {
+    return false;
+  }
+
   // Parse the metrics we are training against.
   MAGEEC_DEBUG("Parsing training metrics");
   std::set<std::string> metrics;
@@ -314,6 +396,247 @@ static bool trainDatabase(Framework &framework, const std::string &db_path,
   return true;
 }
 
+/// \brief Print the evaluation of a machine learner
+///
+/// \param eval The evaluation to print
+static void printEvaluation(const Evaluation &eval) {
+  std::ostream &os = util::out();
+  os << std::fixed;
+
+  os << "  fold  held out  train (s)  prepare (s)  model (bytes)\n";
+  for (size_t i = 0; i < eval.folds.size(); ++i) {
+    const FoldEvaluation &fold = eval.folds[i];
+    os << std::setw(6) << i + 1 << std::setw(10) << fold.n_held_out
+       << std::setprecision(3) << std::setw(11) << fold.train_seconds
+       << std::setprecision(6) << std::setw(13) << fold.prepare_seconds
+       << std::setw(15) << fold.model_bytes << '\n';
+  }
+
+  // Undecided parameters are counted as incorrect
+  auto printAccuracy = [&os](const std::string &name,
+                             const DecisionAccuracy &accuracy) {
+    double percent = accuracy.total == 0
+                         ? 0.0
+                         : 100.0 * static_cast<double>(accuracy.correct) /
+                               static_cast<double>(accuracy.total);
+    os << "  " << std::left << std::setw(24) << name << std::right
+       << std::setw(10) << accuracy.total << std::setw(10)
+       << accuracy.decided << std::setw(10) << accuracy.correct
+       << std::setprecision(2) << std::setw(10) << percent << "%\n";
+  };
+  os << "  " << std::left << std::setw(24) << "decision" << std::right
+     << std::setw(10) << "total" << std::setw(10) << "decided"
+     << std::setw(10) << "correct" << std::setw(11) << "accuracy\n";
+  for (const auto &param : eval.parameters) {
+    printAccuracy("parameter " + std::to_string(param.first), param.second);
+  }
+  for (const auto &pass : eval.passes) {
+    printAccuracy("pass " + pass.first, pass.second);
+  }
+
+  os << "  decision latency (us):" << std::setprecision(2)
+     << " p50 " << eval.decisionPercentile(50) * 1E6
+     << " p90 " << eval.decisionPercentile(90) * 1E6
+     << " p99 " << eval.decisionPercentile(99) * 1E6
+     << " max " << eval.decisionPercentile(100) * 1E6 << '\n';
+  os << std::defaultfloat;
+}
+
+/// \brief Cross-validate machine learners against the results in a database
+///
+/// \param framework Framework instance to load the database
+/// \param db_path Path of the database holding the results
+/// \param mls Machine learners to evaluate
+/// \param metric_strs Metrics to evaluate against
+/// \param ml_config Path of the configuration to provide to the machine
+/// learners, if any
+/// \param n_folds Number of folds to split the results into
+/// \param jobs Number of folds to evaluate at once
+///
+/// \return true on success, false if any evaluation failed
+static bool evaluateDatabase(Framework &framework, const std::string &db_path,
+                             const std::set<std::string> &mls,
+                             const std::set<std::string> &metric_strs,
+                             const util::Option<std::string> &ml_config,
+                             unsigned n_folds, unsigned jobs) {
+  assert(metric_strs.size() > 0);
+  if (!configureMachineLearners(framework, mls, ml_config)) {
+    return false;
+  }
+
+  std::unique_ptr<Database> db = framework.getDatabase(db_path, false);
+  if (!db) {
+    MAGEEC_ERR("Error retrieving database. The database may not exist, "
+               "or you may not have sufficient permissions to read it");
+    return false;
+  }
+
+  std::set<FeatureDesc> feature_descs;
+  std::set<ParameterDesc> parameter_descs;
+  std::set<std::string> passes;
+  db->getTrainingDescs(feature_descs, parameter_descs, passes);
+
+  // Decisions are made using module features, so only evaluate against
+  // results for that class of features.
+  for (auto metric : metric_strs) {
+    std::vector<Result> results =
+        db->getResults(FeatureClass::kModule, metric);
+    for (auto ml : framework.getMachineLearners()) {
+      if (mls.count(ml->getName()) == 0) {
+        continue;
+      }
+      if (!ml->requiresTraining()) {
+        MAGEEC_WARN("Machine learner '" << ml->getName() << "' is not "
+                    "trained, so it cannot be evaluated");
+        continue;
+      }
+
+      // Folds which run at once each train in their own process, so a
+      // machine learner which would train on every core is given its share
+      // of the cores, rather than oversubscribing them and skewing the
+      // timings.
+      unsigned parallel_folds = std::min(jobs, n_folds);
+      if (parallel_folds > 1) {
+        ml->setThreadBudget(
+            std::max(1u, std::thread::hardware_concurrency() / parallel_folds));
+      }
+
+      util::out() << "Evaluating '" << ml->getName() << "' against metric '"
+                  << metric << "' with " << n_folds << " folds\n";
+      auto eval = evaluateMachineLearner(*ml, feature_descs, parameter_descs,
+                                         passes, results, n_folds, jobs);
+      if (!eval) {
+        return false;
+      }
+      printEvaluation(eval.get());
+    }
+  }
+  return true;
+}
+
+/// \brief Check whether a line is a well formed compilation id record, of
+/// the form 'src,module|function,name,compilation,id'.
+static bool isCompilationIDRecord(const std::string &line) {
+  std::vector<std::string> values;
+  std::string::size_type start = 0;
+  while (values.size() < 6) {
+    auto end = line.find(',', start);
+    values.push_back(line.substr(start, end - start));
+    if (end == std::string::npos)
+      break;
+    start = end + 1;
+  }
+  if (values.size() != 5)
+    return false;
+  if (values[0].empty() || values[2].empty())
+    return false;
+  if (values[1] != "module" && values[1] != "function")
+    return false;
+  if (values[3] != "compilation")
+    return false;
+  return static_cast<bool>(util::parseUnsigned(values[4]));
+}
+
+/// \brief Read the compilation ids in a file into a merged set of records
+///
+/// Lines which are not well formed records, such as a record torn by a
+/// failed write, are skipped, as are records which have already been read.
+///
+/// \param path  File holding the compilation ids
+/// \param merged  The merged records, to which new records are appended
+/// \param seen  The records which have already been read
+/// \param n_skipped  Incremented for each malformed line
+///
+/// \return true if the file could be read
+static bool readCompilationIDs(const std::string &path, std::string &merged,
+                               std::set<std::string> &seen,
+                               unsigned &n_skipped) {
+  std::ifstream in_file(path, std::ios::binary);
+  if (!in_file)
+    return false;
+  std::stringstream contents;
+  contents << in_file.rdbuf();
+  const std::string data = contents.str();
+
+  std::string::size_type start = 0;
+  while (start < data.size()) {
+    auto end = data.find('\n', start);
+    if (end == std::string::npos)
+      end = data.size();
+    std::string line = data.substr(start, end - start);
+    start = end + 1;
+
+    if (line.empty())
+      continue;
+    if (!isCompilationIDRecord(line)) {
+      ++n_skipped;
+      continue;
+    }
+    if (!seen.insert(line).second)
+      continue;
+    merged.append(line);
+    merged.push_back('\n');
+  }
+  return true;
+}
+
+/// \brief Merge compilation ids output by mageec-gcc into a single file
+///
+/// \param in_path  A file of compilation ids, or a directory of shard files
+/// each holding the compilation ids of one invocation of mageec-gcc.
+/// \param out_path  File to write the merged compilation ids to
+///
+/// \return true if the compilation ids were merged
+static bool mergeCompilationIDs(const std::string &in_path,
+                                const std::string &out_path) {
+  // Shards are read in order of name, which puts the shards of each process
+  // in the order they were written. Temporary files of shards which are
+  // still being written are skipped.
+  std::vector<std::string> in_files;
+  struct stat in_stat;
+  if (stat(in_path.c_str(), &in_stat) == 0 && S_ISDIR(in_stat.st_mode)) {
+    DIR *dir = opendir(in_path.c_str());
+    if (!dir) {
+      MAGEEC_ERR("Could not open directory '" << in_path << "'");
+      return false;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.empty() || name[0] == '.')
+        continue;
+      if (name.size() < 4 || name.compare(name.size() - 4, 4, ".csv") != 0)
+        continue;
+      in_files.push_back(in_path + "/" + name);
+    }
+    closedir(dir);
+    std::sort(in_files.begin(), in_files.end());
+  } else {
+    in_files.push_back(in_path);
+  }
+
+  std::string merged;
+  std::set<std::string> seen;
+  unsigned n_skipped = 0;
+  for (const auto &in_file : in_files) {
+    MAGEEC_DEBUG("Reading compilation ids from '" << in_file << "'");
+    if (!readCompilationIDs(in_file, merged, seen, n_skipped)) {
+      MAGEEC_ERR("Could not read compilation ids from '" << in_file << "'");
+      return false;
+    }
+  }
+  if (n_skipped != 0) {
+    MAGEEC_WARN(n_skipped << " malformed lines in the compilation ids were "
+                "ignored");
+  }
+
+  if (!util::writeFileAtomically(out_path, merged)) {
+    MAGEEC_ERR("Could not write merged compilation ids to '" << out_path
+               << "'");
+    return false;
+  }
+  return true;
+}
+
 /// \brief parseResults from an results file
 ///
 /// \param result_path Path for the results file
@@ -491,6 +814,87 @@ static bool garbageCollect(Framework &framework, const std::string &db_path) {
   return true;
 }
 
+/// \brief Compile a trained machine learner into a native model
+///
+/// The source of the model is generated by the machine learner from its
+/// training blob, and is compiled into a shared object which can be loaded
+/// by Framework::loadMachineLearner.
+///
+/// \param framework Framework instance to load the database
+/// \param db_path Path to the database holding the trained machine learner
+/// \param ml_name Name of the machine learner to compile
+/// \param metric Metric the machine learner was trained against
+/// \param out_path Path of the shared object to be created
+///
+/// \return true on success, false if the model could not be created
+static bool exportNative(Framework &framework, const std::string &db_path,
+                         const std::string &ml_name, const std::string &metric,
+                         const std::string &out_path) {
+  std::unique_ptr<Database> db = framework.getDatabase(db_path, false);
+  if (!db) {
+    MAGEEC_ERR("Error retrieving database. The database may not exist, "
+               "or you may not have sufficient permissions to read it");
+    return false;
+  }
+
+  // Decisions are made using module features, so use the machine learner
+  // trained for that class of features.
+  std::unique_ptr<TrainedML> ml =
+      db->getTrainedMachineLearner(ml_name, FeatureClass::kModule, metric);
+  if (!ml) {
+    MAGEEC_ERR("No machine learner '" << ml_name << "' trained against "
+               "metric '" << metric << "' in the database");
+    return false;
+  }
+  util::Option<NativeModelSource> source = ml->generateNativeModel();
+  if (!source) {
+    MAGEEC_ERR("Machine learner '" << ml_name << "' cannot be compiled to a "
+               "native model");
+    return false;
+  }
+
+  std::string src_path = out_path + ".cpp";
+  MAGEEC_DEBUG("Writing native model source to '" << src_path << "'");
+  {
+    std::ofstream src_file(src_path);
+    if (!src_file) {
+      MAGEEC_ERR("Could not create native model source '" << src_path << "'");
+      return false;
+    }
+    src_file << emitNativeModel(source.get(), ml_name, metric);
+  }
+
+  // The compiler may be given with arguments of its own, which are
+  // separated by whitespace as they would be by the shell.
+  const char *cxx = getenv("CXX");
+  std::vector<std::string> command;
+  std::istringstream cxx_words(cxx && *cxx ? cxx : "c++");
+  for (std::string word; cxx_words >> word;) {
+    command.push_back(word);
+  }
+  command.insert(command.end(), {"-std=c++11", "-O2", "-fPIC", "-shared",
+                                 "-o", out_path, src_path});
+  if (util::withDebug()) {
+    std::string command_str;
+    for (const auto &arg : command) {
+      command_str += (command_str.empty() ? "" : " ") + arg;
+    }
+    MAGEEC_DEBUG("Executing command: " << command_str);
+  }
+  // FIXME: Windows?
+  util::CommandResult res = util::runCommand(command, false);
+
+  // Keep the source when debugging, so that the model can be inspected
+  if (!util::withDebug()) {
+    remove(src_path.c_str());
+  }
+  if (res.status != 0) {
+    MAGEEC_ERR("Compilation of the native model failed");
+    return false;
+  }
+  return true;
+}
+
 /// \brief Entry point for the MAGEEC driver
 int main(int argc, const char *argv[]) {
   DriverMode mode = DriverMode::kNone;
@@ -503,8 +907,21 @@ int main(int argc, const char *argv[]) {
   std::set<std::string> metric_strs;
   // Machine learners to train
   std::set<std::string> ml_strs;
+  // Configuration provided to the machine learners when training
+  util::Option<std::string> ml_config;
   // The path to the results to be inserted into the database
   util::Option<std::string> results_path;
+  // The machine learner, metric and output path when exporting a native
+  // model
+  util::Option<std::string> export_ml;
+  util::Option<std::string> export_metric;
+  util::Option<std::string> export_path;
+  // Number of folds, and folds evaluated at once, when evaluating
+  unsigned n_folds = 5;
+  unsigned jobs = 1;
+  // Input and output paths when merging compilation ids
+  util::Option<std::string> merge_in_path;
+  util::Option<std::string> merge_out_path;
 
   bool with_db      = false;
   bool with_metric  = false;
@@ -558,9 +975,23 @@ int main(int argc, const char *argv[]) {
       } else if (arg == "--train") {
         mode = DriverMode::kTrain;
         continue;
+      } else if (arg == "--evaluate") {
+        mode = DriverMode::kEvaluate;
+        continue;
       } else if (arg == "--garbage-collect") {
         mode = DriverMode::kGarbageCollect;
         continue;
+      } else if (arg == "--export-native") {
+        if (i + 3 >= argc) {
+          MAGEEC_ERR("'--export-native' requires a machine learner, metric "
+                     "and output path");
+          return -1;
+        }
+        export_ml = std::string(argv[++i]);
+        export_metric = std::string(argv[++i]);
+        export_path = std::string(argv[++i]);
+        mode = DriverMode::kExportNative;
+        continue;
       }
     }
 
@@ -597,12 +1028,46 @@ int main(int argc, const char *argv[]) {
       }
       ml_strs.insert(std::string(argv[i]));
       with_ml = true;
+    } else if (arg == "--ml-config") {
+      ++i;
+      if (i >= argc) {
+        MAGEEC_ERR("No '--ml-config' value provided");
+        return -1;
+      }
+      ml_config = std::string(argv[i]);
+    } else if (arg == "--folds") {
+      ++i;
+      auto folds = i < argc ? util::parseUnsigned(argv[i]) : nullptr;
+      if (!folds || folds.get() < 2 || folds.get() > 1000) {
+        MAGEEC_ERR("'--folds' requires a number of folds between 2 and 1000");
+        return -1;
+      }
+      n_folds = static_cast<unsigned>(folds.get());
+    } else if (arg == "-j") {
+      ++i;
+      auto n_jobs = i < argc ? util::parseUnsigned(argv[i]) : nullptr;
+      if (!n_jobs || n_jobs.get() < 1 || n_jobs.get() > 256) {
+        MAGEEC_ERR("'-j' requires a number of jobs between 1 and 256");
+        return -1;
+      }
+      jobs = static_cast<unsigned>(n_jobs.get());
+    } else if (arg == "--merge-compilation-ids") {
+      if (i + 2 >= argc) {
+        MAGEEC_ERR("'--merge-compilation-ids' requires an input and output "
+                   "path");
+        return -1;
+      }
+      merge_in_path = std::string(argv[++i]);
+      merge_out_path = std::string(argv[++i]);
     } else if (arg == "--add-results") {
       MAGEEC_ERR("'--add-results' must be the second argument");
       return -1;
     } else if (arg == "--append") {
       MAGEEC_ERR("'--append' must be the second argument");
       return -1;
+    } else if (arg == "--export-native") {
+      MAGEEC_ERR("'--export-native' must be the second argument");
+      return -1;
     } else {
       MAGEEC_ERR("Unrecognized argument: '" << arg << "'");
       return -1;
@@ -618,6 +1083,15 @@ int main(int argc, const char *argv[]) {
     MAGEEC_ERR("Training mode specified without any metric to train for");
     return -1;
   }
+  if (mode == DriverMode::kEvaluate && !with_ml) {
+    MAGEEC_ERR("Evaluation mode specified without machine learners");
+    return -1;
+  }
+  if (mode == DriverMode::kEvaluate && !with_metric) {
+    MAGEEC_ERR("Evaluation mode specified without any metric to evaluate "
+               "against");
+    return -1;
+  }
 
   // Warnings
   if (with_db_version && !with_db) {
@@ -629,13 +1103,17 @@ int main(int argc, const char *argv[]) {
       (mode == DriverMode::kCreate) ||
       (mode == DriverMode::kAppend) ||
       (mode == DriverMode::kAddResults) ||
-      (mode == DriverMode::kGarbageCollect)) {
+      (mode == DriverMode::kGarbageCollect) ||
+      (mode == DriverMode::kExportNative)) {
     if (with_metric) {
       MAGEEC_WARN("--metric arguments will be ignored for the specified mode");
     }
     if (with_ml) {
       MAGEEC_WARN("--ml arguments will be ignored for the specified mode");
     }
+    if (ml_config) {
+      MAGEEC_WARN("--ml-config will be ignored for the specified mode");
+    }
   }
 
   // Initialize the framework, and register some built in machine learners
@@ -651,6 +1129,10 @@ int main(int argc, const char *argv[]) {
   std::unique_ptr<IMachineLearner> nn_ml(new OneNN());
   framework.registerMachineLearner(std::move(nn_ml));
 
+  MAGEEC_DEBUG("Registering random forest machine learner interface");
+  std::unique_ptr<IMachineLearner> forest_ml(new RandomForest());
+  framework.registerMachineLearner(std::move(forest_ml));
+
   // Get the machine learners provided on the command line
   std::set<std::string> mls;
   if (with_ml) {
@@ -681,6 +1163,11 @@ int main(int argc, const char *argv[]) {
   if (with_print_ml_interfaces) {
     printMLInterfaces(framework);
   }
+  if (merge_in_path) {
+    if (!mergeCompilationIDs(merge_in_path.get(), merge_out_path.get())) {
+      return -1;
+    }
+  }
 
   // Handle modes
   switch (mode) {
@@ -697,7 +1184,8 @@ int main(int argc, const char *argv[]) {
     }
     return 0;
   case DriverMode::kTrain:
-    if (!trainDatabase(framework, db_str.get(), mls, metric_strs)) {
+    if (!trainDatabase(framework, db_str.get(), mls, metric_strs,
+                       ml_config)) {
       return -1;
     }
     return 0;
@@ -711,6 +1199,18 @@ int main(int argc, const char *argv[]) {
       return -1;
     }
     return 0;
+  case DriverMode::kExportNative:
+    if (!exportNative(framework, db_str.get(), export_ml.get(),
+                      export_metric.get(), export_path.get())) {
+      return -1;
+    }
+    return 0;
+  case DriverMode::kEvaluate:
+    if (!evaluateDatabase(framework, db_str.get(), mls, metric_strs,
+                          ml_config, n_folds, jobs)) {
+      return -1;
+    }
+    return 0;
   }
   return 0;
 }
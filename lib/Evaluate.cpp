@@ -0,0 +1,344 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===------------------ MAGEEC machine learner evaluation -----------------===//
+//
+// This implements k-fold cross-validation of a machine learner. Each fold is
+// trained and evaluated in turn, possibly in a separate process, and the
+// accuracy and cost of each fold are combined into a single evaluation.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mageec/AttributeSet.h"
+#include "mageec/Database.h"
+#include "mageec/Decision.h"
+#include "mageec/Evaluate.h"
+#include "mageec/ML.h"
+#include "mageec/Result.h"
+#include "mageec/Util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace mageec {
+
+namespace {
+
+/// \brief Group the indices of results with the same feature set
+///
+/// \return The results of each distinct feature set, in the order in which
+/// each feature set first appears.
+std::vector<std::vector<size_t>>
+groupByFeatureSet(const std::vector<Result> &results) {
+  std::vector<std::vector<size_t>> groups;
+  std::map<uint64_t, size_t> group_of_hash;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const FeatureSet &features = results[i].getFeatures();
+
+    // Step past feature sets whose hash collides with this one
+    uint64_t hash = features.hash();
+    auto group = group_of_hash.find(hash);
+    while (group != group_of_hash.end() &&
+           !(results[groups[group->second][0]].getFeatures() == features)) {
+      group = group_of_hash.find(++hash);
+    }
+    if (group == group_of_hash.end()) {
+      group_of_hash[hash] = groups.size();
+      groups.push_back({i});
+    } else {
+      groups[group->second].push_back(i);
+    }
+  }
+  return groups;
+}
+
+/// \brief Find the value of a parameter in a set of parameters
+///
+/// \return The parameter, or nullptr if it is not in the set
+const ParameterBase *findParameter(const ParameterSet &parameters,
+                                   unsigned id) {
+  for (const auto &param : parameters) {
+    if (param->getID() == id) {
+      return param.get();
+    }
+  }
+  return nullptr;
+}
+
+/// \brief Time a single decision made by a prepared model, or by the machine
+/// learner if it could not be prepared.
+std::unique_ptr<DecisionBase>
+timeDecision(const IMachineLearner &ml, const IPreparedModel *prepared,
+             const std::vector<uint8_t> &blob,
+             const DecisionRequestBase &request, const FeatureSet &features,
+             std::vector<double> &decision_seconds) {
+  const auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<DecisionBase> decision =
+      prepared ? std::move(prepared->makeDecisions({&request}, features)[0])
+               : ml.makeDecision(request, features, blob);
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  decision_seconds.push_back(elapsed.count());
+  return decision;
+}
+
+/// \brief Record the outcome of a decision against the expected value
+void recordDecision(DecisionAccuracy &accuracy, const DecisionBase &decision,
+                    int64_t expected) {
+  accuracy.total++;
+  int64_t value = 0;
+  switch (decision.getType()) {
+  case DecisionType::kBool:
+    value = static_cast<const BoolDecision &>(decision).getValue() ? 1 : 0;
+    break;
+  case DecisionType::kRange:
+    value = static_cast<const RangeDecision &>(decision).getValue();
+    break;
+  default:
+    // The machine learner declined to make the decision
+    return;
+  }
+  accuracy.decided++;
+  if (value == expected) {
+    accuracy.correct++;
+  }
+}
+
+/// \brief Serialize the evaluation of a single fold
+std::vector<uint8_t> foldToBlob(const FoldEvaluation &fold,
+                                const Evaluation &eval) {
+  std::vector<uint8_t> blob;
+
+  // | train_seconds | prepare_seconds | model_bytes | n_held_out |
+  util::writeDoubleLE(blob, fold.train_seconds);
+  util::writeDoubleLE(blob, fold.prepare_seconds);
+  util::write64LE(blob, fold.model_bytes);
+  util::write64LE(blob, fold.n_held_out);
+
+  // | n_parameters | param_id | total | decided | correct |...
+  util::write64LE(blob, eval.parameters.size());
+  for (const auto &param : eval.parameters) {
+    util::write32LE(blob, param.first);
+    util::write64LE(blob, param.second.total);
+    util::write64LE(blob, param.second.decided);
+    util::write64LE(blob, param.second.correct);
+  }
+
+  // | n_passes | pass_name_len | pass_name | total | decided | correct |...
+  util::write64LE(blob, eval.passes.size());
+  for (const auto &pass : eval.passes) {
+    util::writeBytes(blob,
+                     reinterpret_cast<const uint8_t *>(pass.first.data()),
+                     pass.first.size());
+    util::write64LE(blob, pass.second.total);
+    util::write64LE(blob, pass.second.decided);
+    util::write64LE(blob, pass.second.correct);
+  }
+
+  // | n_decisions | decision_seconds |...
+  util::write64LE(blob, eval.decision_seconds.size());
+  util::writeDoublesLE(blob, eval.decision_seconds.data(),
+                       eval.decision_seconds.size());
+  return blob;
+}
+
+/// \brief Add the serialized evaluation of a single fold to an evaluation
+///
+/// \return True if the blob was well formed
+bool addFoldFromBlob(const std::vector<uint8_t> &blob, Evaluation &eval) {
+  util::SectionReader reader(blob.data(), blob.size());
+
+  FoldEvaluation fold;
+  fold.train_seconds = reader.readDouble();
+  fold.prepare_seconds = reader.readDouble();
+  fold.model_bytes = reader.read64();
+  fold.n_held_out = reader.read64();
+  eval.folds.push_back(fold);
+
+  size_t n_parameters = reader.readCount(28);
+  for (size_t i = 0; i < n_parameters; ++i) {
+    DecisionAccuracy &accuracy = eval.parameters[reader.read32()];
+    accuracy.total += reader.read64();
+    accuracy.decided += reader.read64();
+    accuracy.correct += reader.read64();
+  }
+
+  size_t n_passes = reader.readCount(32);
+  for (size_t i = 0; i < n_passes; ++i) {
+    DecisionAccuracy &accuracy = eval.passes[reader.readString()];
+    accuracy.total += reader.read64();
+    accuracy.decided += reader.read64();
+    accuracy.correct += reader.read64();
+  }
+
+  size_t n_decisions = reader.readCount(8);
+  size_t start = eval.decision_seconds.size();
+  eval.decision_seconds.resize(start + n_decisions);
+  reader.readDoubles(eval.decision_seconds.data() + start, n_decisions);
+  return !reader.failed() && reader.atEnd();
+}
+
+} // end of anonymous namespace
+
+double Evaluation::decisionPercentile(double percentile) const {
+  if (decision_seconds.empty()) {
+    return 0.0;
+  }
+  // Nearest rank
+  double rank = std::ceil(percentile / 100.0 *
+                          static_cast<double>(decision_seconds.size()));
+  size_t index = rank < 1.0 ? 0 : static_cast<size_t>(rank) - 1;
+  return decision_seconds[std::min(index, decision_seconds.size() - 1)];
+}
+
+util::Option<Evaluation>
+evaluateMachineLearner(const IMachineLearner &ml,
+                       const std::set<FeatureDesc> &feature_descs,
+                       const std::set<ParameterDesc> &parameter_descs,
+                       const std::set<std::string> &passes,
+                       const std::vector<Result> &results, unsigned n_folds,
+                       unsigned jobs) {
+  assert(n_folds >= 2 && "Cross-validation requires at least two folds");
+
+  std::vector<std::vector<size_t>> groups = groupByFeatureSet(results);
+  if (groups.size() < n_folds) {
+    MAGEEC_ERR("Only " << groups.size() << " distinct feature sets, which "
+               "cannot be split into " << n_folds << " folds");
+    return nullptr;
+  }
+
+  // Assign the feature sets to folds in a fixed random order, so that the
+  // folds are the same on every run.
+  std::mt19937_64 rng(0xBEEF);
+  for (size_t i = groups.size(); i > 1; --i) {
+    std::swap(groups[i - 1], groups[rng() % i]);
+  }
+
+  MAGEEC_DEBUG("Evaluating '" << ml.getName() << "' over " << groups.size()
+               << " feature sets in " << n_folds << " folds");
+
+  auto evaluateFold = [&](size_t fold_index) {
+    std::vector<Result> training;
+    std::vector<size_t> held_out;
+    for (size_t g = 0; g < groups.size(); ++g) {
+      if (g % n_folds == fold_index) {
+        held_out.push_back(g);
+      } else {
+        for (size_t i : groups[g]) {
+          training.push_back(results[i]);
+        }
+      }
+    }
+
+    MAGEEC_DEBUG("Training fold " << fold_index + 1 << " of " << n_folds
+                 << " on " << training.size() << " results");
+    FoldEvaluation fold;
+    fold.n_held_out = held_out.size();
+    auto start = std::chrono::steady_clock::now();
+    const std::vector<uint8_t> blob =
+        ml.train(feature_descs, parameter_descs, passes,
+                 ResultIterator(std::move(training)));
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    fold.train_seconds = elapsed.count();
+    fold.model_bytes = blob.size();
+
+    start = std::chrono::steady_clock::now();
+    std::unique_ptr<IPreparedModel> prepared = ml.prepare(blob);
+    elapsed = std::chrono::steady_clock::now() - start;
+    fold.prepare_seconds = elapsed.count();
+
+    // The expected decisions for each held-out feature set are the
+    // parameters of its best result, preferring the earliest of equal
+    // results.
+    Evaluation eval;
+    for (size_t g : held_out) {
+      const Result *best = &results[groups[g][0]];
+      for (size_t i : groups[g]) {
+        if (results[i].getValue() < best->getValue()) {
+          best = &results[i];
+        }
+      }
+      const FeatureSet &features = best->getFeatures();
+      const ParameterSet &expected = best->getParameters();
+
+      for (const auto &desc : parameter_descs) {
+        const ParameterBase *param = findParameter(expected, desc.id);
+        if (!param) {
+          continue;
+        }
+
+        std::unique_ptr<DecisionBase> decision;
+        int64_t expected_value = 0;
+        switch (desc.type) {
+        case ParameterType::kBool:
+          decision = timeDecision(ml, prepared.get(), blob,
+                                  BoolDecisionRequest(desc.id), features,
+                                  eval.decision_seconds);
+          expected_value =
+              static_cast<const BoolParameter *>(param)->getValue() ? 1 : 0;
+          recordDecision(eval.parameters[desc.id], *decision, expected_value);
+          break;
+        case ParameterType::kRange:
+          decision = timeDecision(ml, prepared.get(), blob,
+                                  RangeDecisionRequest(desc.id), features,
+                                  eval.decision_seconds);
+          expected_value =
+              static_cast<const RangeParameter *>(param)->getValue();
+          recordDecision(eval.parameters[desc.id], *decision, expected_value);
+          break;
+        case ParameterType::kPassSeq: {
+          // Each pass is gated separately
+          const auto &pass_seq =
+              static_cast<const PassSeqParameter *>(param)->getValue();
+          for (const auto &pass : passes) {
+            decision = timeDecision(ml, prepared.get(), blob,
+                                    PassGateDecisionRequest(pass), features,
+                                    eval.decision_seconds);
+            expected_value = std::find(pass_seq.begin(), pass_seq.end(),
+                                       pass) != pass_seq.end();
+            recordDecision(eval.passes[pass], *decision, expected_value);
+          }
+          break;
+        }
+        }
+      }
+    }
+    return foldToBlob(fold, eval);
+  };
+
+  auto fold_blobs = util::runInProcesses(n_folds, jobs, evaluateFold);
+
+  Evaluation eval;
+  for (size_t i = 0; i < fold_blobs.size(); ++i) {
+    if (!fold_blobs[i] || !addFoldFromBlob(fold_blobs[i].get(), eval)) {
+      MAGEEC_ERR("Evaluation of fold " << i + 1 << " failed");
+      return nullptr;
+    }
+  }
+  std::sort(eval.decision_seconds.begin(), eval.decision_seconds.end());
+  return eval;
+}
+
+} // end of namespace mageec
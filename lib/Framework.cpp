@@ -26,8 +26,11 @@
 #include "mageec/Database.h"
 #include "mageec/Framework.h"
 #include "mageec/ML.h"
+#include "mageec/NativeML.h"
 #include "mageec/Util.h"
 
+#include <dlfcn.h>
+
 #include <cassert>
 #include <set>
 #include <string>
@@ -38,7 +41,8 @@ const util::Version Framework::version(MAGEEC_VERSION_MAJOR,
                                        MAGEEC_VERSION_MINOR,
                                        MAGEEC_VERSION_PATCH);
 
-Framework::Framework(bool with_debug, bool with_sql_trace) : m_mls() {
+Framework::Framework(bool with_debug, bool with_sql_trace)
+    : m_mls(), m_handles() {
   if (with_debug) {
     util::setDebug(true);
   }
@@ -52,6 +56,11 @@ Framework::~Framework(void) {
   for (auto ml : m_mls) {
     delete ml.second;
   }
+  // The machine learners may reference data in the shared objects, so
+  // these are only unloaded once they are gone.
+  for (auto handle : m_handles) {
+    dlclose(handle);
+  }
 }
 
 void Framework::setDebug(bool with_debug) const {
@@ -64,8 +73,40 @@ void Framework::setSQLTrace(bool with_sql_trace) const {
 util::Version Framework::getVersion(void) const { return Framework::version; }
 
 std::string Framework::loadMachineLearner(std::string path) {
-  (void)path;
-  return std::string();
+  if (hasMachineLearner(path)) {
+    return path;
+  }
+
+  MAGEEC_DEBUG("Loading machine learner plugin '" << path << "'");
+  void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    MAGEEC_DEBUG("Unable to load plugin: " << dlerror());
+    return std::string();
+  }
+
+  typedef const mageec_native_model *(*GetNativeModelFn)(void);
+  auto get_model = reinterpret_cast<GetNativeModelFn>(
+      dlsym(handle, MAGEEC_NATIVE_MODEL_SYMBOL));
+  const mageec_native_model *model = get_model ? get_model() : nullptr;
+  if (!model) {
+    MAGEEC_DEBUG("Plugin does not provide a native model");
+    dlclose(handle);
+    return std::string();
+  }
+  if (model->version != MAGEEC_NATIVE_MODEL_VERSION) {
+    MAGEEC_WARN("Native model '" << path << "' has version "
+                << model->version << ", expected version "
+                << MAGEEC_NATIVE_MODEL_VERSION);
+    dlclose(handle);
+    return std::string();
+  }
+  MAGEEC_DEBUG("Loaded native model of machine learner '" << model->ml_name
+               << "' trained against metric '" << model->metric << "'");
+
+  m_handles.push_back(handle);
+  registerMachineLearner(std::unique_ptr<IMachineLearner>(
+      new NativeMachineLearner(*model, path)));
+  return path;
 }
 
 bool Framework::registerMachineLearner(std::unique_ptr<IMachineLearner> ml) {
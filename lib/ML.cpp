@@ -0,0 +1,123 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===---------------------- Machine learner interface ---------------------===//
+//
+// This implements helpers shared by the machine learners.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mageec/ML.h"
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace mageec {
+
+std::vector<std::string>
+mergePassSequences(const std::vector<PassSeq> &pass_seqs,
+                   const std::set<std::string> &passes) {
+  // Number the passes in the order they first appear, and record which
+  // passes directly follow each other in the sequences.
+  std::map<std::string, size_t> index_of;
+  std::vector<std::string> names;
+  std::vector<std::set<size_t>> successors;
+  for (const auto &pass_seq : pass_seqs) {
+    bool has_prev = false;
+    size_t prev = 0;
+    for (const auto &pass : pass_seq) {
+      if (!passes.count(pass)) {
+        continue;
+      }
+      auto it = index_of.find(pass);
+      if (it == index_of.end()) {
+        it = index_of.insert({pass, names.size()}).first;
+        names.push_back(pass);
+        successors.emplace_back();
+      }
+      if (has_prev && prev != it->second) {
+        successors[prev].insert(it->second);
+      }
+      has_prev = true;
+      prev = it->second;
+    }
+  }
+
+  std::vector<size_t> predecessors(names.size(), 0);
+  for (const auto &succ : successors) {
+    for (size_t s : succ) {
+      predecessors[s]++;
+    }
+  }
+
+  // Repeatedly take the earliest pass with no unordered predecessors. If
+  // the sequences disagree there may be none, in which case the earliest
+  // unordered pass is taken anyway.
+  std::vector<std::string> order;
+  std::vector<bool> ordered(names.size(), false);
+  while (order.size() < names.size()) {
+    size_t next = names.size();
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (!ordered[i] && (next == names.size() || predecessors[i] == 0)) {
+        next = i;
+        if (predecessors[i] == 0) {
+          break;
+        }
+      }
+    }
+    ordered[next] = true;
+    order.push_back(names[next]);
+    for (size_t s : successors[next]) {
+      predecessors[s]--;
+    }
+  }
+
+  for (const auto &pass : passes) {
+    if (!index_of.count(pass)) {
+      order.push_back(pass);
+    }
+  }
+  return order;
+}
+
+void encodeFeatures(const FeatureSet &features,
+                    const std::map<unsigned, size_t> &feature_column,
+                    std::vector<double>::iterator row, double true_value,
+                    double false_value) {
+  for (auto f : features) {
+    auto column = feature_column.find(f->getID());
+    if (column == feature_column.cend()) {
+      continue;
+    }
+    auto cell = row + static_cast<std::ptrdiff_t>(column->second);
+    switch (f->getType()) {
+    case FeatureType::kBool:
+      *cell = static_cast<BoolFeature *>(f.get())->getValue() ? true_value
+                                                              : false_value;
+      break;
+    case FeatureType::kInt:
+      *cell = static_cast<double>(
+          static_cast<IntFeature *>(f.get())->getValue());
+      break;
+    }
+  }
+}
+
+} // end of namespace mageec
@@ -19,93 +19,1602 @@
 //
 // This implements an incredibly naive 1-NN 'machine learner'. This finds the
 // closest feature set in the training set to the input feature set, and then
-// uses that configuration to make decisions.
+// uses that configuration to make decisions. The closest feature set is
+// found using a k-d tree built over the training set.
 //
 //===----------------------------------------------------------------------===//
 
 #include "mageec/Database.h"
 #include "mageec/ML/1NN.h"
 #include "mageec/ML.h"
+#include "mageec/NativeML.h"
 #include "mageec/Result.h"
 #include "mageec/Types.h"
 #include "mageec/Util.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
+#include <new>
+#include <queue>
+#include <random>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <limits>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
 namespace mageec {
 
-OneNN::OneNN() : IMachineLearner() {}
+namespace {
+
+/// \brief Deleter for memory allocated by posix_memalign
+struct FreeDeleter {
+  void operator()(void *ptr) const { free(ptr); }
+};
+
+/// \brief Allocate a zeroed array aligned for the widest vector loads
+template <typename T>
+std::unique_ptr<T[], FreeDeleter> allocateAligned(size_t size) {
+  void *ptr = nullptr;
+  size_t bytes = std::max<size_t>(size, 1) * sizeof(T);
+  if (posix_memalign(&ptr, 32, bytes) != 0) {
+    throw std::bad_alloc();
+  }
+  memset(ptr, 0, bytes);
+  return std::unique_ptr<T[], FreeDeleter>(static_cast<T *>(ptr));
+}
+
+/// \struct PointMatrix
+///
+/// \brief Normalized features of the points of the training set
+///
+/// The features are stored a column at a time, with the points of each
+/// column in the order of the search tree so that the points of a leaf are
+/// contiguous. Each column is padded so that a vector load starting at any
+/// point stays within the column. Features missing from a point have a
+/// value of zero and a clear presence mask.
+struct PointMatrix {
+  PointMatrix() : n_points(0), n_columns(0), stride(0), values(), present() {}
+
+  /// \brief Lay out dense rows in the provided order
+  ///
+  /// \param rows  Row-major matrix of features, NaN where missing
+  /// \param n_points  Number of rows in the matrix
+  /// \param n_columns  Number of columns in the matrix
+  /// \param order  Order of the points in the new matrix
+  PointMatrix(const std::vector<double> &rows, size_t n_points,
+              size_t n_columns, const std::vector<uint64_t> &order)
+      : n_points(n_points), n_columns(n_columns),
+        stride((n_points + 3 + 3) & ~static_cast<size_t>(3)),
+        values(allocateAligned<double>(stride * n_columns)),
+        present(allocateAligned<uint64_t>(stride * n_columns)) {
+    assert(order.size() == n_points);
+    for (size_t c = 0; c < n_columns; ++c) {
+      for (size_t i = 0; i < n_points; ++i) {
+        double value = rows[order[i] * n_columns + c];
+        if (!std::isnan(value)) {
+          values[c * stride + i] = value;
+          present[c * stride + i] = ~static_cast<uint64_t>(0);
+        }
+      }
+    }
+  }
+
+  size_t n_points;
+  size_t n_columns;
+  /// Distance between the start of each column
+  size_t stride;
+  std::unique_ptr<double[], FreeDeleter> values;
+  /// All bits set where the feature is present in the point, otherwise zero
+  std::unique_ptr<uint64_t[], FreeDeleter> present;
+};
+
+/// \brief Compute the squared distances from a query to a range of points
+///
+/// Only the provided columns of the query are used, which must be the
+/// columns where the query has a value, in ascending order. Features missing
+/// from a point are ignored. This writes the distance for each point in the
+/// range, and may write up to 3 values past the end of the range.
+typedef void (*DistanceKernel)(const PointMatrix &matrix, const double *query,
+                               const size_t *columns, size_t n_columns,
+                               size_t begin, size_t end, double *distances);
+
+void distancesScalar(const PointMatrix &matrix, const double *query,
+                     const size_t *columns, size_t n_columns, size_t begin,
+                     size_t end, double *distances) {
+  for (size_t i = begin; i < end; ++i) {
+    distances[i - begin] = 0.0;
+  }
+  for (size_t k = 0; k < n_columns; ++k) {
+    const double *values = &matrix.values[columns[k] * matrix.stride];
+    const uint64_t *present = &matrix.present[columns[k] * matrix.stride];
+    double query_value = query[columns[k]];
+    for (size_t i = begin; i < end; ++i) {
+      if (present[i]) {
+        double diff = values[i] - query_value;
+        distances[i - begin] += diff * diff;
+      }
+    }
+  }
+}
+
+// The vector kernels must sum each distance in the same order as the scalar
+// kernel, and must not contract the sums into fused multiply-adds, so that
+// every kernel chooses the same nearest point.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MAGEEC_1NN_X86_KERNELS
+
+__attribute__((target("sse2")))
+void distancesSSE2(const PointMatrix &matrix, const double *query,
+                   const size_t *columns, size_t n_columns, size_t begin,
+                   size_t end, double *distances) {
+  for (size_t i = begin; i < end; i += 2) {
+    __m128d sum = _mm_setzero_pd();
+    for (size_t k = 0; k < n_columns; ++k) {
+      size_t offset = columns[k] * matrix.stride + i;
+      __m128d diff = _mm_sub_pd(_mm_loadu_pd(&matrix.values[offset]),
+                                _mm_set1_pd(query[columns[k]]));
+      __m128d present = _mm_loadu_pd(
+          reinterpret_cast<const double *>(&matrix.present[offset]));
+      sum = _mm_add_pd(sum, _mm_and_pd(_mm_mul_pd(diff, diff), present));
+    }
+    _mm_storeu_pd(&distances[i - begin], sum);
+  }
+}
+
+__attribute__((target("avx2")))
+void distancesAVX2(const PointMatrix &matrix, const double *query,
+                   const size_t *columns, size_t n_columns, size_t begin,
+                   size_t end, double *distances) {
+  for (size_t i = begin; i < end; i += 4) {
+    __m256d sum = _mm256_setzero_pd();
+    for (size_t k = 0; k < n_columns; ++k) {
+      size_t offset = columns[k] * matrix.stride + i;
+      __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(&matrix.values[offset]),
+                                   _mm256_set1_pd(query[columns[k]]));
+      __m256d present = _mm256_loadu_pd(
+          reinterpret_cast<const double *>(&matrix.present[offset]));
+      sum = _mm256_add_pd(sum,
+                          _mm256_and_pd(_mm256_mul_pd(diff, diff), present));
+    }
+    _mm256_storeu_pd(&distances[i - begin], sum);
+  }
+}
+#endif // defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+/// \brief Get the fastest distance kernel supported by the host
+DistanceKernel getDistanceKernel() {
+  static const DistanceKernel kernel = []() -> DistanceKernel {
+#ifdef MAGEEC_1NN_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      MAGEEC_DEBUG("Using AVX2 1-NN distance kernel");
+      return distancesAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+      MAGEEC_DEBUG("Using SSE2 1-NN distance kernel");
+      return distancesSSE2;
+    }
+#endif // MAGEEC_1NN_X86_KERNELS
+    MAGEEC_DEBUG("Using scalar 1-NN distance kernel");
+    return distancesScalar;
+  }();
+  return kernel;
+}
+
+/// Squared distance and index of each of a set of points, nearest first
+typedef std::vector<std::pair<double, uint64_t>> Neighbours;
+
+/// \brief Insert a point into a set of at most k nearest points
+///
+/// Equally distant points are ordered by their index, so that the earliest
+/// point in the training set is preferred.
+void insertNeighbour(Neighbours &neighbours, size_t k,
+                     std::pair<double, uint64_t> neighbour) {
+  if (neighbours.size() == k && !(neighbour < neighbours.back())) {
+    return;
+  }
+  neighbours.insert(std::upper_bound(neighbours.begin(), neighbours.end(),
+                                     neighbour),
+                    neighbour);
+  if (neighbours.size() > k) {
+    neighbours.pop_back();
+  }
+}
+
+/// \struct KDTree
+///
+/// \brief k-d tree over the points of the training set
+///
+/// Each internal node splits its points on the value of a single feature.
+/// Points missing that feature contribute nothing to the distance along it,
+/// so they are held in a third branch of the node which cannot be pruned
+/// using the split.
+///
+/// Searches are exact, and return the same point as a linear scan of the
+/// points in order, taking the earliest of equally distant points.
+struct KDTree {
+  /// Version of the serialized form of the tree. Trees with a different
+  /// version are discarded when parsed, and rebuilt from the points.
+  static const unsigned kVersion = 1;
+
+  /// Column of a leaf node
+  static const unsigned kLeafColumn = 0xFFFF;
+
+  /// Maximum number of points held by a leaf
+  static const size_t kLeafSize = 16;
+
+  struct Node {
+    /// Column of the feature the node splits on, or kLeafColumn
+    unsigned column;
+    /// Points with a value less than or equal to this take the left branch
+    double split;
+    /// Index of the node for each branch, or 0 if the branch is empty
+    uint64_t left;
+    uint64_t right;
+    uint64_t missing;
+    /// Range of the points of the node in the order of the tree
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  /// \brief Build a tree over the dense rows of the points
+  static KDTree build(const std::vector<double> &rows, size_t n_points,
+                      size_t n_columns);
+
+  /// \brief Parse a tree from a blob
+  ///
+  /// \return  The tree, or nothing if the blob has a different version or
+  /// is malformed
+  static util::Option<KDTree> fromBlob(std::vector<uint8_t>::const_iterator it,
+                                       std::vector<uint8_t>::const_iterator end,
+                                       size_t n_points, size_t n_columns);
+
+  /// \brief Serialize the tree, appending it to a blob
+  void toBlob(std::vector<uint8_t> &blob) const;
+
+  /// \brief Find the points nearest to a query
+  ///
+  /// \param matrix  The points the tree was built over, in the order of
+  /// the tree
+  /// \param query  The normalized query, with NaN for missing features
+  /// \param k  The number of points to find
+  /// \return  The squared distance and index of up to k nearest points,
+  /// nearest first
+  Neighbours nearest(const PointMatrix &matrix,
+                     const std::vector<double> &query, size_t k) const;
+
+  /// Nodes of the tree, with the root first. Branches always follow their
+  /// parent.
+  std::vector<Node> nodes;
+
+  /// Indices of the points, ordered so that the points of each node are
+  /// contiguous.
+  std::vector<uint64_t> order;
+
+private:
+  uint64_t buildNode(const std::vector<double> &rows, size_t n_columns,
+                     uint64_t begin, uint64_t end);
+
+  /// State of a search for the nearest point
+  struct Search {
+    const PointMatrix &matrix;
+    const double *query;
+    /// Columns where the query has a value
+    std::vector<size_t> columns;
+    DistanceKernel kernel;
+    /// Distances from the query to the points of a leaf
+    std::vector<double> distances;
+    /// Distance along each column from the query to the region of the
+    /// current node.
+    std::vector<double> offset;
+    /// Number of points to find
+    size_t k;
+    /// Nearest points found so far, nearest first
+    Neighbours best;
+  };
+  void search(uint64_t node, double lower_bound, Search &state) const;
+};
+
+KDTree KDTree::build(const std::vector<double> &rows, size_t n_points,
+                     size_t n_columns) {
+  KDTree tree;
+  for (uint64_t i = 0; i < n_points; ++i) {
+    tree.order.push_back(i);
+  }
+  if (n_points != 0) {
+    tree.buildNode(rows, n_columns, 0, n_points);
+  }
+  return tree;
+}
+
+uint64_t KDTree::buildNode(const std::vector<double> &rows, size_t n_columns,
+                           uint64_t begin, uint64_t end) {
+  uint64_t index = nodes.size();
+  nodes.push_back({kLeafColumn, 0.0, 0, 0, 0, begin, end});
+  if (end - begin <= kLeafSize) {
+    return index;
+  }
+
+  // Split on the feature with the greatest spread of values. If there is
+  // no spread then the points cannot be separated.
+  unsigned column = kLeafColumn;
+  double max_spread = 0.0;
+  for (unsigned c = 0; c < n_columns; ++c) {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    for (uint64_t i = begin; i < end; ++i) {
+      double value = rows[order[i] * n_columns + c];
+      if (!std::isnan(value)) {
+        min = std::min(min, value);
+        max = std::max(max, value);
+      }
+    }
+    if (max - min > max_spread) {
+      max_spread = max - min;
+      column = c;
+    }
+  }
+  if (column == kLeafColumn) {
+    return index;
+  }
+
+  // Split at the median value. If this is the largest value, split below it
+  // instead so that both sides hold points.
+  std::vector<double> values;
+  for (uint64_t i = begin; i < end; ++i) {
+    double value = rows[order[i] * n_columns + column];
+    if (!std::isnan(value)) {
+      values.push_back(value);
+    }
+  }
+  auto median = values.begin() + static_cast<std::ptrdiff_t>(values.size() / 2);
+  std::nth_element(values.begin(), median, values.end());
+  double split = *median;
+  double max = *std::max_element(values.begin(), values.end());
+  if (split == max) {
+    split = -std::numeric_limits<double>::infinity();
+    for (double value : values) {
+      if (value < max && value > split) {
+        split = value;
+      }
+    }
+  }
+
+  // Order the points of the node as left, right, then missing
+  auto first = order.begin() + static_cast<std::ptrdiff_t>(begin);
+  auto last = order.begin() + static_cast<std::ptrdiff_t>(end);
+  auto is_present = [&](uint64_t i) {
+    return !std::isnan(rows[i * n_columns + column]);
+  };
+  auto is_left = [&](uint64_t i) {
+    return rows[i * n_columns + column] <= split;
+  };
+  auto right_begin = std::partition(first, last, is_present);
+  auto missing_begin = right_begin;
+  right_begin = std::partition(first, missing_begin, is_left);
+
+  uint64_t mid = static_cast<uint64_t>(right_begin - order.begin());
+  uint64_t missing = static_cast<uint64_t>(missing_begin - order.begin());
+
+  nodes[index].column = column;
+  nodes[index].split = split;
+  uint64_t left_node = buildNode(rows, n_columns, begin, mid);
+  uint64_t right_node = buildNode(rows, n_columns, mid, missing);
+  nodes[index].left = left_node;
+  nodes[index].right = right_node;
+  if (missing != end) {
+    uint64_t missing_node = buildNode(rows, n_columns, missing, end);
+    nodes[index].missing = missing_node;
+  }
+  return index;
+}
+
+util::Option<KDTree>
+KDTree::fromBlob(std::vector<uint8_t>::const_iterator it,
+                 std::vector<uint8_t>::const_iterator end, size_t n_points,
+                 size_t n_columns) {
+  // | version | n_nodes | node | node |...| n_order | index | index |...
+  // | column | split | left | right | missing | begin | end |
+  const uint64_t node_size = 2 + 8 * 6;
+  if (end - it < 10 || util::read16LE(it) != kVersion) {
+    return nullptr;
+  }
+  uint64_t n_nodes = util::read64LE(it);
+  if (static_cast<uint64_t>(end - it) / node_size < n_nodes) {
+    return nullptr;
+  }
+
+  KDTree tree;
+  for (uint64_t i = 0; i < n_nodes; ++i) {
+    Node node;
+    node.column = util::read16LE(it);
+    node.split = util::readDoubleLE(it);
+    node.left = util::read64LE(it);
+    node.right = util::read64LE(it);
+    node.missing = util::read64LE(it);
+    node.begin = util::read64LE(it);
+    node.end = util::read64LE(it);
+
+    if (node.begin > node.end || node.end > n_points) {
+      return nullptr;
+    }
+    if (node.column != kLeafColumn &&
+        (node.column >= n_columns || node.left <= i || node.left >= n_nodes ||
+         node.right <= i || node.right >= n_nodes ||
+         (node.missing != 0 &&
+          (node.missing <= i || node.missing >= n_nodes)))) {
+      return nullptr;
+    }
+    tree.nodes.push_back(node);
+  }
+
+  if (end - it < 8) {
+    return nullptr;
+  }
+  uint64_t n_order = util::read64LE(it);
+  if (n_order != n_points ||
+      static_cast<uint64_t>(end - it) != n_order * 8) {
+    return nullptr;
+  }
+  for (uint64_t i = 0; i < n_order; ++i) {
+    uint64_t index = util::read64LE(it);
+    if (index >= n_points) {
+      return nullptr;
+    }
+    tree.order.push_back(index);
+  }
+  if (n_points != 0 && tree.nodes.empty()) {
+    return nullptr;
+  }
+  return tree;
+}
+
+void KDTree::toBlob(std::vector<uint8_t> &blob) const {
+  // | version | n_nodes | node | node |...| n_order | index | index |...
+  util::write16LE(blob, kVersion);
+  util::write64LE(blob, nodes.size());
+  for (const auto &node : nodes) {
+    // | column | split | left | right | missing | begin | end |
+    util::write16LE(blob, node.column);
+    util::writeDoubleLE(blob, node.split);
+    util::write64LE(blob, node.left);
+    util::write64LE(blob, node.right);
+    util::write64LE(blob, node.missing);
+    util::write64LE(blob, node.begin);
+    util::write64LE(blob, node.end);
+  }
+  util::write64LE(blob, order.size());
+  for (auto index : order) {
+    util::write64LE(blob, index);
+  }
+}
+
+Neighbours KDTree::nearest(const PointMatrix &matrix,
+                           const std::vector<double> &query, size_t k) const {
+  assert(query.size() == matrix.n_columns);
+  if (nodes.empty() || k == 0) {
+    return Neighbours();
+  }
+  Search state = {matrix,
+                  query.data(),
+                  std::vector<size_t>(),
+                  getDistanceKernel(),
+                  std::vector<double>(),
+                  std::vector<double>(matrix.n_columns, 0.0),
+                  k,
+                  Neighbours()};
+  for (size_t c = 0; c < query.size(); ++c) {
+    if (!std::isnan(query[c])) {
+      state.columns.push_back(c);
+    }
+  }
+  search(0, 0.0, state);
+  return state.best;
+}
+
+void KDTree::search(uint64_t node, double lower_bound, Search &state) const {
+  // The lower bound is computed differently to the distances, so allow for
+  // rounding before pruning. Ties are not pruned, as an earlier point may
+  // be found at the same distance.
+  if (state.best.size() == state.k) {
+    double best_distance = state.best.back().first;
+    if (lower_bound > best_distance + best_distance * 1E-9) {
+      return;
+    }
+  }
+
+  const Node &n = nodes[node];
+  if (n.column == kLeafColumn) {
+    // Leave room for the kernel to write past the end of the leaf
+    size_t n_points = static_cast<size_t>(n.end - n.begin);
+    if (state.distances.size() < n_points + 3) {
+      state.distances.resize(n_points + 3);
+    }
+    state.kernel(state.matrix, state.query, state.columns.data(),
+                 state.columns.size(), n.begin, n.end,
+                 state.distances.data());
+    for (uint64_t i = n.begin; i < n.end; ++i) {
+      uint64_t point = order[i];
+      insertNeighbour(state.best, state.k,
+                      std::make_pair(state.distances[i - n.begin], point));
+    }
+    return;
+  }
+
+  double value = state.query[n.column];
+  double offset = state.offset[n.column];
+  if (std::isnan(value)) {
+    // The query has no value for the feature, so it does not contribute to
+    // the distance to any point.
+    search(n.left, lower_bound, state);
+    search(n.right, lower_bound, state);
+  } else {
+    // Search the side of the split holding the query first, then the other
+    // side using the distance to the split as a bound.
+    bool is_left = value <= n.split;
+    uint64_t near_node = is_left ? n.left : n.right;
+    uint64_t far_node = is_left ? n.right : n.left;
+    search(near_node, lower_bound, state);
+
+    double far_offset = value - n.split;
+    state.offset[n.column] = far_offset;
+    search(far_node,
+           lower_bound - offset * offset + far_offset * far_offset, state);
+    state.offset[n.column] = offset;
+  }
+  if (n.missing != 0) {
+    // Points missing the feature do not contribute any distance along it
+    state.offset[n.column] = 0.0;
+    search(n.missing, lower_bound - offset * offset, state);
+    state.offset[n.column] = offset;
+  }
+}
+
+/// \brief Squared distance between two rows, ignoring missing features
+///
+/// This is the distance computed by the distance kernels, where a feature
+/// missing from either row does not contribute to the distance.
+double rowDistance(const double *a, const double *b, size_t n_columns) {
+  double distance = 0.0;
+  for (size_t c = 0; c < n_columns; ++c) {
+    double diff = a[c] - b[c];
+    if (!std::isnan(diff)) {
+      distance += diff * diff;
+    }
+  }
+  return distance;
+}
+
+/// \struct HNSWGraph
+///
+/// \brief Hierarchical navigable small world graph over the points of the
+/// training set
+///
+/// Each point is linked to a few of its closest points in each layer of the
+/// graph up to the layer of the point, with the number of points in each
+/// layer falling exponentially. A search descends greedily through the
+/// upper layers, and then explores the closest points it finds in the
+/// bottom layer.
+///
+/// Searches are approximate, and may miss some of the nearest points. The
+/// number of candidates explored in the bottom layer trades the time taken
+/// against how often the nearest points are found.
+struct HNSWGraph {
+  /// Version of the serialized form of the graph. Graphs with a different
+  /// version are discarded when parsed.
+  static const unsigned kVersion = 1;
+
+  /// Highest layer of any point
+  static const unsigned kMaxLevel = 31;
+
+  /// \brief Build a graph over the dense rows of the points
+  ///
+  /// \param links  Links from each point in each layer, doubled in the
+  /// bottom layer
+  /// \param ef_construction  Candidates considered when linking each point
+  /// \param seed  Seed used to choose the layer of each point
+  static HNSWGraph build(const std::vector<double> &rows, size_t n_points,
+                         size_t n_columns, unsigned links,
+                         unsigned ef_construction, uint64_t seed);
+
+  /// \brief Parse a graph from a blob
+  ///
+  /// \return  The graph, or nothing if the blob has a different version or
+  /// is malformed
+  static util::Option<HNSWGraph> fromBlob(const std::vector<uint8_t> &blob,
+                                          size_t n_points);
+
+  /// \brief Serialize the graph, appending it to a blob
+  void toBlob(std::vector<uint8_t> &blob) const;
+
+  /// \brief Find points near to a query
+  ///
+  /// \param rows  Row-major matrix of the points the graph was built over
+  /// \param query  The normalized query, with NaN for missing features
+  /// \param ef  Candidates considered in the bottom layer
+  /// \param k  The number of points to find
+  /// \return  The squared distance and index of up to k points, nearest
+  /// first
+  Neighbours nearest(const std::vector<double> &rows, size_t n_columns,
+                     const std::vector<double> &query, size_t ef,
+                     size_t k) const;
+
+  /// Links from each point in each layer above the bottom layer, doubled in
+  /// the bottom layer
+  unsigned max_links;
+  /// Highest layer of any point
+  unsigned max_level;
+  /// Point in the highest layer where every search starts
+  uint64_t entry;
+  /// Links of each point in the bottom layer, which is where most of the
+  /// time searching is spent. Each point has a slot of 2 * max_links + 1
+  /// entries holding the number of links, followed by the links.
+  std::vector<uint64_t> base_links;
+  /// Links of each point in each layer above the bottom layer, up to the
+  /// layer of the point
+  std::vector<std::vector<std::vector<uint64_t>>> upper_links;
+
+private:
+  /// \brief Points visited by a search
+  ///
+  /// Each point is marked with the generation of the search which visited
+  /// it, so that clearing the set between searches only starts a new
+  /// generation, and the same set can be reused by every search.
+  struct Visited {
+    Visited() : generations(), generation(0) {}
+    explicit Visited(size_t n_points) : generations(n_points, 0),
+                                        generation(0) {}
+    /// \brief Resize the set to hold a number of points, and clear it
+    void reset(size_t n_points) {
+      if (generations.size() != n_points) {
+        generations.assign(n_points, 0);
+        generation = 0;
+      }
+      clear();
+    }
+    bool insert(uint64_t point) {
+      if (generations[point] == generation) {
+        return false;
+      }
+      generations[point] = generation;
+      return true;
+    }
+    void clear() {
+      // Only once the generation wraps around do the marks of every point
+      // need to be cleared.
+      if (++generation == 0) {
+        std::fill(generations.begin(), generations.end(), 0);
+        generation = 1;
+      }
+    }
+    std::vector<uint32_t> generations;
+    uint32_t generation;
+  };
+
+  /// \brief Get the links of a point in a layer
+  std::pair<const uint64_t *, const uint64_t *>
+  getLinks(uint64_t point, unsigned layer) const {
+    if (layer == 0) {
+      const uint64_t *slot = &base_links[point * (2 * max_links + 1)];
+      return std::make_pair(slot + 1, slot + 1 + slot[0]);
+    }
+    const auto &links = upper_links[point][layer - 1];
+    return std::make_pair(links.data(), links.data() + links.size());
+  }
+
+  /// \brief Replace the links of a point in a layer
+  void setLinks(uint64_t point, unsigned layer,
+                const std::vector<uint64_t> &links) {
+    if (layer == 0) {
+      assert(links.size() <= 2 * max_links);
+      uint64_t *slot = &base_links[point * (2 * max_links + 1)];
+      slot[0] = links.size();
+      std::copy(links.begin(), links.end(), slot + 1);
+    } else {
+      assert(links.size() <= max_links);
+      upper_links[point][layer - 1] = links;
+    }
+  }
+
+  /// \brief Find the points closest to a query within a single layer
+  Neighbours searchLayer(const double *rows, size_t n_columns,
+                         const double *query, const Neighbours &entries,
+                         size_t ef, unsigned layer, Visited &visited) const;
+
+  /// \brief Choose the points a point should be linked to
+  ///
+  /// Candidates are skipped in favour of more distant candidates if they
+  /// are closer to an already chosen point than to the point itself, so
+  /// that the links span the neighbourhood of the point. Skipped candidates
+  /// fill any remaining links.
+  ///
+  /// \param candidates  Candidates for the links, nearest first
+  static std::vector<uint64_t> selectLinks(const double *rows,
+                                           size_t n_columns,
+                                           const Neighbours &candidates,
+                                           size_t max_links);
+};
+
+HNSWGraph HNSWGraph::build(const std::vector<double> &rows, size_t n_points,
+                           size_t n_columns, unsigned links,
+                           unsigned ef_construction, uint64_t seed) {
+  assert(links >= 2 && ef_construction >= 1);
+  assert(rows.size() == n_points * n_columns);
+
+  HNSWGraph graph;
+  graph.max_links = links;
+  graph.max_level = 0;
+  graph.entry = 0;
+  graph.base_links.resize(n_points * (2 * links + 1), 0);
+  graph.upper_links.resize(n_points);
+
+  std::mt19937_64 rng(seed);
+  Visited visited(n_points);
+  const double level_scale = 1.0 / std::log(static_cast<double>(links));
+  const double *data = rows.data();
+
+  for (uint64_t point = 0; point < n_points; ++point) {
+    // The layer of the point is drawn from an exponential distribution
+    double uniform = std::ldexp(static_cast<double>(rng() >> 11), -53);
+    double level_value = -std::log(1.0 - uniform) * level_scale;
+    unsigned level = level_value >= kMaxLevel
+                         ? kMaxLevel
+                         : static_cast<unsigned>(level_value);
+    graph.upper_links[point].resize(level);
+    if (point == 0) {
+      graph.max_level = level;
+      continue;
+    }
+
+    const double *query = data + point * n_columns;
+    Neighbours entries;
+    entries.push_back(std::make_pair(
+        rowDistance(query, data + graph.entry * n_columns, n_columns),
+        graph.entry));
+    for (unsigned layer = graph.max_level; layer > level; --layer) {
+      entries = graph.searchLayer(data, n_columns, query, entries, 1, layer,
+                                  visited);
+    }
+
+    for (unsigned layer = std::min(level, graph.max_level) + 1; layer-- > 0;) {
+      entries = graph.searchLayer(data, n_columns, query, entries,
+                                  ef_construction, layer, visited);
+      size_t layer_links = layer == 0 ? 2 * links : links;
+      std::vector<uint64_t> point_links =
+          selectLinks(data, n_columns, entries, links);
+      graph.setLinks(point, layer, point_links);
+
+      // Link each chosen point back, shrinking its links if it now has too
+      // many.
+      for (uint64_t neighbour : point_links) {
+        auto current = graph.getLinks(neighbour, layer);
+        std::vector<uint64_t> neighbour_links(current.first, current.second);
+        neighbour_links.push_back(point);
+        if (neighbour_links.size() > layer_links) {
+          const double *neighbour_row = data + neighbour * n_columns;
+          Neighbours candidates;
+          for (uint64_t other : neighbour_links) {
+            candidates.push_back(std::make_pair(
+                rowDistance(neighbour_row, data + other * n_columns,
+                            n_columns),
+                other));
+          }
+          std::sort(candidates.begin(), candidates.end());
+          neighbour_links =
+              selectLinks(data, n_columns, candidates, layer_links);
+        }
+        graph.setLinks(neighbour, layer, neighbour_links);
+      }
+    }
+    if (level > graph.max_level) {
+      graph.max_level = level;
+      graph.entry = point;
+    }
+  }
+  return graph;
+}
+
+std::vector<uint64_t> HNSWGraph::selectLinks(const double *rows,
+                                             size_t n_columns,
+                                             const Neighbours &candidates,
+                                             size_t max_links) {
+  std::vector<uint64_t> selected;
+  std::vector<uint64_t> skipped;
+  for (const auto &candidate : candidates) {
+    if (selected.size() >= max_links) {
+      break;
+    }
+    const double *candidate_row = rows + candidate.second * n_columns;
+    bool is_diverse = true;
+    for (uint64_t other : selected) {
+      if (rowDistance(candidate_row, rows + other * n_columns, n_columns) <
+          candidate.first) {
+        is_diverse = false;
+        break;
+      }
+    }
+    if (is_diverse) {
+      selected.push_back(candidate.second);
+    } else {
+      skipped.push_back(candidate.second);
+    }
+  }
+  for (size_t i = 0; i < skipped.size() && selected.size() < max_links; ++i) {
+    selected.push_back(skipped[i]);
+  }
+  return selected;
+}
+
+Neighbours HNSWGraph::searchLayer(const double *rows, size_t n_columns,
+                                  const double *query,
+                                  const Neighbours &entries, size_t ef,
+                                  unsigned layer, Visited &visited) const {
+  // The candidates are explored nearest first, while the furthest of the
+  // points found is replaced as nearer points are found.
+  typedef std::pair<double, uint64_t> Candidate;
+  std::priority_queue<Candidate, std::vector<Candidate>,
+                      std::greater<Candidate>> candidates;
+  std::priority_queue<Candidate> found;
+  visited.clear();
+  for (const auto &entry : entries) {
+    visited.insert(entry.second);
+    candidates.push(entry);
+    found.push(entry);
+    if (found.size() > ef) {
+      found.pop();
+    }
+  }
+
+  // Explore the closest unexplored candidate until it is further than
+  // every point found.
+  while (!candidates.empty()) {
+    Candidate candidate = candidates.top();
+    candidates.pop();
+    if (found.size() == ef && found.top() < candidate) {
+      break;
+    }
+    auto links = getLinks(candidate.second, layer);
+    for (const uint64_t *link = links.first; link != links.second; ++link) {
+      if (!visited.insert(*link)) {
+        continue;
+      }
+      Candidate next(rowDistance(query, rows + *link * n_columns, n_columns),
+                     *link);
+      if (found.size() < ef || next < found.top()) {
+        candidates.push(next);
+        found.push(next);
+        if (found.size() > ef) {
+          found.pop();
+        }
+      }
+    }
+  }
+
+  Neighbours nearest(found.size());
+  for (size_t i = nearest.size(); i-- > 0; found.pop()) {
+    nearest[i] = found.top();
+  }
+  return nearest;
+}
+
+Neighbours HNSWGraph::nearest(const std::vector<double> &rows,
+                              size_t n_columns,
+                              const std::vector<double> &query, size_t ef,
+                              size_t k) const {
+  assert(query.size() == n_columns);
+  if (upper_links.empty() || k == 0) {
+    return Neighbours();
+  }
+  const double *data = rows.data();
+
+  // The visited set is kept between queries, rather than allocating and
+  // clearing a set the size of the training set for every query.
+  static thread_local Visited visited;
+  visited.reset(upper_links.size());
+  Neighbours entries;
+  entries.push_back(std::make_pair(
+      rowDistance(query.data(), data + entry * n_columns, n_columns), entry));
+  for (unsigned layer = max_level; layer > 0; --layer) {
+    entries = searchLayer(data, n_columns, query.data(), entries, 1, layer,
+                          visited);
+  }
+  Neighbours found = searchLayer(data, n_columns, query.data(), entries,
+                                 std::max(ef, k), 0, visited);
+  if (found.size() > k) {
+    found.resize(k);
+  }
+  return found;
+}
+
+util::Option<HNSWGraph> HNSWGraph::fromBlob(const std::vector<uint8_t> &blob,
+                                            size_t n_points) {
+  // | version | max_links | max_level | entry | n_points | level |...
+  // | n_links | link |...|...
+  util::SectionReader reader(blob.data(), blob.size());
+  HNSWGraph graph;
+  if (reader.read32() != kVersion) {
+    return nullptr;
+  }
+  graph.max_links = reader.read32();
+  graph.max_level = reader.read32();
+  graph.entry = reader.read64();
+  if (reader.readCount(4) != n_points || graph.max_links < 2 ||
+      graph.max_links > (1 << 16) || graph.max_level > kMaxLevel ||
+      (n_points != 0 && graph.entry >= n_points)) {
+    return nullptr;
+  }
+  graph.base_links.resize(n_points * (2 * graph.max_links + 1), 0);
+  graph.upper_links.resize(n_points);
+  for (auto &point_links : graph.upper_links) {
+    unsigned level = reader.read32();
+    if (level > graph.max_level) {
+      return nullptr;
+    }
+    point_links.resize(level);
+  }
+  if (reader.failed() ||
+      (n_points != 0 &&
+       graph.upper_links[graph.entry].size() != graph.max_level)) {
+    return nullptr;
+  }
+  std::vector<uint64_t> links;
+  for (uint64_t point = 0; point < n_points; ++point) {
+    for (unsigned layer = 0; layer <= graph.upper_links[point].size();
+         ++layer) {
+      size_t n_links = reader.readCount(8);
+      if (n_links > (layer == 0 ? 2 : 1) * graph.max_links) {
+        return nullptr;
+      }
+      links.clear();
+      for (size_t i = 0; i < n_links; ++i) {
+        // Every link must be to a point which is present in the layer
+        uint64_t link = reader.read64();
+        if (link >= n_points || graph.upper_links[link].size() < layer) {
+          return nullptr;
+        }
+        links.push_back(link);
+      }
+      graph.setLinks(point, layer, links);
+    }
+  }
+  if (!reader.atEnd()) {
+    return nullptr;
+  }
+  return graph;
+}
+
+void HNSWGraph::toBlob(std::vector<uint8_t> &blob) const {
+  // | version | max_links | max_level | entry | n_points | level |...
+  // | n_links | link |...|...
+  util::write32LE(blob, kVersion);
+  util::write32LE(blob, max_links);
+  util::write32LE(blob, max_level);
+  util::write64LE(blob, entry);
+  util::write64LE(blob, upper_links.size());
+  for (const auto &point_links : upper_links) {
+    util::write32LE(blob, static_cast<uint32_t>(point_links.size()));
+  }
+  for (uint64_t point = 0; point < upper_links.size(); ++point) {
+    for (unsigned layer = 0; layer <= upper_links[point].size(); ++layer) {
+      auto links = getLinks(point, layer);
+      util::write64LE(blob, static_cast<uint64_t>(links.second - links.first));
+      for (const uint64_t *link = links.first; link != links.second; ++link) {
+        util::write64LE(blob, *link);
+      }
+    }
+  }
+}
+
+} // end of anonymous namespace
+
+OneNN::OneNN()
+    : IMachineLearner(), m_training_config(), m_decision_config() {}
 OneNN::~OneNN() {}
 
-std::unique_ptr<DecisionBase>
-OneNN::makeDecision(const DecisionRequestBase &request,
-                    const FeatureSet &features,
-                    const std::vector<uint8_t> &blob) const {
-  // Deserialize from the blob
-  std::map<unsigned, std::pair<double, double>> feature_max_min;
-  std::vector<OneNN::Point> feature_points;
-  
-  auto it = blob.cbegin();
+bool OneNN::setTrainingConfig(std::string config_path) {
+  auto config = util::readConfigFile(config_path);
+  if (!config) {
+    return false;
+  }
+  TrainingConfig training_config;
+  for (const auto &entry : config.get()) {
+    const std::string &key = entry.first;
+    const std::string &value = entry.second;
+    util::Option<unsigned> count;
+    if (key == "index") {
+      if (value != "kdtree" && value != "hnsw") {
+        MAGEEC_ERR(config_path << ": 'index' must be 'kdtree' or 'hnsw'");
+        return false;
+      }
+      training_config.build_graph = value == "hnsw";
+    } else if (key == "hnsw_m") {
+      count = util::parseConfigCount(config_path, key, value, 2, 1024);
+      if (!count) {
+        return false;
+      }
+      training_config.graph_links = count.get();
+    } else if (key == "hnsw_ef_construction") {
+      count = util::parseConfigCount(config_path, key, value, 1, 65536);
+      if (!count) {
+        return false;
+      }
+      training_config.graph_ef_construction = count.get();
+    } else if (key == "hnsw_seed") {
+      auto seed = util::parseUnsigned(value);
+      if (!seed) {
+        MAGEEC_ERR(config_path << ": 'hnsw_seed' must be an integer");
+        return false;
+      }
+      training_config.graph_seed = seed.get();
+    } else {
+      MAGEEC_ERR(config_path << ": Unknown 1-NN training option '" << key
+                             << "'");
+      return false;
+    }
+  }
+  m_training_config = training_config;
+  return true;
+}
+
+bool OneNN::setDecisionConfig(std::string config_path) {
+  auto config = util::readConfigFile(config_path);
+  if (!config) {
+    return false;
+  }
+  DecisionConfig decision_config;
+  for (const auto &entry : config.get()) {
+    const std::string &key = entry.first;
+    const std::string &value = entry.second;
+    util::Option<unsigned> count;
+    if (key == "search") {
+      if (value != "exact" && value != "approximate") {
+        MAGEEC_ERR(config_path
+                   << ": 'search' must be 'exact' or 'approximate'");
+        return false;
+      }
+      decision_config.exact = value == "exact";
+    } else if (key == "ef") {
+      count = util::parseConfigCount(config_path, key, value, 1, 65536);
+      if (!count) {
+        return false;
+      }
+      decision_config.ef = count.get();
+    } else if (key == "k") {
+      count = util::parseConfigCount(config_path, key, value, 1, 1024);
+      if (!count) {
+        return false;
+      }
+      decision_config.k = count.get();
+    } else {
+      MAGEEC_ERR(config_path << ": Unknown 1-NN decision option '" << key
+                             << "'");
+      return false;
+    }
+  }
+  m_decision_config = decision_config;
+  return true;
+}
+
+namespace {
+
+/// Kind of the container holding the training data of the machine learner
+const uint32_t kBlobKind = util::fourCC('1', 'N', 'N', ' ');
+
+/// Version of the layout of the sections of the training data. This must be
+/// bumped whenever the layout of any section changes.
+const uint32_t kBlobVersion = 1;
+
+/// \brief Sections of the container holding the training data
+enum class OneNNBlobSection : uint32_t {
+  /// Identifier and range of each feature
+  kFeatures = 1,
+  /// Normalized features of each point
+  kPoints,
+  /// Parameters of each point
+  kParameters,
+  /// Search index over the points
+  kIndex,
+  /// Graph for approximate search over the points
+  kGraph,
+  /// Pass sequences of each point
+  kPassSequences
+};
+
+} // end of anonymous namespace
+
+util::Option<OneNN::TrainingData>
+OneNN::readBlob(const std::vector<uint8_t> &blob) {
+  if (!util::ContainerReader::isContainer(blob)) {
+    return readLegacyBlob(blob);
+  }
+  auto container = util::ContainerReader::parse(blob);
+  if (!container || container.get().getKind() != kBlobKind ||
+      container.get().getVersion() != kBlobVersion) {
+    return nullptr;
+  }
+  auto features_section = container.get().getSection(
+      static_cast<uint32_t>(OneNNBlobSection::kFeatures));
+  auto points_section = container.get().getSection(
+      static_cast<uint32_t>(OneNNBlobSection::kPoints));
+  auto parameters_section = container.get().getSection(
+      static_cast<uint32_t>(OneNNBlobSection::kParameters));
+  if (!features_section || !points_section || !parameters_section) {
+    return nullptr;
+  }
+
+  TrainingData data;
+
+  // | n_features | feat_id | max | min |...
+  util::SectionReader features = features_section.get();
+  size_t n_features = features.readCount(4 + 8 + 8);
+  for (size_t i = 0; i < n_features; ++i) {
+    unsigned feature_id = features.read32();
+    double max = features.readDouble();
+    double min = features.readDouble();
+    data.feature_max_min[feature_id] = std::make_pair(max, min);
+  }
+  if (!features.atEnd() || data.feature_max_min.size() != n_features) {
+    return nullptr;
+  }
+
+  // | n_columns | n_points | feature | feature |...
+  util::SectionReader points = points_section.get();
+  size_t n_columns = points.readCount(0);
+  data.n_points = points.readCount(8 * n_columns);
+  data.features.resize(data.n_points * n_columns);
+  points.readDoubles(data.features.data(), data.features.size());
+  if (!points.atEnd() || n_columns != n_features) {
+    return nullptr;
+  }
+
+  // | n_parameters | param_id |...| value |...| n_present | present |...
+  util::SectionReader parameters = parameters_section.get();
+  size_t n_parameters = parameters.readCount(4);
+  for (size_t i = 0; i < n_parameters; ++i) {
+    data.parameter_ids.push_back(parameters.read32());
+  }
+  for (size_t i = 0; i < data.n_points * n_parameters; ++i) {
+    data.parameter_values.push_back(
+        static_cast<int64_t>(parameters.read64()));
+    if (parameters.failed()) {
+      return nullptr;
+    }
+  }
+  data.parameter_present = parameters.readBytes();
+  if (!parameters.atEnd() ||
+      data.parameter_present.size() != data.parameter_values.size() ||
+      !std::is_sorted(data.parameter_ids.begin(), data.parameter_ids.end())) {
+    return nullptr;
+  }
+
+  // The search index is optional, as it can be rebuilt from the points
+  auto index_section = container.get().getSection(
+      static_cast<uint32_t>(OneNNBlobSection::kIndex));
+  if (index_section) {
+    util::SectionReader index = index_section.get();
+    data.index = index.readBytes();
+    if (!index.atEnd()) {
+      data.index.clear();
+    }
+  }
+  auto graph_section = container.get().getSection(
+      static_cast<uint32_t>(OneNNBlobSection::kGraph));
+  if (graph_section) {
+    util::SectionReader graph = graph_section.get();
+    data.graph = graph.readBytes();
+    if (!graph.atEnd()) {
+      data.graph.clear();
+    }
+  }
+
+  // Pass sequences are absent from blobs which predate them, in which case
+  // no pass decisions are made.
+  auto pass_seqs_section = container.get().getSection(
+      static_cast<uint32_t>(OneNNBlobSection::kPassSequences));
+  if (pass_seqs_section) {
+    // | n_names | name_len | name |...| n_parameters | param_id |...
+    // | present | n_passes | pass |...|...
+    util::SectionReader pass_seqs = pass_seqs_section.get();
+    size_t n_names = pass_seqs.readCount(8);
+    for (size_t i = 0; i < n_names; ++i) {
+      data.pass_names.push_back(pass_seqs.readString());
+    }
+    size_t n_pass_seq_ids = pass_seqs.readCount(4);
+    for (size_t i = 0; i < n_pass_seq_ids; ++i) {
+      data.pass_seq_ids.push_back(pass_seqs.read32());
+    }
+    for (size_t i = 0; i < data.n_points * n_pass_seq_ids; ++i) {
+      data.pass_seq_present.push_back(pass_seqs.read32() != 0);
+      size_t n_passes = pass_seqs.readCount(4);
+      std::vector<uint32_t> pass_seq;
+      for (size_t j = 0; j < n_passes; ++j) {
+        uint32_t pass = pass_seqs.read32();
+        if (pass >= data.pass_names.size()) {
+          return nullptr;
+        }
+        pass_seq.push_back(pass);
+      }
+      if (pass_seqs.failed()) {
+        return nullptr;
+      }
+      data.pass_seqs.push_back(std::move(pass_seq));
+    }
+    if (!pass_seqs.atEnd() ||
+        !std::is_sorted(data.pass_seq_ids.begin(), data.pass_seq_ids.end())) {
+      return nullptr;
+    }
+  }
+  return data;
+}
+
+util::Option<OneNN::TrainingData>
+OneNN::readLegacyBlob(const std::vector<uint8_t> &blob) {
+  util::SectionReader reader(blob.data(), blob.size());
+  TrainingData data;
 
   // Read the number of features, followed by the feature ids, and the
   // min and max ranges for each feature
   // |    16     |  16  | 64  | 64  |...
   // |NumFeatures|FeatID| max | min |...
-  unsigned n_features = util::read16LE(it);
+  unsigned n_features = reader.read16();
   for (unsigned i = 0; i < n_features; ++i) {
-    unsigned feature_id = util::read16LE(it);
-    uint64_t max = util::read64LE(it);
-    uint64_t min = util::read64LE(it);
-    // FIXME: Make this safe and portable
-    feature_max_min[feature_id] =
-        std::pair<double, double>(*reinterpret_cast<double *>(&max),
-                                  *reinterpret_cast<double *>(&min));
+    unsigned feature_id = reader.read16();
+    double max = reader.readDouble();
+    double min = reader.readDouble();
+    data.feature_max_min[feature_id] = std::pair<double, double>(max, min);
   }
+  std::map<unsigned, size_t> feature_column;
+  for (const auto &max_min : data.feature_max_min) {
+    size_t column = feature_column.size();
+    feature_column[max_min.first] = column;
+  }
+
   // Read the number of feature points, followed by each feature point in
-  // turn.
+  // turn. Any search index following the points is ignored, and rebuilt
+  // when the model is prepared.
   // |   16    |    ??      |    ??      |
   // |NumPoints|FeaturePoint|FeaturePoint|...
-  unsigned n_points = util::read16LE(it);
-  for (unsigned i = 0; i < n_points; ++i) {
+  data.n_points = reader.read16();
+  std::vector<std::map<unsigned, int64_t>> point_parameters;
+  std::set<unsigned> parameter_ids;
+  for (size_t i = 0; i < data.n_points && !reader.failed(); ++i) {
     // Read each feature point. This consists of each feature value in turn,
-    // followed by each parameter in turn
+    // followed by each parameter in turn. A point only holds the features
+    // which were present in its feature set.
     // |    16     |  16  | 64  |...|      16     |  16   | 64  |...
     // |NumFeatures|FeatID|value|...|NumParameters|ParamID|value|...
-    unsigned tmp_n_features = util::read16LE(it);
-    assert(tmp_n_features == n_features);
-
-    std::map<unsigned, double> features;
-    for (unsigned j = 0; j < n_features; ++j) {
-      unsigned id = util::read16LE(it);
-      uint64_t value = util::read64LE(it);
-      features[id] = *reinterpret_cast<double*>(&value);
+    std::vector<double> row(feature_column.size(),
+                            std::numeric_limits<double>::quiet_NaN());
+    unsigned point_n_features = reader.read16();
+    for (unsigned j = 0; j < point_n_features; ++j) {
+      unsigned id = reader.read16();
+      double value = reader.readDouble();
+      const auto column = feature_column.find(id);
+      if (column != feature_column.cend()) {
+        row[column->second] = value;
+      }
     }
-    unsigned n_parameters = util::read16LE(it);
+    data.features.insert(data.features.end(), row.begin(), row.end());
+
+    unsigned n_parameters = reader.read16();
     std::map<unsigned, int64_t> parameters;
     for (unsigned j = 0; j < n_parameters; ++j) {
-      unsigned id = util::read16LE(it);
-      int64_t value = util::read64LE(it);
-      parameters[id] = value;
+      unsigned id = reader.read16();
+      parameters[id] = static_cast<int64_t>(reader.read64());
+      parameter_ids.insert(id);
+    }
+    point_parameters.push_back(parameters);
+  }
+  if (reader.failed()) {
+    return nullptr;
+  }
+
+  data.parameter_ids.assign(parameter_ids.begin(), parameter_ids.end());
+  for (const auto &parameters : point_parameters) {
+    for (auto id : data.parameter_ids) {
+      const auto value = parameters.find(id);
+      data.parameter_values.push_back(
+          value == parameters.cend() ? 0 : value->second);
+      data.parameter_present.push_back(value != parameters.cend());
+    }
+  }
+  return data;
+}
+
+std::vector<uint8_t> OneNN::writeBlob(const TrainingData &data) {
+  util::ContainerWriter container(kBlobKind, kBlobVersion);
+
+  // | n_features | feat_id | max | min |...
+  std::vector<uint8_t> features;
+  util::write64LE(features, data.feature_max_min.size());
+  for (const auto &max_min : data.feature_max_min) {
+    util::write32LE(features, max_min.first);
+    util::writeDoubleLE(features, max_min.second.first);
+    util::writeDoubleLE(features, max_min.second.second);
+  }
+  container.addSection(static_cast<uint32_t>(OneNNBlobSection::kFeatures),
+                       std::move(features));
+
+  // | n_columns | n_points | feature | feature |...
+  std::vector<uint8_t> points;
+  util::write64LE(points, data.feature_max_min.size());
+  util::write64LE(points, data.n_points);
+  util::writeDoublesLE(points, data.features.data(), data.features.size());
+  container.addSection(static_cast<uint32_t>(OneNNBlobSection::kPoints),
+                       std::move(points));
+
+  // | n_parameters | param_id |...| value |...| n_present | present |...
+  std::vector<uint8_t> parameters;
+  util::write64LE(parameters, data.parameter_ids.size());
+  for (auto id : data.parameter_ids) {
+    util::write32LE(parameters, id);
+  }
+  for (auto value : data.parameter_values) {
+    util::write64LE(parameters, static_cast<uint64_t>(value));
+  }
+  util::writeBytes(parameters, data.parameter_present.data(),
+                   data.parameter_present.size());
+  container.addSection(static_cast<uint32_t>(OneNNBlobSection::kParameters),
+                       std::move(parameters));
+
+  if (!data.index.empty()) {
+    std::vector<uint8_t> index;
+    util::writeBytes(index, data.index.data(), data.index.size());
+    container.addSection(static_cast<uint32_t>(OneNNBlobSection::kIndex),
+                         std::move(index));
+  }
+  if (!data.graph.empty()) {
+    std::vector<uint8_t> graph;
+    util::writeBytes(graph, data.graph.data(), data.graph.size());
+    container.addSection(static_cast<uint32_t>(OneNNBlobSection::kGraph),
+                         std::move(graph));
+  }
+
+  // | n_names | name_len | name |...| n_parameters | param_id |...
+  // | present | n_passes | pass |...|...
+  if (!data.pass_seq_ids.empty()) {
+    std::vector<uint8_t> pass_seqs;
+    util::write64LE(pass_seqs, data.pass_names.size());
+    for (const auto &name : data.pass_names) {
+      util::writeBytes(pass_seqs,
+                       reinterpret_cast<const uint8_t *>(name.data()),
+                       name.size());
+    }
+    util::write64LE(pass_seqs, data.pass_seq_ids.size());
+    for (auto id : data.pass_seq_ids) {
+      util::write32LE(pass_seqs, id);
+    }
+    for (size_t i = 0; i < data.pass_seqs.size(); ++i) {
+      util::write32LE(pass_seqs, data.pass_seq_present[i]);
+      util::write64LE(pass_seqs, data.pass_seqs[i].size());
+      for (auto pass : data.pass_seqs[i]) {
+        util::write32LE(pass_seqs, pass);
+      }
     }
-    OneNN::Point point = {features, parameters};
-    feature_points.push_back(point);
+    container.addSection(
+        static_cast<uint32_t>(OneNNBlobSection::kPassSequences),
+        std::move(pass_seqs));
   }
+  return container.finish();
+}
+
+namespace {
 
-  // Take the input features and normalize them
-  std::map<unsigned, double> query_features;
+/// \brief Take the value with the greatest total weight of the neighbours
+///
+/// On a tie, the value of the nearest neighbour is taken, as the neighbours
+/// are nearest first.
+///
+/// \param neighbours  The neighbours of the query, nearest first
+/// \param weights  Weight of the vote of each neighbour
+/// \param value_of  Function giving a pointer to the value of a point, or
+/// nullptr if the point has no value
+/// \return The value, or nothing if no neighbour has a value
+template <typename ValueT, typename ValueOfT>
+util::Option<ValueT> weightedVote(const Neighbours &neighbours,
+                                  const std::vector<double> &weights,
+                                  ValueOfT value_of) {
+  std::vector<std::pair<const ValueT *, double>> votes;
+  for (size_t i = 0; i < neighbours.size(); ++i) {
+    const ValueT *value = value_of(neighbours[i].second);
+    if (!value) {
+      continue;
+    }
+    auto vote = std::find_if(
+        votes.begin(), votes.end(),
+        [value](const std::pair<const ValueT *, double> &v) {
+          return *v.first == *value;
+        });
+    if (vote == votes.end()) {
+      votes.push_back(std::make_pair(value, weights[i]));
+    } else {
+      vote->second += weights[i];
+    }
+  }
+  if (votes.empty()) {
+    return nullptr;
+  }
+  size_t best = 0;
+  for (size_t i = 1; i < votes.size(); ++i) {
+    if (votes[i].second > votes[best].second) {
+      best = i;
+    }
+  }
+  return *votes[best].first;
+}
+
+} // end of anonymous namespace
+
+/// \class OneNN::PreparedModel
+class OneNN::PreparedModel : public IPreparedModel {
+public:
+  PreparedModel(const std::vector<uint8_t> &blob, const DecisionConfig &config)
+      : IPreparedModel(), m_config(config), m_feature_max_min(),
+        m_feature_column(), m_tree(), m_matrix(), m_with_graph(false),
+        m_graph(), m_rows(),
+        m_parameter_column(), m_parameter_values(), m_parameter_present(),
+        m_pass_names(), m_pass_index(), m_pass_seq_column(), m_pass_seqs(),
+        m_pass_seq_present() {
+    auto parsed = readBlob(blob);
+    if (!parsed) {
+      MAGEEC_WARN("Malformed 1-NN training data, no decisions will be made");
+      return;
+    }
+    TrainingData data = parsed.get();
+    m_feature_max_min = data.feature_max_min;
+
+    size_t column = 0;
+    for (const auto &max_min : m_feature_max_min) {
+      m_feature_column[max_min.first] = column++;
+    }
+
+    // Use the index built during training if it is usable, otherwise it is
+    // cheap enough to build again here.
+    auto tree = KDTree::fromBlob(data.index.cbegin(), data.index.cend(),
+                                 data.n_points, m_feature_column.size());
+    if (tree) {
+      m_tree = tree.get();
+    } else {
+      MAGEEC_DEBUG("1-NN search index missing or invalid, rebuilding");
+      m_tree = KDTree::build(data.features, data.n_points,
+                             m_feature_column.size());
+    }
+    m_matrix = PointMatrix(data.features, data.n_points,
+                           m_feature_column.size(), m_tree.order);
+
+    // The graph is only needed for approximate searches. A graph which
+    // cannot be used falls back to the exact search.
+    if (!m_config.exact && !data.graph.empty()) {
+      auto graph = HNSWGraph::fromBlob(data.graph, data.n_points);
+      if (graph) {
+        m_with_graph = true;
+        m_graph = graph.get();
+        m_rows = std::move(data.features);
+      } else {
+        MAGEEC_WARN("1-NN search graph is invalid, using exact search");
+      }
+    }
+
+    column = 0;
+    for (auto id : data.parameter_ids) {
+      m_parameter_column[id] = column++;
+    }
+    m_parameter_values = std::move(data.parameter_values);
+    m_parameter_present = std::move(data.parameter_present);
+
+    for (uint32_t i = 0; i < data.pass_names.size(); ++i) {
+      m_pass_index[data.pass_names[i]] = i;
+    }
+    column = 0;
+    for (auto id : data.pass_seq_ids) {
+      m_pass_seq_column[id] = column++;
+    }
+    m_pass_names = std::move(data.pass_names);
+    m_pass_seqs = std::move(data.pass_seqs);
+    m_pass_seq_present = std::move(data.pass_seq_present);
+  }
+
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features) const override;
+
+private:
+  /// Options controlling how the neighbours of a query are found
+  const DecisionConfig m_config;
+
+  /// Range of each feature, used to normalize the features of a query
+  std::map<unsigned, std::pair<double, double>> m_feature_max_min;
+
+  /// Column of each feature in the matrix of points
+  std::map<unsigned, size_t> m_feature_column;
+
+  /// Index over the points of the training set
+  KDTree m_tree;
+
+  /// Normalized features of the points of the training set
+  PointMatrix m_matrix;
+
+  /// Graph for approximate search over the points, and the row-major
+  /// normalized features of the points it searches, if the graph is used.
+  bool m_with_graph;
+  HNSWGraph m_graph;
+  std::vector<double> m_rows;
+
+  /// Column of each parameter in the parameters of the points
+  std::map<unsigned, size_t> m_parameter_column;
+
+  /// Row-major matrix of the parameters of each point of the training set,
+  /// and whether each parameter is present in the point.
+  std::vector<int64_t> m_parameter_values;
+  std::vector<uint8_t> m_parameter_present;
+
+  /// Names of the passes in the pass sequences, and the index of each pass
+  /// in the names
+  std::vector<std::string> m_pass_names;
+  std::map<std::string, uint32_t> m_pass_index;
+
+  /// Column of each pass sequence parameter in the pass sequences
+  std::map<unsigned, size_t> m_pass_seq_column;
+
+  /// Row-major matrix of the pass sequence of each point of the training set
+  /// for each pass sequence parameter, as indices into the names of the
+  /// passes, and whether each pass sequence is present in the point.
+  std::vector<std::vector<uint32_t>> m_pass_seqs;
+  std::vector<uint8_t> m_pass_seq_present;
+};
+
+std::unique_ptr<DecisionBase>
+OneNN::makeDecision(const DecisionRequestBase &request,
+                    const FeatureSet &features,
+                    const std::vector<uint8_t> &blob) const {
+  return std::move(makeDecisions({&request}, features, blob)[0]);
+}
+
+std::vector<std::unique_ptr<DecisionBase>> OneNN::makeDecisions(
+    const std::vector<const DecisionRequestBase *> &requests,
+    const FeatureSet &features, const std::vector<uint8_t> &blob) const {
+  return PreparedModel(blob, m_decision_config)
+      .makeDecisions(requests, features);
+}
+
+std::unique_ptr<IPreparedModel>
+OneNN::prepare(const std::vector<uint8_t> &blob) const {
+  return std::unique_ptr<IPreparedModel>(
+      new PreparedModel(blob, m_decision_config));
+}
+
+std::vector<std::unique_ptr<DecisionBase>> OneNN::PreparedModel::makeDecisions(
+    const std::vector<const DecisionRequestBase *> &requests,
+    const FeatureSet &features) const {
+  // Take the input features and normalize them. Features which are not in
+  // the training set cannot contribute to the distance, and are dropped.
+  std::vector<double> query(m_feature_column.size(),
+                            std::numeric_limits<double>::quiet_NaN());
   for (auto f : features) {
-    double max = feature_max_min[f->getID()].first;
-    double min = feature_max_min[f->getID()].second;
+    const auto column = m_feature_column.find(f->getID());
+    if (column == m_feature_column.cend()) {
+      continue;
+    }
+    const auto &max_min = m_feature_max_min.at(f->getID());
+    double max = max_min.first;
+    double min = max_min.second;
     switch(f->getType()) {
     case FeatureType::kBool: {
       bool value = static_cast<BoolFeature *>(f.get())->getValue();
       double double_value = value ? 1.0 : 0;
-      query_features[f->getID()] = double_value;
+      query[column->second] = double_value;
       break;
     }
     case FeatureType::kInt: {
@@ -115,63 +1624,287 @@ OneNN::makeDecision(const DecisionRequestBase &request,
         double_value = (double_value - min) / (max - min);
       else
         double_value = 0.0;
-      query_features[f->getID()] = double_value;
+      query[column->second] = double_value;
       break;
     }
     }
   }
 
-  // Find the closest point to the query point
-  // TODO: Don't use a dumb n^2 search here
-  double min_squared_distance = std::numeric_limits<double>::max();
-  OneNN::Point nearest_neighbor;
-  for (auto point : feature_points) {
-    // calculate the distance between the query point and this point. If
-    // any feature is missing, then just ignore it.
-    double squared_distance = 0.0;
-    for (auto query_feature : query_features) {
-      if (point.features.count(query_feature.first)) {
-        double value = point.features[query_feature.first];
-        double query_value = query_feature.second;
-        double diff = value - query_value;
-        double squared_diff = diff * diff;
-        squared_distance += squared_diff;
+  // Find the closest points to the query point. The same neighbors are used
+  // to answer every request.
+  size_t k = m_config.k;
+  Neighbours neighbours =
+      m_with_graph ? m_graph.nearest(m_rows, m_feature_column.size(), query,
+                                     m_config.ef, k)
+                   : m_tree.nearest(m_matrix, query, k);
+
+  // Each neighbor votes for its value of each parameter, weighted by the
+  // inverse of its distance to the query.
+  std::vector<double> weights;
+  for (const auto &neighbour : neighbours) {
+    weights.push_back(1.0 / (std::sqrt(neighbour.first) + 1E-9));
+  }
+
+  // A pass gate is decided from the first pass sequence of each neighbour
+  const size_t n_pass_seq_columns = m_pass_seq_column.size();
+  auto firstPassSeq = [&](uint64_t point) -> const std::vector<uint32_t> * {
+    for (size_t c = 0; c < n_pass_seq_columns; ++c) {
+      size_t index = point * n_pass_seq_columns + c;
+      if (m_pass_seq_present[index]) {
+        return &m_pass_seqs[index];
+      }
+    }
+    return nullptr;
+  };
+
+  std::vector<std::unique_ptr<DecisionBase>> decisions;
+  decisions.reserve(requests.size());
+  for (const auto *request : requests) {
+    DecisionRequestType request_type = request->getType();
+
+    if (request_type == DecisionRequestType::kPassGate) {
+      // Each neighbour votes for whether its pass sequence runs the pass
+      const std::string &pass =
+          static_cast<const PassGateDecisionRequest *>(request)->getID();
+      const auto pass_index = m_pass_index.find(pass);
+      const bool run_values[] = {false, true};
+      util::Option<bool> decided;
+      if (pass_index != m_pass_index.cend()) {
+        decided = weightedVote<bool>(
+            neighbours, weights, [&](uint64_t point) -> const bool * {
+              const auto *pass_seq = firstPassSeq(point);
+              if (!pass_seq) {
+                return nullptr;
+              }
+              return &run_values[std::find(pass_seq->begin(),
+                                           pass_seq->end(),
+                                           pass_index->second) !=
+                                 pass_seq->end()];
+            });
+      }
+      if (!decided) {
+        decisions.push_back(
+            std::unique_ptr<NativeDecision>(new NativeDecision()));
+      } else {
+        decisions.push_back(
+            std::unique_ptr<BoolDecision>(new BoolDecision(decided.get())));
       }
+      continue;
     }
-    if (squared_distance < min_squared_distance) {
-      min_squared_distance = squared_distance;
-      nearest_neighbor = point;
+
+    if (request_type == DecisionRequestType::kPassSeq) {
+      // Each neighbour votes for its whole pass sequence
+      unsigned param_id =
+          static_cast<const PassSeqDecisionRequest *>(request)->getID();
+      const auto column = m_pass_seq_column.find(param_id);
+      util::Option<std::vector<uint32_t>> decided;
+      if (column != m_pass_seq_column.cend()) {
+        decided = weightedVote<std::vector<uint32_t>>(
+            neighbours, weights,
+            [&](uint64_t point) -> const std::vector<uint32_t> * {
+              size_t index = point * n_pass_seq_columns + column->second;
+              return m_pass_seq_present[index] ? &m_pass_seqs[index]
+                                               : nullptr;
+            });
+      }
+      if (!decided) {
+        decisions.push_back(
+            std::unique_ptr<NativeDecision>(new NativeDecision()));
+      } else {
+        PassSeq pass_seq;
+        for (auto pass : decided.get()) {
+          pass_seq.push_back(m_pass_names[pass]);
+        }
+        decisions.push_back(
+            std::unique_ptr<PassSeqDecision>(new PassSeqDecision(pass_seq)));
+      }
+      continue;
+    }
+
+    unsigned param_id = 0;
+    if (request_type == DecisionRequestType::kBool) {
+      param_id = static_cast<const BoolDecisionRequest *>(request)->getID();
+    } else if (request_type == DecisionRequestType::kRange) {
+      param_id = static_cast<const RangeDecisionRequest *>(request)->getID();
+    } else {
+      assert(0 && "Unhandled decision request type");
+    }
+
+    // Take the value with the greatest total weight
+    util::Option<int64_t> decided;
+    const auto column = m_parameter_column.find(param_id);
+    if (column != m_parameter_column.cend()) {
+      decided = weightedVote<int64_t>(
+          neighbours, weights, [&](uint64_t point) -> const int64_t * {
+            size_t index =
+                point * m_parameter_column.size() + column->second;
+            return m_parameter_present[index] ? &m_parameter_values[index]
+                                              : nullptr;
+          });
+    }
+
+    if (!decided) {
+      decisions.push_back(
+          std::unique_ptr<NativeDecision>(new NativeDecision()));
+    } else if (request_type == DecisionRequestType::kBool) {
+      decisions.push_back(
+          std::unique_ptr<BoolDecision>(new BoolDecision(decided.get())));
+    } else {
+      decisions.push_back(
+          std::unique_ptr<RangeDecision>(new RangeDecision(decided.get())));
     }
   }
+  return decisions;
+}
 
-  // Get the parameter from the parameter set associated with the nearest
-  // neighbor.
-  DecisionRequestType request_type = request.getType();
+util::Option<NativeModelSource>
+OneNN::generateNativeModel(const std::vector<uint8_t> &blob) const {
+  auto parsed = readBlob(blob);
+  if (!parsed) {
+    return nullptr;
+  }
+  const TrainingData data = parsed.get();
+
+  // The native model always finds the single nearest point with a linear
+  // scan, so neither the decision config nor any search graph apply to it.
+
+  // Each feature with a range has a column, and each parameter of any point
+  // has a value.
+  NativeModelSource source;
+  for (auto feat : data.feature_max_min) {
+    source.features.push_back(feat.first);
+  }
+  source.parameters = data.parameter_ids;
+  if (data.n_points == 0 || source.parameters.empty()) {
+    return source;
+  }
 
-  if (request_type == DecisionRequestType::kBool) {
-    const auto *bool_request =
-        static_cast<const BoolDecisionRequest *>(&request);
-    unsigned param_id = bool_request->getID();
+  size_t n_columns = source.features.size();
+  size_t n_points = data.n_points;
+  size_t n_parameters = source.parameters.size();
 
-    if (nearest_neighbor.parameters.count(param_id)) {
-      int64_t res = nearest_neighbor.parameters[param_id];
-      return std::unique_ptr<BoolDecision>(new BoolDecision(res));
+  // Emit the ranges of the features, and the features and parameters of
+  // each point as tables.
+  std::ostringstream definitions;
+  definitions << "const double missing = "
+                 "std::numeric_limits<double>::quiet_NaN();\n\n";
+  if (n_columns != 0) {
+    definitions << "const double feature_max[" << n_columns << "] = {\n";
+    for (auto feat : data.feature_max_min) {
+      definitions << "  " << nativeDoubleLiteral(feat.second.first) << ",\n";
+    }
+    definitions << "};\n";
+    definitions << "const double feature_min[" << n_columns << "] = {\n";
+    for (auto feat : data.feature_max_min) {
+      definitions << "  " << nativeDoubleLiteral(feat.second.second) << ",\n";
     }
-    return std::unique_ptr<NativeDecision>(new NativeDecision());
-  } else if (request_type == DecisionRequestType::kRange) {
-    const auto *range_request =
-        static_cast<const RangeDecisionRequest *>(&request);
-    unsigned param_id = range_request->getID();
+    definitions << "};\n";
 
-    if (nearest_neighbor.parameters.count(param_id)) {
-      int64_t res = nearest_neighbor.parameters[param_id];
-      return std::unique_ptr<RangeDecision>(new RangeDecision(res));
+    definitions << "const double point_features[" << n_points << "]["
+                << n_columns << "] = {\n";
+    for (size_t p = 0; p < n_points; ++p) {
+      definitions << "  {";
+      for (size_t c = 0; c < n_columns; ++c) {
+        double value = data.features[p * n_columns + c];
+        definitions << (c == 0 ? "" : ", ")
+                    << (std::isnan(value) ? "missing"
+                                          : nativeDoubleLiteral(value));
+      }
+      definitions << "},\n";
     }
-    return std::unique_ptr<NativeDecision>(new NativeDecision());
-  } else {
-    assert(0 && "Unhandled decision request type");
+    definitions << "};\n";
+  }
+  definitions << "const int64_t point_values[" << n_points << "]["
+              << n_parameters << "] = {\n";
+  for (size_t i = 0; i < n_points; ++i) {
+    definitions << "  {";
+    for (size_t p = 0; p < n_parameters; ++p) {
+      int64_t v = data.parameter_values[i * n_parameters + p];
+      definitions << (p == 0 ? "" : ", ");
+      if (v == std::numeric_limits<int64_t>::min()) {
+        definitions << "INT64_MIN";
+      } else {
+        definitions << "INT64_C(" << v << ")";
+      }
+    }
+    definitions << "},\n";
   }
-  return std::unique_ptr<NativeDecision>(new NativeDecision());
+  definitions << "};\n";
+  definitions << "const unsigned char point_decided[" << n_points << "]["
+              << n_parameters << "] = {\n";
+  for (size_t i = 0; i < n_points; ++i) {
+    definitions << "  {";
+    for (size_t p = 0; p < n_parameters; ++p) {
+      definitions << (p == 0 ? "" : ", ")
+                  << static_cast<unsigned>(
+                         data.parameter_present[i * n_parameters + p]);
+    }
+    definitions << "},\n";
+  }
+  definitions << "};\n";
+  source.definitions = definitions.str();
+
+  // Normalize the query in the same way as makeDecision, then find the
+  // nearest point, ignoring features missing from either point.
+  std::ostringstream decide;
+  decide << "  size_t nearest = 0;\n";
+  if (n_columns != 0) {
+    decide
+        << "  double query[" << n_columns << "];\n"
+        << "  for (unsigned c = 0; c < " << n_columns << "; ++c) {\n"
+        << "    double value = row[c];\n"
+        << "    if (!std::isnan(value)) {\n"
+        << "      if ((feature_max[c] - feature_min[c]) != 0.0)\n"
+        << "        value = (value - feature_min[c]) /\n"
+        << "                (feature_max[c] - feature_min[c]);\n"
+        << "      else\n"
+        << "        value = 0.0;\n"
+        << "    }\n"
+        << "    query[c] = value;\n"
+        << "  }\n"
+        << "  double min_squared_distance = "
+           "std::numeric_limits<double>::max();\n"
+        << "  bool found = false;\n"
+        << "  for (size_t p = 0; p < " << n_points << "; ++p) {\n"
+        << "    double squared_distance = 0.0;\n"
+        << "    for (unsigned c = 0; c < " << n_columns << "; ++c) {\n"
+        << "      if (!std::isnan(query[c]) &&\n"
+        << "          !std::isnan(point_features[p][c])) {\n"
+        << "        double diff = point_features[p][c] - query[c];\n"
+        << "        squared_distance += diff * diff;\n"
+        << "      }\n"
+        << "    }\n"
+        << "    if (squared_distance < min_squared_distance) {\n"
+        << "      min_squared_distance = squared_distance;\n"
+        << "      nearest = p;\n"
+        << "      found = true;\n"
+        << "    }\n"
+        << "  }\n"
+        << "  if (!found) {\n"
+        << "    return;\n"
+        << "  }\n";
+  }
+  decide << "  for (unsigned i = 0; i < " << n_parameters << "; ++i) {\n"
+         << "    values[i] = point_values[nearest][i];\n"
+         << "    decided[i] = point_decided[nearest][i];\n"
+         << "  }\n";
+  source.decide = decide.str();
+  return source;
+}
+
+util::Option<std::set<unsigned>>
+OneNN::getUsedFeatures(const std::vector<uint8_t> &blob) const {
+  auto parsed = readBlob(blob);
+  if (!parsed) {
+    return nullptr;
+  }
+
+  // Every feature with a column contributes to the distance between points
+  std::set<unsigned> used;
+  for (const auto &feat : parsed.get().feature_max_min) {
+    used.insert(feat.first);
+  }
+  return used;
 }
 
 const std::vector<uint8_t>
@@ -214,7 +1947,6 @@ OneNN::train(std::set<FeatureDesc> feature_descs,
 
   std::map<unsigned, FeatureType> feature_type;
   std::map<unsigned, std::pair<double, double>> feature_max_min;
-  std::vector<OneNN::Point> feature_points;
 
   // Get all of the feature ids and their types
   for (auto desc : feature_descs) {
@@ -236,6 +1968,7 @@ OneNN::train(std::set<FeatureDesc> feature_descs,
       case FeatureType::kBool: {
         if (feature_max_min.count(f->getID()) == 0)
           feature_max_min[f->getID()] = std::make_pair<double, double>(1.0, 0.0);
+        break;
       }
       case FeatureType::kInt: {
         int64_t value = static_cast<IntFeature *>(f.get())->getValue();
@@ -255,20 +1988,37 @@ OneNN::train(std::set<FeatureDesc> feature_descs,
     }
   }
 
+  // Each feature with a range has a column in the dense points
+  std::map<unsigned, size_t> feature_column;
+  for (const auto &max_min : feature_max_min) {
+    size_t column = feature_column.size();
+    feature_column[max_min.first] = column;
+  }
+
+  TrainingData data;
+  data.feature_max_min = feature_max_min;
+  data.n_points = result_map.size();
+
   // Add a point for each feature set, normalize the features in the process to
   // the range [0, 1]
+  std::vector<std::map<unsigned, int64_t>> point_parameters;
+  std::vector<std::map<unsigned, PassSeq>> point_pass_seqs;
+  std::set<unsigned> parameter_ids;
+  std::set<unsigned> pass_seq_ids;
   for (auto res : result_map) {
     ParameterSet parameters = res.second.getParameters();
     FeatureSet features = res.second.getFeatures();
 
-    OneNN::Point point;
+    std::vector<double> row(feature_column.size(),
+                            std::numeric_limits<double>::quiet_NaN());
     for (auto f : features) {
       assert(feature_type[f->getID()] == f->getType());
+      size_t column = feature_column.at(f->getID());
 
       switch (f->getType()) {
       case FeatureType::kBool: {
         bool value = static_cast<BoolFeature *>(f.get())->getValue();
-        point.features[f->getID()] = value ? 1.0 : 0.0;
+        row[column] = value ? 1.0 : 0.0;
         break;
       }
       case FeatureType::kInt: {
@@ -280,69 +2030,94 @@ OneNN::train(std::set<FeatureDesc> feature_descs,
           double_value = (double_value - min) / (max - min);
         else
           double_value = 0.0;
-        point.features[f->getID()] = double_value;
+        row[column] = double_value;
         break;
       }
       }
     }
+    data.features.insert(data.features.end(), row.begin(), row.end());
+
+    std::map<unsigned, int64_t> point;
+    std::map<unsigned, PassSeq> point_pass_seq;
     for (auto p : parameters) {
+      if (p->getType() == ParameterType::kPassSeq) {
+        point_pass_seq[p->getID()] =
+            static_cast<PassSeqParameter *>(p.get())->getValue();
+        pass_seq_ids.insert(p->getID());
+        continue;
+      }
       switch(p->getType()) {
       case ParameterType::kBool: {
         bool value = static_cast<BoolParameter*>(p.get())->getValue();
-        point.parameters[p->getID()] = value;
+        point[p->getID()] = value;
         break;
       } 
       case ParameterType::kRange: {
         int64_t value = static_cast<RangeParameter*>(p.get())->getValue();
-        point.parameters[p->getID()] = value;
+        point[p->getID()] = value;
         break;
       }
       default:
         assert(0 && "Unhandled parameter type");
         break;
       }
+      parameter_ids.insert(p->getID());
     }
-    feature_points.push_back(point);
+    point_parameters.push_back(point);
+    point_pass_seqs.push_back(point_pass_seq);
   }
 
-  // Serialize to a blob
-  // Buffer used to store the training blob
-  std::vector<uint8_t> blob;
-
-  // Emit the number of features, followed by the feature ids, and the
-  // min and max ranges for each feature
-  // |    16     |  16  | 64  | 64  |...
-  // |NumFeatures|FeatID| max | min |...
-  util::write16LE(blob, feature_max_min.size());
-  for (auto feat_max_min : feature_max_min) {
-    util::write16LE(blob, feat_max_min.first);
-    // FIXME: Make this safe and portable
-    util::write64LE(blob, *reinterpret_cast<uint64_t*>(&feat_max_min.second.first));
-    util::write64LE(blob, *reinterpret_cast<uint64_t*>(&feat_max_min.second.second));
-  }
-  // Emit the number of feature points, followed by each feature point in
-  // turn.
-  // |   16    |    ??      |    ??      |
-  // |NumPoints|FeaturePoint|FeaturePoint|...
-  util::write16LE(blob, feature_points.size());
-  for (auto point : feature_points) {
-    // Emit each feature point. This consists of each feature value in turn,
-    // followed by each parameter in turn
-    // |    16     |  16  | 64  |...|      16     |  16   | 64  |...
-    // |NumFeatures|FeatID|value|...|NumParameters|ParamID|value|...
-    util::write16LE(blob, point.features.size());
-    for (auto feature : point.features) {
-      util::write16LE(blob, feature.first);
-      // FIXME: Make this safe and portable
-      util::write64LE(blob, *reinterpret_cast<uint64_t*>(&feature.second));
+  // Lay out the parameters of every point with a column for each parameter
+  data.parameter_ids.assign(parameter_ids.begin(), parameter_ids.end());
+  for (const auto &point : point_parameters) {
+    for (auto id : data.parameter_ids) {
+      const auto value = point.find(id);
+      data.parameter_values.push_back(
+          value == point.cend() ? 0 : value->second);
+      data.parameter_present.push_back(value != point.cend());
     }
-    util::write16LE(blob, point.parameters.size());
-    for (auto parameter : point.parameters) {
-      util::write16LE(blob, parameter.first);
-      util::write64LE(blob, *reinterpret_cast<uint64_t*>(&parameter.second));
+  }
+
+  // Lay out the pass sequences in the same way, naming each pass by its
+  // index in the order the passes are first seen.
+  data.pass_seq_ids.assign(pass_seq_ids.begin(), pass_seq_ids.end());
+  std::map<std::string, uint32_t> pass_index;
+  for (const auto &point : point_pass_seqs) {
+    for (auto id : data.pass_seq_ids) {
+      const auto pass_seq = point.find(id);
+      std::vector<uint32_t> indices;
+      if (pass_seq != point.cend()) {
+        for (const auto &pass : pass_seq->second) {
+          auto index = pass_index.find(pass);
+          if (index == pass_index.end()) {
+            index = pass_index
+                        .emplace(pass, static_cast<uint32_t>(
+                                           data.pass_names.size()))
+                        .first;
+            data.pass_names.push_back(pass);
+          }
+          indices.push_back(index->second);
+        }
+      }
+      data.pass_seqs.push_back(std::move(indices));
+      data.pass_seq_present.push_back(pass_seq != point.cend());
     }
   }
-  return blob;
+
+  // Store the search index over the points, so that it does not need to be
+  // built each time the blob is loaded.
+  MAGEEC_DEBUG("Building search index");
+  KDTree::build(data.features, data.n_points, feature_column.size())
+      .toBlob(data.index);
+  if (m_training_config.build_graph) {
+    MAGEEC_DEBUG("Building approximate search graph");
+    HNSWGraph::build(data.features, data.n_points, feature_column.size(),
+                     m_training_config.graph_links,
+                     m_training_config.graph_ef_construction,
+                     m_training_config.graph_seed)
+        .toBlob(data.graph);
+  }
+  return writeBlob(data);
 }
 
 } // end of namespace mageec
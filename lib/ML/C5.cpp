@@ -18,21 +18,28 @@
 //===------------------------ MAGEEC C5.0 Driver --------------------------===//
 //
 // This implements the machine learner interface by using a driver to drive
-// an external C5.0 machine learner. It calls out to the C5.0 command line
-// in order to make decisions and train.
+// the C5.0 machine learner. It calls out to the C5.0 library in order to
+// train, and makes decisions by evaluating a flattened form of the trained
+// classifier trees.
 //
 //===----------------------------------------------------------------------===//
 
 #include "mageec/Database.h"
 #include "mageec/ML/C5.h"
 #include "mageec/ML.h"
+#include "mageec/NativeML.h"
 #include "mageec/Result.h"
 #include "mageec/Types.h"
 #include "mageec/Util.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <limits>
 #include <map>
 #include <set>
 #include <string>
@@ -60,6 +67,26 @@ extern "C" {
            char **rulesv,
            char **outputv);
 
+  void c50_cases(char **namesv,
+                 double *casev,
+                 int *ncases,
+                 char **costv,
+                 int *subset,
+                 int *rules,
+                 int *utility,
+                 int *trials,
+                 int *winnow,
+                 double *sample,
+                 int *seed,
+                 int *noGlobalPruning,
+                 double *CF,
+                 int *minCases,
+                 int *fuzzyThreshold,
+                 int *earlyStopping,
+                 char **treev,
+                 char **rulesv,
+                 char **outputv);
+
   void predictions(char **casev,
                    char **namesv,
                    char **treev,
@@ -74,6 +101,148 @@ extern "C" {
 namespace mageec {
 namespace {
 
+/// \brief Types of node in a C5.0 classifier tree. The values match those
+/// used in the C5.0 tree file format.
+enum class C5NodeType : unsigned {
+  /// Leaf node, predicting the class
+  kLeaf = 0,
+  /// Branch on each value of a discrete feature
+  kDiscrete = 1,
+  /// Branch on a threshold of a continuous feature
+  kThreshold = 2,
+  /// Branch on subsets of the values of a discrete feature
+  kSubset = 3
+};
+
+/// \struct C5FlatTree
+///
+/// \brief A C5.0 classifier tree flattened into an array of nodes
+///
+/// This is evaluated directly over a dense row of feature values, rather
+/// than passing the tree back to the C5.0 library to be parsed for every
+/// decision. The nodes are stored breadth first, so that the branches of a
+/// node are contiguous in the array, and the root is the first node.
+///
+/// A boosted classifier has a tree for each boosting trial. The trees are
+/// stored one after another in the same array, and every trial is evaluated
+/// in a single pass over the row.
+struct C5FlatTree {
+  /// Version of the serialized form of the tree. This must be bumped
+  /// whenever the serialized form changes, trees with a different version
+  /// are discarded when parsed.
+  static const unsigned kVersion = 2;
+
+  struct Node {
+    /// Type of the node
+    C5NodeType type;
+    /// Class predicted by this node, indexed from 1
+    unsigned leaf;
+    /// Number of branches from this node
+    unsigned forks;
+    /// Column of the feature tested by this node
+    uint64_t column;
+    /// Index of the node for the first branch
+    uint64_t branch;
+    /// Threshold of the test of a continuous feature
+    float cut;
+    /// Total weight of the training cases which reached this node
+    float cases;
+    /// Discrete values which select this node, when the parent node is a
+    /// subset test. Bit N is set for the Nth value (N/A being 1).
+    uint64_t subset;
+  };
+
+  /// \brief Flatten a classifier tree produced by the C5.0 library
+  ///
+  /// Only trees using features which can be encoded by encodeC5Features, and
+  /// which do not use probabilistic thresholds, can be flattened.
+  ///
+  /// \param tree  The tree file data produced by the C5.0 library
+  /// \param feature_descs  Features used as inputs to the classifier
+  /// \param class_names  Names of the classes of the target, in the order
+  /// they are declared in the .names data
+  /// \return  The flattened tree, or nothing if the tree could not be
+  /// flattened
+  static util::Option<C5FlatTree>
+  fromTreeData(const std::vector<uint8_t> &tree,
+               const std::set<FeatureDesc> &feature_descs,
+               const std::vector<std::string> &class_names);
+
+  /// \brief Parse a flattened tree from a blob
+  ///
+  /// \param blob  Blob produced by toBlob
+  /// \param n_columns  Number of columns in the rows the tree will classify
+  /// \return  The tree, or nothing if the blob has a different version or
+  /// is malformed
+  static util::Option<C5FlatTree> fromBlob(const std::vector<uint8_t> &blob,
+                                           size_t n_columns);
+
+  /// \brief Serialize the tree to a blob
+  std::vector<uint8_t> toBlob() const;
+
+  /// \brief Classify a row of feature values
+  ///
+  /// This mirrors the classification performed by the C5.0 library, so that
+  /// cases with missing values are weighted across all of the branches of a
+  /// test in proportion to the training cases which took each branch. As in
+  /// the library, thresholds and case weights are single precision.
+  ///
+  /// For a boosted classifier, each trial votes for the class it predicts,
+  /// weighted by its confidence in that class, and the class with the most
+  /// votes is chosen.
+  ///
+  /// \param row  Feature values, as produced by encodeC5Features
+  /// \return  The predicted class, indexed from 1
+  unsigned classify(const std::vector<double> &row) const;
+
+  /// \brief Emit C++ source which classifies a row of a native model
+  ///
+  /// This emits a function for each node of the tree, with the tests of
+  /// each node resolved into straight-line comparisons, followed by a
+  /// function with the given name which returns the class predicted for a
+  /// row. A boosted classifier also has a function for each trial. The
+  /// classification matches that performed by classify.
+  ///
+  /// \param os  Stream to emit the source to
+  /// \param name  Name of the classification function
+  void emitNative(std::ostream &os, const std::string &name) const;
+
+  /// Number of classes of the target
+  unsigned n_classes;
+
+  /// Nodes of the tree, stored breadth first
+  std::vector<Node> nodes;
+
+  /// Index of the root node of the tree for each boosting trial. A classifier
+  /// without boosting has a single tree, rooted at the first node.
+  std::vector<uint64_t> roots;
+
+  /// Class distribution of the training cases at each node, n_classes
+  /// entries per node
+  std::vector<float> class_dist;
+
+private:
+  unsigned classifyTrial(const std::vector<double> &row, uint64_t root,
+                         std::vector<double> &prob) const;
+  void findLeaf(const std::vector<double> &row, uint64_t node,
+                uint64_t parent, float fraction,
+                std::vector<double> &prob) const;
+  void followAllBranches(const std::vector<double> &row, uint64_t node,
+                         float fraction, std::vector<double> &prob) const;
+  void updateFromLeaf(uint64_t node, uint64_t parent, float fraction,
+                      std::vector<double> &prob) const;
+
+  void emitNativeNode(std::ostream &os, const std::string &name,
+                      uint64_t node, uint64_t parent) const;
+  void emitNativeAllBranches(std::ostream &os, const std::string &name,
+                             uint64_t node, const std::string &indent) const;
+  void emitNativeBranch(std::ostream &os, const std::string &name,
+                        uint64_t node, uint64_t branch, uint64_t parent,
+                        unsigned value, const std::string &indent) const;
+  void emitNativeLeaf(std::ostream &os, uint64_t node, uint64_t parent,
+                      const std::string &indent) const;
+};
+
 /// \struct C5Context
 ///
 /// \brief Data stored in the blob held in the database for the machine
@@ -89,13 +258,27 @@ struct C5Context {
 
   /// \brief Parse the data for the C5.0 machine learner from an input blob
   ///
-  /// The input blob must be valid for this machine learner. It is a fatal
-  /// error if the provided blob is invalid or malformed.
+  /// This accepts both containers produced by toBlob and the unversioned
+  /// blobs produced by earlier versions of this machine learner. If the blob
+  /// is malformed, a warning is emitted and the context is empty, so that no
+  /// decisions are made.
   ///
   /// \param blob  The binary blob containing C5.0 training data
   /// \return  The parsed context
   static std::unique_ptr<C5Context> fromBlob(const std::vector<uint8_t> &blob);
 
+  /// \brief Parse a container produced by toBlob into a context
+  ///
+  /// \return  True if the container was valid
+  static bool readContainer(const std::vector<uint8_t> &blob,
+                            C5Context &context);
+
+  /// \brief Parse an unversioned blob into a context
+  ///
+  /// \return  True if the blob was valid
+  static bool readLegacyBlob(const std::vector<uint8_t> &blob,
+                             C5Context &context);
+
   /// Holds a set of all of the features seen when training the classifier.
   /// These are stored ordered, and this defines the order which the features
   /// appear in the .names, .data and .cases file for the classifier.
@@ -108,15 +291,47 @@ struct C5Context {
   /// Holds all of the passes that we have trained for.
   std::set<std::string> passes;
 
+  /// The same passes in the order they are run, used to build a pass
+  /// sequence from the decision for each pass.
+  std::vector<std::string> pass_order;
+
   /// Holds a classifier tree for each of the parameters we trained against.
   std::map<unsigned, std::vector<uint8_t>> parameter_classifier_trees;
 
   /// Classifier trees for each of the passes we trained for.
   std::map<std::string, std::vector<uint8_t>> pass_classifier_trees;
+
+  /// Flattened form of the classifier tree for each parameter, where the
+  /// tree could be flattened.
+  std::map<unsigned, C5FlatTree> parameter_flat_trees;
+
+  /// Flattened form of the classifier tree for each pass.
+  std::map<std::string, C5FlatTree> pass_flat_trees;
+};
+
+/// Kind of the container holding the training data of the machine learner
+const uint32_t kBlobKind = util::fourCC('C', '5', '0', ' ');
+
+/// Version of the layout of the sections of the training data. This must be
+/// bumped whenever the layout of any section changes.
+const uint32_t kBlobVersion = 1;
+
+/// \brief Sections of the container holding the training data
+enum class C5BlobSection : uint32_t {
+  /// Identifier and type of each feature seen when training
+  kFeatureDescs = 1,
+  /// Identifier and type of each parameter seen when training
+  kParameterDescs,
+  /// Name of each pass seen when training
+  kPasses,
+  /// Classifier tree for a parameter, one section per parameter
+  kParameterTree,
+  /// Classifier tree for a pass, one section per pass
+  kPassTree
 };
 
-/// \brief Types of field found in the machine learner blob for the C5.0
-/// classifier.
+/// \brief Types of field found in the unversioned machine learner blob for
+/// the C5.0 classifier.
 enum class C5BlobField {
   /// Field describing the features seen when training
   kFeatureDesc,
@@ -127,251 +342,1230 @@ enum class C5BlobField {
   /// Classifier tree for a parameter
   kParameterClassifierTree,
   /// Classifier tree to classify whether or not to run a pass
-  kPassClassifierTree
+  kPassClassifierTree,
+  /// Flattened classifier tree for a parameter
+  kParameterFlatTree,
+  /// Flattened classifier tree for a pass
+  kPassFlatTree
 };
 
+/// \brief Read a string preceded by its 16-bit length, as found in the
+/// unversioned machine learner blob
+std::string readLegacyString(util::SectionReader &reader) {
+  unsigned len = reader.read16();
+  std::vector<uint8_t> bytes = reader.readBytes(len);
+  return std::string(bytes.begin(), bytes.end());
+}
+
+/// Names of the values of a boolean feature or target, in the order they are
+/// declared in the .names data.
+const std::vector<std::string> bool_value_names = {"t", "f"};
+
+/// \brief Get the column of each feature in a dense row of feature values
+///
+/// Features are laid out in ascending order of feature id, which is the
+/// order they are declared in the .names data.
+std::map<unsigned, size_t>
+getFeatureColumns(const std::set<FeatureDesc> &feature_descs) {
+  std::map<unsigned, size_t> feature_column;
+  for (auto feat : feature_descs) {
+    size_t column = feature_column.size();
+    feature_column[feat.id] = column;
+  }
+  return feature_column;
+}
+
+/// \brief Encode the values of a feature set into a dense row
+///
+/// Continuous features hold their value, and discrete features the 1-based
+/// index of their value in the .names declaration.
+void encodeC5Features(const FeatureSet &features,
+                      const std::map<unsigned, size_t> &feature_column,
+                      std::vector<double>::iterator row) {
+  encodeFeatures(features, feature_column, row, 1.0, 2.0);
+}
+
+/// \brief Build the .names data describing the columns of a classifier
+///
+/// The features form the leading columns, in ascending order of feature id,
+/// followed by a single column for the target of the classifier.
+///
+/// \param target  Name of the target column of the classifier
+/// \param feature_descs  Features which are inputs to the classifier
+/// \param target_values  Values the target can take, in .names syntax
+/// \return  The .names data
+std::string buildNamesData(const std::string &target,
+                           const std::set<FeatureDesc> &feature_descs,
+                           const std::string &target_values) {
+  std::ostringstream names_data;
+
+  // Output the target first
+  // TODO: Comment containing parameter description
+  names_data << target << ".\n";
+
+  // Output columns for all of the features which we have seen in the
+  // training set.
+  // TODO: Add comment containing feature description
+  for (auto feat : feature_descs) {
+    names_data << "feature_" << feat.id << ": ";
+
+    switch (feat.type) {
+    case FeatureType::kBool:
+      names_data << "t, f.";
+      break;
+    case FeatureType::kInt:
+      names_data << "continuous.";
+      break;
+    }
+    names_data << '\n';
+  }
+  names_data << '\n';
+
+  // Output a column for the target
+  names_data << target << ": " << target_values << '\n';
+  return names_data.str();
+}
+
+/// \brief Run the C5.0 classifier over a dense matrix of training cases
+///
+/// \param names_str  .names data describing the columns of each case
+/// \param cases  Row-major matrix of cases, in the layout expected by
+/// c50_cases
+/// \param n_cases  Number of rows in the matrix
+/// \param min_cases  Minimum number of cases in at least two branches of a
+/// split
+/// \param trials  Number of boosting trials
+/// \param winnow  Whether to winnow the features before building the tree
+/// \param sample  Fraction of the cases to train on, or 0 for every case
+/// \param CF  Confidence factor used when pruning
+/// \return  The serialized classifier tree
+std::vector<uint8_t> trainTree(const std::string &names_str,
+                               std::vector<double> &cases, int n_cases,
+                               int min_cases, int trials, int winnow,
+                               double sample, double CF) {
+  char *namesv = (char*)malloc(names_str.size() + 1);
+  strcpy(namesv, names_str.c_str());
+  char *costv = (char*)malloc(1); costv[0] = '\0';
+  // default parameters for C5.0
+  int subset = 1;
+  int rules = 0;
+  int utility = 0;
+  int seed = 0xbeef;
+  int noGlobalPruning = 0;
+  int fuzzyThreshold = 0;
+  int earlyStopping = 1;
+  // output parameters
+  char *treev = nullptr;
+  char *rulesv = nullptr;
+  char *outputv = nullptr;
+
+  c50_cases(&namesv, cases.data(), &n_cases, &costv, &subset, &rules,
+            &utility, &trials, &winnow, &sample, &seed, &noGlobalPruning,
+            &CF, &min_cases, &fuzzyThreshold, &earlyStopping, &treev,
+            &rulesv, &outputv);
+
+  // free memory for all of the unused parameters
+  free(namesv);
+  free(costv);
+  if (rulesv != nullptr)
+    free(rulesv);
+  if (outputv != nullptr)
+    free(outputv);
+
+  // Retrieve the tree
+  assert(treev != nullptr);
+  std::vector<uint8_t> tree_blob(treev, treev + strlen(treev));
+  // free the memory for the tree buffer
+  free(treev);
+  return tree_blob;
+}
+
+/// \brief Train a set of classifiers, several at once where allowed
+///
+/// The C5.0 library holds its state in globals, so it cannot train several
+/// classifiers on different threads. Instead, each classifier is trained in
+/// a child process. If a process fails, its classifier is trained in this
+/// process instead, so the trees are always identical to those trained one
+/// at a time.
+///
+/// \param n_trees  Number of classifiers to train
+/// \param jobs  Maximum number of classifiers to train at once
+/// \param train_tree  Trains the classifier with the given index
+/// \return  The tree of each classifier, in order of index
+std::vector<std::vector<uint8_t>>
+trainTrees(size_t n_trees, unsigned jobs,
+           const std::function<std::vector<uint8_t>(size_t)> &train_tree) {
+  auto results = util::runInProcesses(n_trees, jobs, train_tree);
+
+  std::vector<std::vector<uint8_t>> trees(n_trees);
+  for (size_t i = 0; i < n_trees; ++i) {
+    if (results[i]) {
+      trees[i] = results[i].get();
+    } else {
+      MAGEEC_WARN("Process training classifier " << i
+                  << " failed, training it again");
+      trees[i] = train_tree(i);
+    }
+  }
+  return trees;
+}
+
 } // end of anonymous namespace
 
 std::unique_ptr<C5Context>
 C5Context::fromBlob(const std::vector<uint8_t> &blob) {
   std::unique_ptr<C5Context> context(new C5Context());
 
-  auto it = blob.cbegin();
-  while (it != blob.cend()) {
-    C5BlobField field = static_cast<C5BlobField>(util::read16LE(it));
+  bool valid = util::ContainerReader::isContainer(blob)
+                   ? readContainer(blob, *context)
+                   : readLegacyBlob(blob, *context);
+  if (!valid) {
+    MAGEEC_WARN("Malformed C5.0 training data, no decisions will be made");
+    return std::unique_ptr<C5Context>(new C5Context());
+  }
+
+  // Blobs from older versions may lack flattened trees, or have trees of a
+  // different version. Flatten the text trees where possible so that they
+  // can still be evaluated without the C5.0 library.
+  for (auto param : context->parameter_descs) {
+    auto tree = context->parameter_classifier_trees.find(param.id);
+    if (param.type != ParameterType::kBool ||
+        tree == context->parameter_classifier_trees.end() ||
+        context->parameter_flat_trees.count(param.id)) {
+      continue;
+    }
+    auto flat_tree = C5FlatTree::fromTreeData(
+        tree->second, context->feature_descs, bool_value_names);
+    if (flat_tree) {
+      context->parameter_flat_trees.insert(
+          std::make_pair(param.id, flat_tree.get()));
+    }
+  }
+  for (auto tree : context->pass_classifier_trees) {
+    if (context->pass_flat_trees.count(tree.first)) {
+      continue;
+    }
+    auto flat_tree = C5FlatTree::fromTreeData(
+        tree.second, context->feature_descs, bool_value_names);
+    if (flat_tree) {
+      context->pass_flat_trees.insert(
+          std::make_pair(tree.first, flat_tree.get()));
+    }
+  }
+  return context;
+}
+
+bool C5Context::readContainer(const std::vector<uint8_t> &blob,
+                              C5Context &context) {
+  auto container = util::ContainerReader::parse(blob);
+  if (!container || container.get().getKind() != kBlobKind ||
+      container.get().getVersion() != kBlobVersion) {
+    return false;
+  }
+  auto feature_section = container.get().getSection(
+      static_cast<uint32_t>(C5BlobSection::kFeatureDescs));
+  auto parameter_section = container.get().getSection(
+      static_cast<uint32_t>(C5BlobSection::kParameterDescs));
+  auto pass_section = container.get().getSection(
+      static_cast<uint32_t>(C5BlobSection::kPasses));
+  if (!feature_section || !parameter_section || !pass_section) {
+    return false;
+  }
+
+  // | n_features | feat_id | feat_type |...
+  util::SectionReader features = feature_section.get();
+  size_t n_features = features.readCount(8);
+  for (size_t i = 0; i < n_features; ++i) {
+    unsigned feat_id = features.read32();
+    FeatureType feat_type = static_cast<FeatureType>(features.read32());
+    context.feature_descs.insert({feat_id, feat_type});
+  }
+
+  // | n_parameters | param_id | param_type |...
+  util::SectionReader parameters = parameter_section.get();
+  size_t n_parameters = parameters.readCount(8);
+  for (size_t i = 0; i < n_parameters; ++i) {
+    unsigned param_id = parameters.read32();
+    ParameterType param_type = static_cast<ParameterType>(parameters.read32());
+    context.parameter_descs.insert({param_id, param_type});
+  }
+
+  // | n_passes | pass_name_len | pass_name |...
+  util::SectionReader passes = pass_section.get();
+  size_t n_passes = passes.readCount(8);
+  for (size_t i = 0; i < n_passes; ++i) {
+    std::string pass = passes.readString();
+    if (context.passes.insert(pass).second) {
+      context.pass_order.push_back(pass);
+    }
+  }
+  if (!features.atEnd() || !parameters.atEnd() || !passes.atEnd()) {
+    return false;
+  }
+
+  // | param_id | classifier_len | classifier | flat_tree_len | flat_tree |
+  for (auto tree : container.get().getSections(
+           static_cast<uint32_t>(C5BlobSection::kParameterTree))) {
+    unsigned param_id = tree.read32();
+    std::vector<uint8_t> classifier_blob = tree.readBytes();
+    std::vector<uint8_t> flat_tree_blob = tree.readBytes();
+    if (!tree.atEnd()) {
+      return false;
+    }
+    context.parameter_classifier_trees.insert(
+        std::make_pair(param_id, classifier_blob));
+
+    auto flat_tree =
+        C5FlatTree::fromBlob(flat_tree_blob, context.feature_descs.size());
+    if (flat_tree) {
+      context.parameter_flat_trees.insert(
+          std::make_pair(param_id, flat_tree.get()));
+    }
+  }
+
+  // | pass_name_len | pass_name | classifier_len | classifier |
+  // | flat_tree_len | flat_tree |
+  for (auto tree : container.get().getSections(
+           static_cast<uint32_t>(C5BlobSection::kPassTree))) {
+    std::string pass_name = tree.readString();
+    std::vector<uint8_t> classifier_blob = tree.readBytes();
+    std::vector<uint8_t> flat_tree_blob = tree.readBytes();
+    if (!tree.atEnd()) {
+      return false;
+    }
+    context.pass_classifier_trees.insert(
+        std::make_pair(pass_name, classifier_blob));
+
+    auto flat_tree =
+        C5FlatTree::fromBlob(flat_tree_blob, context.feature_descs.size());
+    if (flat_tree) {
+      context.pass_flat_trees.insert(
+          std::make_pair(pass_name, flat_tree.get()));
+    }
+  }
+  return true;
+}
+
+bool C5Context::readLegacyBlob(const std::vector<uint8_t> &blob,
+                               C5Context &context) {
+  util::SectionReader reader(blob.data(), blob.size());
+  while (!reader.atEnd()) {
+    C5BlobField field = static_cast<C5BlobField>(reader.read16());
     switch (field) {
     case C5BlobField::kFeatureDesc: {
       // | feat_id | feat_type |
-      unsigned feat_id = util::read16LE(it);
-      FeatureType feat_type = static_cast<FeatureType>(util::read16LE(it));
-      context->feature_descs.insert({feat_id, feat_type});
+      unsigned feat_id = reader.read16();
+      FeatureType feat_type = static_cast<FeatureType>(reader.read16());
+      context.feature_descs.insert({feat_id, feat_type});
       break;
     }
     case C5BlobField::kParameterDesc: {
       // | param_id | param_type |
-      unsigned param_id = util::read16LE(it);
-      ParameterType param_type = static_cast<ParameterType>(util::read16LE(it));
-      context->parameter_descs.insert({param_id, param_type});
+      unsigned param_id = reader.read16();
+      ParameterType param_type = static_cast<ParameterType>(reader.read16());
+      context.parameter_descs.insert({param_id, param_type});
       break;
     }
     case C5BlobField::kPassDesc: {
       // | pass_name_len | pass_name |
-      unsigned len = util::read16LE(it);
-      std::string pass_name(it, it + len);
-      it += len;
-      context->passes.insert(pass_name);
+      std::string pass = readLegacyString(reader);
+      if (context.passes.insert(pass).second) {
+        context.pass_order.push_back(pass);
+      }
       break;
     }
     case C5BlobField::kParameterClassifierTree: {
       // | param_id | classifier_len | classifier_blob |
-      unsigned param_id = util::read16LE(it);
-      unsigned len = util::read16LE(it);
-
-      std::vector<uint8_t> classifier_blob(len);
-      for (unsigned i = 0; i < len; ++i) {
-        classifier_blob[i] = *(it + i);
-      }
-      it += len;
-
-      context->parameter_classifier_trees.insert(
-          std::make_pair(param_id, classifier_blob));
+      unsigned param_id = reader.read16();
+      std::string classifier = readLegacyString(reader);
+      context.parameter_classifier_trees.insert(std::make_pair(
+          param_id, std::vector<uint8_t>(classifier.begin(), classifier.end())));
       break;
     }
     case C5BlobField::kPassClassifierTree: {
       // | pass_name_len | pass_name | classifier_len | classifier_blob |
-      unsigned pass_name_len = util::read16LE(it);
-      std::string pass_name(it, it + pass_name_len);
-      it += pass_name_len;
-
-      unsigned classifier_len = util::read16LE(it);
-
-      std::vector<uint8_t> classifier_blob(classifier_len);
-      for (unsigned i = 0; i < classifier_len; ++i) {
-        classifier_blob[i] = *(it + i);
+      std::string pass_name = readLegacyString(reader);
+      std::string classifier = readLegacyString(reader);
+      context.pass_classifier_trees.insert(std::make_pair(
+          pass_name, std::vector<uint8_t>(classifier.begin(), classifier.end())));
+      break;
+    }
+    case C5BlobField::kParameterFlatTree: {
+      // | param_id | flat_tree_len | flat_tree_blob |
+      unsigned param_id = reader.read16();
+      std::vector<uint8_t> flat_tree_blob = reader.readBytes();
+
+      auto flat_tree = C5FlatTree::fromBlob(flat_tree_blob,
+                                            context.feature_descs.size());
+      if (flat_tree) {
+        context.parameter_flat_trees.insert(
+            std::make_pair(param_id, flat_tree.get()));
+      }
+      break;
+    }
+    case C5BlobField::kPassFlatTree: {
+      // | pass_name_len | pass_name | flat_tree_len | flat_tree_blob |
+      std::string pass_name = readLegacyString(reader);
+      std::vector<uint8_t> flat_tree_blob = reader.readBytes();
+
+      auto flat_tree = C5FlatTree::fromBlob(flat_tree_blob,
+                                            context.feature_descs.size());
+      if (flat_tree) {
+        context.pass_flat_trees.insert(
+            std::make_pair(pass_name, flat_tree.get()));
       }
-      it += classifier_len;
-
-      context->pass_classifier_trees.insert(
-          std::make_pair(pass_name, classifier_blob));
       break;
     }
+    default:
+      return false;
+    }
+    if (reader.failed()) {
+      return false;
     }
   }
-  return context;
+  return true;
 }
 
 std::vector<uint8_t> C5Context::toBlob() {
-  // Buffer used to store the training blob
-  std::vector<uint8_t> blob;
+  util::ContainerWriter container(kBlobKind, kBlobVersion);
 
   // Store descriptions of features/parameters and passes that were trained
   // against.
+  // | n_features | feat_id | feat_type |...
+  std::vector<uint8_t> features;
+  util::write64LE(features, feature_descs.size());
   for (auto feat : feature_descs) {
-    // | feat_id | feat_type |
-    unsigned feat_id = feat.id;
-    unsigned feat_type = static_cast<unsigned>(feat.type);
-
-    util::write16LE(blob, static_cast<unsigned>(C5BlobField::kFeatureDesc));
-    util::write16LE(blob, feat_id);
-    util::write16LE(blob, feat_type);
+    util::write32LE(features, feat.id);
+    util::write32LE(features, static_cast<uint32_t>(feat.type));
   }
+  container.addSection(static_cast<uint32_t>(C5BlobSection::kFeatureDescs),
+                       std::move(features));
+
+  // | n_parameters | param_id | param_type |...
+  std::vector<uint8_t> parameters;
+  util::write64LE(parameters, parameter_descs.size());
   for (auto param : parameter_descs) {
-    // | param_id | param_type |
-    unsigned param_id = param.id;
-    unsigned param_type = static_cast<unsigned>(param.type);
+    util::write32LE(parameters, param.id);
+    util::write32LE(parameters, static_cast<uint32_t>(param.type));
+  }
+  container.addSection(static_cast<uint32_t>(C5BlobSection::kParameterDescs),
+                       std::move(parameters));
+
+  // The passes are stored in the order they are run
+  // | n_passes | pass_name_len | pass_name |...
+  assert(pass_order.size() == passes.size());
+  std::vector<uint8_t> pass_names;
+  util::write64LE(pass_names, pass_order.size());
+  for (const auto &pass : pass_order) {
+    util::writeBytes(pass_names, reinterpret_cast<const uint8_t *>(pass.data()),
+                     pass.size());
+  }
+  container.addSection(static_cast<uint32_t>(C5BlobSection::kPasses),
+                       std::move(pass_names));
+
+  // Store the classifier tree for each of the parameters, along with its
+  // flattened form if it has one.
+  // | param_id | classifier_len | classifier | flat_tree_len | flat_tree |
+  for (const auto &param_tree : parameter_classifier_trees) {
+    std::vector<uint8_t> flat_tree_blob;
+    const auto flat_tree = parameter_flat_trees.find(param_tree.first);
+    if (flat_tree != parameter_flat_trees.cend()) {
+      flat_tree_blob = flat_tree->second.toBlob();
+    }
+
+    std::vector<uint8_t> tree;
+    util::write32LE(tree, param_tree.first);
+    util::writeBytes(tree, param_tree.second.data(), param_tree.second.size());
+    util::writeBytes(tree, flat_tree_blob.data(), flat_tree_blob.size());
+    container.addSection(static_cast<uint32_t>(C5BlobSection::kParameterTree),
+                         std::move(tree));
+  }
+
+  // Store the classifier tree for each of the passes
+  // | pass_name_len | pass_name | classifier_len | classifier |
+  // | flat_tree_len | flat_tree |
+  for (const auto &pass_tree : pass_classifier_trees) {
+    std::vector<uint8_t> flat_tree_blob;
+    const auto flat_tree = pass_flat_trees.find(pass_tree.first);
+    if (flat_tree != pass_flat_trees.cend()) {
+      flat_tree_blob = flat_tree->second.toBlob();
+    }
+
+    const std::string &pass_name = pass_tree.first;
+    std::vector<uint8_t> tree;
+    util::writeBytes(tree, reinterpret_cast<const uint8_t *>(pass_name.data()),
+                     pass_name.size());
+    util::writeBytes(tree, pass_tree.second.data(), pass_tree.second.size());
+    util::writeBytes(tree, flat_tree_blob.data(), flat_tree_blob.size());
+    container.addSection(static_cast<uint32_t>(C5BlobSection::kPassTree),
+                         std::move(tree));
+  }
+  return container.finish();
+}
+
+namespace {
+
+/// A property from a line of a C5.0 tree file, consisting of the name of the
+/// property and its comma separated, quoted values.
+typedef std::pair<std::string, std::vector<std::string>> C5TreeProperty;
+
+/// \brief Parse the properties from a line of a C5.0 tree file
+///
+/// Each line is of the form 'name="value" name="value","value" ...'.
+///
+/// \return  The properties, or nothing if the line is malformed
+util::Option<std::vector<C5TreeProperty>>
+parseTreeLine(const std::string &line) {
+  std::vector<C5TreeProperty> props;
+
+  size_t i = 0;
+  while (i < line.size()) {
+    size_t eq = line.find('=', i);
+    if (eq == std::string::npos) {
+      return nullptr;
+    }
+    C5TreeProperty prop;
+    prop.first = line.substr(i, eq - i);
 
-    util::write16LE(blob, static_cast<unsigned>(C5BlobField::kParameterDesc));
-    util::write16LE(blob, param_id);
-    util::write16LE(blob, param_type);
+    i = eq + 1;
+    while (true) {
+      if (i >= line.size() || line[i] != '"') {
+        return nullptr;
+      }
+      std::string value;
+      for (++i; i < line.size() && line[i] != '"'; ++i) {
+        if (line[i] == '\\' && i + 1 < line.size()) {
+          ++i;
+        }
+        value.push_back(line[i]);
+      }
+      if (i >= line.size()) {
+        return nullptr;
+      }
+      prop.second.push_back(value);
+
+      // Skip the closing quote. Further values are separated by commas
+      ++i;
+      if (i < line.size() && line[i] == ',') {
+        ++i;
+        continue;
+      }
+      break;
+    }
+    props.push_back(prop);
+
+    while (i < line.size() && line[i] == ' ') {
+      ++i;
+    }
+  }
+  return props;
+}
+
+/// \struct C5ParsedNode
+///
+/// \brief Node of a C5.0 tree as it is parsed, before flattening
+struct C5ParsedNode {
+  C5FlatTree::Node node;
+  std::vector<float> class_dist;
+  std::vector<C5ParsedNode> branches;
+};
+
+/// \brief Parse a node and its branches from the lines of a C5.0 tree file
+///
+/// The nodes are stored depth first, with each node followed by each of its
+/// branches in turn.
+///
+/// \return  True if the node was parsed successfully
+bool parseTreeNode(const std::vector<std::string> &lines, size_t &pos,
+                   const std::map<std::string, size_t> &feature_column,
+                   const std::set<size_t> &discrete_columns,
+                   const std::vector<std::string> &class_names,
+                   C5ParsedNode &parsed) {
+  if (pos >= lines.size()) {
+    return false;
+  }
+  auto props = parseTreeLine(lines[pos++]);
+  if (!props) {
+    return false;
   }
-  for (auto pass : passes) {
-    // | pass_name_len | pass_name |
-    std::string pass_name = pass;
-    unsigned pass_name_len = static_cast<unsigned>(pass_name.length());
 
-    util::write16LE(blob, static_cast<unsigned>(C5BlobField::kPassDesc));
-    util::write16LE(blob, pass_name_len);
-    for (auto it : pass_name) {
-      blob.push_back(static_cast<uint8_t>(it));
+  C5FlatTree::Node &node = parsed.node;
+  node = {C5NodeType::kLeaf, 0, 0, 0, 0, 0.0f, 0.0f, 0};
+  parsed.class_dist.assign(class_names.size(), 0.0f);
+
+  std::vector<uint64_t> subsets;
+  for (auto prop : props.get()) {
+    const std::string &name = prop.first;
+    const std::vector<std::string> &values = prop.second;
+
+    if (name == "type") {
+      unsigned type = static_cast<unsigned>(std::stoul(values[0]));
+      if (type > static_cast<unsigned>(C5NodeType::kSubset)) {
+        return false;
+      }
+      node.type = static_cast<C5NodeType>(type);
+    } else if (name == "class") {
+      auto c = std::find(class_names.begin(), class_names.end(), values[0]);
+      if (c == class_names.end()) {
+        return false;
+      }
+      node.leaf = static_cast<unsigned>(c - class_names.begin()) + 1;
+    } else if (name == "att") {
+      auto column = feature_column.find(values[0]);
+      if (column == feature_column.end()) {
+        return false;
+      }
+      node.column = column->second;
+    } else if (name == "forks") {
+      node.forks = static_cast<unsigned>(std::stoul(values[0]));
+    } else if (name == "cut") {
+      node.cut = static_cast<float>(std::strtod(values[0].c_str(), nullptr));
+    } else if (name == "freq") {
+      // Weight of the training cases of each class, separated by commas
+      std::istringstream freq(values[0]);
+      for (auto &dist : parsed.class_dist) {
+        double value;
+        char sep;
+        if (!(freq >> value)) {
+          return false;
+        }
+        freq >> sep;
+        dist = static_cast<float>(value);
+        node.cases += dist;
+      }
+    } else if (name == "elts") {
+      // Values of a discrete feature which select the next branch. These
+      // are indexed as in C5.0, with N/A as the first value.
+      uint64_t subset = 0;
+      for (auto value : values) {
+        if (value == "N/A") {
+          subset |= uint64_t(1) << 1;
+        } else {
+          auto v = std::find(bool_value_names.begin(), bool_value_names.end(),
+                             value);
+          if (v == bool_value_names.end()) {
+            return false;
+          }
+          subset |= uint64_t(1) << ((v - bool_value_names.begin()) + 2);
+        }
+      }
+      subsets.push_back(subset);
+    } else {
+      // Probabilistic thresholds and any other properties are not handled
+      return false;
     }
   }
+  if (node.leaf == 0) {
+    return false;
+  }
 
-  // Store the classifier tree for each of the parameters
-  for (auto param_tree : parameter_classifier_trees) {
-    // | param_id | classifier_len | classifier_blob |
-    unsigned param_id = param_tree.first;
-    std::vector<uint8_t> classifier_blob = param_tree.second;
-    unsigned classifier_len = static_cast<unsigned>(classifier_blob.size());
+  switch (node.type) {
+  case C5NodeType::kLeaf:
+    return true;
+  case C5NodeType::kDiscrete:
+    if (!discrete_columns.count(node.column)) {
+      return false;
+    }
+    break;
+  case C5NodeType::kThreshold:
+    if (discrete_columns.count(node.column) || node.forks != 3) {
+      return false;
+    }
+    break;
+  case C5NodeType::kSubset:
+    if (!discrete_columns.count(node.column) || subsets.size() != node.forks) {
+      return false;
+    }
+    break;
+  }
+  if (node.forks == 0) {
+    return false;
+  }
 
-    util::write16LE(
-        blob, static_cast<unsigned>(C5BlobField::kParameterClassifierTree));
-    util::write16LE(blob, param_id);
-    util::write16LE(blob, classifier_len);
-    for (auto it : classifier_blob) {
-      blob.push_back(it);
+  parsed.branches.resize(node.forks);
+  for (unsigned i = 0; i < node.forks; ++i) {
+    if (!parseTreeNode(lines, pos, feature_column, discrete_columns,
+                       class_names, parsed.branches[i])) {
+      return false;
+    }
+    if (node.type == C5NodeType::kSubset) {
+      parsed.branches[i].node.subset = subsets[i];
     }
   }
+  return true;
+}
 
-  // Store the classifier tree for each of the passes
-  for (auto pass_tree : pass_classifier_trees) {
-    // | pass_name_len | pass_name | classifier_len | classifier_blob |
-    std::string pass_name = pass_tree.first;
-    unsigned pass_name_len = static_cast<unsigned>(pass_name.length());
-    std::vector<uint8_t> classifier_blob = pass_tree.second;
-    unsigned classifier_len = static_cast<unsigned>(classifier_blob.size());
+/// \brief Add the features tested by the nodes of a C5.0 tree to a set
+///
+/// \param tree  The tree file data produced by the C5.0 library
+/// \param used  Identifiers of the features tested by the tree are added to
+/// this set
+/// \return  True if the tree was parsed successfully
+bool addTreeFeatures(const std::vector<uint8_t> &tree,
+                     std::set<unsigned> &used) {
+  const std::string prefix = "feature_";
+  std::istringstream tree_data(std::string(tree.begin(), tree.end()));
+  for (std::string line; std::getline(tree_data, line);) {
+    if (line.empty()) {
+      continue;
+    }
+    auto props = parseTreeLine(line);
+    if (!props) {
+      return false;
+    }
+    for (auto prop : props.get()) {
+      if (prop.first != "att") {
+        continue;
+      }
+      const std::string &att = prop.second[0];
+      if (att.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+      }
+      auto id = util::parseUnsigned(att.substr(prefix.size()));
+      if (!id) {
+        return false;
+      }
+      used.insert(static_cast<unsigned>(id.get()));
+    }
+  }
+  return true;
+}
+
+} // end of anonymous namespace
+
+util::Option<C5FlatTree>
+C5FlatTree::fromTreeData(const std::vector<uint8_t> &tree,
+                         const std::set<FeatureDesc> &feature_descs,
+                         const std::vector<std::string> &class_names) {
+  // Map from the names of features in the tree to their columns
+  std::map<std::string, size_t> feature_column;
+  std::set<size_t> discrete_columns;
+  for (auto column : getFeatureColumns(feature_descs)) {
+    feature_column["feature_" + std::to_string(column.first)] = column.second;
+  }
+  for (auto feat : feature_descs) {
+    if (feat.type == FeatureType::kBool) {
+      discrete_columns.insert(
+          feature_column.at("feature_" + std::to_string(feat.id)));
+    }
+  }
+
+  // Split the tree into lines, the first lines are a header preceding the
+  // nodes of the tree.
+  std::vector<std::string> lines;
+  std::istringstream tree_data(std::string(tree.begin(), tree.end()));
+  for (std::string line; std::getline(tree_data, line);) {
+    if (!line.empty()) {
+      lines.push_back(line);
+    }
+  }
+
+  // The header holds the number of boosting trials, each of which has a
+  // tree following the header.
+  uint64_t n_trials = 1;
+  size_t pos = 0;
+  for (; pos < lines.size() && lines[pos].compare(0, 5, "type=") != 0;
+       ++pos) {
+    auto props = parseTreeLine(lines[pos]);
+    if (!props) {
+      return nullptr;
+    }
+    for (auto prop : props.get()) {
+      if (prop.first == "entries") {
+        auto entries = util::parseUnsigned(prop.second[0]);
+        if (!entries || entries.get() == 0) {
+          return nullptr;
+        }
+        n_trials = entries.get();
+      }
+    }
+  }
+
+  C5FlatTree flat_tree;
+  flat_tree.n_classes = static_cast<unsigned>(class_names.size());
+
+  for (uint64_t trial = 0; trial < n_trials; ++trial) {
+    C5ParsedNode root;
+    if (!parseTreeNode(lines, pos, feature_column, discrete_columns,
+                       class_names, root)) {
+      return nullptr;
+    }
+
+    // Flatten breadth first, so that the branches of each node are
+    // contiguous. The tree follows those of the previous trials.
+    uint64_t base = flat_tree.nodes.size();
+    flat_tree.roots.push_back(base);
+
+    std::vector<const C5ParsedNode *> worklist = {&root};
+    for (size_t i = 0; i < worklist.size(); ++i) {
+      const C5ParsedNode *parsed = worklist[i];
+
+      C5FlatTree::Node node = parsed->node;
+      node.branch = base + worklist.size();
+      for (const auto &branch : parsed->branches) {
+        worklist.push_back(&branch);
+      }
+      flat_tree.nodes.push_back(node);
+      flat_tree.class_dist.insert(flat_tree.class_dist.end(),
+                                  parsed->class_dist.begin(),
+                                  parsed->class_dist.end());
+    }
+  }
+  return flat_tree;
+}
+
+util::Option<C5FlatTree>
+C5FlatTree::fromBlob(const std::vector<uint8_t> &blob, size_t n_columns) {
+  // | version | n_classes | n_nodes | n_roots | root | root |...
+  // | node | node |...
+  if (blob.size() < 20) {
+    return nullptr;
+  }
+  auto it = blob.cbegin();
+  if (util::read16LE(it) != kVersion) {
+    return nullptr;
+  }
+
+  C5FlatTree flat_tree;
+  flat_tree.n_classes = util::read16LE(it);
+  uint64_t n_nodes = util::read64LE(it);
+  uint64_t n_roots = util::read64LE(it);
+  if (n_roots == 0 || n_roots > n_nodes || (blob.size() - 20) / 8 < n_roots) {
+    return nullptr;
+  }
+
+  // The first tree is rooted at the first node, and each tree follows the
+  // tree of the previous trial.
+  for (uint64_t i = 0; i < n_roots; ++i) {
+    uint64_t root = util::read64LE(it);
+    if ((i == 0 && root != 0) ||
+        (i != 0 && (root <= flat_tree.roots.back() || root >= n_nodes))) {
+      return nullptr;
+    }
+    flat_tree.roots.push_back(root);
+  }
+
+  // | type | leaf | forks | column | branch | cut | cases | subset | dist |
+  uint64_t header_size = 20 + 8 * n_roots;
+  uint64_t node_size = 6 + 8 * 5 + 8 * flat_tree.n_classes;
+  if ((blob.size() - header_size) / node_size != n_nodes ||
+      (blob.size() - header_size) % node_size != 0) {
+    return nullptr;
+  }
 
-    util::write16LE(blob,
-                    static_cast<unsigned>(C5BlobField::kPassClassifierTree));
-    util::write16LE(blob, pass_name_len);
-    for (auto it : pass_name) {
-      blob.push_back(static_cast<uint8_t>(it));
+  for (uint64_t i = 0; i < n_nodes; ++i) {
+    C5FlatTree::Node node;
+    node.type = static_cast<C5NodeType>(util::read16LE(it));
+    node.leaf = util::read16LE(it);
+    node.forks = util::read16LE(it);
+    node.column = util::read64LE(it);
+    node.branch = util::read64LE(it);
+    node.cut = static_cast<float>(util::readDoubleLE(it));
+    node.cases = static_cast<float>(util::readDoubleLE(it));
+    node.subset = util::read64LE(it);
+    for (unsigned c = 0; c < flat_tree.n_classes; ++c) {
+      flat_tree.class_dist.push_back(
+          static_cast<float>(util::readDoubleLE(it)));
+    }
+
+    if (node.type > C5NodeType::kSubset || node.leaf == 0 ||
+        node.leaf > flat_tree.n_classes) {
+      return nullptr;
+    }
+    if (node.type != C5NodeType::kLeaf &&
+        (node.column >= n_columns || node.branch <= i ||
+         node.branch + node.forks > n_nodes)) {
+      return nullptr;
     }
-    util::write16LE(blob, classifier_len);
-    for (auto it : classifier_blob) {
-      blob.push_back(it);
+    flat_tree.nodes.push_back(node);
+  }
+  return flat_tree;
+}
+
+std::vector<uint8_t> C5FlatTree::toBlob() const {
+  std::vector<uint8_t> blob;
+
+  // | version | n_classes | n_nodes | n_roots | root | root |...
+  // | node | node |...
+  util::write16LE(blob, kVersion);
+  util::write16LE(blob, n_classes);
+  util::write64LE(blob, nodes.size());
+  util::write64LE(blob, roots.size());
+  for (uint64_t root : roots) {
+    util::write64LE(blob, root);
+  }
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    // | type | leaf | forks | column | branch | cut | cases | subset | dist |
+    const Node &node = nodes[i];
+    util::write16LE(blob, static_cast<unsigned>(node.type));
+    util::write16LE(blob, node.leaf);
+    util::write16LE(blob, node.forks);
+    util::write64LE(blob, node.column);
+    util::write64LE(blob, node.branch);
+    util::writeDoubleLE(blob, node.cut);
+    util::writeDoubleLE(blob, node.cases);
+    util::write64LE(blob, node.subset);
+    for (unsigned c = 0; c < n_classes; ++c) {
+      util::writeDoubleLE(blob, class_dist[i * n_classes + c]);
     }
   }
   return blob;
 }
 
-C5Driver::C5Driver() : IMachineLearner() {}
+unsigned C5FlatTree::classify(const std::vector<double> &row) const {
+  // Weight of each class, with the total weight of the leaves reached in
+  // the first entry
+  std::vector<double> prob(n_classes + 1, 0.0);
+  if (roots.size() == 1) {
+    return classifyTrial(row, roots[0], prob);
+  }
 
-C5Driver::~C5Driver() {}
+  // Each trial votes for its class with its confidence in that class, which
+  // is smoothed towards the distribution of the class at the root of its
+  // tree. As in the library, the votes are single precision.
+  std::vector<float> vote(n_classes + 1, 0.0f);
+  double total = 0.0;
+  for (uint64_t root : roots) {
+    unsigned trial_best = classifyTrial(row, root, prob);
+    float prior =
+        class_dist[root * n_classes + trial_best - 1] / nodes[root].cases;
+    double confidence =
+        (prob[0] * prob[trial_best] + prior) / (prob[0] + 1);
+    vote[trial_best] = static_cast<float>(vote[trial_best] + confidence);
+    total += confidence;
+  }
 
-std::unique_ptr<DecisionBase>
-C5Driver::makeDecision(const DecisionRequestBase &request,
-                       const FeatureSet &features,
-                       const std::vector<uint8_t> &blob) const {
-  // Deserialize the machine learner data from the blob
-  std::unique_ptr<C5Context> context = C5Context::fromBlob(blob);
+  // Choose the class with the greatest share of the votes, preferring the
+  // class at the root of the first tree.
+  unsigned best = nodes[roots[0]].leaf;
+  for (unsigned c = 1; c <= n_classes; ++c) {
+    if (vote[c] / total > vote[best] / total) {
+      best = c;
+    }
+  }
+  return best;
+}
 
-  // Find the appropriate classifier tree for the provided decision request
-  DecisionRequestType request_type = request.getType();
+unsigned C5FlatTree::classifyTrial(const std::vector<double> &row,
+                                   uint64_t root,
+                                   std::vector<double> &prob) const {
+  std::fill(prob.begin(), prob.end(), 0.0);
+  findLeaf(row, root, root, 1.0f, prob);
+
+  // Choose the class with the greatest weight, preferring the class at the
+  // root of the tree.
+  unsigned best = nodes[root].leaf;
+  for (unsigned c = 1; c <= n_classes; ++c) {
+    if (prob[c] > prob[best]) {
+      best = c;
+    }
+  }
+  return best;
+}
 
-  assert((request_type == DecisionRequestType::kBool ||
-          request_type == DecisionRequestType::kRange) &&
-         "Unhandled decision request type");
+void C5FlatTree::findLeaf(const std::vector<double> &row, uint64_t node,
+                          uint64_t parent, float fraction,
+                          std::vector<double> &prob) const {
+  const Node &n = nodes[node];
+
+  switch (n.type) {
+  case C5NodeType::kLeaf:
+    updateFromLeaf(node, parent, fraction, prob);
+    return;
+
+  case C5NodeType::kDiscrete: {
+    // Discrete values skip over N/A, which is the first branch.
+    double value = row[n.column];
+    if (std::isnan(value) || value + 1 > n.forks) {
+      followAllBranches(row, node, fraction, prob);
+    } else {
+      uint64_t branch = n.branch + static_cast<uint64_t>(value);
+      findLeaf(row, branch, node, fraction, prob);
+    }
+    return;
+  }
 
-  unsigned param_id;
-  ParameterType param_type;
+  case C5NodeType::kThreshold: {
+    // The branches are N/A, <= cut and > cut.
+    double value = row[n.column];
+    if (std::isnan(value)) {
+      followAllBranches(row, node, fraction, prob);
+    } else if (fraction >= 1E-6) {
+      uint64_t branch =
+          n.branch + (static_cast<float>(value) <= n.cut ? 1 : 2);
+      findLeaf(row, branch, node, fraction, prob);
+    }
+    return;
+  }
 
-  // The ID is the identifier of the tunable parameter
-  if (request_type == DecisionRequestType::kBool) {
-    const auto *bool_request =
-        static_cast<const BoolDecisionRequest *>(&request);
-    param_id = bool_request->getID();
+  case C5NodeType::kSubset: {
+    double value = row[n.column];
+    if (std::isnan(value)) {
+      followAllBranches(row, node, fraction, prob);
+      return;
+    }
+    uint64_t bit = uint64_t(1) << (static_cast<unsigned>(value) + 1);
+    for (unsigned v = 0; v < n.forks; ++v) {
+      if (nodes[n.branch + v].subset & bit) {
+        findLeaf(row, n.branch + v, node, fraction, prob);
+        return;
+      }
+    }
+    // Value not found in any subset, treat this node as a leaf
+    updateFromLeaf(node, parent, fraction, prob);
+    return;
+  }
+  }
+}
 
-    assert(bool_request->getDecisionType() == DecisionType::kBool);
-    param_type = ParameterType::kBool;
-  } else if (request_type == DecisionRequestType::kRange) {
-    const auto *range_request =
-        static_cast<const RangeDecisionRequest *>(&request);
-    param_id = range_request->getID();
+void C5FlatTree::followAllBranches(const std::vector<double> &row,
+                                   uint64_t node, float fraction,
+                                   std::vector<double> &prob) const {
+  // Weight each branch in proportion to the training cases which took it
+  const Node &n = nodes[node];
+  for (unsigned v = 0; v < n.forks; ++v) {
+    const Node &branch = nodes[n.branch + v];
+    if (branch.cases > 1E-4) {
+      findLeaf(row, n.branch + v, node, (fraction * branch.cases) / n.cases,
+               prob);
+    }
+  }
+}
 
-    assert(range_request->getDecisionType() == DecisionType::kRange);
-    param_type = ParameterType::kRange;
-  } else {
-    assert(0 && "Unreachable");
+void C5FlatTree::updateFromLeaf(uint64_t node, uint64_t parent,
+                                float fraction,
+                                std::vector<double> &prob) const {
+  // Use the parent node if there were effectively no cases at this node
+  if (nodes[node].cases < 1E-4) {
+    node = parent;
+  }
+  const Node &n = nodes[node];
+  for (unsigned c = 1; c <= n_classes; ++c) {
+    prob[c] += fraction * class_dist[node * n_classes + c - 1] / n.cases;
+  }
+  prob[0] += fraction * n.cases;
+}
+
+void C5FlatTree::emitNative(std::ostream &os,
+                            const std::string &name) const {
+  // Each node has a single parent, which is needed when a leaf has no
+  // training cases. The root of each tree is its own parent.
+  std::vector<uint64_t> parent(nodes.size(), 0);
+  for (uint64_t root : roots) {
+    parent[root] = root;
+  }
+  for (uint64_t i = 0; i < nodes.size(); ++i) {
+    if (nodes[i].type != C5NodeType::kLeaf) {
+      for (unsigned v = 0; v < nodes[i].forks; ++v) {
+        parent[nodes[i].branch + v] = i;
+      }
+    }
   }
 
-  // Check if we have a classifier tree for this parameter.
-  const auto res = context->parameter_classifier_trees.find(param_id);
-  if (res == context->parameter_classifier_trees.cend()) {
-    return std::unique_ptr<DecisionBase>(new NativeDecision());
+  // Branches always follow their parent, so emitting the nodes in reverse
+  // defines each node before it is called.
+  for (uint64_t i = nodes.size(); i-- > 0;) {
+    emitNativeNode(os, name, i, parent[i]);
   }
 
-  // Output the classifier tree to a buffer
-  const std::vector<uint8_t> &tree_blob = res->second;
-  std::ostringstream tree_data;
-  for (auto c : tree_blob) {
-    tree_data << c;
+  if (roots.size() == 1) {
+    os << "unsigned " << name << "(const double *row) {\n"
+       << "  double prob[" << n_classes + 1 << "] = {0.0};\n"
+       << "  " << name << "_n0(row, 1.0f, prob);\n"
+       << "  unsigned best = " << nodes[0].leaf << ";\n"
+       << "  for (unsigned c = 1; c <= " << n_classes << "; ++c) {\n"
+       << "    if (prob[c] > prob[best]) {\n"
+       << "      best = c;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  return best;\n"
+       << "}\n\n";
+    return;
   }
 
-  // Output names data (columns for classifier) for this parameter
-  // FIXME: This is copied from the 'train' code and should be factored out
-  // TODO: Platform independent temporary file
-  std::ostringstream names_data;
-    
-  // Output the target parameter first
-  // TODO: Comment containing parameter description
-  names_data << "parameter_" << std::to_string(param_id) << ".\n";
+  // Each trial adds its vote for a class, weighted by its confidence
+  for (size_t t = 0; t < roots.size(); ++t) {
+    uint64_t root = roots[t];
+    os << "void " << name << "_t" << t
+       << "(const double *row, float *vote, double *total) {\n"
+       << "  double prob[" << n_classes + 1 << "] = {0.0};\n"
+       << "  " << name << "_n" << root << "(row, 1.0f, prob);\n"
+       << "  const float prior[" << n_classes + 1 << "] = {0.0f";
+    for (unsigned c = 1; c <= n_classes; ++c) {
+      float prior = class_dist[root * n_classes + c - 1] / nodes[root].cases;
+      os << ", " << nativeFloatLiteral(prior);
+    }
+    os << "};\n"
+       << "  unsigned best = " << nodes[root].leaf << ";\n"
+       << "  for (unsigned c = 1; c <= " << n_classes << "; ++c) {\n"
+       << "    if (prob[c] > prob[best]) {\n"
+       << "      best = c;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  double confidence =\n"
+       << "      (prob[0] * prob[best] + prior[best]) / (prob[0] + 1);\n"
+       << "  vote[best] += confidence;\n"
+       << "  *total += confidence;\n"
+       << "}\n\n";
+  }
 
-  // Output columns for all of the features which we have seen in the
-  // training set.
-  // TODO: Add comment containing feature description
-  for (auto feat : context->feature_descs) {
-    names_data << "feature_" << std::to_string(feat.id) << ": ";
+  os << "unsigned " << name << "(const double *row) {\n"
+     << "  float vote[" << n_classes + 1 << "] = {0.0f};\n"
+     << "  double total = 0.0;\n";
+  for (size_t t = 0; t < roots.size(); ++t) {
+    os << "  " << name << "_t" << t << "(row, vote, &total);\n";
+  }
+  os << "  unsigned best = " << nodes[roots[0]].leaf << ";\n"
+     << "  for (unsigned c = 1; c <= " << n_classes << "; ++c) {\n"
+     << "    if (vote[c] / total > vote[best] / total) {\n"
+     << "      best = c;\n"
+     << "    }\n"
+     << "  }\n"
+     << "  return best;\n"
+     << "}\n\n";
+}
 
-    switch (feat.type) {
-    case FeatureType::kBool:
-      names_data << "t, f.";
-      break;
-    case FeatureType::kInt:
-      names_data << "continuous.";
-      break;
-    }
-    names_data << '\n';
+void C5FlatTree::emitNativeNode(std::ostream &os, const std::string &name,
+                                uint64_t node, uint64_t parent) const {
+  const Node &n = nodes[node];
+
+  os << "void " << name << "_n" << node
+     << "(const double *row, float fraction, double *prob) {\n";
+  if (n.type == C5NodeType::kLeaf) {
+    os << "  (void)row;\n";
+    emitNativeLeaf(os, node, parent, "  ");
+    os << "}\n\n";
+    return;
   }
-  names_data << '\n';
 
-  // Output a column for the target parameter
-  names_data << "parameter_" << std::to_string(param_id) << ": ";
-  switch (param_type) {
-  case ParameterType::kBool:
-    names_data << "t, f.";
+  os << "  double value = row[" << n.column << "];\n"
+     << "  if (std::isnan(value)) {\n";
+  emitNativeAllBranches(os, name, node, "    ");
+
+  switch (n.type) {
+  case C5NodeType::kLeaf:
+    assert(0 && "Unreachable");
     break;
-  case ParameterType::kRange:
-    names_data << "continuous.";
+  case C5NodeType::kDiscrete:
+  case C5NodeType::kSubset:
+    // Discrete features are boolean, and the native row holds 1.0 for the
+    // first value and 0.0 for the second, so each branch is resolved here.
+    os << "  } else if (value != 0.0) {\n";
+    emitNativeBranch(os, name, node, n.branch, parent, 1, "    ");
+    os << "  } else {\n";
+    emitNativeBranch(os, name, node, n.branch, parent, 2, "    ");
+    os << "  }\n";
     break;
-  default:
+  case C5NodeType::kThreshold:
+    // The branches are N/A, <= cut and > cut.
+    os << "  } else if (fraction >= 1E-6) {\n"
+       << "    if (static_cast<float>(value) <= " << nativeFloatLiteral(n.cut)
+       << ") {\n"
+       << "      " << name << "_n" << n.branch + 1
+       << "(row, fraction, prob);\n"
+       << "    } else {\n"
+       << "      " << name << "_n" << n.branch + 2
+       << "(row, fraction, prob);\n"
+       << "    }\n"
+       << "  }\n";
     break;
   }
-  names_data << '\n';
+  os << "}\n\n";
+}
+
+void C5FlatTree::emitNativeAllBranches(std::ostream &os,
+                                       const std::string &name,
+                                       uint64_t node,
+                                       const std::string &indent) const {
+  const Node &n = nodes[node];
+  for (unsigned v = 0; v < n.forks; ++v) {
+    const Node &branch = nodes[n.branch + v];
+    if (branch.cases > 1E-4) {
+      os << indent << name << "_n" << n.branch + v << "(row, (fraction * "
+         << nativeFloatLiteral(branch.cases) << ") / "
+         << nativeFloatLiteral(n.cases) << ", prob);\n";
+    }
+  }
+}
+
+void C5FlatTree::emitNativeBranch(std::ostream &os, const std::string &name,
+                                  uint64_t node, uint64_t branch,
+                                  uint64_t parent, unsigned value,
+                                  const std::string &indent) const {
+  const Node &n = nodes[node];
+  if (n.type == C5NodeType::kDiscrete) {
+    // Discrete values skip over N/A, which is the first branch.
+    if (value + 1 > n.forks) {
+      emitNativeAllBranches(os, name, node, indent);
+    } else {
+      os << indent << name << "_n" << branch + value
+         << "(row, fraction, prob);\n";
+    }
+    return;
+  }
+
+  assert(n.type == C5NodeType::kSubset);
+  uint64_t bit = uint64_t(1) << (value + 1);
+  for (unsigned v = 0; v < n.forks; ++v) {
+    if (nodes[branch + v].subset & bit) {
+      os << indent << name << "_n" << branch + v
+         << "(row, fraction, prob);\n";
+      return;
+    }
+  }
+  // Value not found in any subset, treat this node as a leaf
+  emitNativeLeaf(os, node, parent, indent);
+}
+
+void C5FlatTree::emitNativeLeaf(std::ostream &os, uint64_t node,
+                                uint64_t parent,
+                                const std::string &indent) const {
+  // Use the parent node if there were effectively no cases at this node
+  if (nodes[node].cases < 1E-4) {
+    node = parent;
+  }
+  const Node &n = nodes[node];
+  for (unsigned c = 1; c <= n_classes; ++c) {
+    os << indent << "prob[" << c << "] += fraction * "
+       << nativeFloatLiteral(class_dist[node * n_classes + c - 1]) << " / "
+       << nativeFloatLiteral(n.cases) << ";\n";
+  }
+  os << indent << "prob[0] += fraction * " << nativeFloatLiteral(n.cases)
+     << ";\n";
+}
+
+namespace {
+
+/// \brief Make a prediction by running a classifier tree through the C5.0
+/// library
+///
+/// This is used for trees which could not be flattened.
+///
+/// \param context  The context parsed from the training blob
+/// \param target  Name of the target of the classifier
+/// \param target_values  Values of the target, as declared in .names data
+/// \param tree_blob  The classifier tree
+/// \param features  The features to make the prediction for
+///
+/// \return  The predicted class, indexed from 1
+int predictFromTreeData(const C5Context &context, const std::string &target,
+                        const std::string &target_values,
+                        const std::vector<uint8_t> &tree_blob,
+                        const FeatureSet &features) {
+  // Output the classifier tree to a buffer
+  std::ostringstream tree_data;
+  for (auto c : tree_blob) {
+    tree_data << c;
+  }
+
+  // Output names data (columns for classifier) for this target
+  std::string names_str =
+      buildNamesData(target, context.feature_descs, target_values);
 
   // Output cases file (.cases) data, containing the feature set
   std::ostringstream cases_data;
 
-  for (auto feat : context->feature_descs) {
+  for (auto feat : context.feature_descs) {
     // Feature values are output in the order they appear in the feature
     // description map (ascending order of feature id)
 
@@ -415,7 +1609,6 @@ C5Driver::makeDecision(const DecisionRequestBase &request,
 
   // input files as buffers
   std::string cases_str = cases_data.str();
-  std::string names_str = names_data.str();
   std::string tree_str = tree_data.str();
 
   char *casev = (char*)malloc(cases_str.size() + 1);
@@ -427,10 +1620,10 @@ C5Driver::makeDecision(const DecisionRequestBase &request,
 
   char *rulesv = (char*)malloc(1); rulesv[0] = '\0';
   char *costv = (char*)malloc(1); costv[0] = '\0';
-  // default parameters for C5.0
-  int trials = 1;
+  // Use every boosting trial the tree was built with
+  int trials = 0;
   // output parameters
-  int *predv = (int*)malloc(1);
+  int *predv = (int*)malloc(sizeof(int));
   double confidencev;
   char *outputv = nullptr;
 
@@ -449,9 +1642,144 @@ C5Driver::makeDecision(const DecisionRequestBase &request,
   // The result was written back to predv
   int predict_res = predv[0];
   free(predv);
+  return predict_res;
+}
+
+/// \brief Decide whether to run a pass using a parsed context
+///
+/// \param context  The context parsed from the training blob
+/// \param pass  Name of the pass
+/// \param features  The features to make the decision for
+/// \param row  The features encoded for the flattened trees of the context
+///
+/// \return  Whether to run the pass, or nothing if there is no classifier for
+/// the pass
+util::Option<bool> decidePass(const C5Context &context,
+                              const std::string &pass,
+                              const FeatureSet &features,
+                              const std::vector<double> &row) {
+  const auto tree = context.pass_classifier_trees.find(pass);
+  if (tree == context.pass_classifier_trees.cend()) {
+    return nullptr;
+  }
+
+  // The result is an index into the class 't,f', starting from 1
+  int predict_res;
+  const auto flat_tree = context.pass_flat_trees.find(pass);
+  if (flat_tree != context.pass_flat_trees.cend()) {
+    predict_res = static_cast<int>(flat_tree->second.classify(row));
+  } else {
+    predict_res = predictFromTreeData(context, "pass_" + pass, "t, f.",
+                                      tree->second, features);
+  }
+  assert(predict_res == 1 || predict_res == 2);
+  return predict_res == 1;
+}
+
+/// \brief Make a single decision using a parsed context
+///
+/// A pass sequence is built from the decision for each pass, taking the
+/// passes which should be run in the order they are run. As every pass is
+/// decided from the same row, the whole sequence costs a single evaluation
+/// of each pass classifier.
+///
+/// \param context  The context parsed from the training blob
+/// \param request  The decision to be made
+/// \param features  The features to make the decision for
+/// \param row  The features encoded for the flattened trees of the context
+///
+/// \return  The decision, or the native decision if there is no classifier
+/// for the request
+std::unique_ptr<DecisionBase> decide(const C5Context &context,
+                                     const DecisionRequestBase &request,
+                                     const FeatureSet &features,
+                                     const std::vector<double> &row) {
+  // Find the appropriate classifier tree for the provided decision request
+  DecisionRequestType request_type = request.getType();
+
+  if (request_type == DecisionRequestType::kPassGate) {
+    const auto *gate_request =
+        static_cast<const PassGateDecisionRequest *>(&request);
+    assert(gate_request->getDecisionType() == DecisionType::kBool);
+
+    auto run_pass = decidePass(context, gate_request->getID(), features, row);
+    if (!run_pass) {
+      return std::unique_ptr<DecisionBase>(new NativeDecision());
+    }
+    return std::unique_ptr<BoolDecision>(new BoolDecision(run_pass.get()));
+  }
+
+  if (request_type == DecisionRequestType::kPassSeq) {
+    const auto *seq_request =
+        static_cast<const PassSeqDecisionRequest *>(&request);
+    assert(seq_request->getDecisionType() == DecisionType::kPassSeq);
+
+    // The sequence is only decided if every pass can be decided
+    const auto desc = context.parameter_descs.find(
+        {seq_request->getID(), ParameterType::kPassSeq});
+    if (desc == context.parameter_descs.cend() ||
+        desc->type != ParameterType::kPassSeq || context.pass_order.empty()) {
+      return std::unique_ptr<DecisionBase>(new NativeDecision());
+    }
+    PassSeq pass_seq;
+    for (const auto &pass : context.pass_order) {
+      auto run_pass = decidePass(context, pass, features, row);
+      if (!run_pass) {
+        return std::unique_ptr<DecisionBase>(new NativeDecision());
+      }
+      if (run_pass.get()) {
+        pass_seq.push_back(pass);
+      }
+    }
+    return std::unique_ptr<PassSeqDecision>(new PassSeqDecision(pass_seq));
+  }
+
+  assert((request_type == DecisionRequestType::kBool ||
+          request_type == DecisionRequestType::kRange) &&
+         "Unhandled decision request type");
+
+  unsigned param_id;
+  ParameterType param_type;
+
+  // The ID is the identifier of the tunable parameter
+  if (request_type == DecisionRequestType::kBool) {
+    const auto *bool_request =
+        static_cast<const BoolDecisionRequest *>(&request);
+    param_id = bool_request->getID();
+
+    assert(bool_request->getDecisionType() == DecisionType::kBool);
+    param_type = ParameterType::kBool;
+  } else if (request_type == DecisionRequestType::kRange) {
+    const auto *range_request =
+        static_cast<const RangeDecisionRequest *>(&request);
+    param_id = range_request->getID();
+
+    assert(range_request->getDecisionType() == DecisionType::kRange);
+    param_type = ParameterType::kRange;
+  } else {
+    assert(0 && "Unreachable");
+  }
+
+  // Check if we have a classifier tree for this parameter.
+  const auto res = context.parameter_classifier_trees.find(param_id);
+  if (res == context.parameter_classifier_trees.cend()) {
+    return std::unique_ptr<DecisionBase>(new NativeDecision());
+  }
+
+  // Evaluate the flattened tree directly where there is one, otherwise fall
+  // back to running the tree through the C5.0 library.
+  int predict_res;
+  const auto flat_tree = context.parameter_flat_trees.find(param_id);
+  if (flat_tree != context.parameter_flat_trees.cend()) {
+    predict_res = static_cast<int>(flat_tree->second.classify(row));
+  } else {
+    predict_res = predictFromTreeData(
+        context, "parameter_" + std::to_string(param_id),
+        param_type == ParameterType::kBool ? "t, f." : "continuous.",
+        res->second, features);
+  }
 
   // Get the value of the returned decision
-  // FIXME: Call out to the C5.0 classifier
   switch (request_type) {
   case DecisionRequestType::kBool: {
     const auto *bool_request =
@@ -477,6 +1805,190 @@ C5Driver::makeDecision(const DecisionRequestBase &request,
   }
 }
 
+
+/// \class C5PreparedModel
+///
+/// \brief Model for the C5.0 machine learner, holding the context parsed
+/// from a training blob.
+class C5PreparedModel : public IPreparedModel {
+public:
+  C5PreparedModel(std::unique_ptr<C5Context> context)
+      : m_context(std::move(context)),
+        m_feature_column(getFeatureColumns(m_context->feature_descs)) {}
+
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features) const override {
+    // Encode the features for the flattened trees once for all of the
+    // requests
+    std::vector<double> row(m_context->feature_descs.size(),
+                            std::numeric_limits<double>::quiet_NaN());
+    encodeC5Features(features, m_feature_column, row.begin());
+
+    std::vector<std::unique_ptr<DecisionBase>> decisions;
+    decisions.reserve(requests.size());
+    for (const auto *request : requests) {
+      decisions.push_back(decide(*m_context, *request, features, row));
+    }
+    return decisions;
+  }
+
+private:
+  /// Context parsed from the training blob
+  std::unique_ptr<C5Context> m_context;
+
+  /// Column of each feature in the rows evaluated by the flattened trees
+  std::map<unsigned, size_t> m_feature_column;
+};
+
+} // end of anonymous namespace
+
+C5Driver::C5Driver() : IMachineLearner(), m_training_config() {}
+
+C5Driver::~C5Driver() {}
+
+bool C5Driver::setTrainingConfig(std::string config_path) {
+  auto config = util::readConfigFile(config_path);
+  if (!config) {
+    return false;
+  }
+  TrainingConfig training_config;
+  for (const auto &entry : config.get()) {
+    const std::string &key = entry.first;
+    const std::string &value = entry.second;
+    if (key == "sample") {
+      auto sample = util::parseDouble(value);
+      if (!sample || !(sample.get() >= 0.0 && sample.get() < 1.0)) {
+        MAGEEC_ERR(config_path << ": 'sample' must be at least 0 and less "
+                                  "than 1");
+        return false;
+      }
+      training_config.sample = sample.get();
+    } else if (key == "minCases") {
+      auto min_cases =
+          util::parseConfigCount(config_path, key, value, 1, 1000000);
+      if (!min_cases) {
+        return false;
+      }
+      training_config.min_cases = min_cases.get();
+    } else if (key == "CF") {
+      auto cf = util::parseDouble(value);
+      if (!cf || !(cf.get() > 0.0 && cf.get() <= 1.0)) {
+        MAGEEC_ERR(config_path << ": 'CF' must be greater than 0 and at most "
+                                  "1");
+        return false;
+      }
+      training_config.cf = cf.get();
+    } else if (key == "winnow") {
+      if (value != "true" && value != "false") {
+        MAGEEC_ERR(config_path << ": 'winnow' must be 'true' or 'false'");
+        return false;
+      }
+      training_config.winnow = value == "true";
+    } else if (key == "trials") {
+      auto trials = util::parseConfigCount(config_path, key, value, 1, 100);
+      if (!trials) {
+        return false;
+      }
+      training_config.trials = trials.get();
+    } else if (key == "jobs") {
+      auto jobs = util::parseConfigCount(config_path, key, value, 1, 256);
+      if (!jobs) {
+        return false;
+      }
+      training_config.jobs = jobs.get();
+    } else {
+      MAGEEC_ERR(config_path << ": Unknown C5.0 training option '" << key
+                             << "'");
+      return false;
+    }
+  }
+  m_training_config = training_config;
+  return true;
+}
+
+std::unique_ptr<DecisionBase>
+C5Driver::makeDecision(const DecisionRequestBase &request,
+                       const FeatureSet &features,
+                       const std::vector<uint8_t> &blob) const {
+  return std::move(makeDecisions({&request}, features, blob)[0]);
+}
+
+std::vector<std::unique_ptr<DecisionBase>> C5Driver::makeDecisions(
+    const std::vector<const DecisionRequestBase *> &requests,
+    const FeatureSet &features, const std::vector<uint8_t> &blob) const {
+  // Deserialize the machine learner data from the blob once for all of the
+  // requests
+  return prepare(blob)->makeDecisions(requests, features);
+}
+
+std::unique_ptr<IPreparedModel>
+C5Driver::prepare(const std::vector<uint8_t> &blob) const {
+  return std::unique_ptr<IPreparedModel>(
+      new C5PreparedModel(C5Context::fromBlob(blob)));
+}
+
+util::Option<NativeModelSource>
+C5Driver::generateNativeModel(const std::vector<uint8_t> &blob) const {
+  std::unique_ptr<C5Context> context = C5Context::fromBlob(blob);
+
+  // The row of the native model has the same columns as the rows evaluated
+  // by the flattened trees.
+  NativeModelSource source;
+  for (auto feat : context->feature_descs) {
+    source.features.push_back(feat.id);
+  }
+
+  std::ostringstream definitions;
+  std::ostringstream decide;
+  for (auto param : context->parameter_descs) {
+    if (param.type != ParameterType::kBool ||
+        !context->parameter_classifier_trees.count(param.id)) {
+      continue;
+    }
+    const auto flat_tree = context->parameter_flat_trees.find(param.id);
+    if (flat_tree == context->parameter_flat_trees.cend()) {
+      MAGEEC_WARN("Classifier tree for parameter " << param.id << " could "
+                  "not be flattened, it will not be decided by the native "
+                  "model");
+      continue;
+    }
+
+    std::string name = "parameter_" + std::to_string(param.id);
+    flat_tree->second.emitNative(definitions, name);
+
+    // The class is an index into 't,f', starting from 1
+    size_t index = source.parameters.size();
+    source.parameters.push_back(param.id);
+    decide << "  values[" << index << "] = " << name
+           << "(row) == 1 ? 1 : 0;\n"
+           << "  decided[" << index << "] = 1;\n";
+  }
+  source.definitions = definitions.str();
+  source.decide = decide.str();
+  return source;
+}
+
+util::Option<std::set<unsigned>>
+C5Driver::getUsedFeatures(const std::vector<uint8_t> &blob) const {
+  std::unique_ptr<C5Context> context = C5Context::fromBlob(blob);
+
+  // Only the features tested by a classifier are used. Where winnowing is
+  // enabled, this excludes every feature which was winnowed.
+  std::set<unsigned> used;
+  for (const auto &tree : context->parameter_classifier_trees) {
+    if (!addTreeFeatures(tree.second, used)) {
+      return nullptr;
+    }
+  }
+  for (const auto &tree : context->pass_classifier_trees) {
+    if (!addTreeFeatures(tree.second, used)) {
+      return nullptr;
+    }
+  }
+  return used;
+}
+
 const std::vector<uint8_t>
 C5Driver::train(std::set<FeatureDesc> feature_descs,
                 std::set<ParameterDesc> parameter_descs,
@@ -522,353 +2034,220 @@ C5Driver::train(std::set<FeatureDesc> feature_descs,
     }
   }
 
-  // Create a classifier trained for each tunable parameter in turn.
-  MAGEEC_DEBUG("Training for tunable parameters");
-
-  unsigned curr_param = 0;
-  unsigned param_count = static_cast<unsigned>(parameter_descs.size());
+  // Lay out the features of every result as a dense matrix, with one column
+  // per feature in ascending order of feature id. These rows are shared by
+  // all of the classifiers trained below, and are passed to C5.0 directly
+  // rather than being formatted as .data text and parsed again.
+  MAGEEC_DEBUG("Building feature matrix");
+
+  std::map<unsigned, size_t> feature_column = getFeatureColumns(feature_descs);
+  const size_t n_features = feature_column.size();
+
+  std::vector<double> feature_matrix;
+  feature_matrix.reserve(result_map.size() * n_features);
+  std::vector<ParameterSet> result_parameters;
+  result_parameters.reserve(result_map.size());
+
+  for (auto res : result_map) {
+    // Features with no value in this result are left missing
+    size_t row = feature_matrix.size();
+    feature_matrix.resize(row + n_features,
+                          std::numeric_limits<double>::quiet_NaN());
+    encodeC5Features(res.second.getFeatures(), feature_column,
+                     feature_matrix.begin() + static_cast<std::ptrdiff_t>(row));
+    result_parameters.push_back(res.second.getParameters());
+  }
 
-  // Train for all of the simple parameter types. Training for pass sequences
-  // is a little more complicated and is handled separately later.
+  // Train each classifier with the configured options, reporting the time
+  // taken to train each of them.
+  const TrainingConfig &config = m_training_config;
+  const auto train_start = std::chrono::steady_clock::now();
+  auto trainClassifier = [&config](const std::string &names_str,
+                                   std::vector<double> &cases, int n_cases,
+                                   int default_min_cases,
+                                   const std::string &target) {
+    int min_cases = config.min_cases != 0
+                        ? static_cast<int>(config.min_cases)
+                        : default_min_cases;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> tree_blob = trainTree(
+        names_str, cases, n_cases, min_cases, static_cast<int>(config.trials),
+        config.winnow ? 1 : 0, config.sample, config.cf);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    MAGEEC_STATUS("Trained the classifier for " << target << " from "
+                  << n_cases << " cases in " << elapsed.count() << "s");
+    return tree_blob;
+  };
+
+  // The classifiers for the simple parameter types are trained first.
+  // Training for pass sequences is a little more complicated, and has a
+  // classifier for each pass.
+  std::vector<ParameterDesc> tree_params;
   for (auto param : parameter_descs) {
-    if (param.type == ParameterType::kPassSeq) {
-      continue;
+    if (param.type != ParameterType::kPassSeq) {
+      tree_params.push_back(param);
     }
-
-    MAGEEC_DEBUG("Training parameter " << curr_param << " of "
-                 << param_count - 1);
-    curr_param++;
-
-    // Output names file (columns for classifier) for this parameter
-    MAGEEC_DEBUG("Building .names file data");
-    std::ostringstream names_data;
-
-    // Output the target parameter first
-    // TODO: Comment containing parameter description
-    names_data << "parameter_" << param.id << ".\n";
-
-    // Output columns for all of the features which we have seen in the
-    // training set.
-    // TODO: Add comment containing feature description
-    for (auto feat : feature_descs) {
-      names_data << "feature_" << feat.id << ": ";
-
-      switch (feat.type) {
-      case FeatureType::kBool:
-        names_data << "t, f.";
-        break;
-      case FeatureType::kInt:
-        names_data << "continuous.";
+  }
+  std::vector<std::string> tree_passes(passes.begin(), passes.end());
+
+  // Find the pass sequence of each result. Results without one are not used
+  // to train the classifiers for passes.
+  std::vector<const PassSeq *> result_pass_seqs;
+  std::vector<PassSeq> pass_seqs;
+  for (const auto &parameters : result_parameters) {
+    const PassSeq *pass_seq = nullptr;
+    for (const auto &p : parameters) {
+      if (p->getType() == ParameterType::kPassSeq) {
+        pass_seq = &static_cast<PassSeqParameter *>(p.get())->getValue();
+        pass_seqs.push_back(*pass_seq);
         break;
       }
-      names_data << '\n';
     }
-    names_data << '\n';
-
-    // Output a column for the target parameter
-    names_data << "parameter_" << param.id << ": ";
-    switch (param.type) {
-    case ParameterType::kBool:
-      names_data << "t, f.";
-      break;
-    case ParameterType::kRange:
-      names_data << "continuous.";
-      break;
-    default:
-      break;
-    }
-    names_data << '\n';
-
-    // For the current parameter, generate the values in the .data file
-    // containing all of the training data
-    MAGEEC_DEBUG("Building .data file data");
-    std::ostringstream data_data;
-
-    for (auto res : result_map) {
-      ParameterSet parameters = res.second.getParameters();
-      FeatureSet features = res.second.getFeatures();
-
+    result_pass_seqs.push_back(pass_seq);
+  }
+  context->pass_order = mergePassSequences(pass_seqs, passes);
+
+  auto trainParameter = [&](size_t index) {
+    const ParameterDesc &param = tree_params[index];
+    MAGEEC_DEBUG("Training parameter " << index << " of "
+                 << tree_params.size() - 1);
+
+    std::string target = "parameter_" + std::to_string(param.id);
+    std::string names_str = buildNamesData(
+        target, feature_descs,
+        param.type == ParameterType::kBool ? "t, f." : "continuous.");
+
+    // For the current parameter, build the matrix of training cases. Each
+    // case is a row of the feature matrix, with the value of the parameter
+    // appended as the target column.
+    MAGEEC_DEBUG("Building training cases");
+    std::vector<double> cases;
+    int n_cases = 0;
+
+    for (size_t i = 0; i < result_parameters.size(); ++i) {
       // Check that this result has an entry for this parameter. If not then
       // skip as we can't use it for training.
-      // FIXME: Don't use a dumb linear search here
       ParameterBase *p = nullptr;
-      for (auto it : parameters) {
+      for (auto it : result_parameters[i]) {
         if (it->getID() == param.id) {
           p = it.get();
+          break;
         }
       }
       if (!p)
         continue;
-
-      for (auto feat : feature_descs) {
-        // Feature values are output in the order they appear in the feature
-        // description map (ascending order of feature id)
-        // FIXME: Don't use a dumb linear search here
-        FeatureBase *f = nullptr;
-        for (auto it : features) {
-          if (it->getID() == feat.id) {
-            f = it.get();
-          }
-        }
-
-        if (f) {
-          // The result has a value for this feature, output it
-          assert(f->getType() == feat.type);
-
-          switch (feat.type) {
-          case FeatureType::kBool: {
-            bool value = static_cast<BoolFeature *>(f)->getValue();
-            data_data << (value ? "t" : "f");
-            break;
-          }
-          case FeatureType::kInt: {
-            int64_t value = static_cast<IntFeature *>(f)->getValue();
-            data_data << value;
-            break;
-          }
-          }
-          data_data << ",";
-        } else {
-          // No value for this feature for this result.
-          data_data << "?,";
-        }
-      }
-      // Output the parameter value last.
       assert(p->getType() == param.type);
 
+      auto row = feature_matrix.cbegin() + i * n_features;
+      cases.insert(cases.end(), row, row + n_features);
+
       switch (param.type) {
       case ParameterType::kBool: {
         bool value = static_cast<BoolParameter *>(p)->getValue();
-        data_data << (value ? "t" : "f");
+        cases.push_back(value ? 1.0 : 2.0);
         break;
       }
       case ParameterType::kRange: {
         int64_t value = static_cast<RangeParameter *>(p)->getValue();
-        data_data << value;
+        cases.push_back(static_cast<double>(value));
         break;
       }
       default:
+        assert(0 && "Unreachable");
         break;
       }
-      data_data << "\n";
+      n_cases++;
     }
 
-    // Now we have .names and .data files, run the classifier over them to
-    // generate a tree
+    // Now we have .names data and the training cases, run the classifier
+    // over them to generate a tree
     MAGEEC_DEBUG("Running the C5.0 classifier for parameter "
                  << std::to_string(param.id));
+    return trainClassifier(names_str, cases, n_cases, 1, target);
+  };
 
-    // input files as buffers
-    std::string names_str = names_data.str();
-    std::string data_str = data_data.str();
-
-    char *namesv = (char*)malloc(names_str.size() + 1);
-    strcpy(namesv, names_str.c_str());
-    char *datav = (char*)malloc(data_str.size() + 1);
-    strcpy(datav, data_str.c_str());
-    char *costv = (char*)malloc(1); costv[0] = '\0';
-    // default parameters for C5.0
-    int subset = 1;
-    int rules = 0;
-    int utility = 0;
-    int trials = 1;
-    int winnow = 0;
-    double sample = 0.0;
-    int seed = 0xbeef;
-    int noGlobalPruning = 0;
-    double CF = 0.25;
-    int minCases = 1;
-    int fuzzyThreshold = 0;
-    int earlyStopping = 1;
-    // output parameters
-    char *treev = nullptr;
-    char *rulesv = nullptr;
-    char *outputv = nullptr;
-
-    c50(&namesv, &datav, &costv, &subset, &rules, &utility, &trials,
-        &winnow, &sample, &seed, &noGlobalPruning, &CF, &minCases,
-        &fuzzyThreshold, &earlyStopping, &treev, &rulesv, &outputv);
-
-    // free memory for all of the unused parameters
-    free(namesv);
-    free(datav);
-    if (rulesv != nullptr)
-      free(rulesv);
-    if (outputv != nullptr)
-      free(outputv);
-
-    // Retrieve the tree
-    assert(treev != nullptr);
-    std::vector<uint8_t> tree_blob;
-    tree_blob.resize(strlen(treev));
-    for (unsigned i = 0; i < strlen(treev); ++i)
-      tree_blob.data()[i] = treev[i];
-    // free the memory for the tree buffer
-    free(treev);
-
-    // save the tree for the current parameter
-    context->parameter_classifier_trees.insert(
-        std::make_pair(param.id, tree_blob));
-  }
-
-  MAGEEC_DEBUG("Training passes");
-
-  // Create a classifier trained for each of the input passes in turn
-  for (auto pass : passes) {
+  auto trainPass = [&](size_t index) {
+    const std::string &pass = tree_passes[index];
     MAGEEC_DEBUG("Training for pass '" << pass << "'");
 
-    // Output names file (columns for classifier) for this pass
-    MAGEEC_DEBUG("Building .names file data");
-    std::ostringstream names_data;
+    std::string names_str =
+        buildNamesData("pass_" + pass, feature_descs, "t, f.");
 
-    // Output the target pass first
-    // TODO: Comment containing pass description
-    names_data << "pass_" << pass << ".\n";
+    // For the current pass, build the matrix of training cases, with whether
+    // the pass was run as the target column.
+    MAGEEC_DEBUG("Building training cases");
+    std::vector<double> cases;
+    cases.reserve(result_parameters.size() * (n_features + 1));
+    int n_cases = 0;
 
-    // Output columns for all of the features which we have seen in the
-    // training set.
-    // TODO: Add comment containing feature description
-    for (auto feat : feature_descs) {
-      names_data << "feature_" << feat.id << ": ";
-
-      switch (feat.type) {
-      case FeatureType::kBool:
-        names_data << "t, f.";
-        break;
-      case FeatureType::kInt:
-        names_data << "continuous.";
-        break;
-      }
-      names_data << '\n';
-    }
-    names_data << '\n';
-
-    // Output a column for the target pass
-    names_data << "pass_" << pass << ": t, f.\n";
-
-    // For the current pass, generate the values in the .data file
-    // containing all of the training data
-    MAGEEC_DEBUG("Building .data file data");
-    std::ostringstream data_data;
-
-    for (auto res : result_map) {
-      FeatureSet features = res.second.getFeatures();
-      ParameterSet parameters = res.second.getParameters();
-
-      // Find the parameter in the parameter set which holds the pass
-      // sequence.
-      // TODO: Don't use a linear search to do this?
-      std::vector<std::string> pass_seq;
-      for (auto p : parameters) {
-        if (p->getType() == ParameterType::kPassSeq) {
-          pass_seq = static_cast<PassSeqParameter *>(p.get())->getValue();
-          break;
-        }
+    for (size_t i = 0; i < result_parameters.size(); ++i) {
+      if (!result_pass_seqs[i]) {
+        continue;
       }
-      assert(pass_seq.size());
-
-      for (auto feat : feature_descs) {
-        // Feature values are output in the order they appear in the feature
-        // description map (ascending order of feature id)
-        // FIXME: Don't use a dumb linear search here
-        FeatureBase *f = nullptr;
-        for (auto it : features) {
-          if (it->getID() == feat.id) {
-            f = it.get();
-          }
-        }
+      const PassSeq &pass_seq = *result_pass_seqs[i];
 
-        if (f) {
-          // The result has a value for this feature, output it
-          assert(f->getType() == feat.type);
+      auto row = feature_matrix.cbegin() + i * n_features;
+      cases.insert(cases.end(), row, row + n_features);
 
-          switch (feat.type) {
-          case FeatureType::kBool: {
-            bool value = static_cast<BoolFeature *>(f)->getValue();
-            data_data << (value ? "t" : "f");
-            break;
-          }
-          case FeatureType::kInt: {
-            int64_t value = static_cast<IntFeature *>(f)->getValue();
-            data_data << value;
-            break;
-          }
-          }
-          data_data << ",";
-        } else {
-          // No value for this feature for this result.
-          data_data << "?,";
-        }
-      }
-      // Output whether the pass was run or not last.
-      bool run_pass = false;
-      for (auto p : pass_seq) {
-        if (p == pass) {
-          run_pass = true;
-          break;
-        }
-      }
-      data_data << (run_pass ? "t" : "f");
-      data_data << "\n";
+      bool run_pass = std::find(pass_seq.begin(), pass_seq.end(), pass) !=
+                      pass_seq.end();
+      cases.push_back(run_pass ? 1.0 : 2.0);
+      n_cases++;
     }
 
-    // Now we have .names and .data files, run the classifier over them to
-    // generate a tree
+    // Now we have .names data and the training cases, run the classifier
+    // over them to generate a tree
     MAGEEC_DEBUG("Running the C5.0 classifier for pass " << pass);
+    return trainClassifier(names_str, cases, n_cases, 2, "pass_" + pass);
+  };
+
+  // The classifiers are independent, so several can be trained at once
+  MAGEEC_DEBUG("Training for tunable parameters and passes");
+  std::vector<std::vector<uint8_t>> trees = trainTrees(
+      tree_params.size() + tree_passes.size(), config.jobs,
+      [&](size_t index) {
+        return index < tree_params.size()
+                   ? trainParameter(index)
+                   : trainPass(index - tree_params.size());
+      });
+
+  // save the tree for each parameter, along with its flattened form if it
+  // has one
+  for (size_t i = 0; i < tree_params.size(); ++i) {
+    const ParameterDesc &param = tree_params[i];
+    const std::vector<uint8_t> &tree_blob = trees[i];
+    if (param.type == ParameterType::kBool) {
+      auto flat_tree =
+          C5FlatTree::fromTreeData(tree_blob, feature_descs, bool_value_names);
+      if (flat_tree) {
+        context->parameter_flat_trees.insert(
+            std::make_pair(param.id, flat_tree.get()));
+      } else {
+        MAGEEC_WARN("Unable to flatten the classifier tree for parameter "
+                    << param.id);
+      }
+    }
+    context->parameter_classifier_trees.insert(
+        std::make_pair(param.id, tree_blob));
+  }
 
-    // input files as buffers
-    std::string names_str = names_data.str();
-    std::string data_str = data_data.str();
-
-    char *namesv = (char*)malloc(names_str.size() + 1);
-    strcpy(namesv, names_str.c_str());
-    char *datav = (char*)malloc(data_str.size() + 1);
-    strcpy(datav, data_str.c_str());
-    char *costv = (char*)malloc(1); costv[0] = '\0';
-    // default parameters for C5.0
-    int subset = 1;
-    int rules = 0;
-    int utility = 0;
-    int trials = 1;
-    int winnow = 0;
-    double sample = 0.0;
-    int seed = 0xbeef;
-    int noGlobalPruning = 0;
-    double CF = 0.25;
-    int minCases = 2;
-    int fuzzyThreshold = 0;
-    int earlyStopping = 1;
-    // output parameters
-    char *treev = nullptr;
-    char *rulesv = nullptr;
-    char *outputv = nullptr;
-
-    c50(&namesv, &datav, &costv, &subset, &rules, &utility, &trials,
-        &winnow, &sample, &seed, &noGlobalPruning, &CF, &minCases,
-        &fuzzyThreshold, &earlyStopping, &treev, &rulesv, &outputv);
-
-    // free memory for all of the unused parameters
-    free(namesv);
-    free(datav);
-    if (rulesv != nullptr)
-      free(rulesv);
-    if (outputv != nullptr)
-      free(outputv);
-
-    // Retrieve the tree
-    assert(treev != nullptr);
-    std::vector<uint8_t> tree_blob;
-    tree_blob.resize(strlen(treev));
-    for (unsigned i = 0; i < strlen(treev); ++i)
-      tree_blob.data()[i] = treev[i];
-    // free the memory for the tree buffer
-    free(treev);
-
-    // save the tree for the current parameter
-    context->pass_classifier_trees.insert(
-        std::make_pair(pass, tree_blob));
-  }
-  MAGEEC_DEBUG("Training finished");
+  // save the tree for each pass, along with its flattened form
+  for (size_t i = 0; i < tree_passes.size(); ++i) {
+    const std::string &pass = tree_passes[i];
+    const std::vector<uint8_t> &tree_blob = trees[tree_params.size() + i];
+    auto flat_tree =
+        C5FlatTree::fromTreeData(tree_blob, feature_descs, bool_value_names);
+    if (flat_tree) {
+      context->pass_flat_trees.insert(std::make_pair(pass, flat_tree.get()));
+    } else {
+      MAGEEC_WARN("Unable to flatten the classifier tree for pass " << pass);
+    }
+    context->pass_classifier_trees.insert(std::make_pair(pass, tree_blob));
+  }
+  const std::chrono::duration<double> train_elapsed =
+      std::chrono::steady_clock::now() - train_start;
+  MAGEEC_STATUS("Training finished in " << train_elapsed.count() << "s");
 
   // Serialize the context to a blob
   return context->toBlob();
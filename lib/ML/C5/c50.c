@@ -10,6 +10,11 @@ extern void c50main();
 extern void sample(double *outputv);
 extern void FreeCases(void);
 
+/* Dense training cases, see c50_cases.  These are not touched by
+ * initglobals so that they survive the reset at the start of c50. */
+extern double *CaseMatrix;
+extern int CaseMatrixRows;
+
 void c50(char **namesv,
          char **datav,
          char **costv,
@@ -66,13 +71,17 @@ void c50(char **namesv,
     fprintf(stderr, "undefined.names already exists");
 	}
 
-    // Create a strbuf using *datav and register it as "undefined.data"
-    STRBUF *sb_datav = strbuf_create_full(*datav, strlen(*datav));
-    // XXX why is sb_datav copied? was that part of my debugging?
-    // XXX or is this the cause of the leak?
-	if (rbm_register(strbuf_copy(sb_datav), "undefined.data", 0) < 0) {
-		fprintf(stderr, "undefined data already exists");
-	}
+    // Create a strbuf using *datav and register it as "undefined.data".
+    // When the cases were supplied through c50_cases there is no data
+    // text to register.
+    if (CaseMatrix == NULL) {
+        STRBUF *sb_datav = strbuf_create_full(*datav, strlen(*datav));
+        // XXX why is sb_datav copied? was that part of my debugging?
+        // XXX or is this the cause of the leak?
+	    if (rbm_register(strbuf_copy(sb_datav), "undefined.data", 0) < 0) {
+		    fprintf(stderr, "undefined data already exists");
+	    }
+    }
 
     // Create a strbuf using *costv and register it as "undefined.costs"
     if (strlen(*costv) > 0) {
@@ -144,6 +153,47 @@ void c50(char **namesv,
     initglobals();
 }
 
+/*
+ * Equivalent to c50, but the training cases are provided as a dense
+ * matrix of *ncases rows rather than as the text of a data file. Each
+ * row holds one value per attribute declared in *namesv, followed by
+ * the class number when the names do not declare an explicit class
+ * attribute. Discrete values are the 1-based index of the value in the
+ * attribute's declaration, and NaN denotes a missing value.
+ */
+void c50_cases(char **namesv,
+               double *casev,
+               int *ncases,
+               char **costv,
+               int *subset,
+               int *rules,
+               int *utility,
+               int *trials,
+               int *winnow,
+               double *sample,
+               int *seed,
+               int *noGlobalPruning,
+               double *CF,
+               int *minCases,
+               int *fuzzyThreshold,
+               int *earlyStopping,
+               char **treev,
+               char **rulesv,
+               char **outputv)
+{
+    char *datav = "";
+
+    CaseMatrix = casev;
+    CaseMatrixRows = *ncases;
+
+    c50(namesv, &datav, costv, subset, rules, utility, trials, winnow,
+        sample, seed, noGlobalPruning, CF, minCases, fuzzyThreshold,
+        earlyStopping, treev, rulesv, outputv);
+
+    CaseMatrix = NULL;
+    CaseMatrixRows = 0;
+}
+
 void predictions(char **casev,
                  char **namesv,
                  char **treev,
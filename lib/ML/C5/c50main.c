@@ -87,8 +87,15 @@ int c50main()
 
     /*  Read data file  */
 
-    if ( ! (F = GetFile(".data", "r")) ) Error(NOFILE, "", "");
-    GetData(F, true, false);
+    if ( CaseMatrix )
+    {
+	GetDataMatrix(true);
+    }
+    else
+    {
+	if ( ! (F = GetFile(".data", "r")) ) Error(NOFILE, "", "");
+	GetData(F, true, false);
+    }
     fprintf(Of, TX_ReadData(MaxCase+1, MaxAtt, FileStem));
 
     if ( XVAL && (F = GetFile(".test", "r")) )
@@ -168,13 +175,21 @@ int c50main()
 
 	Evaluate(CMINFO | USAGEINFO);
 
-	if ( (F = GetFile(( SAMPLE ? ".data" : ".test" ), "r")) )
+	if ( ( SAMPLE && CaseMatrix ) ||
+	     (F = GetFile(( SAMPLE ? ".data" : ".test" ), "r")) )
 	{
 	    NotifyStage(READTEST);
 	    fprintf(Of, "\n");
 
 	    FreeData();
-	    GetData(F, false, false);
+	    if ( SAMPLE && CaseMatrix )
+	    {
+		GetDataMatrix(false);
+	    }
+	    else
+	    {
+		GetData(F, false, false);
+	    }
 
 	    fprintf(Of, T_EvalTest, MaxCase+1);
 
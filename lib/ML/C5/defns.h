@@ -509,6 +509,8 @@ DataRec	    GetDataRec(FILE *Df, Boolean Train);
 DataRec	    PredictGetDataRec(FILE *Df, Boolean Train);
 DataRec	    PredictGetDataRec(FILE *Df, Boolean Train);
 CaseNo	    CountData(FILE *Df);
+void	    GetDataMatrix(Boolean Train);
+DataRec	    GetMatrixDataRec(double *Row);
 int	    StoreIVal(String s);
 void	    FreeData(void);
 void	    CheckValue(DataRec Case, Attribute Att);
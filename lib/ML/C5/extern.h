@@ -92,6 +92,9 @@ extern	DataRec		*Case;
 
 extern	DataRec		*SaveCase;
 
+extern	double		*CaseMatrix;
+extern	CaseNo		CaseMatrixRows;
+
 extern	String		FileStem;
 
 extern	Tree		*Raw,
@@ -123,7 +126,7 @@ extern	float		*Gain,
 			*Info,
 			*EstMaxGR;
 
-double			*ClassSum;
+extern double		*ClassSum;
 
 extern	ContValue	*Bar;
 
@@ -618,6 +618,230 @@ DataRec PredictGetDataRec(FILE *Df, Boolean Train)
 }
 
 
+/*************************************************************************/
+/*									 */
+/*	Read raw cases from the dense matrix CaseMatrix rather than	 */
+/*	from a data file.  This is the equivalent of GetData for	 */
+/*	callers which already hold the cases in numeric form, and	 */
+/*	avoids formatting and re-parsing every value as text.		 */
+/*									 */
+/*	Each row holds one value per attribute in attribute order,	 */
+/*	followed by the class number when there is no class attribute.	 */
+/*	Continuous values are stored directly, discrete values hold	 */
+/*	the (1-based) position of the value in the attribute's list	 */
+/*	of explicit values, and NaN marks a missing value.		 */
+/*									 */
+/*************************************************************************/
+
+
+void GetDataMatrix(Boolean Train)
+/*   -------------  */
+{
+    DataRec	DVec;
+    CaseNo	CaseSpace, Row, Cols, WantTrain, LeftTrain, WantTest, LeftTest;
+    Boolean	FirstIgnore=true, SelectTrain;
+
+    LineNo = 0;
+    SuppressErrorMessages = SAMPLE && ! Train;
+
+    MaxCase = MaxLabel = CaseSpace = 0;
+    Case = Alloc(1, DataRec);	/* for error reporting */
+
+    Cols = MaxAtt + ( ClassAtt ? 0 : 1 );
+
+    if ( SAMPLE )
+    {
+	if ( Train )
+	{
+	    SampleFrom = CaseMatrixRows;
+	}
+	ResetKR(KRInit);
+
+	WantTrain = SampleFrom * SAMPLE + 0.5;
+	LeftTrain = SampleFrom;
+
+	WantTest  = ( SAMPLE < 0.5 ? WantTrain : SampleFrom - WantTrain );
+	LeftTest  = SampleFrom - WantTrain;
+    }
+
+    ForEach(Row, 0, CaseMatrixRows-1)
+    {
+	/*  Make sure there is room for another case  */
+
+	if ( MaxCase >= CaseSpace )
+	{
+	    CaseSpace += Inc;
+	    Realloc(Case, CaseSpace+1, DataRec);
+	}
+
+	if ( ! (DVec = GetMatrixDataRec(CaseMatrix + (size_t) Row * Cols)) )
+	{
+	    continue;
+	}
+
+	/*  Check whether to include if we are sampling (see GetData)  */
+
+	if ( SAMPLE )
+	{
+	    SelectTrain = KRandom() < WantTrain / (float) LeftTrain--;
+
+	    if ( SelectTrain )
+	    {
+		WantTrain--;
+	    }
+
+	    if ( SelectTrain != Train ||
+		 ( ! Train && AltRandom >= WantTest / (float) LeftTest-- ) )
+	    {
+		FreeLastCase(DVec);
+		continue;
+	    }
+
+	    if ( ! Train )
+	    {
+		WantTest--;
+	    }
+	}
+
+	/*  Ignore cases with unknown class  */
+
+	if ( (Class(DVec) & 077777777) > 0 )
+	{
+	    Case[MaxCase] = DVec;
+	    MaxCase++;
+	}
+	else
+	{
+	    if ( FirstIgnore && Of )
+	    {
+		fprintf(Of, T_IgnoreBadClass);
+		FirstIgnore = false;
+	    }
+
+	    FreeLastCase(DVec);
+	}
+    }
+
+    MaxCase--;
+}
+
+
+
+/*************************************************************************/
+/*									 */
+/*	Build a case from one row of a dense case matrix.  The row	 */
+/*	layout is described above GetDataMatrix.			 */
+/*									 */
+/*************************************************************************/
+
+
+DataRec GetMatrixDataRec(double *Row)
+/*      ----------------  */
+{
+    Attribute	Att;
+    DataRec	DVec;
+    double	V;
+    int		Dv;
+    ContValue	Cv;
+
+    Case[MaxCase] = DVec = NewCase();
+    ForEach(Att, 1, MaxAtt)
+    {
+	if ( AttDef[Att] )
+	{
+	    DVec[Att] = EvaluateDef(AttDef[Att], DVec);
+
+	    if ( Continuous(Att) )
+	    {
+		CheckValue(DVec, Att);
+	    }
+
+	    if ( SomeMiss )
+	    {
+		SomeMiss[Att] |= Unknown(DVec, Att);
+		SomeNA[Att]   |= NotApplic(DVec, Att);
+	    }
+
+	    continue;
+	}
+
+	V = Row[Att-1];
+
+	if ( Exclude(Att) )
+	{
+	    /*  Labels and ignored values have no numeric form  */
+
+	    DVal(DVec, Att) = UNKNOWN;
+	}
+	else
+	if ( isnan(V) )
+	{
+	    /*  Set marker to indicate missing value  */
+
+	    DVal(DVec, Att) = UNKNOWN;
+	    if ( SomeMiss ) SomeMiss[Att] = true;
+	}
+	else
+	if ( Discrete(Att) )
+	{
+	    /*  Every attribute except the class has "N/A" as its
+		first value, so skip over it  */
+
+	    Dv = (int) V + ( Att == ClassAtt ? 0 : 1 );
+	    if ( Dv < 1 || Dv > MaxAttVal[Att] )
+	    {
+		XError(BADATTVAL, AttName[Att], "");
+		Dv = UNKNOWN;
+	    }
+	    DVal(DVec, Att) = Dv;
+	}
+	else
+	{
+	    CVal(DVec, Att) = V;
+	    CheckValue(DVec, Att);
+	}
+    }
+
+    if ( ClassAtt )
+    {
+	if ( Discrete(ClassAtt) )
+	{
+	    Class(DVec) = XDVal(DVec, ClassAtt);
+	}
+	else
+	if ( Unknown(DVec, ClassAtt) || NotApplic(DVec, ClassAtt) )
+	{
+	    Class(DVec) = 0;
+	}
+	else
+	{
+	    /*  Find appropriate segment using class thresholds  */
+
+	    Cv = CVal(DVec, ClassAtt);
+
+	    for ( Dv = 1 ; Dv < MaxClass && Cv > ClassThresh[Dv] ; Dv++ )
+		;
+
+	    Class(DVec) = Dv;
+	}
+    }
+    else
+    {
+	V = Row[MaxAtt];
+	Dv = ( isnan(V) ? 0 : (int) V );
+	if ( Dv < 0 || Dv > MaxClass )
+	{
+	    XError(BADCLASS, "", "");
+	    Dv = 0;
+	}
+	Class(DVec) = Dv;
+    }
+
+    return DVec;
+}
+
+
+
 /*************************************************************************/
 /*                                                                       */
 /*      Count cases in data file					 */
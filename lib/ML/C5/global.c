@@ -119,6 +119,9 @@ DataRec		*Case=0;	/* data cases */
 
 DataRec		*SaveCase=0;
 
+double		*CaseMatrix=0;	/* dense cases supplied by c50_cases */
+CaseNo		CaseMatrixRows=0;/* number of rows in CaseMatrix */
+
 String		FileStem="undefined";
 
 /*************************************************************************/
@@ -0,0 +1,1334 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===------------------ MAGEEC Random Forest Classifier -------------------===//
+//
+// This implements the random forest machine learner. The training set is
+// laid out by column, and the values of each feature are binned once so that
+// the best threshold of a split can be found from a histogram of the bins.
+// The trees of every forest are grown in parallel on a pool of threads which
+// steal work from each other, and are flattened into a single array of
+// nodes.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mageec/AttributeSet.h"
+#include "mageec/Database.h"
+#include "mageec/Decision.h"
+#include "mageec/ML/RandomForest.h"
+#include "mageec/ML.h"
+#include "mageec/NativeML.h"
+#include "mageec/Result.h"
+#include "mageec/Types.h"
+#include "mageec/Util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mageec {
+
+namespace {
+
+/// Column of a leaf node
+const uint32_t kLeaf = 0xFFFFFFFF;
+
+/// \struct ForestNode
+///
+/// \brief Node of a flattened tree
+///
+/// The children of a split are adjacent, with the left child first, and
+/// always follow their parent. A case goes left if its feature is no greater
+/// than the threshold, or if the feature is missing and missing features go
+/// left.
+struct ForestNode {
+  /// Column of the feature tested by a split, or kLeaf for a leaf
+  uint32_t column;
+  /// Whether cases missing the feature go to the left child
+  uint32_t missing_left;
+  /// Index of the left child of a split, or the class of a leaf
+  uint32_t value;
+  /// Threshold of a split
+  double threshold;
+};
+
+/// \brief Kinds of target predicted by a forest
+enum class ForestKind : uint32_t { kBool = 0, kRange, kPass };
+
+/// \struct Forest
+///
+/// \brief The trees predicting a single parameter or pass
+struct Forest {
+  ForestKind kind;
+  /// Identifier of the parameter, or zero for a pass
+  unsigned id;
+  /// Name of the pass, or empty for a parameter
+  std::string pass;
+  /// Value of each class. Boolean targets have the classes false and true.
+  std::vector<int64_t> class_values;
+  /// Index of the root node of each tree
+  std::vector<uint64_t> roots;
+};
+
+/// \struct ForestModel
+///
+/// \brief The flattened forests of every parameter and pass
+struct ForestModel {
+  /// Identifier of the feature of each column, in ascending order
+  std::vector<unsigned> feature_ids;
+  /// Forest of each parameter and pass, with all of their trees sharing a
+  /// single array of nodes. The forests of passes are in the order the
+  /// passes are run.
+  std::vector<Forest> forests;
+  std::vector<ForestNode> nodes;
+  /// Identifier of each pass sequence parameter, decided from the forests of
+  /// the passes
+  std::vector<unsigned> pass_seq_ids;
+};
+
+/// \brief Find the class predicted by a single tree for a row
+inline uint32_t classifyTree(const ForestNode *nodes, uint64_t root,
+                             const double *row) {
+  const ForestNode *node = &nodes[root];
+  while (node->column != kLeaf) {
+    double value = row[node->column];
+    bool left = std::isnan(value) ? node->missing_left != 0
+                                  : value <= node->threshold;
+    node = &nodes[node->value + (left ? 0 : 1)];
+  }
+  return node->value;
+}
+
+/// \brief Find the class with the most votes of the trees of a forest
+///
+/// \param votes  Scratch space for the votes, of at least the number of
+/// classes of the forest
+/// \return The class, preferring the first of classes with equal votes
+uint32_t classifyForest(const ForestModel &model, const Forest &forest,
+                        const double *row, std::vector<uint32_t> &votes) {
+  const size_t n_classes = forest.class_values.size();
+  std::fill(votes.begin(), votes.begin() + n_classes, 0);
+  for (uint64_t root : forest.roots) {
+    votes[classifyTree(model.nodes.data(), root, row)]++;
+  }
+  uint32_t best = 0;
+  for (uint32_t c = 1; c < n_classes; ++c) {
+    if (votes[c] > votes[best]) {
+      best = c;
+    }
+  }
+  return best;
+}
+
+/// \class BinnedDataset
+///
+/// \brief Column-major training set, with the value of each feature replaced
+/// by the index of its bin.
+///
+/// Bin 0 holds the cases missing the feature. The remaining bins each cover
+/// the values up to and including their upper edge, so a split after bin t
+/// sends a case left exactly when its value is no greater than the upper
+/// edge of bin t.
+class BinnedDataset {
+public:
+  /// \brief Bin the columns of a row-major matrix of features
+  ///
+  /// Where a feature has no more distinct values than bins, each value has
+  /// its own bin. Otherwise the edges of the bins are quantiles of the
+  /// values.
+  BinnedDataset(const std::vector<double> &rows, size_t n_rows,
+                size_t n_columns, unsigned max_bins)
+      : m_n_rows(n_rows), m_edges(n_columns), m_bins(n_rows * n_columns, 0) {
+    assert(max_bins >= 2 && max_bins <= 255);
+    std::vector<double> values;
+    std::vector<double> distinct;
+    for (size_t c = 0; c < n_columns; ++c) {
+      values.clear();
+      for (size_t r = 0; r < n_rows; ++r) {
+        double value = rows[r * n_columns + c];
+        if (!std::isnan(value)) {
+          values.push_back(value);
+        }
+      }
+      std::sort(values.begin(), values.end());
+
+      std::vector<double> &edges = m_edges[c];
+      distinct.clear();
+      std::unique_copy(values.begin(), values.end(),
+                       std::back_inserter(distinct));
+      if (distinct.size() <= max_bins) {
+        edges = distinct;
+      } else {
+        for (size_t b = 1; b <= max_bins; ++b) {
+          double edge = values[b * values.size() / max_bins - 1];
+          if (edges.empty() || edge > edges.back()) {
+            edges.push_back(edge);
+          }
+        }
+      }
+
+      uint8_t *bins = &m_bins[c * n_rows];
+      for (size_t r = 0; r < n_rows; ++r) {
+        double value = rows[r * n_columns + c];
+        if (!std::isnan(value)) {
+          bins[r] = static_cast<uint8_t>(
+              1 + (std::lower_bound(edges.begin(), edges.end(), value) -
+                   edges.begin()));
+        }
+      }
+    }
+  }
+
+  size_t numRows() const { return m_n_rows; }
+  size_t numColumns() const { return m_edges.size(); }
+
+  /// \brief Number of bins holding values of a column, excluding the bin of
+  /// missing values
+  size_t numBins(size_t column) const { return m_edges[column].size(); }
+
+  /// \brief Upper edge of a bin of a column, numbered from 1
+  double edge(size_t column, size_t bin) const {
+    return m_edges[column][bin - 1];
+  }
+
+  /// \brief Bins of every row for a column
+  const uint8_t *bins(size_t column) const {
+    return &m_bins[column * m_n_rows];
+  }
+
+private:
+  size_t m_n_rows;
+  std::vector<std::vector<double>> m_edges;
+  std::vector<uint8_t> m_bins;
+};
+
+/// \struct TreeOptions
+///
+/// \brief Limits on the growth of a single tree
+struct TreeOptions {
+  unsigned max_depth;
+  unsigned min_leaf;
+  /// Features considered at each split
+  unsigned split_features;
+};
+
+/// \brief Gini impurity of a set of cases, scaled by their total weight
+inline double weightedGini(const double *counts, unsigned n_classes,
+                           double total) {
+  if (total <= 0.0) {
+    return 0.0;
+  }
+  double sum_squares = 0.0;
+  for (unsigned k = 0; k < n_classes; ++k) {
+    sum_squares += counts[k] * counts[k];
+  }
+  return total - sum_squares / total;
+}
+
+/// \brief Grow a single classification tree from a bootstrap sample
+///
+/// Each split is chosen from a random subset of the features, minimizing the
+/// Gini impurity of its children, with the missing values of the feature
+/// sent to whichever side gives the lower impurity.
+///
+/// \param data  The binned training set
+/// \param labels  Class of each row, or -1 where the row has no class
+/// \param n_classes  Number of classes
+/// \param options  Limits on the growth of the tree
+/// \param rng  Source of the sample and the features of each split
+/// \return The nodes of the tree, rooted at the first node
+std::vector<ForestNode> growTree(const BinnedDataset &data,
+                                 const std::vector<int32_t> &labels,
+                                 unsigned n_classes,
+                                 const TreeOptions &options,
+                                 std::mt19937_64 &rng) {
+  // Draw the bootstrap sample, weighting each row by the number of times it
+  // was drawn.
+  std::vector<uint32_t> labelled;
+  for (size_t r = 0; r < data.numRows(); ++r) {
+    if (labels[r] >= 0) {
+      labelled.push_back(static_cast<uint32_t>(r));
+    }
+  }
+  assert(!labelled.empty());
+  std::vector<uint32_t> weight(data.numRows(), 0);
+  for (size_t i = 0; i < labelled.size(); ++i) {
+    weight[labelled[rng() % labelled.size()]]++;
+  }
+  std::vector<uint32_t> rows;
+  for (uint32_t r : labelled) {
+    if (weight[r] != 0) {
+      rows.push_back(r);
+    }
+  }
+
+  std::vector<size_t> columns(data.numColumns());
+  for (size_t c = 0; c < columns.size(); ++c) {
+    columns[c] = c;
+  }
+  const size_t n_split_features =
+      std::min<size_t>(options.split_features, columns.size());
+
+  // Nodes are split depth first. Each node to be split covers a contiguous
+  // range of the sampled rows, which is partitioned between its children.
+  struct Pending {
+    size_t node;
+    size_t begin;
+    size_t end;
+    unsigned depth;
+  };
+  std::vector<ForestNode> nodes(1);
+  std::vector<Pending> pending = {{0, 0, rows.size(), 0}};
+  std::vector<double> counts(n_classes);
+  std::vector<double> histogram;
+  std::vector<double> left(n_classes);
+  std::vector<double> right(n_classes);
+
+  while (!pending.empty()) {
+    const Pending item = pending.back();
+    pending.pop_back();
+
+    std::fill(counts.begin(), counts.end(), 0.0);
+    double total = 0.0;
+    for (size_t i = item.begin; i < item.end; ++i) {
+      counts[static_cast<size_t>(labels[rows[i]])] += weight[rows[i]];
+      total += weight[rows[i]];
+    }
+    uint32_t majority = 0;
+    for (uint32_t k = 1; k < n_classes; ++k) {
+      if (counts[k] > counts[majority]) {
+        majority = k;
+      }
+    }
+    double impurity = weightedGini(counts.data(), n_classes, total);
+
+    // Find the split of a random subset of the features which most reduces
+    // the impurity of the node.
+    bool found = false;
+    size_t best_column = 0;
+    size_t best_bin = 0;
+    bool best_missing_left = false;
+    double best_impurity = impurity - 1E-9;
+    if (item.depth < options.max_depth && impurity > 0.0 &&
+        total >= 2.0 * options.min_leaf) {
+      for (size_t f = 0; f < n_split_features; ++f) {
+        std::swap(columns[f], columns[f + rng() % (columns.size() - f)]);
+        const size_t column = columns[f];
+        const size_t n_bins = data.numBins(column);
+        if (n_bins < 2) {
+          continue;
+        }
+
+        // Histogram of the classes of the rows in each bin
+        const uint8_t *bins = data.bins(column);
+        histogram.assign((n_bins + 1) * n_classes, 0.0);
+        for (size_t i = item.begin; i < item.end; ++i) {
+          uint32_t r = rows[i];
+          histogram[bins[r] * n_classes + static_cast<size_t>(labels[r])] +=
+              weight[r];
+        }
+        const double *missing = &histogram[0];
+        double missing_total = 0.0;
+        for (unsigned k = 0; k < n_classes; ++k) {
+          missing_total += missing[k];
+        }
+
+        // Sweep the thresholds, accumulating the bins to the left of each
+        std::fill(left.begin(), left.end(), 0.0);
+        double left_total = 0.0;
+        for (size_t bin = 1; bin < n_bins; ++bin) {
+          for (unsigned k = 0; k < n_classes; ++k) {
+            left[k] += histogram[bin * n_classes + k];
+            left_total += histogram[bin * n_classes + k];
+          }
+          for (int missing_left = 0; missing_left < 2; ++missing_left) {
+            double l_total = left_total + (missing_left ? missing_total : 0.0);
+            double r_total = total - l_total;
+            if (l_total < options.min_leaf || r_total < options.min_leaf) {
+              continue;
+            }
+            double split_impurity = 0.0;
+            double l_sum = 0.0;
+            double r_sum = 0.0;
+            for (unsigned k = 0; k < n_classes; ++k) {
+              double l = left[k] + (missing_left ? missing[k] : 0.0);
+              double r = counts[k] - l;
+              l_sum += l * l;
+              r_sum += r * r;
+            }
+            split_impurity = (l_total - l_sum / l_total) +
+                             (r_total - r_sum / r_total);
+            if (split_impurity < best_impurity) {
+              found = true;
+              best_impurity = split_impurity;
+              best_column = column;
+              best_bin = bin;
+              best_missing_left = missing_left != 0;
+            }
+          }
+        }
+      }
+    }
+
+    if (!found) {
+      nodes[item.node].column = kLeaf;
+      nodes[item.node].missing_left = 0;
+      nodes[item.node].value = majority;
+      nodes[item.node].threshold = 0.0;
+      continue;
+    }
+
+    // Partition the rows of the node between its children
+    const uint8_t *bins = data.bins(best_column);
+    auto goesLeft = [&](uint32_t r) {
+      return bins[r] == 0 ? best_missing_left : bins[r] <= best_bin;
+    };
+    auto middle =
+        std::stable_partition(rows.begin() + item.begin,
+                              rows.begin() + item.end, goesLeft);
+    size_t split = static_cast<size_t>(middle - rows.begin());
+
+    size_t child = nodes.size();
+    nodes[item.node].column = static_cast<uint32_t>(best_column);
+    nodes[item.node].missing_left = best_missing_left ? 1 : 0;
+    nodes[item.node].value = static_cast<uint32_t>(child);
+    nodes[item.node].threshold = data.edge(best_column, best_bin);
+    nodes.resize(child + 2);
+    pending.push_back({child + 1, split, item.end, item.depth + 1});
+    pending.push_back({child, item.begin, split, item.depth + 1});
+  }
+  return nodes;
+}
+
+/// \brief Run tasks on a pool of threads which steal work from each other
+///
+/// The tasks are dealt out to a queue for each thread. Each thread takes
+/// tasks from the back of its own queue, and once that is empty steals from
+/// the front of the queues of the other threads, so threads which are given
+/// cheaper tasks help with the rest. No tasks are added once the pool
+/// starts, so a thread finishes when every queue is empty.
+///
+/// \param n_tasks  Number of tasks
+/// \param n_threads  Number of threads, at least 1
+/// \param task  Function running the task with the given index
+void runWorkStealing(size_t n_tasks, unsigned n_threads,
+                     const std::function<void(size_t)> &task) {
+  assert(n_threads >= 1);
+  n_threads = static_cast<unsigned>(std::min<size_t>(n_threads, n_tasks));
+  if (n_threads <= 1) {
+    for (size_t i = 0; i < n_tasks; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  struct TaskQueue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    queues.emplace_back(new TaskQueue());
+  }
+  for (size_t i = 0; i < n_tasks; ++i) {
+    queues[i % n_threads]->tasks.push_back(i);
+  }
+
+  auto worker = [&](unsigned self) {
+    while (true) {
+      bool found = false;
+      size_t next = 0;
+      for (unsigned i = 0; i < n_threads && !found; ++i) {
+        TaskQueue &queue = *queues[(self + i) % n_threads];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+          continue;
+        }
+        found = true;
+        if (i == 0) {
+          next = queue.tasks.back();
+          queue.tasks.pop_back();
+        } else {
+          next = queue.tasks.front();
+          queue.tasks.pop_front();
+        }
+      }
+      if (!found) {
+        return;
+      }
+      task(next);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < n_threads; ++t) {
+    threads.emplace_back(worker, t);
+  }
+  worker(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+/// Kind of the container holding the training data of the machine learner
+const uint32_t kBlobKind = util::fourCC('R', 'F', 'S', 'T');
+
+/// Version of the layout of the sections of the training data. This must be
+/// bumped whenever the layout of any section changes.
+const uint32_t kBlobVersion = 1;
+
+/// \brief Sections of the container holding the training data
+enum class ForestBlobSection : uint32_t {
+  /// Identifier of each feature
+  kFeatures = 1,
+  /// Target, classes and trees of each forest
+  kForests,
+  /// Nodes of every tree
+  kNodes,
+  /// Identifier of each pass sequence parameter
+  kPassSeqParameters
+};
+
+/// \brief Serialize the forests to a blob
+std::vector<uint8_t> writeBlob(const ForestModel &model) {
+  util::ContainerWriter container(kBlobKind, kBlobVersion);
+
+  // | n_features | feat_id |...
+  std::vector<uint8_t> features;
+  util::write64LE(features, model.feature_ids.size());
+  for (auto id : model.feature_ids) {
+    util::write32LE(features, id);
+  }
+  container.addSection(static_cast<uint32_t>(ForestBlobSection::kFeatures),
+                       std::move(features));
+
+  // | n_forests | kind | id | pass_len | pass | n_classes | value |...
+  //   | n_trees | root |...|...
+  std::vector<uint8_t> forests;
+  util::write64LE(forests, model.forests.size());
+  for (const auto &forest : model.forests) {
+    util::write32LE(forests, static_cast<uint32_t>(forest.kind));
+    util::write32LE(forests, forest.id);
+    util::writeBytes(forests,
+                     reinterpret_cast<const uint8_t *>(forest.pass.data()),
+                     forest.pass.size());
+    util::write64LE(forests, forest.class_values.size());
+    for (auto value : forest.class_values) {
+      util::write64LE(forests, static_cast<uint64_t>(value));
+    }
+    util::write64LE(forests, forest.roots.size());
+    for (auto root : forest.roots) {
+      util::write64LE(forests, root);
+    }
+  }
+  container.addSection(static_cast<uint32_t>(ForestBlobSection::kForests),
+                       std::move(forests));
+
+  // | n_nodes | column | missing_left | value | threshold |...
+  std::vector<uint8_t> nodes;
+  util::write64LE(nodes, model.nodes.size());
+  for (const auto &node : model.nodes) {
+    util::write32LE(nodes, node.column);
+    util::write32LE(nodes, node.missing_left);
+    util::write32LE(nodes, node.value);
+    util::writeDoubleLE(nodes, node.threshold);
+  }
+  container.addSection(static_cast<uint32_t>(ForestBlobSection::kNodes),
+                       std::move(nodes));
+
+  // | n_parameters | param_id |...
+  if (!model.pass_seq_ids.empty()) {
+    std::vector<uint8_t> pass_seq_ids;
+    util::write64LE(pass_seq_ids, model.pass_seq_ids.size());
+    for (auto id : model.pass_seq_ids) {
+      util::write32LE(pass_seq_ids, id);
+    }
+    container.addSection(
+        static_cast<uint32_t>(ForestBlobSection::kPassSeqParameters),
+        std::move(pass_seq_ids));
+  }
+  return container.finish();
+}
+
+/// \brief Check that every tree of a forest is well formed
+///
+/// Children must follow their parent and lie within the nodes, so that every
+/// walk from a root ends at a leaf, and every leaf must hold a class of the
+/// forest.
+bool validateForest(const ForestModel &model, const Forest &forest) {
+  std::vector<uint64_t> stack;
+  for (uint64_t root : forest.roots) {
+    stack.push_back(root);
+    if (root >= model.nodes.size()) {
+      return false;
+    }
+    while (!stack.empty()) {
+      uint64_t index = stack.back();
+      stack.pop_back();
+      const ForestNode &node = model.nodes[index];
+      if (node.column == kLeaf) {
+        if (node.value >= forest.class_values.size()) {
+          return false;
+        }
+        continue;
+      }
+      if (node.column >= model.feature_ids.size() || node.value <= index ||
+          static_cast<uint64_t>(node.value) + 1 >= model.nodes.size()) {
+        return false;
+      }
+      stack.push_back(node.value);
+      stack.push_back(node.value + 1);
+    }
+  }
+  return true;
+}
+
+/// \brief Deserialize the forests from a blob
+///
+/// \return The forests, or nothing if the blob is malformed
+util::Option<ForestModel> readBlob(const std::vector<uint8_t> &blob) {
+  auto container = util::ContainerReader::parse(blob);
+  if (!container || container.get().getKind() != kBlobKind ||
+      container.get().getVersion() != kBlobVersion) {
+    return nullptr;
+  }
+  auto features_section = container.get().getSection(
+      static_cast<uint32_t>(ForestBlobSection::kFeatures));
+  auto forests_section = container.get().getSection(
+      static_cast<uint32_t>(ForestBlobSection::kForests));
+  auto nodes_section = container.get().getSection(
+      static_cast<uint32_t>(ForestBlobSection::kNodes));
+  if (!features_section || !forests_section || !nodes_section) {
+    return nullptr;
+  }
+
+  ForestModel model;
+
+  // | n_features | feat_id |...
+  util::SectionReader features = features_section.get();
+  size_t n_features = features.readCount(4);
+  for (size_t i = 0; i < n_features; ++i) {
+    model.feature_ids.push_back(features.read32());
+  }
+  if (!features.atEnd() ||
+      !std::is_sorted(model.feature_ids.begin(), model.feature_ids.end())) {
+    return nullptr;
+  }
+
+  // | n_forests | kind | id | pass_len | pass | n_classes | value |...
+  //   | n_trees | root |...|...
+  util::SectionReader forests = forests_section.get();
+  size_t n_forests = forests.readCount(4 + 4 + 8 + 8 + 8);
+  for (size_t i = 0; i < n_forests; ++i) {
+    Forest forest;
+    uint32_t kind = forests.read32();
+    if (kind > static_cast<uint32_t>(ForestKind::kPass)) {
+      return nullptr;
+    }
+    forest.kind = static_cast<ForestKind>(kind);
+    forest.id = forests.read32();
+    forest.pass = forests.readString();
+    size_t n_classes = forests.readCount(8);
+    for (size_t c = 0; c < n_classes; ++c) {
+      forest.class_values.push_back(static_cast<int64_t>(forests.read64()));
+    }
+    size_t n_trees = forests.readCount(8);
+    for (size_t t = 0; t < n_trees; ++t) {
+      forest.roots.push_back(forests.read64());
+    }
+    if (forests.failed() || forest.class_values.empty()) {
+      return nullptr;
+    }
+    model.forests.push_back(std::move(forest));
+  }
+  if (!forests.atEnd()) {
+    return nullptr;
+  }
+
+  // | n_nodes | column | missing_left | value | threshold |...
+  util::SectionReader nodes = nodes_section.get();
+  size_t n_nodes = nodes.readCount(4 + 4 + 4 + 8);
+  model.nodes.resize(n_nodes);
+  for (auto &node : model.nodes) {
+    node.column = nodes.read32();
+    node.missing_left = nodes.read32();
+    node.value = nodes.read32();
+    node.threshold = nodes.readDouble();
+  }
+  if (!nodes.atEnd()) {
+    return nullptr;
+  }
+
+  for (const auto &forest : model.forests) {
+    if (!validateForest(model, forest)) {
+      return nullptr;
+    }
+  }
+
+  // | n_parameters | param_id |...
+  auto pass_seqs_section = container.get().getSection(
+      static_cast<uint32_t>(ForestBlobSection::kPassSeqParameters));
+  if (pass_seqs_section) {
+    util::SectionReader pass_seqs = pass_seqs_section.get();
+    size_t n_pass_seq_ids = pass_seqs.readCount(4);
+    for (size_t i = 0; i < n_pass_seq_ids; ++i) {
+      model.pass_seq_ids.push_back(pass_seqs.read32());
+    }
+    if (!pass_seqs.atEnd()) {
+      return nullptr;
+    }
+  }
+  return model;
+}
+
+/// \class ForestPreparedModel
+///
+/// \brief Model holding the forests deserialized from a training blob
+class ForestPreparedModel : public IPreparedModel {
+public:
+  ForestPreparedModel(const std::vector<uint8_t> &blob)
+      : IPreparedModel(), m_model(), m_feature_column(), m_parameter_forest(),
+        m_pass_forest(), m_pass_forests(), m_pass_seq_ids(),
+        m_max_classes(0) {
+    auto parsed = readBlob(blob);
+    if (!parsed) {
+      MAGEEC_WARN("Malformed random forest training data, no decisions will "
+                  "be made");
+      return;
+    }
+    m_model = parsed.get();
+    for (size_t c = 0; c < m_model.feature_ids.size(); ++c) {
+      m_feature_column[m_model.feature_ids[c]] = c;
+    }
+    for (size_t i = 0; i < m_model.forests.size(); ++i) {
+      const Forest &forest = m_model.forests[i];
+      if (forest.kind == ForestKind::kPass) {
+        m_pass_forest[forest.pass] = i;
+        m_pass_forests.push_back(i);
+      } else {
+        m_parameter_forest[forest.id] = i;
+      }
+      m_max_classes = std::max(m_max_classes, forest.class_values.size());
+    }
+    m_pass_seq_ids.insert(m_model.pass_seq_ids.begin(),
+                          m_model.pass_seq_ids.end());
+  }
+
+  std::vector<std::unique_ptr<DecisionBase>>
+  makeDecisions(const std::vector<const DecisionRequestBase *> &requests,
+                const FeatureSet &features) const override {
+    // Encode the features once, and then run every request through the
+    // trees of its forest.
+    std::vector<double> row(m_feature_column.size(),
+                            std::numeric_limits<double>::quiet_NaN());
+    encodeFeatures(features, m_feature_column, row.begin(), 1.0, 0.0);
+    std::vector<uint32_t> votes(m_max_classes);
+
+    std::vector<std::unique_ptr<DecisionBase>> decisions;
+    decisions.reserve(requests.size());
+    for (const auto *request : requests) {
+      if (request->getType() == DecisionRequestType::kPassSeq) {
+        unsigned id =
+            static_cast<const PassSeqDecisionRequest *>(request)->getID();
+        decisions.push_back(decidePassSeq(id, row.data(), votes));
+        continue;
+      }
+
+      const Forest *forest = nullptr;
+      switch (request->getType()) {
+      case DecisionRequestType::kBool: {
+        unsigned id =
+            static_cast<const BoolDecisionRequest *>(request)->getID();
+        forest = findForest(m_parameter_forest, id, ForestKind::kBool);
+        break;
+      }
+      case DecisionRequestType::kRange: {
+        unsigned id =
+            static_cast<const RangeDecisionRequest *>(request)->getID();
+        forest = findForest(m_parameter_forest, id, ForestKind::kRange);
+        break;
+      }
+      case DecisionRequestType::kPassGate: {
+        const std::string &pass =
+            static_cast<const PassGateDecisionRequest *>(request)->getID();
+        forest = findForest(m_pass_forest, pass, ForestKind::kPass);
+        break;
+      }
+      default:
+        break;
+      }
+
+      if (!forest || forest->roots.empty()) {
+        decisions.push_back(
+            std::unique_ptr<NativeDecision>(new NativeDecision()));
+        continue;
+      }
+      int64_t value = forest->class_values[classifyForest(
+          m_model, *forest, row.data(), votes)];
+      if (forest->kind == ForestKind::kRange) {
+        decisions.push_back(
+            std::unique_ptr<RangeDecision>(new RangeDecision(value)));
+      } else {
+        decisions.push_back(
+            std::unique_ptr<BoolDecision>(new BoolDecision(value != 0)));
+      }
+    }
+    return decisions;
+  }
+
+private:
+  /// \brief Build a pass sequence from the forest of each pass
+  ///
+  /// The passes which should be run are taken in the order they are run.
+  /// The sequence is only decided if every pass has a forest with trees.
+  std::unique_ptr<DecisionBase>
+  decidePassSeq(unsigned id, const double *row,
+                std::vector<uint32_t> &votes) const {
+    if (!m_pass_seq_ids.count(id) || m_pass_forests.empty()) {
+      return std::unique_ptr<NativeDecision>(new NativeDecision());
+    }
+    PassSeq pass_seq;
+    for (size_t index : m_pass_forests) {
+      const Forest &forest = m_model.forests[index];
+      if (forest.roots.empty()) {
+        return std::unique_ptr<NativeDecision>(new NativeDecision());
+      }
+      if (forest.class_values[classifyForest(m_model, forest, row, votes)]) {
+        pass_seq.push_back(forest.pass);
+      }
+    }
+    return std::unique_ptr<PassSeqDecision>(new PassSeqDecision(pass_seq));
+  }
+
+  /// \brief Find the forest of a parameter or pass
+  ///
+  /// \return The forest, or nullptr if there is none of the expected kind
+  template <typename KeyT>
+  const Forest *findForest(const std::map<KeyT, size_t> &forests,
+                           const KeyT &key, ForestKind kind) const {
+    auto it = forests.find(key);
+    if (it == forests.cend() || m_model.forests[it->second].kind != kind) {
+      return nullptr;
+    }
+    return &m_model.forests[it->second];
+  }
+
+  ForestModel m_model;
+
+  /// Column of each feature in an encoded row
+  std::map<unsigned, size_t> m_feature_column;
+
+  /// Forest of each parameter and pass
+  std::map<unsigned, size_t> m_parameter_forest;
+  std::map<std::string, size_t> m_pass_forest;
+
+  /// Forests of the passes, in the order the passes are run
+  std::vector<size_t> m_pass_forests;
+
+  /// Pass sequence parameters decided from the forests of the passes
+  std::set<unsigned> m_pass_seq_ids;
+
+  /// Greatest number of classes of any forest
+  size_t m_max_classes;
+};
+
+} // end of anonymous namespace
+
+RandomForest::RandomForest()
+    : IMachineLearner(), m_training_config(), m_thread_budget(0) {}
+RandomForest::~RandomForest() {}
+
+bool RandomForest::setTrainingConfig(std::string config_path) {
+  auto config = util::readConfigFile(config_path);
+  if (!config) {
+    return false;
+  }
+  TrainingConfig training_config;
+  for (const auto &entry : config.get()) {
+    const std::string &key = entry.first;
+    const std::string &value = entry.second;
+    util::Option<unsigned> count;
+    if (key == "trees") {
+      count = util::parseConfigCount(config_path, key, value, 1, 4096);
+      if (!count) {
+        return false;
+      }
+      training_config.trees = count.get();
+    } else if (key == "max_depth") {
+      count = util::parseConfigCount(config_path, key, value, 1, 64);
+      if (!count) {
+        return false;
+      }
+      training_config.max_depth = count.get();
+    } else if (key == "min_leaf") {
+      count = util::parseConfigCount(config_path, key, value, 1, 1000000);
+      if (!count) {
+        return false;
+      }
+      training_config.min_leaf = count.get();
+    } else if (key == "split_features") {
+      count = util::parseConfigCount(config_path, key, value, 0, 65536);
+      if (!count) {
+        return false;
+      }
+      training_config.split_features = count.get();
+    } else if (key == "bins") {
+      count = util::parseConfigCount(config_path, key, value, 2, 255);
+      if (!count) {
+        return false;
+      }
+      training_config.bins = count.get();
+    } else if (key == "threads") {
+      count = util::parseConfigCount(config_path, key, value, 0, 256);
+      if (!count) {
+        return false;
+      }
+      training_config.threads = count.get();
+    } else if (key == "seed") {
+      auto seed = util::parseUnsigned(value);
+      if (!seed) {
+        MAGEEC_ERR(config_path << ": 'seed' must be an integer");
+        return false;
+      }
+      training_config.seed = seed.get();
+    } else {
+      MAGEEC_ERR(config_path << ": Unknown random forest training option '"
+                             << key << "'");
+      return false;
+    }
+  }
+  m_training_config = training_config;
+  return true;
+}
+
+std::unique_ptr<DecisionBase>
+RandomForest::makeDecision(const DecisionRequestBase &request,
+                           const FeatureSet &features,
+                           const std::vector<uint8_t> &blob) const {
+  return std::move(makeDecisions({&request}, features, blob)[0]);
+}
+
+std::vector<std::unique_ptr<DecisionBase>> RandomForest::makeDecisions(
+    const std::vector<const DecisionRequestBase *> &requests,
+    const FeatureSet &features, const std::vector<uint8_t> &blob) const {
+  return ForestPreparedModel(blob).makeDecisions(requests, features);
+}
+
+std::unique_ptr<IPreparedModel>
+RandomForest::prepare(const std::vector<uint8_t> &blob) const {
+  return std::unique_ptr<IPreparedModel>(new ForestPreparedModel(blob));
+}
+
+util::Option<NativeModelSource>
+RandomForest::generateNativeModel(const std::vector<uint8_t> &blob) const {
+  auto parsed = readBlob(blob);
+  if (!parsed) {
+    return nullptr;
+  }
+  const ForestModel model = parsed.get();
+
+  // Only the forests of parameters can be decided by a native model. Their
+  // trees are copied out of the shared array of nodes, keeping the children
+  // of each split adjacent.
+  NativeModelSource source;
+  source.features = model.feature_ids;
+
+  std::vector<ForestNode> nodes;
+  std::vector<uint64_t> roots;
+  std::vector<int64_t> class_values;
+  std::vector<size_t> first_root;
+  std::vector<size_t> first_class;
+  size_t max_classes = 0;
+  for (const auto &forest : model.forests) {
+    if (forest.kind == ForestKind::kPass || forest.roots.empty()) {
+      continue;
+    }
+    source.parameters.push_back(forest.id);
+    first_root.push_back(roots.size());
+    first_class.push_back(class_values.size());
+    class_values.insert(class_values.end(), forest.class_values.begin(),
+                        forest.class_values.end());
+    max_classes = std::max(max_classes, forest.class_values.size());
+
+    for (uint64_t root : forest.roots) {
+      roots.push_back(nodes.size());
+      nodes.push_back(model.nodes[root]);
+      std::vector<std::pair<size_t, uint64_t>> copies = {
+          {nodes.size() - 1, root}};
+      while (!copies.empty()) {
+        const auto copy = copies.back();
+        copies.pop_back();
+        const ForestNode &node = model.nodes[copy.second];
+        if (node.column == kLeaf) {
+          continue;
+        }
+        nodes[copy.first].value = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(model.nodes[node.value]);
+        nodes.push_back(model.nodes[node.value + 1]);
+        copies.push_back({nodes.size() - 2, node.value});
+        copies.push_back({nodes.size() - 1, node.value + 1});
+      }
+    }
+  }
+  if (source.parameters.empty()) {
+    return source;
+  }
+  first_root.push_back(roots.size());
+
+  // Emit the nodes as a table for each field, the roots of the trees of
+  // each parameter, and the value of each class of each parameter.
+  std::ostringstream definitions;
+  definitions << "const unsigned node_column[" << nodes.size() << "] = {\n";
+  for (const auto &node : nodes) {
+    definitions << "  " << node.column << "u,\n";
+  }
+  definitions << "};\n";
+  definitions << "const unsigned char node_missing_left[" << nodes.size()
+              << "] = {\n";
+  for (const auto &node : nodes) {
+    definitions << "  " << node.missing_left << ",\n";
+  }
+  definitions << "};\n";
+  definitions << "const unsigned node_value[" << nodes.size() << "] = {\n";
+  for (const auto &node : nodes) {
+    definitions << "  " << node.value << "u,\n";
+  }
+  definitions << "};\n";
+  definitions << "const double node_threshold[" << nodes.size() << "] = {\n";
+  for (const auto &node : nodes) {
+    definitions << "  " << nativeDoubleLiteral(node.threshold) << ",\n";
+  }
+  definitions << "};\n";
+  definitions << "const unsigned tree_root[" << roots.size() << "] = {\n";
+  for (auto root : roots) {
+    definitions << "  " << root << "u,\n";
+  }
+  definitions << "};\n";
+  definitions << "const unsigned parameter_first_tree["
+              << first_root.size() << "] = {\n";
+  for (auto first : first_root) {
+    definitions << "  " << first << "u,\n";
+  }
+  definitions << "};\n";
+  definitions << "const unsigned parameter_first_class["
+              << first_class.size() << "] = {\n";
+  for (auto first : first_class) {
+    definitions << "  " << first << "u,\n";
+  }
+  definitions << "};\n";
+  definitions << "const unsigned parameter_classes[" << first_class.size()
+              << "] = {\n";
+  for (size_t p = 0; p < first_class.size(); ++p) {
+    size_t end = p + 1 < first_class.size() ? first_class[p + 1]
+                                            : class_values.size();
+    definitions << "  " << end - first_class[p] << "u,\n";
+  }
+  definitions << "};\n";
+  definitions << "const int64_t class_value[" << class_values.size()
+              << "] = {\n";
+  for (auto value : class_values) {
+    if (value == std::numeric_limits<int64_t>::min()) {
+      definitions << "  INT64_MIN,\n";
+    } else {
+      definitions << "  INT64_C(" << value << "),\n";
+    }
+  }
+  definitions << "};\n";
+  source.definitions = definitions.str();
+
+  // Walk every tree of each parameter and take the class with the most
+  // votes, in the same way as makeDecisions.
+  std::ostringstream decide;
+  decide << "  for (unsigned p = 0; p < " << source.parameters.size()
+         << "; ++p) {\n"
+         << "    unsigned votes[" << max_classes << "] = {0};\n"
+         << "    for (unsigned t = parameter_first_tree[p];\n"
+         << "         t < parameter_first_tree[p + 1]; ++t) {\n"
+         << "      unsigned n = tree_root[t];\n"
+         << "      while (node_column[n] != " << kLeaf << "u) {\n"
+         << "        double value = row[node_column[n]];\n"
+         << "        bool left = std::isnan(value)\n"
+         << "                        ? node_missing_left[n] != 0\n"
+         << "                        : value <= node_threshold[n];\n"
+         << "        n = node_value[n] + (left ? 0 : 1);\n"
+         << "      }\n"
+         << "      votes[node_value[n]]++;\n"
+         << "    }\n"
+         << "    unsigned best = 0;\n"
+         << "    for (unsigned c = 1; c < parameter_classes[p]; ++c) {\n"
+         << "      if (votes[c] > votes[best]) {\n"
+         << "        best = c;\n"
+         << "      }\n"
+         << "    }\n"
+         << "    values[p] = class_value[parameter_first_class[p] + best];\n"
+         << "    decided[p] = 1;\n"
+         << "  }\n";
+  source.decide = decide.str();
+  return source;
+}
+
+util::Option<std::set<unsigned>>
+RandomForest::getUsedFeatures(const std::vector<uint8_t> &blob) const {
+  auto parsed = readBlob(blob);
+  if (!parsed) {
+    return nullptr;
+  }
+  const ForestModel model = parsed.get();
+
+  // Only the features tested by a split of some tree are used
+  std::set<unsigned> used;
+  for (const auto &node : model.nodes) {
+    if (node.column != kLeaf) {
+      used.insert(model.feature_ids[node.column]);
+    }
+  }
+  return used;
+}
+
+const std::vector<uint8_t>
+RandomForest::train(std::set<FeatureDesc> feature_descs,
+                    std::set<ParameterDesc> parameter_descs,
+                    std::set<std::string> passes,
+                    ResultIterator result_iter) const {
+  MAGEEC_DEBUG("Training database using random forest machine learner");
+
+  // Read all of the results data in one go. For each distinct set of input
+  // features, store the best set of results. This is achieved by storing a
+  // hash from a feature set to its current best result.
+  MAGEEC_DEBUG("Collecting results");
+  std::map<uint64_t, Result> result_map;
+  for (util::Option<Result> result; (result = *result_iter);
+       result_iter = result_iter.next()) {
+    FeatureSet features = result.get().getFeatures();
+    double value = result.get().getValue();
+    uint64_t hash = features.hash();
+
+    bool result_handled = false;
+    while (!result_handled) {
+      auto curr_entry = result_map.find(hash);
+      if (curr_entry != result_map.end()) {
+        const FeatureSet &curr_features = curr_entry->second.getFeatures();
+        double curr_value = curr_entry->second.getValue();
+
+        if (features == curr_features) {
+          if (value < curr_value) {
+            result_map.at(hash) = result.get();
+          }
+          result_handled = true;
+        } else {
+          hash++;
+        }
+      } else {
+        result_map.emplace(hash, result.get());
+        result_handled = true;
+      }
+    }
+  }
+
+  // Each boolean and integer feature has a column, in ascending order of
+  // feature id.
+  ForestModel model;
+  std::map<unsigned, size_t> feature_column;
+  for (auto desc : feature_descs) {
+    if (desc.type == FeatureType::kBool || desc.type == FeatureType::kInt) {
+      feature_column[desc.id] = model.feature_ids.size();
+      model.feature_ids.push_back(desc.id);
+    }
+  }
+  const size_t n_columns = model.feature_ids.size();
+  const size_t n_rows = result_map.size();
+
+  MAGEEC_DEBUG("Binning features of " << n_rows << " feature sets");
+  std::vector<double> rows(n_rows * n_columns,
+                           std::numeric_limits<double>::quiet_NaN());
+  std::vector<ParameterSet> row_parameters;
+  row_parameters.reserve(n_rows);
+  for (auto res : result_map) {
+    auto row = rows.begin() +
+               static_cast<std::ptrdiff_t>(row_parameters.size() * n_columns);
+    encodeFeatures(res.second.getFeatures(), feature_column, row, 1.0, 0.0);
+    row_parameters.push_back(res.second.getParameters());
+  }
+  const BinnedDataset data(rows, n_rows, n_columns,
+                           m_training_config.bins);
+
+  // Label each row with the class of each parameter and pass, or -1 where
+  // the row has no value for it.
+  std::vector<std::vector<int32_t>> labels;
+  for (auto param : parameter_descs) {
+    if (param.type == ParameterType::kPassSeq) {
+      model.pass_seq_ids.push_back(param.id);
+      continue;
+    }
+    std::vector<util::Option<int64_t>> values(n_rows);
+    std::set<int64_t> distinct;
+    for (size_t r = 0; r < n_rows; ++r) {
+      for (auto p : row_parameters[r]) {
+        if (p->getID() != param.id) {
+          continue;
+        }
+        assert(p->getType() == param.type);
+        if (param.type == ParameterType::kBool) {
+          values[r] = static_cast<BoolParameter *>(p.get())->getValue() ? 1 : 0;
+        } else {
+          values[r] = static_cast<RangeParameter *>(p.get())->getValue();
+        }
+        distinct.insert(values[r].get());
+        break;
+      }
+    }
+
+    Forest forest;
+    forest.kind = param.type == ParameterType::kBool ? ForestKind::kBool
+                                                     : ForestKind::kRange;
+    forest.id = param.id;
+    if (param.type == ParameterType::kBool) {
+      forest.class_values = {0, 1};
+    } else {
+      forest.class_values.assign(distinct.begin(), distinct.end());
+    }
+    std::vector<int32_t> forest_labels(n_rows, -1);
+    for (size_t r = 0; r < n_rows; ++r) {
+      if (values[r]) {
+        forest_labels[r] = static_cast<int32_t>(
+            std::lower_bound(forest.class_values.begin(),
+                             forest.class_values.end(), values[r].get()) -
+            forest.class_values.begin());
+      }
+    }
+    model.forests.push_back(forest);
+    labels.push_back(std::move(forest_labels));
+  }
+
+  // The forests of the passes are stored in the order the passes are run
+  std::vector<const PassSeq *> row_pass_seqs(n_rows, nullptr);
+  std::vector<PassSeq> pass_seqs;
+  for (size_t r = 0; r < n_rows; ++r) {
+    for (const auto &p : row_parameters[r]) {
+      if (p->getType() == ParameterType::kPassSeq) {
+        row_pass_seqs[r] =
+            &static_cast<PassSeqParameter *>(p.get())->getValue();
+        pass_seqs.push_back(*row_pass_seqs[r]);
+        break;
+      }
+    }
+  }
+  for (const auto &pass : mergePassSequences(pass_seqs, passes)) {
+    std::vector<int32_t> forest_labels(n_rows, -1);
+    for (size_t r = 0; r < n_rows; ++r) {
+      if (row_pass_seqs[r]) {
+        const PassSeq &pass_seq = *row_pass_seqs[r];
+        forest_labels[r] = std::find(pass_seq.begin(), pass_seq.end(),
+                                     pass) != pass_seq.end();
+      }
+    }
+
+    Forest forest;
+    forest.kind = ForestKind::kPass;
+    forest.id = 0;
+    forest.pass = pass;
+    forest.class_values = {0, 1};
+    model.forests.push_back(forest);
+    labels.push_back(std::move(forest_labels));
+  }
+
+  // Every tree of every forest is a separate task. Forests without any
+  // labelled rows have no trees, so make no decisions.
+  const TrainingConfig &config = m_training_config;
+  TreeOptions options;
+  options.max_depth = config.max_depth;
+  options.min_leaf = config.min_leaf;
+  options.split_features =
+      config.split_features != 0
+          ? config.split_features
+          : static_cast<unsigned>(
+                std::ceil(std::sqrt(static_cast<double>(n_columns))));
+
+  std::vector<std::pair<size_t, unsigned>> tasks;
+  for (size_t f = 0; f < model.forests.size(); ++f) {
+    if (std::any_of(labels[f].begin(), labels[f].end(),
+                    [](int32_t label) { return label >= 0; })) {
+      for (unsigned t = 0; t < config.trees; ++t) {
+        tasks.push_back(std::make_pair(f, t));
+      }
+    }
+  }
+
+  unsigned n_threads = config.threads;
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (m_thread_budget != 0) {
+      n_threads = std::min(n_threads, m_thread_budget);
+    }
+  }
+  MAGEEC_DEBUG("Growing " << tasks.size() << " trees for "
+               << model.forests.size() << " forests on " << n_threads
+               << " threads");
+
+  // Each tree has its own generator, seeded from its forest and its index
+  // in the forest, so that the trees do not depend on which thread grows
+  // them.
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::vector<ForestNode>> trees(tasks.size());
+  runWorkStealing(tasks.size(), n_threads, [&](size_t index) {
+    const size_t forest = tasks[index].first;
+    const unsigned tree = tasks[index].second;
+    std::seed_seq seed = {static_cast<uint32_t>(config.seed),
+                          static_cast<uint32_t>(config.seed >> 32),
+                          static_cast<uint32_t>(forest),
+                          static_cast<uint32_t>(tree)};
+    std::mt19937_64 rng(seed);
+    unsigned n_classes =
+        static_cast<unsigned>(model.forests[forest].class_values.size());
+    trees[index] = growTree(data, labels[forest], n_classes, options, rng);
+  });
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  MAGEEC_DEBUG("Grew " << tasks.size() << " trees in " << elapsed.count()
+               << "s");
+
+  // Flatten the trees into a single array of nodes, in order of task
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    const uint64_t root = model.nodes.size();
+    for (ForestNode node : trees[i]) {
+      if (node.column != kLeaf) {
+        node.value += static_cast<uint32_t>(root);
+      }
+      model.nodes.push_back(node);
+    }
+    model.forests[tasks[i].first].roots.push_back(root);
+  }
+  return writeBlob(model);
+}
+
+} // end of namespace mageec
@@ -0,0 +1,249 @@
+/*  Copyright (C) 2017, Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===---------------------- MAGEEC native models --------------------------===//
+//
+// This implements the machine learner interface to a native model, as well
+// as the generation of the source of a native model.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mageec/AttributeSet.h"
+#include "mageec/Database.h"
+#include "mageec/Decision.h"
+#include "mageec/ML.h"
+#include "mageec/NativeML.h"
+#include "mageec/Util.h"
+
+#include <cassert>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace mageec {
+
+NativeMachineLearner::NativeMachineLearner(const mageec_native_model &model,
+                                           std::string name)
+    : IMachineLearner(), m_model(model), m_name(name), m_feature_column(),
+      m_parameter_index() {
+  assert(model.version == MAGEEC_NATIVE_MODEL_VERSION);
+  for (unsigned i = 0; i < model.n_features; ++i) {
+    m_feature_column[model.feature_ids[i]] = i;
+  }
+  for (unsigned i = 0; i < model.n_parameters; ++i) {
+    m_parameter_index[model.parameter_ids[i]] = i;
+  }
+}
+
+NativeMachineLearner::~NativeMachineLearner() {}
+
+std::unique_ptr<DecisionBase>
+NativeMachineLearner::makeDecision(const DecisionRequestBase &request,
+                                   const FeatureSet &features,
+                                   const std::vector<uint8_t> &blob) const {
+  return std::move(makeDecisions({&request}, features, blob)[0]);
+}
+
+std::vector<std::unique_ptr<DecisionBase>> NativeMachineLearner::makeDecisions(
+    const std::vector<const DecisionRequestBase *> &requests,
+    const FeatureSet &features, const std::vector<uint8_t> &blob) const {
+  // The training data is compiled into the model
+  (void)blob;
+
+  // Encode the features into a row for the model, as described by
+  // NativeModelSource. Features which are missing from the feature set are
+  // NaN.
+  std::vector<double> row(m_model.n_features,
+                          std::numeric_limits<double>::quiet_NaN());
+  encodeFeatures(features, m_feature_column, row.begin(), 1.0, 0.0);
+
+  // A single call to the model decides every parameter
+  std::vector<int64_t> values(m_model.n_parameters, 0);
+  std::vector<unsigned char> decided(m_model.n_parameters, 0);
+  m_model.decide(row.data(), values.data(), decided.data());
+
+  std::vector<std::unique_ptr<DecisionBase>> decisions;
+  decisions.reserve(requests.size());
+  for (const auto *request : requests) {
+    DecisionRequestType request_type = request->getType();
+
+    // Pass decisions are not compiled into native models
+    util::Option<unsigned> param_id;
+    if (request_type == DecisionRequestType::kBool) {
+      param_id = static_cast<const BoolDecisionRequest *>(request)->getID();
+    } else if (request_type == DecisionRequestType::kRange) {
+      param_id = static_cast<const RangeDecisionRequest *>(request)->getID();
+    }
+
+    const auto index = param_id ? m_parameter_index.find(param_id.get())
+                                : m_parameter_index.cend();
+    if (index == m_parameter_index.cend() || !decided[index->second]) {
+      decisions.push_back(
+          std::unique_ptr<DecisionBase>(new NativeDecision()));
+    } else if (request_type == DecisionRequestType::kBool) {
+      decisions.push_back(std::unique_ptr<DecisionBase>(
+          new BoolDecision(values[index->second] != 0)));
+    } else {
+      decisions.push_back(std::unique_ptr<DecisionBase>(
+          new RangeDecision(values[index->second])));
+    }
+  }
+  return decisions;
+}
+
+const std::vector<uint8_t>
+NativeMachineLearner::train(std::set<FeatureDesc>, std::set<ParameterDesc>,
+                            std::set<std::string>, ResultIterator) const {
+  assert(0 && "Native model cannot be trained");
+  return std::vector<uint8_t>();
+}
+
+namespace {
+
+/// \brief Format a string as a C++ string literal
+std::string stringLiteral(const std::string &str) {
+  std::ostringstream literal;
+  literal << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      literal << '\\' << c;
+    } else if (c < ' ' || c > '~') {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\%03o", static_cast<unsigned char>(c));
+      literal << buf;
+    } else {
+      literal << c;
+    }
+  }
+  literal << '"';
+  return literal.str();
+}
+
+/// \brief Format a list of identifiers as the initializer of an array
+std::string idList(const std::vector<unsigned> &ids) {
+  std::ostringstream list;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    list << (i == 0 ? "" : ", ") << ids[i] << 'u';
+  }
+  return list.str();
+}
+
+} // end of anonymous namespace
+
+std::string nativeDoubleLiteral(double value) {
+  assert(value == value && "Cannot emit a literal for NaN");
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", value);
+  std::string literal(buf);
+  if (literal.find_first_of(".e") == std::string::npos) {
+    literal += ".0";
+  }
+  return literal;
+}
+
+std::string nativeFloatLiteral(float value) {
+  assert(value == value && "Cannot emit a literal for NaN");
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9g", static_cast<double>(value));
+  std::string literal(buf);
+  if (literal.find_first_of(".e") == std::string::npos) {
+    literal += ".0";
+  }
+  return literal + "f";
+}
+
+std::string emitNativeModel(const NativeModelSource &source,
+                            const std::string &ml_name,
+                            const std::string &metric) {
+  std::ostringstream out;
+
+  out << "// Native model generated by MAGEEC from the '" << ml_name
+      << "' machine learner,\n"
+      << "// trained against the '" << metric << "' metric.\n"
+      << "\n"
+      << "#include <cmath>\n"
+      << "#include <cstddef>\n"
+      << "#include <cstdint>\n"
+      << "#include <limits>\n"
+      << "\n";
+
+  // This must match the definition in NativeML.h
+  out << "extern \"C\" {\n"
+      << "struct mageec_native_model {\n"
+      << "  unsigned version;\n"
+      << "  const char *ml_name;\n"
+      << "  const char *metric;\n"
+      << "  unsigned n_features;\n"
+      << "  const unsigned *feature_ids;\n"
+      << "  unsigned n_parameters;\n"
+      << "  const unsigned *parameter_ids;\n"
+      << "  void (*decide)(const double *row, int64_t *values,\n"
+      << "                 unsigned char *decided);\n"
+      << "};\n"
+      << "}\n"
+      << "\n";
+
+  out << "namespace {\n"
+      << "\n"
+      << source.definitions << "\n";
+
+  if (!source.features.empty()) {
+    out << "const unsigned feature_ids[] = {" << idList(source.features)
+        << "};\n";
+  }
+  if (!source.parameters.empty()) {
+    out << "const unsigned parameter_ids[] = {" << idList(source.parameters)
+        << "};\n";
+  }
+  out << "\n"
+      << "void decide(const double *row, int64_t *values,\n"
+      << "            unsigned char *decided) {\n"
+      << "  (void)row;\n"
+      << "  (void)values;\n"
+      << "  (void)decided;\n"
+      << source.decide
+      << "}\n"
+      << "\n";
+
+  out << "const mageec_native_model model = {\n"
+      << "  " << MAGEEC_NATIVE_MODEL_VERSION << ",\n"
+      << "  " << stringLiteral(ml_name) << ",\n"
+      << "  " << stringLiteral(metric) << ",\n"
+      << "  " << source.features.size() << ",\n"
+      << "  " << (source.features.empty() ? "nullptr" : "feature_ids")
+      << ",\n"
+      << "  " << source.parameters.size() << ",\n"
+      << "  " << (source.parameters.empty() ? "nullptr" : "parameter_ids")
+      << ",\n"
+      << "  decide\n"
+      << "};\n"
+      << "\n"
+      << "} // end of anonymous namespace\n"
+      << "\n";
+
+  out << "extern \"C\" const mageec_native_model *"
+      << MAGEEC_NATIVE_MODEL_SYMBOL << "(void) {\n"
+      << "  return &model;\n"
+      << "}\n";
+  return out.str();
+}
+
+} // end of namespace mageec
@@ -39,7 +39,8 @@
 namespace mageec {
 
 TrainedML::TrainedML(IMachineLearner &ml)
-    : m_ml(ml), m_feature_class(), m_metric(), m_blob() {
+    : m_ml(ml), m_feature_class(), m_metric(), m_blob(), m_prepared(),
+      m_prepare_attempted(false) {
   assert(!ml.requiresTraining() &&
          "Machine learner requires training, so it must be initialized with "
          "a metric and blob");
@@ -48,7 +49,8 @@ TrainedML::TrainedML(IMachineLearner &ml)
 TrainedML::TrainedML(IMachineLearner &ml, FeatureClass feature_class,
                      std::string metric,
                      const std::vector<uint8_t> blob)
-    : m_ml(ml), m_feature_class(feature_class), m_metric(metric), m_blob(blob) {
+    : m_ml(ml), m_feature_class(feature_class), m_metric(metric), m_blob(blob),
+      m_prepared(), m_prepare_attempted(false) {
   assert(ml.requiresTraining() && "Machine learner does not require training, "
                                   "where did the metric and blob come from?");
 }
@@ -73,15 +75,45 @@ bool TrainedML::setDecisionConfig(std::string config_path) {
   assert(requiresDecisionConfig() &&
          "Cannot provide decision config to "
          "a machine learner which does not require one");
+  // The prepared model depends on the decision config, so it must be
+  // prepared again with the new config.
+  m_prepared.reset();
+  m_prepare_attempted = false;
   return m_ml.setDecisionConfig(config_path);
 }
 
+const IPreparedModel *TrainedML::getPreparedModel(void) {
+  if (!m_prepare_attempted) {
+    m_prepare_attempted = true;
+    m_prepared = m_ml.prepare(m_blob);
+  }
+  return m_prepared.get();
+}
+
 std::unique_ptr<DecisionBase>
 TrainedML::makeDecision(const DecisionRequestBase &request,
                         const FeatureSet &features) {
+  const IPreparedModel *prepared = getPreparedModel();
+  if (prepared) {
+    return std::move(prepared->makeDecisions({&request}, features)[0]);
+  }
   return m_ml.makeDecision(request, features, m_blob);
 }
 
+std::vector<std::unique_ptr<DecisionBase>> TrainedML::makeDecisions(
+    const std::vector<const DecisionRequestBase *> &requests,
+    const FeatureSet &features) {
+  const IPreparedModel *prepared = getPreparedModel();
+  if (prepared) {
+    return prepared->makeDecisions(requests, features);
+  }
+  return m_ml.makeDecisions(requests, features, m_blob);
+}
+
+util::Option<NativeModelSource> TrainedML::generateNativeModel(void) const {
+  return m_ml.generateNativeModel(m_blob);
+}
+
 void TrainedML::print(std::ostream &os) const {
   os << getName();
 
@@ -23,11 +23,28 @@
 
 #include "mageec/Util.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 namespace mageec {
 namespace util {
 
@@ -89,28 +106,1058 @@ void write64LE(std::vector<uint8_t> &buf, uint64_t value) {
   buf.push_back(static_cast<uint8_t>(value >> 56));
 }
 
+double readDoubleLE(std::vector<uint8_t>::const_iterator &it) {
+  static_assert(sizeof(double) == sizeof(uint64_t),
+                "double must be a 64-bit type");
+  uint64_t bits = read64LE(it);
+  double res;
+  std::memcpy(&res, &bits, sizeof(res));
+  return res;
+}
+
+void writeDoubleLE(std::vector<uint8_t> &buf, double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  write64LE(buf, bits);
+}
+
+void write32LE(std::vector<uint8_t> &buf, uint32_t value) {
+  buf.push_back(static_cast<uint8_t>(value));
+  buf.push_back(static_cast<uint8_t>(value >> 8));
+  buf.push_back(static_cast<uint8_t>(value >> 16));
+  buf.push_back(static_cast<uint8_t>(value >> 24));
+}
+
+void writeDoublesLE(std::vector<uint8_t> &buf, const double *values,
+                    size_t n) {
+  size_t start = buf.size();
+  buf.resize(start + n * sizeof(double));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (n != 0) {
+    std::memcpy(&buf[start], values, n * sizeof(double));
+  }
+#else
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t bits;
+    std::memcpy(&bits, &values[i], sizeof(bits));
+    for (unsigned b = 0; b < 8; ++b) {
+      buf[start + i * 8 + b] = static_cast<uint8_t>(bits >> (b * 8));
+    }
+  }
+#endif
+}
+
+void writeBytes(std::vector<uint8_t> &buf, const uint8_t *data, size_t n) {
+  write64LE(buf, n);
+  buf.insert(buf.end(), data, data + n);
+}
+
 // Based on crc32b from Hacker's Delight
 // (http://www.hackersdelight.org/hdcodetxt/crc.c.txt)
 // Expanded to support crc64 and nulls by Simon Cook
-uint64_t crc64(uint8_t *message, unsigned len) {
-  unsigned i;
-  int j;
-  uint64_t byte, crc, mask;
-
-  i = 0;
-  crc = 0xFFFFFFFFFFFFFFFFULL;
-  while (i < len) {
-    byte = message[i]; // Get next byte.
-    crc = crc ^ byte;
-    for (j = 7; j >= 0; j--) { // Do eight times.
-      mask = -(crc & 1);
-      crc = (crc >> 1) ^ (0xC96C5795D7870F42ULL & mask);
-    }
-    i = i + 1;
+// Processes a byte at a time using a table of the remainder of each byte.
+uint64_t crc64(const uint8_t *message, size_t len) {
+  static const std::array<uint64_t, 256> table = []() {
+    std::array<uint64_t, 256> res;
+    for (unsigned byte = 0; byte < 256; ++byte) {
+      uint64_t crc = byte;
+      for (int j = 7; j >= 0; j--) { // Do eight times.
+        uint64_t mask = -(crc & 1);
+        crc = (crc >> 1) ^ (0xC96C5795D7870F42ULL & mask);
+      }
+      res[byte] = crc;
+    }
+    return res;
+  }();
+
+  uint64_t crc = 0xFFFFFFFFFFFFFFFFULL;
+  for (size_t i = 0; i < len; ++i) {
+    crc = (crc >> 8) ^ table[(crc ^ message[i]) & 0xFF];
   }
   return ~crc;
 }
 
+namespace {
+
+const std::array<uint32_t, 64> kSHA256RoundConstants = {{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+}};
+
+inline uint32_t rotr32(uint32_t value, unsigned n) {
+  return (value >> n) | (value << (32 - n));
+}
+
+} // end of anonymous namespace
+
+// Implementation of SHA-256 as specified in FIPS 180-4
+SHA256::SHA256()
+    : m_state{{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+               0x9b05688c, 0x1f83d9ab, 0x5be0cd19}},
+      m_block(), m_block_len(0), m_len(0), m_finished(false) {}
+
+void SHA256::update(const uint8_t *data, size_t len) {
+  assert(!m_finished && "Data added to a finished digest");
+  m_len += len;
+  while (len != 0) {
+    // Whole blocks are digested in place, rather than being copied
+    if (m_block_len == 0 && len >= m_block.size()) {
+      processBlock(data);
+      data += m_block.size();
+      len -= m_block.size();
+      continue;
+    }
+    size_t n = std::min(len, m_block.size() - m_block_len);
+    memcpy(m_block.data() + m_block_len, data, n);
+    m_block_len += n;
+    data += n;
+    len -= n;
+    if (m_block_len == m_block.size()) {
+      processBlock(m_block.data());
+      m_block_len = 0;
+    }
+  }
+}
+
+void SHA256::update(const std::string &data) {
+  update(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+}
+
+std::string SHA256::finish() {
+  assert(!m_finished && "Digest finished twice");
+
+  // Pad with a single set bit, then zeros up to the 64-bit big endian
+  // length in bits at the end of a block.
+  uint64_t bit_len = m_len * 8;
+  uint8_t padding[72] = {0x80};
+  size_t pad_len = (m_block_len < 56 ? 56 : 120) - m_block_len;
+  for (unsigned i = 0; i < 8; ++i) {
+    padding[pad_len + i] = static_cast<uint8_t>(bit_len >> (56 - i * 8));
+  }
+  update(padding, pad_len + 8);
+  assert(m_block_len == 0);
+  m_finished = true;
+
+  static const char hex_digits[] = "0123456789abcdef";
+  std::string digest;
+  for (uint32_t word : m_state) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      digest.push_back(hex_digits[(word >> shift) & 0xf]);
+    }
+  }
+  return digest;
+}
+
+void SHA256::processBlock(const uint8_t *block) {
+  std::array<uint32_t, 64> w;
+  for (unsigned i = 0; i < 16; ++i) {
+    w[i] = static_cast<uint32_t>(block[i * 4]) << 24 |
+           static_cast<uint32_t>(block[i * 4 + 1]) << 16 |
+           static_cast<uint32_t>(block[i * 4 + 2]) << 8 |
+           static_cast<uint32_t>(block[i * 4 + 3]);
+  }
+  for (unsigned i = 16; i < 64; ++i) {
+    uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+  uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+  for (unsigned i = 0; i < 64; ++i) {
+    uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kSHA256RoundConstants[i] + w[i];
+    uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  m_state[0] += a;
+  m_state[1] += b;
+  m_state[2] += c;
+  m_state[3] += d;
+  m_state[4] += e;
+  m_state[5] += f;
+  m_state[6] += g;
+  m_state[7] += h;
+}
+
+const uint8_t *SectionReader::take(size_t n) {
+  if (m_failed || n > m_size - m_pos) {
+    m_failed = true;
+    return nullptr;
+  }
+  const uint8_t *res = m_data + m_pos;
+  m_pos += n;
+  return res;
+}
+
+unsigned SectionReader::read16() {
+  const uint8_t *data = take(2);
+  if (!data) {
+    return 0;
+  }
+  return static_cast<unsigned>(data[0]) | static_cast<unsigned>(data[1]) << 8;
+}
+
+uint32_t SectionReader::read32() {
+  const uint8_t *data = take(4);
+  if (!data) {
+    return 0;
+  }
+  uint32_t res = 0;
+  for (unsigned i = 0; i < 4; ++i) {
+    res |= static_cast<uint32_t>(data[i]) << (i * 8);
+  }
+  return res;
+}
+
+uint64_t SectionReader::read64() {
+  const uint8_t *data = take(8);
+  if (!data) {
+    return 0;
+  }
+  uint64_t res = 0;
+  for (unsigned i = 0; i < 8; ++i) {
+    res |= static_cast<uint64_t>(data[i]) << (i * 8);
+  }
+  return res;
+}
+
+double SectionReader::readDouble() {
+  uint64_t bits = read64();
+  double res;
+  std::memcpy(&res, &bits, sizeof(res));
+  return res;
+}
+
+size_t SectionReader::readCount(size_t element_size) {
+  uint64_t count = read64();
+  if (m_failed) {
+    return 0;
+  }
+  if (element_size != 0 && count > (m_size - m_pos) / element_size) {
+    m_failed = true;
+    return 0;
+  }
+  return static_cast<size_t>(count);
+}
+
+bool SectionReader::readDoubles(double *values, size_t n) {
+  if (n > (m_size - m_pos) / sizeof(double)) {
+    m_failed = true;
+    return false;
+  }
+  const uint8_t *data = take(n * sizeof(double));
+  if (!data) {
+    return false;
+  }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (n != 0) {
+    std::memcpy(values, data, n * sizeof(double));
+  }
+#else
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t bits = 0;
+    for (unsigned b = 0; b < 8; ++b) {
+      bits |= static_cast<uint64_t>(data[i * 8 + b]) << (b * 8);
+    }
+    std::memcpy(&values[i], &bits, sizeof(bits));
+  }
+#endif
+  return true;
+}
+
+std::vector<uint8_t> SectionReader::readBytes() {
+  return readBytes(readCount(1));
+}
+
+std::vector<uint8_t> SectionReader::readBytes(size_t n) {
+  const uint8_t *data = take(n);
+  if (!data) {
+    return std::vector<uint8_t>();
+  }
+  return std::vector<uint8_t>(data, data + n);
+}
+
+std::string SectionReader::readString() {
+  std::vector<uint8_t> bytes = readBytes();
+  return std::string(bytes.begin(), bytes.end());
+}
+
+/// Size of the fixed part of the header of a container
+static const size_t container_header_size = 32;
+/// Size of each entry in the section table of a container
+static const size_t container_entry_size = 32;
+
+void ContainerWriter::addSection(uint32_t tag, std::vector<uint8_t> data) {
+  m_sections.push_back(std::make_pair(tag, std::move(data)));
+}
+
+std::vector<uint8_t> ContainerWriter::finish() const {
+  // Lay out the sections after the section table
+  std::vector<uint64_t> offsets;
+  uint64_t offset =
+      container_header_size + m_sections.size() * container_entry_size;
+  for (const auto &section : m_sections) {
+    offset = (offset + kAlignment - 1) / kAlignment * kAlignment;
+    offsets.push_back(offset);
+    offset += section.second.size();
+  }
+
+  std::vector<uint8_t> blob;
+  blob.reserve(offset);
+  blob.insert(blob.end(), kContainerMagic.begin(), kContainerMagic.end());
+  write32LE(blob, kContainerVersion);
+  write32LE(blob, m_kind);
+  write32LE(blob, m_version);
+  write32LE(blob, static_cast<uint32_t>(m_sections.size()));
+  // Placeholder for the checksum of the header
+  write64LE(blob, 0);
+  for (size_t i = 0; i < m_sections.size(); ++i) {
+    const auto &data = m_sections[i].second;
+    write32LE(blob, m_sections[i].first);
+    write32LE(blob, 0);
+    write64LE(blob, offsets[i]);
+    write64LE(blob, data.size());
+    write64LE(blob, crc64(data.data(), data.size()));
+  }
+
+  // The header checksum covers the header and the section table, with the
+  // checksum itself taken to be zero.
+  uint64_t checksum = crc64(blob.data(), blob.size());
+  for (unsigned i = 0; i < 8; ++i) {
+    blob[24 + i] = static_cast<uint8_t>(checksum >> (i * 8));
+  }
+
+  for (size_t i = 0; i < m_sections.size(); ++i) {
+    blob.resize(offsets[i], 0);
+    blob.insert(blob.end(), m_sections[i].second.begin(),
+                m_sections[i].second.end());
+  }
+  return blob;
+}
+
+bool ContainerReader::isContainer(const std::vector<uint8_t> &blob) {
+  return blob.size() >= kContainerMagic.size() &&
+         std::equal(kContainerMagic.begin(), kContainerMagic.end(),
+                    blob.begin());
+}
+
+Option<ContainerReader>
+ContainerReader::parse(const std::vector<uint8_t> &blob) {
+  if (!isContainer(blob) || blob.size() < container_header_size) {
+    MAGEEC_DEBUG("Blob is not a container");
+    return nullptr;
+  }
+
+  // Skip the magic number, which has already been checked
+  SectionReader header(blob.data(), blob.size());
+  header.read64();
+  if (header.read32() != kContainerVersion) {
+    MAGEEC_DEBUG("Container has an unsupported version");
+    return nullptr;
+  }
+  ContainerReader reader;
+  reader.m_data = blob.data();
+  reader.m_kind = header.read32();
+  reader.m_version = header.read32();
+  uint64_t n_sections = header.read32();
+  uint64_t checksum = header.read64();
+
+  if (n_sections > (blob.size() - container_header_size) /
+                       container_entry_size) {
+    MAGEEC_DEBUG("Container section table is truncated");
+    return nullptr;
+  }
+  size_t table_end =
+      container_header_size +
+      static_cast<size_t>(n_sections) * container_entry_size;
+  std::vector<uint8_t> header_data(blob.begin(),
+                                   blob.begin() +
+                                       static_cast<std::ptrdiff_t>(table_end));
+  std::fill(header_data.begin() + 24, header_data.begin() + 32, 0);
+  if (crc64(header_data.data(), header_data.size()) != checksum) {
+    MAGEEC_DEBUG("Container header checksum mismatch");
+    return nullptr;
+  }
+
+  for (uint64_t i = 0; i < n_sections; ++i) {
+    Section section;
+    section.tag = header.read32();
+    header.read32();
+    section.offset = header.read64();
+    section.size = header.read64();
+    uint64_t section_checksum = header.read64();
+
+    if (section.offset < table_end || section.offset > blob.size() ||
+        section.size > blob.size() - section.offset) {
+      MAGEEC_DEBUG("Container section is out of bounds");
+      return nullptr;
+    }
+    if (crc64(blob.data() + section.offset, section.size) !=
+        section_checksum) {
+      MAGEEC_DEBUG("Container section checksum mismatch");
+      return nullptr;
+    }
+    reader.m_sections.push_back(section);
+  }
+  return reader;
+}
+
+Option<SectionReader> ContainerReader::getSection(uint32_t tag) const {
+  for (const auto &section : m_sections) {
+    if (section.tag == tag) {
+      return SectionReader(m_data + section.offset, section.size);
+    }
+  }
+  return nullptr;
+}
+
+std::vector<SectionReader> ContainerReader::getSections(uint32_t tag) const {
+  std::vector<SectionReader> sections;
+  for (const auto &section : m_sections) {
+    if (section.tag == tag) {
+      sections.push_back(SectionReader(m_data + section.offset, section.size));
+    }
+  }
+  return sections;
+}
+
+Option<std::map<std::string, std::string>>
+readConfigFile(const std::string &path) {
+  std::ifstream config(path);
+  if (!config) {
+    MAGEEC_ERR("Unable to open configuration file '" << path << "'");
+    return nullptr;
+  }
+
+  const char *whitespace = " \t\r";
+  std::map<std::string, std::string> values;
+  std::string line;
+  for (unsigned line_no = 1; std::getline(config, line); ++line_no) {
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(whitespace) == std::string::npos) {
+      continue;
+    }
+    size_t eq = line.find('=');
+    std::string key = line.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : line.substr(eq + 1);
+
+    size_t key_begin = key.find_first_not_of(whitespace);
+    size_t value_begin = value.find_first_not_of(whitespace);
+    if (eq == std::string::npos || key_begin == std::string::npos ||
+        value_begin == std::string::npos) {
+      MAGEEC_ERR(path << ":" << line_no << ": expected 'key = value'");
+      return nullptr;
+    }
+    key = key.substr(key_begin, key.find_last_not_of(whitespace) + 1 -
+                                    key_begin);
+    value = value.substr(value_begin, value.find_last_not_of(whitespace) +
+                                          1 - value_begin);
+    values[key] = value;
+  }
+  return values;
+}
+
+Option<uint64_t> parseUnsigned(const std::string &str) {
+  if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos) {
+    return nullptr;
+  }
+  errno = 0;
+  unsigned long long value = strtoull(str.c_str(), nullptr, 10);
+  if (errno == ERANGE) {
+    return nullptr;
+  }
+  return static_cast<uint64_t>(value);
+}
+
+Option<double> parseDouble(const std::string &str) {
+  if (str.empty()) {
+    return nullptr;
+  }
+  char *end = nullptr;
+  errno = 0;
+  double value = strtod(str.c_str(), &end);
+  if (errno == ERANGE || end != str.c_str() + str.size()) {
+    return nullptr;
+  }
+  return value;
+}
+
+Option<unsigned> parseConfigCount(const std::string &path,
+                                  const std::string &key,
+                                  const std::string &value, unsigned min,
+                                  unsigned max) {
+  auto count = parseUnsigned(value);
+  if (!count || count.get() < min || count.get() > max) {
+    MAGEEC_ERR(path << ": '" << key << "' must be an integer between " << min
+                    << " and " << max);
+    return nullptr;
+  }
+  return static_cast<unsigned>(count.get());
+}
+
+namespace {
+
+/// \brief Write a buffer to a file descriptor, retrying partial writes
+///
+/// \return True if the whole buffer was written
+bool writeAll(int fd, const uint8_t *data, size_t size) {
+  while (size != 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+/// \brief Read from a file descriptor until the end of the file
+///
+/// \return The data read, or nothing if the read failed
+Option<std::vector<uint8_t>> readAll(int fd) {
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  while (true) {
+    ssize_t n_read = read(fd, buf, sizeof(buf));
+    if (n_read < 0 && errno == EINTR) {
+      continue;
+    } else if (n_read < 0) {
+      return nullptr;
+    } else if (n_read == 0) {
+      return data;
+    }
+    data.insert(data.end(), buf, buf + n_read);
+  }
+}
+
+/// \struct ChildTask
+///
+/// \brief A task running in a child process
+struct ChildTask {
+  /// Index of the task
+  size_t index;
+  /// Process running the task
+  pid_t pid;
+  /// Read end of the pipe which the process writes its data to
+  int fd;
+};
+
+/// \brief Wait for a task running in a child process to finish
+///
+/// The child writes the length of its data followed by the data itself,
+/// which is only accepted if the child then exits successfully.
+///
+/// \return The data returned by the task, or nothing if the child failed
+Option<std::vector<uint8_t>> finishChildTask(const ChildTask &child) {
+  auto data = readAll(child.fd);
+  close(child.fd);
+
+  int status = 0;
+  while (waitpid(child.pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  if (!data || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return nullptr;
+  }
+
+  // | size | data |
+  std::vector<uint8_t> output = data.get();
+  SectionReader reader(output.data(), output.size());
+  uint64_t size = reader.read64();
+  std::vector<uint8_t> result = reader.readBytes(static_cast<size_t>(size));
+  if (reader.failed() || !reader.atEnd()) {
+    return nullptr;
+  }
+  return result;
+}
+
+} // end of anonymous namespace
+
+std::vector<Option<std::vector<uint8_t>>>
+runInProcesses(size_t n_tasks, unsigned jobs,
+               const std::function<std::vector<uint8_t>(size_t)> &task) {
+  std::vector<Option<std::vector<uint8_t>>> results(n_tasks);
+  if (jobs <= 1) {
+    for (size_t i = 0; i < n_tasks; ++i) {
+      results[i] = task(i);
+    }
+    return results;
+  }
+
+  // Make sure that buffered output is not duplicated by the children
+  fflush(nullptr);
+  std::cout.flush();
+
+  std::vector<ChildTask> running;
+  size_t next = 0;
+  while (next < n_tasks || !running.empty()) {
+    // Start as many tasks as allowed. The data of each task is collected in
+    // order, so a child which finishes early waits until its data is read.
+    while (next < n_tasks && running.size() < jobs) {
+      int fds[2];
+      if (pipe(fds) != 0) {
+        break;
+      }
+      pid_t pid = fork();
+      if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        break;
+      }
+      if (pid == 0) {
+        close(fds[0]);
+        std::vector<uint8_t> data = task(next);
+        std::vector<uint8_t> size;
+        write64LE(size, data.size());
+        bool written = writeAll(fds[1], size.data(), size.size()) &&
+                       writeAll(fds[1], data.data(), data.size());
+        close(fds[1]);
+        _exit(written ? 0 : 1);
+      }
+      close(fds[1]);
+      running.push_back({next, pid, fds[0]});
+      ++next;
+    }
+
+    // If no process could be started for the next task, it has failed
+    if (running.empty()) {
+      MAGEEC_DEBUG("Unable to start a process for task " << next);
+      ++next;
+      continue;
+    }
+
+    ChildTask child = running.front();
+    running.erase(running.begin());
+    results[child.index] = finishChildTask(child);
+  }
+  return results;
+}
+
+namespace {
+
+/// \class JobServer
+///
+/// \brief Client of the jobserver of a parent GNU make
+///
+/// Make passes a jobserver to its recipes in MAKEFLAGS, either as a pair of
+/// pipe file descriptors or as a named pipe. Each byte in the pipe is a
+/// token allowing one more job to run, in addition to the one job which
+/// every recipe may run without a token.
+///
+/// Make leaves the jobserver in MAKEFLAGS for recipes which it closes the
+/// pipe for, in which case the descriptors may since have been reused for
+/// other files. The jobserver is only used if it is still a pipe.
+class JobServer {
+public:
+  JobServer() : m_read_fd(-1), m_write_fd(-1), m_tokens() {
+    const char *makeflags = getenv("MAKEFLAGS");
+    if (!makeflags) {
+      return;
+    }
+    std::string flags(makeflags);
+    std::string auth;
+    for (const std::string prefix :
+         {"--jobserver-auth=", "--jobserver-fds="}) {
+      size_t pos = flags.rfind(prefix);
+      if (pos != std::string::npos) {
+        pos += prefix.size();
+        auth = flags.substr(pos, flags.find(' ', pos) - pos);
+        break;
+      }
+    }
+    if (auth.empty()) {
+      return;
+    }
+
+    // Open a separate description of the pipe, so that it can be made
+    // non-blocking without affecting make or its other children.
+    std::string read_path;
+    std::string write_path;
+    if (auth.compare(0, 5, "fifo:") == 0) {
+      read_path = write_path = auth.substr(5);
+    } else {
+      size_t comma = auth.find(',');
+      if (comma == std::string::npos) {
+        return;
+      }
+      auto read_fd = parseUnsigned(auth.substr(0, comma));
+      auto write_fd = parseUnsigned(auth.substr(comma + 1));
+      if (!read_fd || !write_fd || !isFifo(static_cast<int>(read_fd.get())) ||
+          !isFifo(static_cast<int>(write_fd.get()))) {
+        MAGEEC_DEBUG("Ignoring the jobserver '" << auth
+                     << "', which is not a pipe");
+        return;
+      }
+      read_path = "/proc/self/fd/" + std::to_string(read_fd.get());
+      write_path = "/proc/self/fd/" + std::to_string(write_fd.get());
+    }
+    struct stat path_stat;
+    if (stat(read_path.c_str(), &path_stat) != 0 ||
+        !S_ISFIFO(path_stat.st_mode)) {
+      MAGEEC_DEBUG("Ignoring the jobserver '" << auth
+                   << "', which is not a pipe");
+      return;
+    }
+    m_read_fd = open(read_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    m_write_fd = open(write_path.c_str(), O_WRONLY | O_CLOEXEC);
+    // The path may have been replaced since it was checked
+    if (m_read_fd < 0 || m_write_fd < 0 || !isFifo(m_read_fd) ||
+        !isFifo(m_write_fd)) {
+      MAGEEC_DEBUG("Unable to open the jobserver '" << auth << "'");
+      close();
+    }
+  }
+
+  ~JobServer() {
+    // Return any tokens which are still held
+    while (!m_tokens.empty()) {
+      release();
+    }
+    close();
+  }
+
+  JobServer(const JobServer &) = delete;
+  JobServer &operator=(const JobServer &) = delete;
+
+  /// \brief Whether there is a jobserver to take tokens from
+  bool available(void) const { return m_read_fd >= 0; }
+
+  /// \brief Take a token if one is available, without waiting for one
+  ///
+  /// \return True if a token was taken
+  bool tryAcquire(void) {
+    if (!available()) {
+      return false;
+    }
+    char token;
+    ssize_t n_read;
+    do {
+      n_read = read(m_read_fd, &token, 1);
+    } while (n_read < 0 && errno == EINTR);
+    if (n_read != 1) {
+      return false;
+    }
+    m_tokens.push_back(token);
+    return true;
+  }
+
+  /// \brief Return a token taken by tryAcquire
+  void release(void) {
+    assert(!m_tokens.empty());
+    char token = m_tokens.back();
+    m_tokens.pop_back();
+    while (write(m_write_fd, &token, 1) < 0 && errno == EINTR) {
+    }
+  }
+
+private:
+  static bool isFifo(int fd) {
+    struct stat fd_stat;
+    return fstat(fd, &fd_stat) == 0 && S_ISFIFO(fd_stat.st_mode);
+  }
+
+  void close(void) {
+    if (m_read_fd >= 0) {
+      ::close(m_read_fd);
+    }
+    if (m_write_fd >= 0) {
+      ::close(m_write_fd);
+    }
+    m_read_fd = m_write_fd = -1;
+  }
+
+  int m_read_fd;
+  int m_write_fd;
+  /// Tokens taken from the jobserver, which must be returned as they were
+  std::vector<char> m_tokens;
+};
+
+/// \struct RunningCommand
+///
+/// \brief A command running in a child process
+struct RunningCommand {
+  /// Index of the command
+  size_t index;
+  /// Process running the command
+  pid_t pid;
+  /// Read ends of the pipes capturing the standard output and error of the
+  /// command, or -1 if they are not captured or have been read to the end
+  int out_fd;
+  int err_fd;
+};
+
+/// \brief Start a command in a child process
+///
+/// The program is searched for in PATH and is started directly, without a
+/// shell.
+///
+/// \param args  The program followed by its arguments
+/// \param capture  Whether to capture the standard output and error of the
+/// command through pipes
+/// \param command  Filled with the running command
+/// \return True if the command was started
+bool spawnCommand(const std::vector<std::string> &args, bool capture,
+                  RunningCommand &command) {
+  assert(!args.empty() && "Command has no program to run");
+  command.pid = -1;
+  command.out_fd = command.err_fd = -1;
+
+  std::vector<char *> argv;
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  int out_fds[2] = {-1, -1};
+  int err_fds[2] = {-1, -1};
+  if (capture && (pipe2(out_fds, O_CLOEXEC) != 0 ||
+                  pipe2(err_fds, O_CLOEXEC) != 0)) {
+    for (int fd : {out_fds[0], out_fds[1], err_fds[0], err_fds[1]}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+    return false;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (capture) {
+    posix_spawn_file_actions_adddup2(&actions, out_fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_fds[1], STDERR_FILENO);
+  }
+  int res = posix_spawnp(&command.pid, argv[0], &actions, nullptr,
+                         argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (capture) {
+    close(out_fds[1]);
+    close(err_fds[1]);
+    if (res != 0) {
+      close(out_fds[0]);
+      close(err_fds[0]);
+    } else {
+      command.out_fd = out_fds[0];
+      command.err_fd = err_fds[0];
+    }
+  }
+  if (res != 0) {
+    MAGEEC_DEBUG("Unable to start '" << args[0] << "': " << strerror(res));
+    command.pid = -1;
+    return false;
+  }
+  return true;
+}
+
+/// \brief Read whatever is available from a pipe capturing the output of a
+/// command, closing it at the end of the output
+void readCapture(int &fd, std::string &data) {
+  char buf[4096];
+  ssize_t n_read;
+  do {
+    n_read = read(fd, buf, sizeof(buf));
+  } while (n_read < 0 && errno == EINTR);
+  if (n_read > 0) {
+    data.append(buf, static_cast<size_t>(n_read));
+  } else {
+    close(fd);
+    fd = -1;
+  }
+}
+
+/// \brief Wait for a command to exit, and record its exit code
+void finishCommand(const RunningCommand &command, CommandResult &result) {
+  int status = 0;
+  while (waitpid(command.pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  if (WIFEXITED(status)) {
+    result.status = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    result.status = 128 + WTERMSIG(status);
+  }
+}
+
+/// \brief Run a number of commands, several at once
+///
+/// \param commands  Commands to run, started in order
+/// \param jobs  Maximum number of commands to run at once, or 0 to use the
+/// jobserver
+/// \param capture  Whether to capture the output of the commands. This is
+/// forced when more than one command may run at once.
+std::vector<CommandResult>
+runCommandList(const std::vector<std::vector<std::string>> &commands,
+               unsigned jobs, bool capture) {
+  std::vector<CommandResult> results(commands.size());
+
+  // The jobserver is only opened when it decides the number of jobs
+  std::unique_ptr<JobServer> job_server;
+  if (jobs == 0) {
+    job_server.reset(new JobServer());
+    jobs = 1;
+  }
+  bool use_job_server = job_server && job_server->available();
+  capture = capture || jobs > 1 || use_job_server;
+
+  // Make sure that buffered output is not interleaved with that of the
+  // children
+  fflush(nullptr);
+  std::cout.flush();
+
+  std::vector<RunningCommand> running;
+  size_t next = 0;
+  bool failed = false;
+  while ((next < commands.size() && !failed) || !running.empty()) {
+    // Start as many commands as allowed. Every command after the first
+    // needs a token from the jobserver when it is used.
+    while (next < commands.size() && !failed) {
+      if (use_job_server) {
+        if (!running.empty() && !job_server->tryAcquire()) {
+          break;
+        }
+      } else if (running.size() >= jobs) {
+        break;
+      }
+
+      RunningCommand command;
+      command.index = next;
+      results[next].run = true;
+      if (!spawnCommand(commands[next], capture, command)) {
+        if (use_job_server && !running.empty()) {
+          job_server->release();
+        }
+        failed = true;
+        ++next;
+        break;
+      }
+      running.push_back(command);
+      ++next;
+    }
+    if (running.empty()) {
+      continue;
+    }
+
+    if (!capture) {
+      // Only one command runs at a time
+      assert(running.size() == 1);
+      finishCommand(running[0], results[running[0].index]);
+    } else {
+      // Read the output of every command until one of them has finished
+      // writing it, which is when it exits.
+      std::vector<pollfd> fds;
+      for (const auto &command : running) {
+        for (int fd : {command.out_fd, command.err_fd}) {
+          if (fd >= 0) {
+            fds.push_back({fd, POLLIN, 0});
+          }
+        }
+      }
+      if (!fds.empty()) {
+        while (poll(fds.data(), fds.size(), -1) < 0 && errno == EINTR) {
+        }
+      }
+      for (auto &command : running) {
+        CommandResult &result = results[command.index];
+        for (const auto &fd : fds) {
+          if (fd.revents == 0) {
+            continue;
+          }
+          if (fd.fd == command.out_fd) {
+            readCapture(command.out_fd, result.out);
+          } else if (fd.fd == command.err_fd) {
+            readCapture(command.err_fd, result.err);
+          }
+        }
+        if (command.out_fd < 0 && command.err_fd < 0) {
+          finishCommand(command, result);
+        }
+      }
+    }
+
+    // Forget the commands which have finished, returning their tokens
+    for (size_t i = running.size(); i > 0; --i) {
+      const RunningCommand &command = running[i - 1];
+      if (command.out_fd >= 0 || command.err_fd >= 0) {
+        continue;
+      }
+      if (results[command.index].status != 0) {
+        failed = true;
+      }
+      running.erase(running.begin() + static_cast<std::ptrdiff_t>(i - 1));
+      if (use_job_server && !running.empty()) {
+        job_server->release();
+      }
+    }
+  }
+  return results;
+}
+
+} // end of anonymous namespace
+
+std::vector<CommandResult>
+runCommands(const std::vector<std::vector<std::string>> &commands,
+            unsigned jobs, bool capture) {
+  return runCommandList(commands, jobs, capture);
+}
+
+CommandResult runCommand(const std::vector<std::string> &args, bool capture) {
+  return runCommandList({args}, 1, capture)[0];
+}
+
+util::Option<std::string> findProgram(const std::string &command) {
+  auto isExecutable = [](const std::string &candidate) {
+    struct stat program_stat;
+    return stat(candidate.c_str(), &program_stat) == 0 &&
+           S_ISREG(program_stat.st_mode) &&
+           access(candidate.c_str(), X_OK) == 0;
+  };
+
+  if (command.find('/') != std::string::npos) {
+    if (!isExecutable(command))
+      return nullptr;
+    return command;
+  }
+  const char *env_path = getenv("PATH");
+  std::string search_path = env_path ? env_path : "/bin:/usr/bin";
+  size_t start = 0;
+  while (start <= search_path.size()) {
+    size_t end = search_path.find(':', start);
+    if (end == std::string::npos) {
+      end = search_path.size();
+    }
+    std::string dir = search_path.substr(start, end - start);
+    std::string path = (dir.empty() ? "." : dir) + "/" + command;
+    if (isExecutable(path)) {
+      return path;
+    }
+    start = end + 1;
+  }
+  return nullptr;
+}
+
 #ifdef __unix__
   extern "C" {
     #include <linux/limits.h>
@@ -120,6 +1167,46 @@ uint64_t crc64(uint8_t *message, unsigned len) {
   #error Only Linux is supported
 #endif
 
+bool appendToFile(const std::string &path, const std::string &data) {
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0)
+    return false;
+
+  // A write to a regular file only falls short on error, such as when the
+  // disk is full. The remainder is not written, as a second write could be
+  // interleaved with data appended by another process.
+  ssize_t res;
+  do {
+    res = write(fd, data.data(), data.size());
+  } while (res < 0 && errno == EINTR);
+  if (close(fd) != 0)
+    return false;
+  return res >= 0 && static_cast<size_t>(res) == data.size();
+}
+
+bool writeFileAtomically(const std::string &path, const std::string &data) {
+  std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream tmp_file(tmp_path, std::ios::binary);
+    tmp_file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    tmp_file.close();
+    if (!tmp_file) {
+      remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool fileExists(const std::string &path) {
+  struct stat file_stat;
+  return stat(path.c_str(), &file_stat) == 0;
+}
+
 std::string getFullPath(std::string filename) {
   char path[PATH_MAX + 1];
   char *res = realpath(filename.c_str(), path);
@@ -217,19 +217,43 @@ std::unique_ptr<FunctionFeatures> extractFunctionFeatures(void) {
 }
 
 
+// Destination of converted features, holding the set of features to convert
+// into and the features which are used. Features which are not used are not
+// converted, and the output is then only part of the features.
+struct FeatureOutput {
+  FeatureOutput(mageec::FeatureSet &feature_set,
+                const std::set<unsigned> *used_features)
+      : feature_set(feature_set), used_features(used_features),
+        partial(false) {}
+
+  bool isUsed(unsigned feature_id) {
+    if (!used_features || used_features->count(feature_id))
+      return true;
+    partial = true;
+    return false;
+  }
+
+  mageec::FeatureSet &feature_set;
+  const std::set<unsigned> *used_features;
+  bool partial;
+};
+
+
 // Insert a single integer feature value into a mageec feature set
-static void insertFeature(mageec::FeatureSet &feature_set,
+static void insertFeature(FeatureOutput &out,
                           unsigned feature_id, int64_t value,
                           std::string name) {
-  feature_set.add(std::make_shared<mageec::IntFeature>(feature_id, value,
-                                                       name));
+  if (!out.isUsed(feature_id))
+    return;
+  out.feature_set.add(std::make_shared<mageec::IntFeature>(feature_id, value,
+                                                           name));
 }
 
 
 // Insert a set of features into the mageec feature set, deriving the
 // features values from the provided vector of values, as well as a set of
 // reduction functions to run over those values.
-static void insertFeatures(mageec::FeatureSet &feature_set,
+static void insertFeatures(FeatureOutput &out,
                            unsigned feature_id, std::vector<int64_t> values,
                            const char *name, std::set<unsigned> reductions) {
   // Don't insert any data if none was extracted
@@ -237,6 +261,11 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
     return;
 
   for (auto reduce_op : reductions) {
+    // Skip the reduction if the feature it produces is not used
+    if (!out.isUsed(feature_id | (kFeatureReductionMask &
+                                  (reduce_op << kFeatureReductionBit))))
+      continue;
+
     switch (reduce_op) {
     case FeatureReduce::kTotal: {
       unsigned total_feature_id = feature_id;
@@ -247,7 +276,7 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
       for (int64_t val : values)
         total += val;
 
-      insertFeature(feature_set, total_feature_id, total,
+      insertFeature(out, total_feature_id, total,
                     std::string(name) + " (Total)");
       break;
     }
@@ -260,7 +289,7 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
       for (int64_t val : values)
         min = std::min(min, val);
 
-      insertFeature(feature_set, min_feature_id, min,
+      insertFeature(out, min_feature_id, min,
                     std::string(name) + " (Min)");
       break;
     }
@@ -273,7 +302,7 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
       for (int64_t val : values)
         max = std::max(max, val);
 
-      insertFeature(feature_set, max_feature_id, max,
+      insertFeature(out, max_feature_id, max,
                     std::string(name) + " (Max)");
       break;
     }
@@ -290,7 +319,7 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
       }
       uint64_t range = max - min;
 
-      insertFeature(feature_set, range_feature_id, range,
+      insertFeature(out, range_feature_id, range,
                     std::string(name) + " (Range)");
       break;
     }
@@ -304,7 +333,7 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
         total += val;
       int64_t mean = total / values.size();
 
-      insertFeature(feature_set, mean_feature_id, mean,
+      insertFeature(out, mean_feature_id, mean,
                     std::string(name) + " (Mean)");
       break;
     }
@@ -316,7 +345,7 @@ static void insertFeatures(mageec::FeatureSet &feature_set,
       std::sort(values.begin(), values.end());
       int64_t median = values[values.size() / 2];
 
-      insertFeature(feature_set, median_feature_id, median,
+      insertFeature(out, median_feature_id, median,
                     std::string(name) + " (Median)");
       break;
     }
@@ -420,35 +449,38 @@ extractModuleFeatures(std::vector<const FunctionFeatures *> fn_features) {
 
 
 std::unique_ptr<mageec::FeatureSet>
-convertFunctionFeatures(const FunctionFeatures &features) {
+convertFunctionFeatures(const FunctionFeatures &features,
+                        const std::set<unsigned> *used_features,
+                        bool &partial) {
   using namespace FeatureReduce;
 
   // Features as they are represented in mageec
   std::unique_ptr<mageec::FeatureSet> feature_set(new mageec::FeatureSet());
+  FeatureOutput features_out(*feature_set, used_features);
 
-  insertFeature(*feature_set, FunctionFeature::kArgCount,
+  insertFeature(features_out, FunctionFeature::kArgCount,
                 features.args,
                 "Func: Num of arguments");
   // TODO: kCyclomaticComplexity
-  //insertFeature(*feature_set, FunctionFeature::kCyclomaticComplexity,
+  //insertFeature(features_out, FunctionFeature::kCyclomaticComplexity,
   //              features.cyclomatic_complexity,
   //              "Func: Cyclomatic complexity");
-  insertFeature(*feature_set, FunctionFeature::kCFGEdges,
+  insertFeature(features_out, FunctionFeature::kCFGEdges,
                 features.cfg_edges,
                 "Func: Control flow graph edges");
-  insertFeature(*feature_set, FunctionFeature::kCFGAbnormalEdges,
+  insertFeature(features_out, FunctionFeature::kCFGAbnormalEdges,
                 features.cfg_abnormal_edges,
                 "Func: Number of abnormal control flow graph edges");
   // TODO: kCriticalPathLen
-  //insertFeature(*feature_set, FunctionFeature::kCriticalPathLen,
+  //insertFeature(features_out, FunctionFeature::kCriticalPathLen,
   //              features.critical_path_len,
   //              "Func: Length of the CFG critical path");
 
   // Loop features
-  insertFeature(*feature_set, FunctionFeature::kLoops,
+  insertFeature(features_out, FunctionFeature::kLoops,
                 features.loops,
                 "Func: Number of loops");
-  insertFeatures(*feature_set, FunctionFeature::kLoopDepth,
+  insertFeatures(features_out, FunctionFeature::kLoopDepth,
                  features.loop_depth,
                  "Func: Depth of loops",
                  {kMin, kMax, kRange, kMean, kMedian});
@@ -463,32 +495,32 @@ convertFunctionFeatures(const FunctionFeatures &features) {
     if (depth > 2)
       loop_depth_gt2++;
   }
-  insertFeature(*feature_set, FunctionFeature::kLoopDepth1,
+  insertFeature(features_out, FunctionFeature::kLoopDepth1,
                 loop_depth_1,
                 "Func: Number of loops of depth 1");
-  insertFeature(*feature_set, FunctionFeature::kLoopDepth2,
+  insertFeature(features_out, FunctionFeature::kLoopDepth2,
                 loop_depth_2,
                 "Func: Number of loops of depth 2");
-  insertFeature(*feature_set, FunctionFeature::kLoopDepthGt2,
+  insertFeature(features_out, FunctionFeature::kLoopDepthGt2,
                 loop_depth_gt2,
                 "Func: Number of loops of depth >2");
 
   // Basic block counts
-  insertFeature(*feature_set, FunctionFeature::kBasicBlocks,
+  insertFeature(features_out, FunctionFeature::kBasicBlocks,
                 features.basic_blocks,
                 "Func: Number of basic blocks");
-  insertFeature(*feature_set, FunctionFeature::kBBInLoop,
+  insertFeature(features_out, FunctionFeature::kBBInLoop,
                 features.bb_in_loop,
                 "Func: Number of basic blocks in a loop");
-  insertFeature(*feature_set, FunctionFeature::kBBOutsideLoop,
+  insertFeature(features_out, FunctionFeature::kBBOutsideLoop,
                 features.bb_outside_loop,
                 "Func: Number of basic blocks outside a loop");
 
-  insertFeatures(*feature_set, FunctionFeature::kBBSucc,
+  insertFeatures(features_out, FunctionFeature::kBBSucc,
                  features.bb_succ,
                  "Func: Number of successors for a basic block",
                  {kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBPred,
+  insertFeatures(features_out, FunctionFeature::kBBPred,
                  features.bb_pred,
                  "Func: Number of predecessors for a basic block",
                  {kMin, kMax, kRange, kMean, kMedian});
@@ -531,29 +563,29 @@ convertFunctionFeatures(const FunctionFeatures &features) {
     if (features.bb_succ[i] > 2)
       bb_gt2succ++;
   }
-  insertFeature(*feature_set, FunctionFeature::kBB1Pred, bb_1pred,
+  insertFeature(features_out, FunctionFeature::kBB1Pred, bb_1pred,
                 "Func: Number of basic blocks with 1 predecessor");
-  insertFeature(*feature_set, FunctionFeature::kBB2Pred, bb_2pred,
+  insertFeature(features_out, FunctionFeature::kBB2Pred, bb_2pred,
                 "Func: Number of basic blocks with 2 predecessors");
-  insertFeature(*feature_set, FunctionFeature::kBBGt2Pred, bb_gt2pred,
+  insertFeature(features_out, FunctionFeature::kBBGt2Pred, bb_gt2pred,
                 "Func: Number of basic blocks with >2 predecessors");
 
-  insertFeature(*feature_set, FunctionFeature::kBB1Succ, bb_1succ,
+  insertFeature(features_out, FunctionFeature::kBB1Succ, bb_1succ,
                 "Func: Number of basic blocks with 1 successor");
-  insertFeature(*feature_set, FunctionFeature::kBB2Succ, bb_2succ,
+  insertFeature(features_out, FunctionFeature::kBB2Succ, bb_2succ,
                 "Func: Number of basic blocks with 2 successor");
-  insertFeature(*feature_set, FunctionFeature::kBBGt2Succ, bb_gt2succ,
+  insertFeature(features_out, FunctionFeature::kBBGt2Succ, bb_gt2succ,
                 "Func: Number of basic blocks with >2 successor");
 
-  insertFeature(*feature_set, FunctionFeature::kBB1Pred1Succ, bb_1pred_1succ,
+  insertFeature(features_out, FunctionFeature::kBB1Pred1Succ, bb_1pred_1succ,
                 "Func: Number of basic blocks with 1 predecessor, 1 successor");
-  insertFeature(*feature_set, FunctionFeature::kBB1Pred2Succ, bb_1pred_2succ,
+  insertFeature(features_out, FunctionFeature::kBB1Pred2Succ, bb_1pred_2succ,
                 "Func: Number of basic blocks with 1 predecessor, 2 successors");
-  insertFeature(*feature_set, FunctionFeature::kBB2Pred1Succ, bb_2pred_1succ,
+  insertFeature(features_out, FunctionFeature::kBB2Pred1Succ, bb_2pred_1succ,
                 "Func: Number of basic blocks with 2 predecessors, 1 successor");
-  insertFeature(*feature_set, FunctionFeature::kBB2Pred2Succ, bb_2pred_2succ,
+  insertFeature(features_out, FunctionFeature::kBB2Pred2Succ, bb_2pred_2succ,
                 "Func: Number of basic blocks with 2 predecessors, 2 successors");
-  insertFeature(*feature_set, FunctionFeature::kBBGt2PredGt2Succ, bb_gt2pred_gt2succ,
+  insertFeature(features_out, FunctionFeature::kBBGt2PredGt2Succ, bb_gt2pred_gt2succ,
                 "Func: Number of basic blocks with >2 predecessors, >2 successors");
 
   // TODO: kBBPhi0
@@ -565,61 +597,61 @@ convertFunctionFeatures(const FunctionFeatures &features) {
   // TODO: kBBInsnGt500
 
   // Instruction counts (per basic block)
-  insertFeatures(*feature_set, FunctionFeature::kBBInstructions,
+  insertFeatures(features_out, FunctionFeature::kBBInstructions,
                  features.bb_instructions,
                  "Func: Number of instructions in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBCondStmts,
+  insertFeatures(features_out, FunctionFeature::kBBCondStmts,
                  features.bb_cond_stmts,
                  "Func: Number of conditional statements in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBDirectCalls,
+  insertFeatures(features_out, FunctionFeature::kBBDirectCalls,
                  features.bb_direct_calls,
                  "Func: Number of direct calls in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBIndirectCalls,
+  insertFeatures(features_out, FunctionFeature::kBBIndirectCalls,
                  features.bb_indirect_calls,
                  "Func: Number of indirect calls in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBIntOps,
+  insertFeatures(features_out, FunctionFeature::kBBIntOps,
                  features.bb_int_ops,
                  "Func: Number of integer operations in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBFloatOps,
+  insertFeatures(features_out, FunctionFeature::kBBFloatOps,
                  features.bb_float_ops,
                  "Func: Number of floating-point operations in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBUnaryOps,
+  insertFeatures(features_out, FunctionFeature::kBBUnaryOps,
                  features.bb_unary_ops,
                  "Func: Number of unary operations in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBPtrArithOps,
+  insertFeatures(features_out, FunctionFeature::kBBPtrArithOps,
                  features.bb_ptr_arith_ops,
                  "Func: Number of pointer arithmetic operations in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBUncondBrs,
+  insertFeatures(features_out, FunctionFeature::kBBUncondBrs,
                  features.bb_uncond_brs,
                  "Func: Number of unconditional branches in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBAssignStmts,
+  insertFeatures(features_out, FunctionFeature::kBBAssignStmts,
                  features.bb_assign_stmts,
                  "Func: Number of assignments in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBSwitchStmts,
+  insertFeatures(features_out, FunctionFeature::kBBSwitchStmts,
                  features.bb_switch_stmts,
                  "Func: Number of switches in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBPhiNodes,
+  insertFeatures(features_out, FunctionFeature::kBBPhiNodes,
                  features.bb_phi_nodes,
                  "Func: Number of phi nodes in basic block",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, FunctionFeature::kBBPhiHeaderNodes,
+  insertFeatures(features_out, FunctionFeature::kBBPhiHeaderNodes,
                  features.bb_phi_header_nodes,
                  "Func: Number of phi header nodes in basic block",
                  {kTotal, kMax, kMean, kMedian});
 
   // Function instruction counts
-  insertFeatures(*feature_set, FunctionFeature::kPhiArgs,
+  insertFeatures(features_out, FunctionFeature::kPhiArgs,
                  features.phi_args,
                  "Func: Number of arguments in phi nodes",
                  {kMax, kMean, kMedian});
@@ -631,14 +663,14 @@ convertFunctionFeatures(const FunctionFeatures &features) {
     if (n_args > 5)
       phi_args_gt5++;
   }
-  insertFeature(*feature_set, FunctionFeature::kPhiArgs1to5,
+  insertFeature(features_out, FunctionFeature::kPhiArgs1to5,
                 phi_args_1to5,
                 "Func: Number of phi nodes with between 1 and 5 arguments");
-  insertFeature(*feature_set, FunctionFeature::kPhiArgsGt5,
+  insertFeature(features_out, FunctionFeature::kPhiArgsGt5,
                 phi_args_gt5,
                 "Func: Number of phi nodes with >5 arguments");
   
-  insertFeatures(*feature_set, FunctionFeature::kCallArgs,
+  insertFeatures(features_out, FunctionFeature::kCallArgs,
                  features.call_args,
                  "Func: Number of arguments in call instructions",
                  {kMax, kMean, kMedian});
@@ -653,51 +685,55 @@ convertFunctionFeatures(const FunctionFeatures &features) {
     if (n_args > 3)
       call_args_gt3++;
   }
-  insertFeature(*feature_set, FunctionFeature::kCallArgs0,
+  insertFeature(features_out, FunctionFeature::kCallArgs0,
                 call_args_0,
                 "Func: Number of call instructions with 0 arguments");
-  insertFeature(*feature_set, FunctionFeature::kCallArgs1to3,
+  insertFeature(features_out, FunctionFeature::kCallArgs1to3,
                 call_args_1to3,
                 "Func: Number of call instructions with between 1 and 3 arguments");
-  insertFeature(*feature_set, FunctionFeature::kCallArgsGt3,
+  insertFeature(features_out, FunctionFeature::kCallArgsGt3,
                 call_args_gt3,
                 "Func: Number of call instructions with >3 arguments");
 
-  insertFeatures(*feature_set, FunctionFeature::kCallPtrArgs,
+  insertFeatures(features_out, FunctionFeature::kCallPtrArgs,
                  features.call_ptr_args,
                  "Func: Number of pointer arguments in call instructions",
                  {kMax, kMin, kMedian});
 
   // TODO: kCallRetVoid
-  insertFeature(*feature_set, FunctionFeature::kCallRetInt,
+  insertFeature(features_out, FunctionFeature::kCallRetInt,
                 features.call_ret_int,
                 "Func: Number of call instructions returning integers");
-  insertFeature(*feature_set, FunctionFeature::kCallRetFloat,
+  insertFeature(features_out, FunctionFeature::kCallRetFloat,
                 features.call_ret_float,
                 "Func: Number of call instructions returning floats");
 
+  partial = features_out.partial;
   return feature_set;
 }
 
 
 std::unique_ptr<mageec::FeatureSet>
-convertModuleFeatures(const ModuleFeatures &features) {
+convertModuleFeatures(const ModuleFeatures &features,
+                      const std::set<unsigned> *used_features,
+                      bool &partial) {
   using namespace FeatureReduce;
 
   // Features as they are represented in mageec
   std::unique_ptr<mageec::FeatureSet> feature_set(new mageec::FeatureSet());
+  FeatureOutput features_out(*feature_set, used_features);
 
   // General module features
-  insertFeature(*feature_set, ModuleFeature::kFunctions,
+  insertFeature(features_out, ModuleFeature::kFunctions,
                 features.functions,
                 "Module: Number of functions");
-  insertFeature(*feature_set, ModuleFeature::kSCCs,
+  insertFeature(features_out, ModuleFeature::kSCCs,
                 features.sccs,
                 "Module: Number of SCCs");
-  insertFeature(*feature_set, ModuleFeature::kFuncRetInt,
+  insertFeature(features_out, ModuleFeature::kFuncRetInt,
                 features.fn_ret_int,
                 "Module: Number of functions returning integers");
-  insertFeature(*feature_set, ModuleFeature::kFuncRetFloat,
+  insertFeature(features_out, ModuleFeature::kFuncRetFloat,
                 features.fn_ret_float,
                 "Module: Number of functions returning floats");
   // TODO: kFuncRetVoid
@@ -707,7 +743,7 @@ convertModuleFeatures(const ModuleFeatures &features) {
   // TODO: kFuncGt3Args
 
   // Loops
-  insertFeatures(*feature_set, ModuleFeature::kLoopDepth,
+  insertFeatures(features_out, ModuleFeature::kLoopDepth,
                  features.loop_depth,
                  "Module: Depth of loops",
                  {kMin, kMax, kMean, kMedian});
@@ -722,109 +758,110 @@ convertModuleFeatures(const ModuleFeatures &features) {
     if (depth > 2)
       loop_depth_gt2++;
   }
-  insertFeature(*feature_set, ModuleFeature::kLoopDepth1,
+  insertFeature(features_out, ModuleFeature::kLoopDepth1,
                 loop_depth_1,
                 "Module: Number of loops of depth 1");
-  insertFeature(*feature_set, ModuleFeature::kLoopDepth2,
+  insertFeature(features_out, ModuleFeature::kLoopDepth2,
                 loop_depth_2,
                 "Module: Number of loops of depth 2");
-  insertFeature(*feature_set, ModuleFeature::kLoopDepthGt2,
+  insertFeature(features_out, ModuleFeature::kLoopDepthGt2,
                 loop_depth_gt2,
                 "Module: Number of loops of depth >2");
 
   // Function features
-  insertFeatures(*feature_set, ModuleFeature::kFuncArgs,
+  insertFeatures(features_out, ModuleFeature::kFuncArgs,
                  features.fn_args,
                  "Module: Number of arguments to a function",
                  {kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncCyclomaticComplexity,
+  insertFeatures(features_out, ModuleFeature::kFuncCyclomaticComplexity,
                  features.fn_cyclomatic_complexity,
                  "Module: Cyclomatic complexity of a function",
                  {kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncCFGEdges,
+  insertFeatures(features_out, ModuleFeature::kFuncCFGEdges,
                  features.fn_cfg_edges,
                  "Module: CFG edges of a function",
                  {kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncCFGAbnormalEdges,
+  insertFeatures(features_out, ModuleFeature::kFuncCFGAbnormalEdges,
                  features.fn_cfg_abnormal_edges,
                  "Module: Abnormal CFG edges of a function",
                  {kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncCriticalPathLen,
+  insertFeatures(features_out, ModuleFeature::kFuncCriticalPathLen,
                  features.fn_critical_path_len,
                  "Module: CFG critical path length of a function",
                  {kMin, kMax, kRange, kMean, kMedian});
 
-  insertFeatures(*feature_set, ModuleFeature::kFuncLoops,
+  insertFeatures(features_out, ModuleFeature::kFuncLoops,
                  features.fn_loops,
                  "Module: Number of loops in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
 
-  insertFeatures(*feature_set, ModuleFeature::kFuncBasicBlocks,
+  insertFeatures(features_out, ModuleFeature::kFuncBasicBlocks,
                  features.fn_basic_blocks,
                  "Module: Number of basic blocks in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncBBInLoop,
+  insertFeatures(features_out, ModuleFeature::kFuncBBInLoop,
                  features.fn_bb_in_loop,
                  "Module: Number of basic blocks inside a loop in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncBBOutsideLoop,
+  insertFeatures(features_out, ModuleFeature::kFuncBBOutsideLoop,
                  features.fn_bb_outside_loop,
                  "Module: Number of basic blocks outside a loop in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
 
   // Instruction features
-  insertFeatures(*feature_set, ModuleFeature::kFuncInsnCount,
+  insertFeatures(features_out, ModuleFeature::kFuncInsnCount,
                  features.fn_instructions,
                  "Module: Number of instructions in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncCondStmts,
+  insertFeatures(features_out, ModuleFeature::kFuncCondStmts,
                  features.fn_cond_stmts,
                  "Module: Number of conditional statments in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncDirectCalls,
+  insertFeatures(features_out, ModuleFeature::kFuncDirectCalls,
                  features.fn_direct_calls,
                  "Module: Number of direct calls in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncIndirectCalls,
+  insertFeatures(features_out, ModuleFeature::kFuncIndirectCalls,
                  features.fn_indirect_calls,
                  "Module: Number of indirect calls in a function",
                  {kTotal, kMin, kMax, kRange, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncIntOps,
+  insertFeatures(features_out, ModuleFeature::kFuncIntOps,
                  features.fn_int_ops,
                  "Module: Number of integer operations in function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncFloatOps,
+  insertFeatures(features_out, ModuleFeature::kFuncFloatOps,
                  features.fn_float_ops,
                  "Module: Number of floating-point operations in function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncUnaryOps,
+  insertFeatures(features_out, ModuleFeature::kFuncUnaryOps,
                  features.fn_unary_ops,
                  "Module: Number of unary operations in function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncPtrArithOps,
+  insertFeatures(features_out, ModuleFeature::kFuncPtrArithOps,
                  features.fn_ptr_arith_ops,
                  "Module: Number of pointer arithmetic operations in function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncUncondBrs,
+  insertFeatures(features_out, ModuleFeature::kFuncUncondBrs,
                  features.fn_uncond_brs,
                  "Module: Number of unconditional branches in a function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncAssignStmts,
+  insertFeatures(features_out, ModuleFeature::kFuncAssignStmts,
                  features.fn_assign_stmts,
                  "Module: Number of assignments in a function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncSwitchStmts,
+  insertFeatures(features_out, ModuleFeature::kFuncSwitchStmts,
                  features.fn_switch_stmts,
                  "Module: Number of switches in a function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncPhiNodes,
+  insertFeatures(features_out, ModuleFeature::kFuncPhiNodes,
                  features.fn_phi_nodes,
                  "Module: Number of phi nodes in a function",
                  {kTotal, kMax, kMean, kMedian});
-  insertFeatures(*feature_set, ModuleFeature::kFuncPhiHeaderNodes,
+  insertFeatures(features_out, ModuleFeature::kFuncPhiHeaderNodes,
                  features.fn_phi_header_nodes,
                  "Module: Number of phi header nodes in a function",
                  {kTotal, kMax, kMean, kMedian});
 
+  partial = features_out.partial;
   return feature_set;
 }
@@ -28,6 +28,7 @@
 #include "mageec/AttributeSet.h"
 
 #include <memory>
+#include <set>
 #include <vector>
 
 
@@ -234,17 +235,29 @@ extractModuleFeatures(std::vector<const FunctionFeatures*> func_features);
 /// \brief Converts function features into a FeatureSet used by MAGEEC
 ///
 /// \param features  The function features to be converted
+/// \param used_features  Identifiers of the features to convert, or nullptr
+/// to convert every feature
+/// \param partial  Set to true if some of the features were not converted,
+/// as they are not used
 /// \return The FeatureSet for the given FunctionFeatures
 std::unique_ptr<mageec::FeatureSet>
-convertFunctionFeatures(const FunctionFeatures &features);
+convertFunctionFeatures(const FunctionFeatures &features,
+                        const std::set<unsigned> *used_features,
+                        bool &partial);
 
 
 /// \brief Convert module features into a FeatureSet used by MAGEEC
 ///
 /// \param features  The module features to be converted
+/// \param used_features  Identifiers of the features to convert, or nullptr
+/// to convert every feature
+/// \param partial  Set to true if some of the features were not converted,
+/// as they are not used
 /// \return The FeatureSet for the given ModuleFeatures
 std::unique_ptr<mageec::FeatureSet>
-convertModuleFeatures(const ModuleFeatures &features);
+convertModuleFeatures(const ModuleFeatures &features,
+                      const std::set<unsigned> *used_features,
+                      bool &partial);
 
 
 #endif // MAGEEC_GCC_FEATURE_EXTRACT_H
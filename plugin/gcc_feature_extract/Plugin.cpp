@@ -33,6 +33,7 @@
 #include <fstream>
 #include <map>
 #include <string>
+#include <vector>
 
 // GCC Plugin headers                                                           
 // Undefine these as gcc-plugin.h redefines them                                
@@ -121,7 +122,13 @@ static void printHelp()
 "  -database=<arg>      Database to be used to store extracted features\n"
 "  -database-version    Print the version of the provided database\n"
 "  -out=<arg>           The output file records identifiers of feature sets\n"
-"                       in the database for each element of the program\n"
+"                       in the database for each element of the program.\n"
+"                       These are also recorded in the database for each\n"
+"                       source file\n"
+"  -trained-features    Only extract the features used by the machine\n"
+"                       learners trained in the database. The feature\n"
+"                       sets are marked as partial, and are not used\n"
+"                       for training\n"
 "\n"
 "examples:\n"
 "  gcc -fplugin=libfeature_extract_gcc.so\n"
@@ -197,6 +204,7 @@ static bool parseArguments(struct plugin_name_args *plugin_info,
   bool with_debug               = false;
   bool with_sql_trace           = false;
   bool with_db_version          = false;
+  bool with_trained_features    = false;
 
   // Flags with arguments
   bool with_db       = false;
@@ -248,6 +256,13 @@ static bool parseArguments(struct plugin_name_args *plugin_info,
         return false;
       }
       with_db_version = true;
+    } else if (arg_str == "trained-features") {
+      if (argv[i].value) {
+        MAGEEC_ERR("Plugin argument 'trained-features' does not take a "
+                   "value");
+        return false;
+      }
+      with_trained_features = true;
     }
 
     // Flags with arguments
@@ -304,11 +319,6 @@ static bool parseArguments(struct plugin_name_args *plugin_info,
                "to");
     return false;
   }
-  if (!with_outfile) {
-    MAGEEC_ERR("Cannot feature extract without somewhere to output feature set "
-               "ids");
-    return false;
-  }
 
   // Now we know whether a database is required we can load it.
   assert(db_str != "");
@@ -318,7 +328,12 @@ static bool parseArguments(struct plugin_name_args *plugin_info,
   if (with_db_version)
     printDatabaseVersion(getContext().getDatabase());
 
-  getContext().openOutFile(outfile_str);
+  // Skip the features which no trained machine learner uses
+  if (with_trained_features)
+    getContext().loadUsedFeatures();
+
+  if (with_outfile)
+    getContext().openOutFile(outfile_str);
   return true;
 }
 
@@ -477,32 +492,64 @@ void featureExtractFinishUnit(void *, void *) {
 
   std::unique_ptr<ModuleFeatures> module_features =
       extractModuleFeatures(func_features);
+  bool module_partial = false;
   std::unique_ptr<mageec::FeatureSet> module_feature_set =
-      convertModuleFeatures(*module_features);
+      convertModuleFeatures(*module_features,
+                            getContext().getModuleUsedFeatures(),
+                            module_partial);
 
+  // Only the features used by the trained machine learners may have been
+  // converted, in which case the feature set is marked so that it is not
+  // used for training.
   mageec::FeatureSetID module_feature_set_id =
-      getContext().getDatabase().newFeatureSet(*module_feature_set);
-
-  getContext().getOutFile() << src_filename << ",module,"
-                            << module_name << ",features,"
-                            << (uint64_t)module_feature_set_id
-                            << ",feature_class,"
-                            << (uint64_t)mageec::FeatureClass::kModule << "\n";
+      module_partial
+          ? getContext().getDatabase().newPartialFeatureSet(
+                *module_feature_set)
+          : getContext().getDatabase().newFeatureSet(*module_feature_set);
+
+  // The feature sets of the source file are recorded in the database, so
+  // that they can be found when the file is compiled, as well as in the
+  // output file if there is one.
+  std::vector<mageec::SourceFeatureSet> src_feature_sets;
+  src_feature_sets.push_back({module_name, mageec::FeatureClass::kModule,
+                              module_feature_set_id, module_partial});
+
+  if (getContext().hasOutFile()) {
+    getContext().getOutFile() << src_filename << ",module,"
+                              << module_name << ",features,"
+                              << (uint64_t)module_feature_set_id
+                              << ",feature_class,"
+                              << (uint64_t)mageec::FeatureClass::kModule
+                              << "\n";
+  }
 
   // Insert the features of each function into the database
   // Functions also inherit features from their encapsulating module
   for (auto &features : getContext().getFunctionFeatures()) {
+    bool func_partial = false;
     std::unique_ptr<mageec::FeatureSet> func_feature_set =
-        convertFunctionFeatures(*features.second.get());
+        convertFunctionFeatures(*features.second.get(),
+                                getContext().getFunctionUsedFeatures(),
+                                func_partial);
 
     mageec::FeatureSetID func_feature_set_id =
-        getContext().getDatabase().newFeatureSet(*func_feature_set);
-
-    getContext().getOutFile() << src_filename << ",function,"
-                              << features.first << ",features,"
-                              << (uint64_t)func_feature_set_id
-                              << ",feature_class,"
-                              << (uint64_t)mageec::FeatureClass::kFunction
-                              << "\n";
+        func_partial
+            ? getContext().getDatabase().newPartialFeatureSet(
+                  *func_feature_set)
+            : getContext().getDatabase().newFeatureSet(*func_feature_set);
+    src_feature_sets.push_back({features.first,
+                                mageec::FeatureClass::kFunction,
+                                func_feature_set_id, func_partial});
+
+    if (getContext().hasOutFile()) {
+      getContext().getOutFile() << src_filename << ",function,"
+                                << features.first << ",features,"
+                                << (uint64_t)func_feature_set_id
+                                << ",feature_class,"
+                                << (uint64_t)mageec::FeatureClass::kFunction
+                                << "\n";
+    }
   }
+  getContext().getDatabase().setSourceFeatureSets(src_filename,
+                                                  src_feature_sets);
 }
@@ -35,6 +35,7 @@
 #include <fstream>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 
 
@@ -55,12 +56,13 @@ static_assert(GCC_FEATURE_EXTRACT_PLUGIN_VERSION_MAJOR == 2 &&
 ///
 /// This holds handles to the framework and database, as well as
 /// the features for each of the functions in the current modules. It also
-/// holds a handle to the output file into which the FeatureIDs are
+/// holds a handle to the optional output file into which the FeatureIDs are
 /// emitted once the features have been extracted
 class FeatureExtractContext {
 public:
   FeatureExtractContext()
-      : m_framework(), m_db(), m_outfile(), m_func_features()
+      : m_framework(), m_db(), m_outfile(), m_func_features(),
+        m_module_used_features(), m_function_used_features()
   {}
 
   FeatureExtractContext(const FeatureExtractContext &) = delete;
@@ -98,12 +100,44 @@ public:
     assert(m_outfile);
     return *m_outfile;
   }
+  bool hasOutFile(void) const {
+    return m_outfile != nullptr;
+  }
 
   std::map<std::string, std::unique_ptr<FunctionFeatures>>&
   getFunctionFeatures(void) {
     return m_func_features;
   }
 
+  /// \brief Restrict extraction to the features used by the machine
+  /// learners trained in the database
+  ///
+  /// If a class of features has no trained machine learners, or one which
+  /// may use any feature, every feature of that class is still extracted.
+  void loadUsedFeatures(void) {
+    assert(m_db);
+    auto module_used =
+        m_db->getUsedFeatures(mageec::FeatureClass::kModule);
+    if (module_used)
+      m_module_used_features.reset(new std::set<unsigned>(module_used.get()));
+    auto function_used =
+        m_db->getUsedFeatures(mageec::FeatureClass::kFunction);
+    if (function_used)
+      m_function_used_features.reset(
+          new std::set<unsigned>(function_used.get()));
+  }
+
+  /// \brief Get the module features to extract, or nullptr for all of them
+  const std::set<unsigned> *getModuleUsedFeatures(void) const {
+    return m_module_used_features.get();
+  }
+
+  /// \brief Get the function features to extract, or nullptr for all of
+  /// them
+  const std::set<unsigned> *getFunctionUsedFeatures(void) const {
+    return m_function_used_features.get();
+  }
+
 private:
   /// Handle to the framework
   std::unique_ptr<mageec::Framework> m_framework;
@@ -117,6 +151,11 @@ private:
   /// Extracted features for each function in the module, keyed on the
   /// name of the function
   std::map<std::string, std::unique_ptr<FunctionFeatures>> m_func_features;
+
+  /// Module and function features to extract, if they are restricted to
+  /// those used by trained machine learners
+  std::unique_ptr<std::set<unsigned>> m_module_used_features;
+  std::unique_ptr<std::set<unsigned>> m_function_used_features;
 };
 
 /// The plugin base_name for our hooks to use to schedule new passes
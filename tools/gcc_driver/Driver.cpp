@@ -3,11 +3,17 @@
 #include "mageec/Framework.h"
 #include "mageec/ML/C5.h"
 #include "mageec/ML/1NN.h"
+#include "mageec/ML/RandomForest.h"
 #include "mageec/Util.h"
+#include "FlagTable.h"
+#include "ObjectCache.h"
 #include "Parameters.h"
+#include "PredictService.h"
 
+#include <chrono>
 #include <cstring>
 #include <fstream>
+#include <iostream>
 #include <map>
 #include <memory>
 #include <set>
@@ -15,6 +21,9 @@
 #include <sstream>
 #include <vector>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #if !defined(GCC_DRIVER_VERSION_MAJOR) ||                                      \
     !defined(GCC_DRIVER_VERSION_MINOR) ||                                      \
     !defined(GCC_DRIVER_VERSION_PATCH)
@@ -41,167 +50,149 @@ enum class DriverMode {
 };
 
 
-/// Map from a flag to an integer parameter to be used with MAGEEC, as well
-/// as the gcc version that the flag is first supported.
-// Heap allocate so the destructor does not need to be called
-static const auto &all_flag_to_parameter = *new std::map<std::string, std::pair<unsigned, unsigned>>({
-  {"-faggressive-loop-optimizations",      {FlagParameterID::kAggressiveLoopOptimizations, 40800}},
-  {"-falign-functions",                    {FlagParameterID::kAlignFunctions, 40500}},
-  {"-falign-jumps",                        {FlagParameterID::kAlignJumps, 40500}},
-  {"-falign-labels",                       {FlagParameterID::kAlignLabels, 40500}},
-  {"-falign-loops",                        {FlagParameterID::kAlignLoops, 40500}},
-  {"-fbranch-count-reg",                   {FlagParameterID::kBranchCountReg, 40500}},
-  {"-fbranch-target-load-optimize",        {FlagParameterID::kBranchTargetLoadOptimize, 40500}},
+/// Flags with the integer parameter to be used with MAGEEC, as well as the
+/// gcc version that the flag is first supported.
+static const FlagInfo all_flags[] = {
+  {"-faggressive-loop-optimizations",      FlagParameterID::kAggressiveLoopOptimizations, 40800},
+  {"-falign-functions",                    FlagParameterID::kAlignFunctions, 40500},
+  {"-falign-jumps",                        FlagParameterID::kAlignJumps, 40500},
+  {"-falign-labels",                       FlagParameterID::kAlignLabels, 40500},
+  {"-falign-loops",                        FlagParameterID::kAlignLoops, 40500},
+  {"-fbranch-count-reg",                   FlagParameterID::kBranchCountReg, 40500},
+  {"-fbranch-target-load-optimize",        FlagParameterID::kBranchTargetLoadOptimize, 40500},
   // Can't run multiple times
-  //{"-fbranch-target-load-optimize2",       {FlagParameterID::kBranchTargetLoadOptimize2, 40500}},
-  {"-fbtr-bb-exclusive",                   {FlagParameterID::kBTRBBExclusive, 40500}},
-  {"-fcaller-saves",                       {FlagParameterID::kCallerSaves, 40500}},
-  {"-fcombine-stack-adjustments",          {FlagParameterID::kCombineStackAdjustments, 40600}},
+  //{"-fbranch-target-load-optimize2",       FlagParameterID::kBranchTargetLoadOptimize2, 40500},
+  {"-fbtr-bb-exclusive",                   FlagParameterID::kBTRBBExclusive, 40500},
+  {"-fcaller-saves",                       FlagParameterID::kCallerSaves, 40500},
+  {"-fcombine-stack-adjustments",          FlagParameterID::kCombineStackAdjustments, 40600},
   // affects semantics, unlikely to affect performance
-  //{"-fcommon",                             {FlagParameterID::kCommon, 40500}},
-  {"-fcompare-elim",                       {FlagParameterID::kCompareElim, 40600}},
-  {"-fconserve-stack",                     {FlagParameterID::kConserveStack, 40500}},
-  {"-fcprop-registers",                    {FlagParameterID::kCPropRegister, 40500}},
-  {"-fcrossjumping",                       {FlagParameterID::kCrossJumping, 40500}},
-  {"-fcse-follow-jumps",                   {FlagParameterID::kCSEFollowJumps, 40500}},
+  //{"-fcommon",                             FlagParameterID::kCommon, 40500},
+  {"-fcompare-elim",                       FlagParameterID::kCompareElim, 40600},
+  {"-fconserve-stack",                     FlagParameterID::kConserveStack, 40500},
+  {"-fcprop-registers",                    FlagParameterID::kCPropRegister, 40500},
+  {"-fcrossjumping",                       FlagParameterID::kCrossJumping, 40500},
+  {"-fcse-follow-jumps",                   FlagParameterID::kCSEFollowJumps, 40500},
   // affects semantics, unlikely to affect performance
-  //{"-fdata-sections",                      {FlagParameterID::kDataSections, 40500}},
-  {"-fdce",                                {FlagParameterID::kDCE, 40500}},
-  {"-fdefer-pop",                          {FlagParameterID::kDeferPop, 40500}},
-  {"-fdelete-null-pointer-checks",         {FlagParameterID::kDeleteNullPointerChecks, 40500}},
-  {"-fdevirtualize",                       {FlagParameterID::kDevirtualize, 40600}},
-  {"-fdse",                                {FlagParameterID::kDSE, 40500}},
-  {"-fearly-inlining",                     {FlagParameterID::kEarlyInlining, 40500}},
-  {"-fexpensive-optimizations",            {FlagParameterID::kExpensiveOptimizations, 40500}},
-  {"-fforward-propagate",                  {FlagParameterID::kForwardPropagate, 40500}},
-  {"-fgcse",                               {FlagParameterID::kGCSE, 40500}},
-  {"-fgcse-after-reload",                  {FlagParameterID::kGCSEAfterReload, 40500}},
-  {"-fgcse-las",                           {FlagParameterID::kGCSELAS, 40500}},
-  {"-fgcse-lm",                            {FlagParameterID::kGCSELM, 40500}},
-  {"-fgcse-sm",                            {FlagParameterID::kGCSESM, 40500}},
-  {"-fguess-branch-probability",           {FlagParameterID::kGuessBranchProbability, 40500}},
-  {"-fhoist-adjacent-loads",               {FlagParameterID::kHoistAdjacentLoads, 40800}},
-  {"-fif-conversion",                      {FlagParameterID::kIfConversion, 40500}},
-  {"-fif-conversion2",                     {FlagParameterID::kIfConversion2, 40500}},
-  {"-finline",                             {FlagParameterID::kInline, 40500}},
-  {"-finline-atomics",                     {FlagParameterID::kInlineAtomics, 40700}},
-  {"-finline-functions",                   {FlagParameterID::kInlineFunctions, 40500}},
-  {"-finline-functions-called-once",       {FlagParameterID::kInlineFunctionsCalledOnce, 40500}},
-  {"-finline-small-functions",             {FlagParameterID::kInlineSmallFunctions, 40500}},
-  {"-fipa-cp",                             {FlagParameterID::kIPACP, 40500}},
-  {"-fipa-cp-clone",                       {FlagParameterID::kIPACPClone, 40500}},
-  {"-fipa-profile",                        {FlagParameterID::kIPAProfile, 40600}},
-  {"-fipa-pta",                            {FlagParameterID::kIPAPTA, 40500}},
-  {"-fipa-pure-const",                     {FlagParameterID::kIPAPureConst, 40500}},
-  {"-fipa-reference",                      {FlagParameterID::kIPAReference, 40500}},
-  {"-fipa-sra",                            {FlagParameterID::kIPASRA, 40500}},
-  {"-fira-hoist-pressure",                 {FlagParameterID::kIRAHoistPressure, 40800}},
-  {"-fivopts",                             {FlagParameterID::kIVOpts, 40500}},
-  {"-fmerge-constants",                    {FlagParameterID::kMergeConstants, 40500}},
-  {"-fmodulo-sched",                       {FlagParameterID::kModuloSched, 40500}},
-  {"-fmove-loop-invariants",               {FlagParameterID::kMoveLoopInvariants, 40500}},
-  {"-fomit-frame-pointer",                 {FlagParameterID::kOmitFramePointer, 40500}},
-  {"-foptimize-sibling-calls",             {FlagParameterID::kOptimizeSiblingCalls, 40500}},
-  {"-foptimize-strlen",                    {FlagParameterID::kOptimizeStrLen, 40700}},
-  {"-fpeephole",                           {FlagParameterID::kPeephole, 40500}},
-  {"-fpeephole2",                          {FlagParameterID::kPeephole2, 40500}},
-  {"-fpredictive-commoning",               {FlagParameterID::kPredictiveCommoning, 40500}},
-  {"-fprefetch-loop-arrays",               {FlagParameterID::kPrefetchLoopArrays, 40500}},
-  {"-fregmove",                            {FlagParameterID::kRegMove, 40500}},
-  {"-frename-registers",                   {FlagParameterID::kRenameRegisters, 40500}},
-  {"-freorder-blocks",                     {FlagParameterID::kReorderBlocks, 40500}},
-  {"-freorder-functions",                  {FlagParameterID::kReorderFunctions, 40500}},
-  {"-frerun-cse-after-loop",               {FlagParameterID::kRerunCSEAfterLoop, 40500}},
-  {"-freschedule-modulo-scheduled-loops",  {FlagParameterID::kRescheduleModuloScheduledLoops, 40500}},
-  {"-fsched-critical-path-heuristic",      {FlagParameterID::kSchedCriticalPathHeuristic, 40500}},
-  {"-fsched-dep-count-heuristic",          {FlagParameterID::kSchedDepCountHeuristic, 40500}},
-  {"-fsched-group-heuristic",              {FlagParameterID::kSchedGroupHeuristic, 40500}},
-  {"-fsched-interblock",                   {FlagParameterID::kSchedInterblock, 40500}},
-  {"-fsched-last-insn-heuristic",          {FlagParameterID::kSchedLastInsnHeuristic, 40500}},
-  {"-fsched-pressure",                     {FlagParameterID::kSchedPressure, 40500}},
-  {"-fsched-rank-heuristic",               {FlagParameterID::kSchedRankHeuristic, 40500}},
-  {"-fsched-spec",                         {FlagParameterID::kSchedSpec, 40500}},
-  {"-fsched-spec-insn-heuristic",          {FlagParameterID::kSchedSpecInsnHeuristic, 40500}},
-  {"-fsched-spec-load",                    {FlagParameterID::kSchedSpecLoad, 40500}},
-  {"-fsched-stalled-insns",                {FlagParameterID::kSchedStalledInsns, 40500}},
-  {"-fsched-stalled-insns-dep",            {FlagParameterID::kSchedStalledInsnsDep, 40500}},
-  {"-fschedule-insns",                     {FlagParameterID::kScheduleInsns, 40500}},
-  {"-fschedule-insns2",                    {FlagParameterID::kScheduleInsns2, 40500}},
+  //{"-fdata-sections",                      FlagParameterID::kDataSections, 40500},
+  {"-fdce",                                FlagParameterID::kDCE, 40500},
+  {"-fdefer-pop",                          FlagParameterID::kDeferPop, 40500},
+  {"-fdelete-null-pointer-checks",         FlagParameterID::kDeleteNullPointerChecks, 40500},
+  {"-fdevirtualize",                       FlagParameterID::kDevirtualize, 40600},
+  {"-fdse",                                FlagParameterID::kDSE, 40500},
+  {"-fearly-inlining",                     FlagParameterID::kEarlyInlining, 40500},
+  {"-fexpensive-optimizations",            FlagParameterID::kExpensiveOptimizations, 40500},
+  {"-fforward-propagate",                  FlagParameterID::kForwardPropagate, 40500},
+  {"-fgcse",                               FlagParameterID::kGCSE, 40500},
+  {"-fgcse-after-reload",                  FlagParameterID::kGCSEAfterReload, 40500},
+  {"-fgcse-las",                           FlagParameterID::kGCSELAS, 40500},
+  {"-fgcse-lm",                            FlagParameterID::kGCSELM, 40500},
+  {"-fgcse-sm",                            FlagParameterID::kGCSESM, 40500},
+  {"-fguess-branch-probability",           FlagParameterID::kGuessBranchProbability, 40500},
+  {"-fhoist-adjacent-loads",               FlagParameterID::kHoistAdjacentLoads, 40800},
+  {"-fif-conversion",                      FlagParameterID::kIfConversion, 40500},
+  {"-fif-conversion2",                     FlagParameterID::kIfConversion2, 40500},
+  {"-finline",                             FlagParameterID::kInline, 40500},
+  {"-finline-atomics",                     FlagParameterID::kInlineAtomics, 40700},
+  {"-finline-functions",                   FlagParameterID::kInlineFunctions, 40500},
+  {"-finline-functions-called-once",       FlagParameterID::kInlineFunctionsCalledOnce, 40500},
+  {"-finline-small-functions",             FlagParameterID::kInlineSmallFunctions, 40500},
+  {"-fipa-cp",                             FlagParameterID::kIPACP, 40500},
+  {"-fipa-cp-clone",                       FlagParameterID::kIPACPClone, 40500},
+  {"-fipa-profile",                        FlagParameterID::kIPAProfile, 40600},
+  {"-fipa-pta",                            FlagParameterID::kIPAPTA, 40500},
+  {"-fipa-pure-const",                     FlagParameterID::kIPAPureConst, 40500},
+  {"-fipa-reference",                      FlagParameterID::kIPAReference, 40500},
+  {"-fipa-sra",                            FlagParameterID::kIPASRA, 40500},
+  {"-fira-hoist-pressure",                 FlagParameterID::kIRAHoistPressure, 40800},
+  {"-fivopts",                             FlagParameterID::kIVOpts, 40500},
+  {"-fmerge-constants",                    FlagParameterID::kMergeConstants, 40500},
+  {"-fmodulo-sched",                       FlagParameterID::kModuloSched, 40500},
+  {"-fmove-loop-invariants",               FlagParameterID::kMoveLoopInvariants, 40500},
+  {"-fomit-frame-pointer",                 FlagParameterID::kOmitFramePointer, 40500},
+  {"-foptimize-sibling-calls",             FlagParameterID::kOptimizeSiblingCalls, 40500},
+  {"-foptimize-strlen",                    FlagParameterID::kOptimizeStrLen, 40700},
+  {"-fpeephole",                           FlagParameterID::kPeephole, 40500},
+  {"-fpeephole2",                          FlagParameterID::kPeephole2, 40500},
+  {"-fpredictive-commoning",               FlagParameterID::kPredictiveCommoning, 40500},
+  {"-fprefetch-loop-arrays",               FlagParameterID::kPrefetchLoopArrays, 40500},
+  {"-fregmove",                            FlagParameterID::kRegMove, 40500},
+  {"-frename-registers",                   FlagParameterID::kRenameRegisters, 40500},
+  {"-freorder-blocks",                     FlagParameterID::kReorderBlocks, 40500},
+  {"-freorder-functions",                  FlagParameterID::kReorderFunctions, 40500},
+  {"-frerun-cse-after-loop",               FlagParameterID::kRerunCSEAfterLoop, 40500},
+  {"-freschedule-modulo-scheduled-loops",  FlagParameterID::kRescheduleModuloScheduledLoops, 40500},
+  {"-fsched-critical-path-heuristic",      FlagParameterID::kSchedCriticalPathHeuristic, 40500},
+  {"-fsched-dep-count-heuristic",          FlagParameterID::kSchedDepCountHeuristic, 40500},
+  {"-fsched-group-heuristic",              FlagParameterID::kSchedGroupHeuristic, 40500},
+  {"-fsched-interblock",                   FlagParameterID::kSchedInterblock, 40500},
+  {"-fsched-last-insn-heuristic",          FlagParameterID::kSchedLastInsnHeuristic, 40500},
+  {"-fsched-pressure",                     FlagParameterID::kSchedPressure, 40500},
+  {"-fsched-rank-heuristic",               FlagParameterID::kSchedRankHeuristic, 40500},
+  {"-fsched-spec",                         FlagParameterID::kSchedSpec, 40500},
+  {"-fsched-spec-insn-heuristic",          FlagParameterID::kSchedSpecInsnHeuristic, 40500},
+  {"-fsched-spec-load",                    FlagParameterID::kSchedSpecLoad, 40500},
+  {"-fsched-stalled-insns",                FlagParameterID::kSchedStalledInsns, 40500},
+  {"-fsched-stalled-insns-dep",            FlagParameterID::kSchedStalledInsnsDep, 40500},
+  {"-fschedule-insns",                     FlagParameterID::kScheduleInsns, 40500},
+  {"-fschedule-insns2",                    FlagParameterID::kScheduleInsns2, 40500},
   // may conflict with other flags
-  //{"-fsection-anchors",                    {FlagParameterID::kSectionAnchors, 40500}},
-  {"-fsel-sched-pipelining",               {FlagParameterID::kSelSchedPipelining, 40500}},
-  {"-fsel-sched-pipelining-outer-loops",   {FlagParameterID::kSelSchedPipeliningOuterLoops, 40500}},
-  {"-fsel-sched-reschedule-pipelined",     {FlagParameterID::kSelSchedReschedulePipelined, 40500}},
-  {"-fselective-scheduling",               {FlagParameterID::kSelectiveScheduling, 40500}},
-  {"-fselective-scheduling2",              {FlagParameterID::kSelectiveScheduling2, 40500}},
-  {"-fshrink-wrap",                        {FlagParameterID::kShrinkWrap, 40700}},
-  {"-fsplit-ivs-in-unroller",              {FlagParameterID::kSplitIVsInUnroller, 40500}},
-  {"-fsplit-wide-types",                   {FlagParameterID::kSplitWideTypes, 40500}},
+  //{"-fsection-anchors",                    FlagParameterID::kSectionAnchors, 40500},
+  {"-fsel-sched-pipelining",               FlagParameterID::kSelSchedPipelining, 40500},
+  {"-fsel-sched-pipelining-outer-loops",   FlagParameterID::kSelSchedPipeliningOuterLoops, 40500},
+  {"-fsel-sched-reschedule-pipelined",     FlagParameterID::kSelSchedReschedulePipelined, 40500},
+  {"-fselective-scheduling",               FlagParameterID::kSelectiveScheduling, 40500},
+  {"-fselective-scheduling2",              FlagParameterID::kSelectiveScheduling2, 40500},
+  {"-fshrink-wrap",                        FlagParameterID::kShrinkWrap, 40700},
+  {"-fsplit-ivs-in-unroller",              FlagParameterID::kSplitIVsInUnroller, 40500},
+  {"-fsplit-wide-types",                   FlagParameterID::kSplitWideTypes, 40500},
   // affects semantics
-  //{"-fstrict-aliasing",                    {FlagParameterID::kStrictAliasing, 40500}},
-  {"-fthread-jumps",                       {FlagParameterID::kThreadJumps, 40500}},
-  {"-ftoplevel-reorder",                   {FlagParameterID::kTopLevelReorder, 40500}},
-  {"-ftree-bit-ccp",                       {FlagParameterID::kTreeBitCCP, 40600}},
-  {"-ftree-builtin-call-dce",              {FlagParameterID::kTreeBuiltinCallDCE, 40500}},
-  {"-ftree-ccp",                           {FlagParameterID::kTreeCCP, 40500}},
-  {"-ftree-ch",                            {FlagParameterID::kTreeCH, 40500}},
+  //{"-fstrict-aliasing",                    FlagParameterID::kStrictAliasing, 40500},
+  {"-fthread-jumps",                       FlagParameterID::kThreadJumps, 40500},
+  {"-ftoplevel-reorder",                   FlagParameterID::kTopLevelReorder, 40500},
+  {"-ftree-bit-ccp",                       FlagParameterID::kTreeBitCCP, 40600},
+  {"-ftree-builtin-call-dce",              FlagParameterID::kTreeBuiltinCallDCE, 40500},
+  {"-ftree-ccp",                           FlagParameterID::kTreeCCP, 40500},
+  {"-ftree-ch",                            FlagParameterID::kTreeCH, 40500},
   // no corresponding -fno- for this flag
-  //{"-ftree-coalesce-inlined-vars",         {FlagParameterID::kTreeCoalesceInlinedVars, 40500}},
-  {"-ftree-coalesce-vars",                 {FlagParameterID::kTreeCoalesceVars, 40800}},
-  {"-ftree-copy-prop",                     {FlagParameterID::kTreeCopyProp, 40500}},
-  {"-ftree-copyrename",                    {FlagParameterID::kTreeCopyRename, 40500}},
-  {"-ftree-cselim",                        {FlagParameterID::kTreeCSEElim, 40500}},
-  {"-ftree-dce",                           {FlagParameterID::kTreeDCE, 40500}},
-  {"-ftree-dominator-opts",                {FlagParameterID::kTreeDominatorOpts, 40500}},
-  {"-ftree-dse",                           {FlagParameterID::kTreeDSE, 40500}},
-  {"-ftree-forwprop",                      {FlagParameterID::kTreeForwProp, 40500}},
-  {"-ftree-fre",                           {FlagParameterID::kTreeFRE, 40500}},
-  {"-ftree-loop-distribute-patterns",      {FlagParameterID::kTreeLoopDistributePatterns, 40600}},
-  {"-ftree-loop-distribution",             {FlagParameterID::kTreeLoopDistribution, 40500}},
-  {"-ftree-loop-if-convert",               {FlagParameterID::kTreeLoopIfConvert, 40600}},
-  {"-ftree-loop-im",                       {FlagParameterID::kTreeLoopIM, 40500}},
-  {"-ftree-loop-ivcanon",                  {FlagParameterID::kTreeLoopIVCanon, 40500}},
-  {"-ftree-loop-optimize",                 {FlagParameterID::kTreeLoopOptimize, 40500}},
-  {"-ftree-partial-pre",                   {FlagParameterID::kTreePartialPre, 40800}},
-  {"-ftree-phiprop",                       {FlagParameterID::kTreePhiProp, 40500}},
-  {"-ftree-pre",                           {FlagParameterID::kTreePre, 40500}},
-  {"-ftree-pta",                           {FlagParameterID::kTreePTA, 40500}},
-  {"-ftree-reassoc",                       {FlagParameterID::kTreeReassoc, 40500}},
-  {"-ftree-scev-cprop",                    {FlagParameterID::kTreeSCEVCProp, 40500}},
-  {"-ftree-sink",                          {FlagParameterID::kTreeSink, 40500}},
-  {"-ftree-slp-vectorize",                 {FlagParameterID::kTreeSLPVectorize, 40500}},
-  {"-ftree-slsr",                          {FlagParameterID::kTreeSLSR, 40800}},
-  {"-ftree-sra",                           {FlagParameterID::kTreeSRA, 40500}},
-  {"-ftree-switch-conversion",             {FlagParameterID::kTreeSwitchConversion, 40500}},
-  {"-ftree-tail-merge",                    {FlagParameterID::kTreeTailMerge, 40700}},
-  {"-ftree-ter",                           {FlagParameterID::kTreeTER, 40500}},
-  {"-ftree-vect-loop-version",             {FlagParameterID::kTreeVectLoopVersion, 40500}},
-  {"-ftree-vectorize",                     {FlagParameterID::kTreeVectorize, 40500}},
-  {"-ftree-vrp",                           {FlagParameterID::kTreeVRP, 40500}},
-  {"-funroll-all-loops",                   {FlagParameterID::kUnrollAllLoops, 40500}},
-  {"-funroll-loops",                       {FlagParameterID::kUnrollLoops, 40500}},
-  {"-funswitch-loops",                     {FlagParameterID::kUnswitchLoops, 40500}},
-  {"-fvariable-expansion-in-unroller",     {FlagParameterID::kVariableExpansionInUnroller, 40500}},
-  {"-fvect-cost-model",                    {FlagParameterID::kVectCostModel, 40500}},
-  {"-fweb",                                {FlagParameterID::kWeb, 40500}},
-});
-
-struct ParameterToFlag {
-  ParameterToFlag() {}
-  operator std::map<unsigned, std::pair<std::string, unsigned>>() {
-    static bool is_init = false;
-    static auto &all_parameter_to_flag = *new std::map<unsigned, std::pair<std::string, unsigned>>();
-
-    if (!is_init) {
-      for (auto entry : all_flag_to_parameter)
-        all_parameter_to_flag[entry.second.first] = {entry.first, entry.second.second};
-      is_init = true;
-    }
-    return all_parameter_to_flag;
-  }
+  //{"-ftree-coalesce-inlined-vars",         FlagParameterID::kTreeCoalesceInlinedVars, 40500},
+  {"-ftree-coalesce-vars",                 FlagParameterID::kTreeCoalesceVars, 40800},
+  {"-ftree-copy-prop",                     FlagParameterID::kTreeCopyProp, 40500},
+  {"-ftree-copyrename",                    FlagParameterID::kTreeCopyRename, 40500},
+  {"-ftree-cselim",                        FlagParameterID::kTreeCSEElim, 40500},
+  {"-ftree-dce",                           FlagParameterID::kTreeDCE, 40500},
+  {"-ftree-dominator-opts",                FlagParameterID::kTreeDominatorOpts, 40500},
+  {"-ftree-dse",                           FlagParameterID::kTreeDSE, 40500},
+  {"-ftree-forwprop",                      FlagParameterID::kTreeForwProp, 40500},
+  {"-ftree-fre",                           FlagParameterID::kTreeFRE, 40500},
+  {"-ftree-loop-distribute-patterns",      FlagParameterID::kTreeLoopDistributePatterns, 40600},
+  {"-ftree-loop-distribution",             FlagParameterID::kTreeLoopDistribution, 40500},
+  {"-ftree-loop-if-convert",               FlagParameterID::kTreeLoopIfConvert, 40600},
+  {"-ftree-loop-im",                       FlagParameterID::kTreeLoopIM, 40500},
+  {"-ftree-loop-ivcanon",                  FlagParameterID::kTreeLoopIVCanon, 40500},
+  {"-ftree-loop-optimize",                 FlagParameterID::kTreeLoopOptimize, 40500},
+  {"-ftree-partial-pre",                   FlagParameterID::kTreePartialPre, 40800},
+  {"-ftree-phiprop",                       FlagParameterID::kTreePhiProp, 40500},
+  {"-ftree-pre",                           FlagParameterID::kTreePre, 40500},
+  {"-ftree-pta",                           FlagParameterID::kTreePTA, 40500},
+  {"-ftree-reassoc",                       FlagParameterID::kTreeReassoc, 40500},
+  {"-ftree-scev-cprop",                    FlagParameterID::kTreeSCEVCProp, 40500},
+  {"-ftree-sink",                          FlagParameterID::kTreeSink, 40500},
+  {"-ftree-slp-vectorize",                 FlagParameterID::kTreeSLPVectorize, 40500},
+  {"-ftree-slsr",                          FlagParameterID::kTreeSLSR, 40800},
+  {"-ftree-sra",                           FlagParameterID::kTreeSRA, 40500},
+  {"-ftree-switch-conversion",             FlagParameterID::kTreeSwitchConversion, 40500},
+  {"-ftree-tail-merge",                    FlagParameterID::kTreeTailMerge, 40700},
+  {"-ftree-ter",                           FlagParameterID::kTreeTER, 40500},
+  {"-ftree-vect-loop-version",             FlagParameterID::kTreeVectLoopVersion, 40500},
+  {"-ftree-vectorize",                     FlagParameterID::kTreeVectorize, 40500},
+  {"-ftree-vrp",                           FlagParameterID::kTreeVRP, 40500},
+  {"-funroll-all-loops",                   FlagParameterID::kUnrollAllLoops, 40500},
+  {"-funroll-loops",                       FlagParameterID::kUnrollLoops, 40500},
+  {"-funswitch-loops",                     FlagParameterID::kUnswitchLoops, 40500},
+  {"-fvariable-expansion-in-unroller",     FlagParameterID::kVariableExpansionInUnroller, 40500},
+  {"-fvect-cost-model",                    FlagParameterID::kVectCostModel, 40500},
+  {"-fweb",                                FlagParameterID::kWeb, 40500},
 };
-static const std::map<unsigned, std::pair<std::string, unsigned>> &all_parameter_to_flag =
-    *new ParameterToFlag();
 
 /// \brief Split a string into substrings on an input character
 static std::vector<std::string> splitString(std::string str, char c) {
@@ -220,6 +211,30 @@ static std::vector<std::string> splitString(std::string str, char c) {
   return res;
 }
 
+/// \brief Get a path for a new shard of compilation ids in a directory
+///
+/// The name is unique to this invocation of the driver, so that each
+/// parallel compilation writes to its own shard.
+static std::string getShardPath(const std::string &dir) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+
+  std::stringstream path;
+  path << dir << "/mageec-" << getpid() << '-' << std::hex << ns << ".csv";
+  return path.str();
+}
+
+/// \brief Join the arguments of a command with spaces, for display
+static std::string joinCommand(const std::vector<std::string> &args) {
+  std::string command;
+  for (const auto &arg : args) {
+    if (!command.empty())
+      command += " ";
+    command += arg;
+  }
+  return command;
+}
+
 /// \brief Print the version of this driver
 static void printVersion() {
   mageec::util::out() << MAGEEC_PREFIX "Driver version: "
@@ -341,6 +356,41 @@ loadFeatureIDs(std::string features_path) {
   return file_to_features;
 }
 
+/// \brief Load the feature IDs recorded in the database for the source files
+/// being compiled
+///
+/// \param gather  Whether the compilations are gathered for training, in
+/// which case a warning is given for the feature sets which hold only some
+/// of the features of their program unit, as they are not used for training.
+static std::map<std::string, FileFeatureIDs>
+loadSourceFeatureIDs(mageec::Database &db,
+                     const std::vector<std::string> &src_files, bool gather) {
+  std::map<std::string, FileFeatureIDs> file_to_features;
+
+  for (const auto &file_arg : src_files) {
+    auto src_file_path = mageec::util::getFullPath(file_arg);
+    auto feature_sets = db.getSourceFeatureSets(src_file_path);
+    if (feature_sets.empty())
+      continue;
+
+    FileFeatureIDs &file_entry = file_to_features[src_file_path];
+    for (const auto &feature_set : feature_sets) {
+      if (gather && feature_set.partial)
+        MAGEEC_WARN("Only the trained features of '" << feature_set.unit_name
+                    << "' in '" << src_file_path << "' were extracted, so "
+                    "its compilations will not be used for training");
+      FeatureIDEntry entry = { feature_set.unit_name,
+                               feature_set.feature_set_id,
+                               feature_set.feature_class };
+      if (feature_set.feature_class == mageec::FeatureClass::kModule)
+        file_entry.module = entry;
+      else
+        file_entry.functions.insert(entry);
+    }
+  }
+  return file_to_features;
+}
+
 /// \brief Print help output string
 static void printHelp() {
   mageec::util::out() <<
@@ -356,11 +406,29 @@ static void printHelp() {
 "  -fmageec-mode=<mode>        Mode of the driver, valid values are\n"
 "                              gather and predict\n"
 "  -fmageec-database=<file>    Database to record to\n"
-"  -fmageec-features=<file>    File containing feature group identifiers\n"
-"  -fmageec-out=<file>         File to output compilation ids into\n"
+"  -fmageec-features=<file>    File containing feature group identifiers. If\n"
+"                              not provided, the feature groups recorded in\n"
+"                              the database for each input file are used\n"
+"  -fmageec-out=<file>         File to append compilation ids to. If this is\n"
+"                              a directory, the ids are written to a new\n"
+"                              shard file in it for each invocation, which\n"
+"                              can be merged with mageec\n"
+"                              --merge-compilation-ids\n"
 "  -fmageec-ml=<id>            string identifier or shared object identifying\n"
 "                              the machine learner to be used\n"
-"  -fmageec-metric=<name>      Metric to optimize for\n";
+"  -fmageec-ml-config=<file>   Configuration file provided to the machine\n"
+"                              learner when making decisions\n"
+"  -fmageec-metric=<name>      Metric to optimize for\n"
+"  -fmageec-jobs=<n>           Maximum number of files to compile at once.\n"
+"                              By default this is limited by the jobserver\n"
+"                              of a parent make, or 1 without one\n"
+"  -fmageec-object-cache=<dir> Directory of objects from earlier\n"
+"                              compilations. A file compiled with the same\n"
+"                              compiler and flags as an earlier compilation\n"
+"                              is copied from the cache rather than compiled\n"
+"\n"
+"In predict mode, decisions are made by mageec-predictd if it is serving the\n"
+"database, and by the driver otherwise.\n";
 }
 
 /// \brief Entry point for the GCC wrapper driver
@@ -377,8 +445,14 @@ int main(int argc, const char *argv[]) {
   std::vector<std::string> param_list;
   // The machine learner to optimize with
   std::string ml_str;
+  // Configuration provided to the machine learner when making decisions
+  std::string ml_config_path;
   // The metric to use when optimizing
   std::string metric_str;
+  // Maximum number of files to compile at once, or 0 to use the jobserver
+  unsigned jobs = 0;
+  // Directory holding the object cache
+  std::string object_cache_path;
 
   bool with_help              = false;
   bool with_version           = false;
@@ -390,7 +464,9 @@ int main(int argc, const char *argv[]) {
   bool with_features          = false;
   bool with_out               = false;
   bool with_ml                = false;
+  bool with_ml_config         = false;
   bool with_metric            = false;
+  bool with_object_cache      = false;
 
   // Handle arguments controlling mageec, accumulate the arguments which
   // aren't controlling this driver
@@ -462,6 +538,30 @@ int main(int argc, const char *argv[]) {
         return -1;
       }
       with_ml = true;
+    } else if (arg.compare(0, strlen("ml-config="), "ml-config=") == 0) {
+      ml_config_path =
+          std::string(arg.begin() + strlen("ml-config="), arg.end());
+      if (ml_config_path.size() == 0) {
+        MAGEEC_ERR("No machine learner config path provided");
+        return -1;
+      }
+      with_ml_config = true;
+    } else if (arg.compare(0, strlen("jobs="), "jobs=") == 0) {
+      auto n_jobs = mageec::util::parseUnsigned(
+          std::string(arg.begin() + strlen("jobs="), arg.end()));
+      if (!n_jobs || n_jobs.get() < 1 || n_jobs.get() > 1024) {
+        MAGEEC_ERR("Number of jobs must be an integer between 1 and 1024");
+        return -1;
+      }
+      jobs = static_cast<unsigned>(n_jobs.get());
+    } else if (arg.compare(0, strlen("object-cache="), "object-cache=") == 0) {
+      object_cache_path =
+          std::string(arg.begin() + strlen("object-cache="), arg.end());
+      if (object_cache_path.size() == 0) {
+        MAGEEC_ERR("No object cache directory provided");
+        return -1;
+      }
+      with_object_cache = true;
     } else if (arg.compare(0, strlen("metric="), "metric=") == 0) {
       metric_str = std::string(arg.begin() + strlen("metric="), arg.end());
       if (metric_str.size() == 0) {
@@ -482,10 +582,6 @@ int main(int argc, const char *argv[]) {
       MAGEEC_ERR("Predict mode specified without a database");
       have_error = true;
     }
-    if (!with_features) {
-      MAGEEC_ERR("Predict mode specified without a features file");
-      have_error = true;
-    }
     if (!with_out) {
       MAGEEC_ERR("Predict mode specified without an output file");
       have_error = true;
@@ -503,10 +599,6 @@ int main(int argc, const char *argv[]) {
       MAGEEC_ERR("Gather mode specified without a database");
       have_error = true;
     }
-    if (!with_features) {
-      MAGEEC_ERR("Gather mode specified without a features file ");
-      have_error = true;
-    }
     if (!with_out) {
       MAGEEC_ERR("Gather mode specified without an output file");
       have_error = true;
@@ -521,6 +613,8 @@ int main(int argc, const char *argv[]) {
       MAGEEC_WARN("-fmageec-ml argument will be ignored");
     if (with_metric)
       MAGEEC_WARN("-fmageec-metric argument will be ignored");
+    if (with_ml_config)
+      MAGEEC_WARN("-fmageec-ml-config argument will be ignored");
   }
 
   // Get the underlying gcc command to be executed. Do this by stripping
@@ -529,46 +623,6 @@ int main(int argc, const char *argv[]) {
   std::string gcc_command =
       cmd_args[0].substr(cmd_args[0].find("mageec-") + strlen("mageec="));
 
-  // Run the underlying gcc command to determine the version of the
-  // compiler being targetted
-  std::array<char, 128> buffer;
-  std::string version_str;
-
-  std::string gcc_version_cmd = gcc_command + " -dumpversion";
-  std::shared_ptr<FILE> pipe(popen(gcc_version_cmd.c_str(), "r"), pclose);
-  if (!pipe) throw std::runtime_error("popen() failed!");
-  while (!feof(pipe.get())) {
-      if (fgets(buffer.data(), 128, pipe.get()) != NULL)
-          version_str += buffer.data();
-  }
-  size_t idx = 0;
-  int major = std::stoi(version_str, &idx);
-  assert(version_str[idx] == '.');
-  version_str = version_str.substr(idx+1);
-
-  int minor = std::stoi(version_str, &idx);
-  assert(version_str[idx] == '.');
-  version_str = version_str.substr(idx+1);
-
-  int patch = std::stoi(version_str, &idx);
-  unsigned gcc_version = (major * 10000) + (minor * 100) + patch;
-
-  if (gcc_version < 40500) {
-    MAGEEC_ERR("GCC version '" + std::to_string(major) + "."
-                               + std::to_string(minor) + "."
-                               + std::to_string(patch) + "' (>= 4.5.0 is required)");
-    return -1;
-  }
-
-  // Use the GCC version to remove any flags and parameters which aren't
-  // supported
-  std::map<std::string, std::pair<unsigned, unsigned>> flag_to_parameter;
-  std::map<unsigned, std::pair<std::string, unsigned>> parameter_to_flag;
-  for (auto entry : all_flag_to_parameter)
-    flag_to_parameter.insert(entry);
-  for (auto entry : all_parameter_to_flag)
-    parameter_to_flag.insert(entry);
-
   // Initialize the framework, and register some builtin machine learners so
   // they can be selected by name by the user.
   mageec::Framework framework(with_debug, with_sql_trace);
@@ -582,6 +636,11 @@ int main(int argc, const char *argv[]) {
   std::unique_ptr<mageec::IMachineLearner> nn_ml(new mageec::OneNN());
   framework.registerMachineLearner(std::move(nn_ml));
 
+  MAGEEC_DEBUG("Registering random forest machine learner interface");
+  std::unique_ptr<mageec::IMachineLearner> forest_ml(
+      new mageec::RandomForest());
+  framework.registerMachineLearner(std::move(forest_ml));
+
   // Select the machine learner chosen by the user. This may be the name of
   // an already register machine learner, or a path to a shared object which
   // needs to be loaded and registered.
@@ -664,23 +723,35 @@ int main(int argc, const char *argv[]) {
   // If we are not in 'gather' or 'predict' modes, or if we're not compiling
   // to an object file, then just run the original command
   if (!to_obj || (mode == DriverMode::kNone)) {
-    std::stringstream command;
-    for (unsigned i = 0; i < cmd_args.size(); ++i) {
-      if (i == 0) {
-        command << cmd_args[i];
-      } else {
-        command << " " << cmd_args[i];
-      }
-    }
     if (!to_obj && with_debug) {
       MAGEEC_WARN("MAGEEC driver called, but not compiling to an object file, "
                   "calling the original command");
     }
     if (with_debug) {
-      MAGEEC_DEBUG("Executing command: " + command.str());
+      MAGEEC_DEBUG("Executing command: " + joinCommand(cmd_args));
     }
-    // FIXME: Windows?
-    return system(command.str().c_str());
+    auto res = mageec::util::runCommand(cmd_args, false);
+    if (res.status < 0) {
+      MAGEEC_ERR("Unable to run '" << cmd_args[0] << "'");
+    }
+    return res.status;
+  }
+
+  // Find the version of the compiler being targetted, and the flags which it
+  // supports. These are cached for each compiler, so the compiler only needs
+  // to be run when it changes.
+  auto flag_table = FlagTable::load(gcc_command, all_flags,
+                                    sizeof(all_flags) / sizeof(all_flags[0]));
+  if (!flag_table)
+    return -1;
+
+  unsigned gcc_version = flag_table->getGCCVersion();
+  if (gcc_version < 40500) {
+    MAGEEC_ERR("GCC version '" + std::to_string(gcc_version / 10000) + "."
+                               + std::to_string(gcc_version / 100 % 100) + "."
+                               + std::to_string(gcc_version % 100)
+                               + "' (>= 4.5.0 is required)");
+    return -1;
   }
 
   // Names of all of the input files involved in the compilation
@@ -751,11 +822,18 @@ int main(int argc, const char *argv[]) {
     return -1;
   }
 
-  // Load the features file to get the feature groups
-  auto feature_groups = loadFeatureIDs(features_path);
-  if (!feature_groups) {
-    MAGEEC_ERR("Failed to retrieve feature groups from features file");
-    return -1;
+  // Load the feature groups of the source files, either from the features
+  // file or from the database.
+  mageec::util::Option<std::map<std::string, FileFeatureIDs>> feature_groups;
+  if (with_features) {
+    feature_groups = loadFeatureIDs(features_path);
+    if (!feature_groups) {
+      MAGEEC_ERR("Failed to retrieve feature groups from features file");
+      return -1;
+    }
+  } else {
+    feature_groups = loadSourceFeatureIDs(*db, src_files,
+                                          mode == DriverMode::kGather);
   }
 
   // Extract the parameters that were provided to the compiler on the command
@@ -778,9 +856,9 @@ int main(int argc, const char *argv[]) {
   // flag -> parameter
   std::vector<std::string> flags;
   for (auto f : flags) {
-    auto p = flag_to_parameter.find(f);
-    if (p != flag_to_parameter.end())
-      orig_params.insert(p->second.first);
+    auto p = flag_table->getParameter(f);
+    if (p)
+      orig_params.insert(p.get());
   }
 
   // Now, toggle individual flags, modifying the base set of flags. The
@@ -797,9 +875,9 @@ int main(int argc, const char *argv[]) {
     // Individual flags may enable the parameter, or disable it if it has a
     // "-fno-" prefix. First check if the flag enables a parameter, then if
     // it disables one.
-    auto p = flag_to_parameter.find(arg);
-    if (p != flag_to_parameter.end()) {
-      orig_params.insert(p->second.first);
+    auto p = flag_table->getParameter(arg);
+    if (p) {
+      orig_params.insert(p.get());
       continue;
     } else {
       if (arg.size() > strlen("-fno-") &&
@@ -807,9 +885,9 @@ int main(int argc, const char *argv[]) {
         arg = std::string("-f") +
               std::string(arg.begin() + strlen("-fno-"), arg.end());
 
-        p = flag_to_parameter.find(arg);
-        if (p != flag_to_parameter.end()) {
-          orig_params.erase(p->second.first);
+        p = flag_table->getParameter(arg);
+        if (p) {
+          orig_params.erase(p.get());
           continue;
         }
       }
@@ -821,71 +899,147 @@ int main(int argc, const char *argv[]) {
 
   auto src_file_feature_set_ids = feature_groups.get();
   std::map<std::string, std::set<unsigned>> src_file_parameters;
-  std::map<std::string, mageec::ParameterSetID> src_file_parameter_set_ids;
+  std::map<std::string, mageec::ParameterSet> src_file_parameter_sets;
+  // Files whose parameters were newly decided in 'predict' mode, and the
+  // key under which those decisions are cached once they are recorded.
+  std::map<std::string, mageec::DecisionCacheKey> src_file_cache_keys;
+
+  // The parameters provided by the flags originally on the command line
+  mageec::ParameterSet orig_param_set;
+  for (unsigned i = FlagParameterID::kFIRST_FLAG_PARAMETER;
+       i <= FlagParameterID::kLAST_FLAG_PARAMETER; ++i) {
+    const char *flag = flag_table->getFlag(i);
+    if (!flag)
+      continue;
+    orig_param_set.add(std::make_shared<mageec::BoolParameter>(
+        i, orig_params.count(i), flag));
+  }
+
+  // In 'predict' mode, the digest of the model making the decisions, and the
+  // files with features for which there are no cached decisions. The cached
+  // decisions also depend on the original flags, which are used for any
+  // native decisions.
+  mageec::util::Option<uint64_t> ml_digest;
+  std::vector<std::string> undecided_files;
+  const uint64_t orig_param_set_hash = orig_param_set.hash();
+  auto cacheKey = [&](mageec::FeatureSetID feature_set_id) {
+    return mageec::DecisionCacheKey{feature_set_id, orig_param_set_hash,
+                                    ml->getName(), metric_str,
+                                    ml_digest.get()};
+  };
 
   if (mode == DriverMode::kGather) {
     // When in 'gather' mode, the parameters used for each file are based on
     // the flags originally provided on the command line
-    mageec::ParameterSet param_set;
-    for (unsigned i = FlagParameterID::kFIRST_FLAG_PARAMETER;
-         i <= FlagParameterID::kLAST_FLAG_PARAMETER; ++i) {
-      if (!parameter_to_flag.count(i))
-        continue;
-      auto param_flag = parameter_to_flag.at(i);
-      assert(param_flag.second <= gcc_version);
-      param_set.add(std::make_shared<mageec::BoolParameter>(i,
-                                                            orig_params.count(i),
-                                                            param_flag.first));
-    }
-    // Add the set of parameters to the database
-    auto param_set_id = db->newParameterSet(param_set);
-
+    //
     // Use the same parameters for every input file
     for (auto file_arg : src_files) {
       auto src_file_path = mageec::util::getFullPath(file_arg);
       src_file_parameters[src_file_path] = orig_params;
-      src_file_parameter_set_ids[src_file_path] = param_set_id;
+      src_file_parameter_sets[src_file_path] = orig_param_set;
     }
   } else {
     // When in 'predict' mode, the parameters used for each file are based on
     // flags predicted by the machine learner using the features
+    //
+    // The parameters decided for a feature set by a trained model are cached
+    // in the database, so that they are only decided once. Machine learners
+    // which do not require training, or are given a decision config, have
+    // no digest for their model and are not cached.
     assert(mode == DriverMode::kPredict);
+    if (ml->requiresTraining() && !with_ml_config) {
+      ml_digest = db->getMachineLearnerDigest(
+          ml->getName(), mageec::FeatureClass::kModule, metric_str);
+    }
+    for (auto file_arg : src_files) {
+      auto src_file_path = mageec::util::getFullPath(file_arg);
+      auto feature_set_ids = src_file_feature_set_ids.find(src_file_path);
+      if (feature_set_ids == src_file_feature_set_ids.end())
+        continue;
 
-    // Find the selected machine learner trained for the specified metric
-    auto trained_mls = db->getTrainedMachineLearners();
-    mageec::TrainedML *chosen_ml = nullptr;
-
-    bool found_ml = false;
-    for (auto &trained_ml : trained_mls) {
-      if (trained_ml.getName() == ml->getName()) {
-        found_ml = true;
-
-        // Check that the found machine learner is trained for the desired
-        // metric and class of features.
-        // TODO: Only module features can be handled here
-        if (trained_ml.getMetric() == metric_str &&
-            trained_ml.getFeatureClass() == mageec::FeatureClass::kModule) {
-          chosen_ml = &trained_ml;
-          break;
-        }
+      assert(feature_set_ids->second.module);
+      auto feature_set_id = feature_set_ids->second.module.get().id;
+      mageec::util::Option<mageec::ParameterSetID> param_set_id;
+      if (ml_digest)
+        param_set_id = db->getCachedDecisions(cacheKey(feature_set_id));
+      if (!param_set_id) {
+        undecided_files.push_back(file_arg);
+        continue;
       }
+
+      MAGEEC_DEBUG("Using cached decisions for '" << file_arg << "'");
+      std::set<unsigned> params;
+      auto param_set = db->getParameters(param_set_id.get());
+      for (const auto &param : param_set) {
+        if (param->getType() == mageec::ParameterType::kBool &&
+            static_cast<mageec::BoolParameter *>(param.get())->getValue())
+          params.insert(param->getID());
+      }
+      src_file_parameters[src_file_path] = params;
+      src_file_parameter_sets[src_file_path] = param_set;
     }
-    if (!found_ml) {
-      MAGEEC_ERR("Could not find training data for specified machine learner "
-                 "and metric");
-      return -1;
+  }
+  if (mode == DriverMode::kPredict && !undecided_files.empty()) {
+    // The same flags are decided for every file, so build the requests once
+    std::vector<unsigned> flag_params;
+    std::vector<mageec::BoolDecisionRequest> flag_requests;
+    for (unsigned i = FlagParameterID::kFIRST_FLAG_PARAMETER;
+         i <= FlagParameterID::kLAST_FLAG_PARAMETER; ++i) {
+      flag_params.push_back(i);
+      flag_requests.push_back(mageec::BoolDecisionRequest(i));
+    }
+    std::vector<const mageec::DecisionRequestBase *> requests;
+    for (const auto &req : flag_requests) {
+      requests.push_back(&req);
     }
 
-    // For each input file, use the set of features for the file and the
-    // user-specified machine learner to generate flags for the compilation
-    for (auto file_arg : src_files) {
-      auto src_file_path = mageec::util::getFullPath(file_arg);
+    // If mageec-predictd is serving the database, it already holds the
+    // trained machine learner, so ask it for the decisions. Only models
+    // with a digest can be served, as the daemon must hold the same model
+    // as the database.
+    std::unique_ptr<PredictClient> predictd;
+    if (ml_digest)
+      predictd = PredictClient::connect(mageec::util::getFullPath(db_str));
+
+    // Find the selected machine learner trained for the specified metric.
+    // Machine learners which do not require training, such as native
+    // models, have no training data in the database and are used directly.
+    // This is only loaded if there is a file the daemon does not decide.
+    //
+    // TODO: Only module features can be handled here
+    std::unique_ptr<mageec::TrainedML> chosen_ml;
+    auto loadChosenML = [&]() {
+      if (!ml->requiresTraining()) {
+        chosen_ml.reset(new mageec::TrainedML(*ml));
+      } else {
+        chosen_ml = db->getTrainedMachineLearner(
+            ml->getName(), mageec::FeatureClass::kModule, metric_str);
+      }
+      if (!chosen_ml) {
+        MAGEEC_ERR("Could not find training data for specified machine "
+                   "learner and metric");
+        return false;
+      }
+      if (with_ml_config) {
+        if (!chosen_ml->requiresDecisionConfig()) {
+          MAGEEC_WARN("Machine learner does not accept a decision config, "
+                      "-fmageec-ml-config argument will be ignored");
+        } else if (!chosen_ml->setDecisionConfig(ml_config_path)) {
+          MAGEEC_ERR("Invalid decision config for machine learner");
+          return false;
+        }
+      }
+      return true;
+    };
 
-      // Ignore any files which don't have associated features, these will
-      // be built with the original command line
+    // For each input file without cached decisions, use the set of features
+    // for the file and the user-specified machine learner to generate flags
+    // for the compilation. Files without features were skipped earlier, and
+    // will be built with the original command line.
+    for (auto file_arg : undecided_files) {
+      auto src_file_path = mageec::util::getFullPath(file_arg);
       auto feature_set_ids = src_file_feature_set_ids.find(src_file_path);
-      if (feature_set_ids == src_file_feature_set_ids.end())
-        continue;
+      assert(feature_set_ids != src_file_feature_set_ids.end());
 
       // Generate a parameter set based on the features of the module for the
       // file
@@ -895,46 +1049,85 @@ int main(int argc, const char *argv[]) {
       // mageec then this will form the 'native' decision
       assert(feature_set_ids->second.module);
       auto feature_set_id = feature_set_ids->second.module.get().id;
-      auto features = db->getFeatureSetFeatures(feature_set_id);
-      assert(features.size() != 0);
+
+      // Decide every flag for the module in a single call, either by the
+      // daemon or in this process if the daemon could not answer.
+      mageec::util::Option<std::vector<PredictDecision>> decisions;
+      if (predictd) {
+        decisions = predictd->predict({feature_set_id, ml->getName(),
+                                       metric_str, ml_digest.get(),
+                                       flag_params});
+        if (decisions) {
+          MAGEEC_DEBUG("Decisions for '" << file_arg << "' made by "
+                       "mageec-predictd");
+        } else {
+          MAGEEC_DEBUG("mageec-predictd could not make decisions, "
+                       "falling back to the driver");
+          predictd.reset();
+        }
+      }
+      if (!decisions) {
+        if (!chosen_ml && !loadChosenML())
+          return -1;
+
+        auto features = db->getFeatureSetFeatures(feature_set_id);
+        assert(features.size() != 0);
+
+        auto results = chosen_ml->makeDecisions(requests, features);
+        assert(results.size() == requests.size());
+
+        std::vector<PredictDecision> local_decisions;
+        for (const auto &res : results) {
+          if (res->getType() == mageec::DecisionType::kNative) {
+            local_decisions.push_back(PredictDecision::kNative);
+          } else {
+            auto *decision = static_cast<mageec::BoolDecision*>(res.get());
+            local_decisions.push_back(decision->getValue()
+                                          ? PredictDecision::kEnabled
+                                          : PredictDecision::kDisabled);
+          }
+        }
+        decisions = local_decisions;
+      }
+      const std::vector<PredictDecision> flag_decisions = decisions.get();
+      assert(flag_decisions.size() == flag_params.size());
 
       std::set<unsigned> params;
       mageec::ParameterSet param_set;
       for (unsigned i = FlagParameterID::kFIRST_FLAG_PARAMETER;
            i <= FlagParameterID::kLAST_FLAG_PARAMETER; ++i) {
-        assert(chosen_ml);
-
-        mageec::BoolDecisionRequest req(i);
-        auto res = chosen_ml->makeDecision(req, features);
+        PredictDecision decision =
+            flag_decisions[i - FlagParameterID::kFIRST_FLAG_PARAMETER];
 
         bool enabled = false;
-        if (res->getType() == mageec::DecisionType::kNative) {
+        if (decision == PredictDecision::kNative) {
           enabled = orig_params.count(i);
         } else {
-          auto *decision = static_cast<mageec::BoolDecision*>(res.get());
-          enabled = decision->getValue();
+          enabled = (decision == PredictDecision::kEnabled);
         }
 
-        if (!parameter_to_flag.count(i))
+        const char *flag = flag_table->getFlag(i);
+        if (!flag)
           continue;
-        auto param_flag = parameter_to_flag.at(i);
-        assert(param_flag.second <= gcc_version);
         param_set.add(std::make_shared<mageec::BoolParameter>(i, enabled,
-                                                              param_flag.first));
+                                                              flag));
         if (enabled)
           params.insert(i);
       }
-      // Add the set of parameters to the database
-      auto param_set_id = db->newParameterSet(param_set);
+      // The set of parameters is added to the database when the compilation
+      // is recorded, and cached so that the same features need not be
+      // decided again
+      if (ml_digest)
+        src_file_cache_keys.emplace(src_file_path, cacheKey(feature_set_id));
 
       src_file_parameters[src_file_path] = params;
-      src_file_parameter_set_ids[src_file_path] = param_set_id;
+      src_file_parameter_sets[src_file_path] = param_set;
     }
   }
 
-  // Mapping from an input filename, to a command string to compile that file
-  // With the appropriate set of parameters.
-  std::map<std::string, std::string> src_file_commands;
+  // Mapping from an input filename, to the arguments of a command to compile
+  // that file with the appropriate set of parameters.
+  std::map<std::string, std::vector<std::string>> src_file_commands;
 
   for (auto file_arg : src_files) {
     auto src_file_path = mageec::util::getFullPath(file_arg);
@@ -942,17 +1135,11 @@ int main(int argc, const char *argv[]) {
     // If this file doesn't have any features, then it cannot be affected by
     // mageec. Just use the original command with the input filename appended
     if (src_file_feature_set_ids.count(src_file_path) == 0) {
-      std::stringstream command;
-      for (unsigned i = 0; i < cmd_args.size(); ++i) {
-        if (i == 0)
-          command << cmd_args[i];
-        else
-          command << " " << cmd_args[i];
-      }
+      std::vector<std::string> command = cmd_args;
       // Add in the input file
-      command << " " << file_arg;
+      command.push_back(file_arg);
 
-      src_file_commands[src_file_path] = command.str();
+      src_file_commands[src_file_path] = command;
       continue;
     }
 
@@ -992,11 +1179,10 @@ int main(int argc, const char *argv[]) {
     // disabled
     for (unsigned i = FlagParameterID::kFIRST_FLAG_PARAMETER;
          i <= FlagParameterID::kLAST_FLAG_PARAMETER; ++i) {
-      if (!parameter_to_flag.count(i))
+      const char *param_flag = flag_table->getFlag(i);
+      if (!param_flag)
         continue;
-      auto entry = parameter_to_flag.at(i);
-      assert(entry.second <= gcc_version);
-      std::string flag = entry.first;
+      std::string flag = param_flag;
 
       if (params.count(i)) {
         file_cmd.push_back(flag);
@@ -1014,86 +1200,195 @@ int main(int argc, const char *argv[]) {
 
     // Add the input filename
     file_cmd.push_back(file_arg);
-
-    // Build a command appropriate to compile each of the files
-    std::stringstream command;
-    for (unsigned i = 0; i < file_cmd.size(); ++i) {
-      if (i == 0)
-        command << file_cmd[i];
-      else
-        command << " " << file_cmd[i];
-    }
-    src_file_commands[src_file_path] = command.str();
+    src_file_commands[src_file_path] = file_cmd;
   }
 
-  // Compile each of the files in turn, if any fail, error out early
+  std::vector<std::vector<std::string>> commands;
   for (auto file_arg : src_files) {
     auto src_file_path = mageec::util::getFullPath(file_arg);
-    auto command = src_file_commands[src_file_path];
+    commands.push_back(src_file_commands[src_file_path]);
+  }
 
-    // FIXME: Windows?
-    MAGEEC_DEBUG("Executing command: " << command);
-    int res = system(command.c_str());
-    if (res) {
-      MAGEEC_ERR("Compilation failed\ncommand: " << command);
-      return res;
+  // If there is an object cache, the files are first preprocessed, and the
+  // programs each compilation would run are listed, to find the key of each
+  // compilation. The objects of any compilations which are already in the
+  // cache are taken from it, and only the remaining files are compiled.
+  std::unique_ptr<ObjectCache> object_cache;
+  uint64_t compiler_hash = flag_table->getCompilerHash();
+  if (with_object_cache && compiler_hash == 0) {
+    MAGEEC_WARN("Unable to identify the compiler, the object cache will not "
+                "be used");
+  } else if (with_object_cache) {
+    object_cache.reset(new ObjectCache(object_cache_path));
+  }
+
+  std::vector<std::string> cache_keys(commands.size());
+  std::vector<std::string> object_paths(commands.size());
+  std::vector<mageec::util::Option<std::string>> cached_diagnostics(
+      commands.size());
+  if (object_cache) {
+    std::vector<size_t> cacheable;
+    std::vector<std::vector<std::string>> preprocess_commands;
+    for (size_t i = 0; i < commands.size(); ++i) {
+      std::vector<std::string> preprocess_command;
+      if (!ObjectCache::getPreprocessCommand(commands[i], preprocess_command,
+                                             object_paths[i]))
+        continue;
+      cacheable.push_back(i);
+      preprocess_commands.push_back(preprocess_command);
+    }
+
+    std::vector<std::vector<std::string>> key_commands = preprocess_commands;
+    for (const auto &preprocess_command : preprocess_commands) {
+      key_commands.push_back(
+          ObjectCache::getToolchainCommand(preprocess_command));
+    }
+    auto key_outputs = mageec::util::runCommands(key_commands, jobs, true);
+    for (size_t i = 0; i < cacheable.size(); ++i) {
+      // A file which fails to preprocess is compiled anyway, so that the
+      // compiler reports the error.
+      const auto &preprocessed = key_outputs[i];
+      const auto &toolchain_listing = key_outputs[cacheable.size() + i];
+      if (!preprocessed.run || preprocessed.status != 0 ||
+          !toolchain_listing.run || toolchain_listing.status != 0)
+        continue;
+      auto toolchain = ObjectCache::getToolchainIdentity(
+          compiler_hash, toolchain_listing.err);
+      if (!toolchain)
+        continue;
+
+      size_t cmd = cacheable[i];
+      cache_keys[cmd] = ObjectCache::getKey(
+          preprocess_commands[i], toolchain.get(), preprocessed.out);
+
+      std::string diagnostics;
+      if (object_cache->fetch(cache_keys[cmd], object_paths[cmd],
+                              diagnostics)) {
+        MAGEEC_DEBUG("Using cached object " << cache_keys[cmd] << " for '"
+                     << object_paths[cmd] << "'");
+        cached_diagnostics[cmd] = diagnostics;
+      }
+    }
+  }
+
+  // Compile the files, several at once if allowed. Once any fail no more
+  // are started, and the first failure in the order of the files is
+  // reported. The output of compilations which may be cached is captured
+  // so that it can be cached along with the object.
+  std::vector<size_t> compiled;
+  std::vector<std::vector<std::string>> compile_commands;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    if (cached_diagnostics[i])
+      continue;
+    MAGEEC_DEBUG("Executing command: " << joinCommand(commands[i]));
+    compiled.push_back(i);
+    compile_commands.push_back(commands[i]);
+  }
+  auto results = mageec::util::runCommands(compile_commands, jobs,
+                                           object_cache != nullptr);
+
+  // The output of each compilation is printed in the order of the files,
+  // regardless of the order they finished in.
+  size_t next_result = 0;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    if (cached_diagnostics[i]) {
+      std::cerr << cached_diagnostics[i].get();
+      continue;
+    }
+    const auto &result = results[next_result++];
+    if (!result.run)
+      continue;
+    std::cout << result.out;
+    std::cout.flush();
+    std::cerr << result.err;
+    if (result.status != 0) {
+      MAGEEC_ERR("Compilation failed\ncommand: " << joinCommand(commands[i]));
+      return result.status;
     }
+    // Only the diagnostics are kept with a cached object, so compilations
+    // which printed anything else are not cached.
+    if (!cache_keys[i].empty() && result.out.empty())
+      object_cache->store(cache_keys[i], object_paths[i], result.err);
   }
 
-  // If all of the file compiled successfully, generated compilation ids for
-  // them and output these ids into the output file
-  std::ofstream out_file(out_path, std::ios::app);
-  if (!out_file.is_open()) {
+  // If all of the file compiled successfully, record the compilations in the
+  // database in a single transaction, and output the compilation ids into
+  // the output file, or a shard file of their own if the output is a
+  // directory.
+  struct stat out_stat;
+  bool out_is_dir = (stat(out_path.c_str(), &out_stat) == 0) &&
+                    S_ISDIR(out_stat.st_mode);
+  if (out_is_dir ? (access(out_path.c_str(), W_OK | X_OK) != 0)
+                 : !mageec::util::appendToFile(out_path, "")) {
     MAGEEC_ERR("Error opening output file. The file may not exist, or you "
                "may not have sufficient permissions to read and write it");
     return -1;
   }
+  std::vector<std::string> recorded_files;
+  std::vector<mageec::ModuleCompilation> compilations;
   for (auto file_arg : src_files) {
     std::string src_file_path = mageec::util::getFullPath(file_arg);
     auto feature_set_ids = src_file_feature_set_ids.find(src_file_path);
-    auto param_set_id = src_file_parameter_set_ids.find(src_file_path);
+    auto param_set = src_file_parameter_sets.find(src_file_path);
 
     // If there were no features for this file, then parameters would not have
     // been derived and there will be no compilation id
     if (feature_set_ids == src_file_feature_set_ids.end())
       continue;
-    assert(param_set_id != src_file_parameter_set_ids.end());
+    assert(param_set != src_file_parameter_sets.end());
 
-    // Generate a compilation id for the module
-    // Append the generated compilation ids to the output file
     assert(feature_set_ids->second.module);
     auto module_entry = feature_set_ids->second.module.get();
-    auto module_compilation = db->newCompilation(module_entry.name, "module",
-                                                 module_entry.id,
-                                                 mageec::FeatureClass::kModule,
-                                                 param_set_id->second,
-                                                 // FIXME: The compilation command
-                                                 // takes up a lot of space so
-                                                 // we don't store it for now
-                                                 nullptr, //src_file_commands[src_file_path],
-                                                 nullptr);
-
-    // TODO: Avoid static_cast here
-    uint64_t tmp = static_cast<uint64_t>(module_compilation);
-    out_file << src_file_path << ",module," << module_entry.name
-                               << ",compilation," << tmp << "\n";
 
-    // Generate a compilation id for each of the functions in the module.
+    mageec::ModuleCompilation compilation;
+    compilation.module = {module_entry.name, module_entry.id};
     for (auto function_entry : feature_set_ids->second.functions) {
-      auto function_compilation =
-          db->newCompilation(function_entry.name, "function",
-                             function_entry.id, mageec::FeatureClass::kFunction,
-                             param_set_id->second,
-                             // FIXME: The compilation command takes up a lot of
-                             // space so we don't store it for now.
-                             nullptr, //src_file_commands[src_file_path],
-                             module_compilation);
-
-      // TODO: Avoid static cast here
-      tmp = static_cast<uint64_t>(function_compilation);
-      out_file << src_file_path << ",function," << function_entry.name
-                                 << ",compilation," << tmp << "\n";
+      compilation.functions.push_back({function_entry.name,
+                                       function_entry.id});
+    }
+    compilation.parameters = param_set->second;
+
+    auto cache_key = src_file_cache_keys.find(src_file_path);
+    if (cache_key != src_file_cache_keys.end())
+      compilation.decision_cache_key = cache_key->second;
+
+    recorded_files.push_back(src_file_path);
+    compilations.push_back(compilation);
+  }
+  auto compilation_ids = db->newCompilations(compilations);
+  assert(compilation_ids.size() == compilations.size());
+
+  // The ids are appended to the output file in a single write, so that the
+  // ids of parallel compilations are never interleaved
+  std::ostringstream out_lines;
+  for (size_t i = 0; i < compilations.size(); ++i) {
+    const auto &compilation = compilations[i];
+    const auto &ids = compilation_ids[i];
+
+    // TODO: Avoid static_cast here
+    out_lines << recorded_files[i] << ",module," << compilation.module.name
+              << ",compilation," << static_cast<uint64_t>(ids.module)
+              << "\n";
+    for (size_t j = 0; j < compilation.functions.size(); ++j) {
+      out_lines << recorded_files[i] << ",function,"
+                << compilation.functions[j].name << ",compilation,"
+                << static_cast<uint64_t>(ids.functions[j]) << "\n";
     }
   }
+
+  if (compilations.empty())
+    return 0;
+
+  bool written;
+  if (out_is_dir) {
+    written = mageec::util::writeFileAtomically(getShardPath(out_path),
+                                                out_lines.str());
+  } else {
+    written = mageec::util::appendToFile(out_path, out_lines.str());
+  }
+  if (!written) {
+    MAGEEC_ERR("Error writing compilation ids to '" << out_path << "'");
+    return -1;
+  }
   return 0;
 }
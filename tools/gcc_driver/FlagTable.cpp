@@ -0,0 +1,444 @@
+/*  MAGEEC GCC Flag Table
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===----------------------- MAGEEC GCC Flag Table ------------------------===//
+//
+// This implements loading and caching of the table of flags supported by a
+// compiler.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FlagTable.h"
+
+#include "mageec/Util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/// Identifies a flag table, and the version of its layout
+const char kTableMagic[8] = {'M', 'G', 'C', 'F', 'L', 'A', 'G', 'S'};
+const uint32_t kTableFormat = 1;
+
+/// Marks a parameter which has no supported flag
+const uint32_t kNoFlag = std::numeric_limits<uint32_t>::max();
+
+/// \struct TableHeader
+///
+/// \brief Header at the start of a flag table
+///
+/// The header is followed by a record for each supported flag, sorted by
+/// the name of the flag, then the index of the record of each parameter,
+/// then the names of the flags, each terminated by a null.
+struct TableHeader {
+  char magic[8];
+  uint32_t format;
+  uint32_t gcc_version;
+  /// Hash of the flags known to the driver
+  uint64_t flags_hash;
+  /// Identity of the compiler binary the table was built for
+  uint64_t compiler_dev;
+  uint64_t compiler_ino;
+  uint64_t compiler_size;
+  int64_t compiler_mtime_sec;
+  int64_t compiler_mtime_nsec;
+
+  uint32_t n_flags;
+  uint32_t n_parameters;
+  uint32_t strings_size;
+  uint32_t reserved;
+};
+
+/// \struct FlagRecord
+///
+/// \brief A supported flag in a flag table
+struct FlagRecord {
+  uint32_t parameter;
+  /// Offset of the name of the flag in the names
+  uint32_t name;
+};
+
+const TableHeader &getHeader(const uint8_t *data) {
+  return *reinterpret_cast<const TableHeader *>(data);
+}
+
+const FlagRecord *getRecords(const uint8_t *data) {
+  return reinterpret_cast<const FlagRecord *>(data + sizeof(TableHeader));
+}
+
+const uint32_t *getParameterFlags(const uint8_t *data) {
+  return reinterpret_cast<const uint32_t *>(
+      getRecords(data) + getHeader(data).n_flags);
+}
+
+const char *getNames(const uint8_t *data) {
+  return reinterpret_cast<const char *>(getParameterFlags(data) +
+                                        getHeader(data).n_parameters);
+}
+
+/// \brief Hash the flags known to the driver, so that a table built with
+/// different flags is not used.
+uint64_t hashFlags(const FlagInfo *flags, size_t n_flags) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto addByte = [&hash](uint8_t byte) {
+    hash ^= byte;
+    hash *= 0x100000001b3ULL;
+  };
+  for (size_t i = 0; i < n_flags; ++i) {
+    for (const char *c = flags[i].flag; *c; ++c) {
+      addByte(static_cast<uint8_t>(*c));
+    }
+    addByte(0);
+    for (unsigned value : {flags[i].parameter, flags[i].gcc_version}) {
+      for (unsigned j = 0; j < 4; ++j) {
+        addByte(static_cast<uint8_t>(value >> (j * 8)));
+      }
+    }
+  }
+  return hash;
+}
+
+/// \brief Fill in the key of a table, which identifies the compiler and
+/// the flags known to the driver.
+void setKey(TableHeader &header, const struct stat &compiler_stat,
+            uint64_t flags_hash) {
+  header.flags_hash = flags_hash;
+  header.compiler_dev = static_cast<uint64_t>(compiler_stat.st_dev);
+  header.compiler_ino = static_cast<uint64_t>(compiler_stat.st_ino);
+  header.compiler_size = static_cast<uint64_t>(compiler_stat.st_size);
+  header.compiler_mtime_sec = compiler_stat.st_mtim.tv_sec;
+  header.compiler_mtime_nsec = compiler_stat.st_mtim.tv_nsec;
+}
+
+bool sameKey(const TableHeader &a, const TableHeader &b) {
+  return a.flags_hash == b.flags_hash && a.compiler_dev == b.compiler_dev &&
+         a.compiler_ino == b.compiler_ino &&
+         a.compiler_size == b.compiler_size &&
+         a.compiler_mtime_sec == b.compiler_mtime_sec &&
+         a.compiler_mtime_nsec == b.compiler_mtime_nsec;
+}
+
+/// \brief Find the compiler binary which will be run for a command
+///
+/// \return True if the compiler was found, in which case its path and
+/// status are set.
+bool findCompiler(const std::string &gcc_command, std::string &path,
+                  struct stat &compiler_stat) {
+  auto found = mageec::util::findProgram(gcc_command);
+  if (!found)
+    return false;
+  path = found.get();
+  return stat(path.c_str(), &compiler_stat) == 0;
+}
+
+/// \brief Get the directory holding the cached flag tables
+///
+/// \return The directory, or nothing if there is nowhere to cache them
+mageec::util::Option<std::string> getCacheDir() {
+  const char *xdg_cache = getenv("XDG_CACHE_HOME");
+  if (xdg_cache && xdg_cache[0] == '/') {
+    return std::string(xdg_cache) + "/mageec";
+  }
+  const char *home = getenv("HOME");
+  if (home && home[0] == '/') {
+    return std::string(home) + "/.cache/mageec";
+  }
+  return nullptr;
+}
+
+/// \brief Get the path of the cached flag table for a compiler
+std::string getCachePath(const std::string &cache_dir,
+                         const std::string &compiler_path) {
+  // FNV-1a of the path of the compiler
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : compiler_path) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/flags-%016llx",
+           static_cast<unsigned long long>(hash));
+  return cache_dir + name;
+}
+
+/// \brief Run the compiler to find its version
+///
+/// \return The version as (major * 10000) + (minor * 100) + patch, or
+/// nothing if it could not be determined.
+mageec::util::Option<unsigned> readGCCVersion(const std::string &gcc_command) {
+  auto res = mageec::util::runCommand({gcc_command, "-dumpversion"}, true);
+  if (res.status != 0) {
+    return nullptr;
+  }
+
+  // Newer compilers may only print the major, or major and minor, version
+  unsigned components[3] = {0, 0, 0};
+  const char *str = res.out.c_str();
+  for (unsigned i = 0; i < 3; ++i) {
+    if (*str < '0' || *str > '9') {
+      if (i == 0) {
+        return nullptr;
+      }
+      break;
+    }
+    char *end;
+    components[i] = static_cast<unsigned>(strtoul(str, &end, 10));
+    str = end;
+    if (*str != '.') {
+      break;
+    }
+    ++str;
+  }
+  return (components[0] * 10000) + (components[1] * 100) + components[2];
+}
+
+/// \brief Build the table of the flags supported by a version of the
+/// compiler
+std::vector<uint8_t> buildTable(const TableHeader &key, const FlagInfo *flags,
+                                size_t n_flags, unsigned gcc_version) {
+  std::vector<const FlagInfo *> supported;
+  uint32_t n_parameters = 0;
+  for (size_t i = 0; i < n_flags; ++i) {
+    n_parameters = std::max(n_parameters, flags[i].parameter + 1);
+    if (flags[i].gcc_version <= gcc_version) {
+      supported.push_back(&flags[i]);
+    }
+  }
+  std::sort(supported.begin(), supported.end(),
+            [](const FlagInfo *a, const FlagInfo *b) {
+    return strcmp(a->flag, b->flag) < 0;
+  });
+
+  std::vector<FlagRecord> records;
+  std::vector<uint32_t> parameter_flags(n_parameters, kNoFlag);
+  std::string names;
+  for (const FlagInfo *info : supported) {
+    parameter_flags[info->parameter] = static_cast<uint32_t>(records.size());
+    records.push_back({info->parameter, static_cast<uint32_t>(names.size())});
+    names.append(info->flag);
+    names.push_back('\0');
+  }
+
+  TableHeader header = key;
+  memcpy(header.magic, kTableMagic, sizeof(header.magic));
+  header.format = kTableFormat;
+  header.gcc_version = gcc_version;
+  header.n_flags = static_cast<uint32_t>(records.size());
+  header.n_parameters = n_parameters;
+  header.strings_size = static_cast<uint32_t>(names.size());
+  header.reserved = 0;
+
+  std::vector<uint8_t> table(sizeof(header) +
+                             records.size() * sizeof(FlagRecord) +
+                             parameter_flags.size() * sizeof(uint32_t) +
+                             names.size());
+  uint8_t *out = table.data();
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  memcpy(out, records.data(), records.size() * sizeof(FlagRecord));
+  out += records.size() * sizeof(FlagRecord);
+  memcpy(out, parameter_flags.data(),
+         parameter_flags.size() * sizeof(uint32_t));
+  out += parameter_flags.size() * sizeof(uint32_t);
+  memcpy(out, names.data(), names.size());
+  return table;
+}
+
+/// \brief Write a table to the cache, replacing any existing table
+///
+/// The table is written atomically, so that other instances of the driver
+/// never see a partially written table.
+void writeCache(const std::string &cache_dir, const std::string &cache_path,
+                const std::vector<uint8_t> &table) {
+  // Create the cache directory and its parent if needed
+  std::string parent = cache_dir.substr(0, cache_dir.rfind('/'));
+  mkdir(parent.c_str(), 0755);
+  mkdir(cache_dir.c_str(), 0755);
+
+  std::string data(table.begin(), table.end());
+  if (!mageec::util::writeFileAtomically(cache_path, data)) {
+    MAGEEC_DEBUG("Unable to write flag table cache '" << cache_path << "'");
+  }
+}
+
+} // end of anonymous namespace
+
+
+FlagTable::~FlagTable() {
+  if (m_mapped) {
+    munmap(const_cast<uint8_t *>(m_data), m_size);
+  }
+}
+
+std::unique_ptr<FlagTable> FlagTable::load(const std::string &gcc_command,
+                                           const FlagInfo *flags,
+                                           size_t n_flags) {
+  std::unique_ptr<FlagTable> table(new FlagTable());
+
+  TableHeader key;
+  memset(&key, 0, sizeof(key));
+  std::string compiler_path;
+  struct stat compiler_stat;
+  mageec::util::Option<std::string> cache_dir;
+  std::string cache_path;
+  if (findCompiler(gcc_command, compiler_path, compiler_stat)) {
+    setKey(key, compiler_stat, hashFlags(flags, n_flags));
+    cache_dir = getCacheDir();
+    if (cache_dir) {
+      cache_path = getCachePath(cache_dir.get(), compiler_path);
+    }
+  }
+
+  // Map the cached table, and use it if it was built for this compiler and
+  // these flags.
+  if (!cache_path.empty()) {
+    int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat cache_stat;
+    if (fd >= 0 && fstat(fd, &cache_stat) == 0 && cache_stat.st_size > 0) {
+      size_t size = static_cast<size_t>(cache_stat.st_size);
+      void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        table->m_data = static_cast<const uint8_t *>(data);
+        table->m_size = size;
+        table->m_mapped = true;
+        if (isValid(table->m_data, size) &&
+            sameKey(getHeader(table->m_data), key)) {
+          close(fd);
+          MAGEEC_DEBUG("Loaded flag table from '" << cache_path << "'");
+          return table;
+        }
+        munmap(data, size);
+        table->m_mapped = false;
+      }
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  // Otherwise build the table from the version of the compiler
+  auto gcc_version = readGCCVersion(gcc_command);
+  if (!gcc_version) {
+    MAGEEC_ERR("Unable to determine the version of '" << gcc_command << "'");
+    return nullptr;
+  }
+  table->m_buffer = buildTable(key, flags, n_flags, gcc_version.get());
+  table->m_data = table->m_buffer.data();
+  table->m_size = table->m_buffer.size();
+  assert(isValid(table->m_data, table->m_size));
+
+  if (!cache_path.empty()) {
+    MAGEEC_DEBUG("Caching flag table in '" << cache_path << "'");
+    writeCache(cache_dir.get(), cache_path, table->m_buffer);
+  }
+  return table;
+}
+
+bool FlagTable::isValid(const uint8_t *data, size_t size) {
+  if (size < sizeof(TableHeader)) {
+    return false;
+  }
+  const TableHeader &header = getHeader(data);
+  if (memcmp(header.magic, kTableMagic, sizeof(header.magic)) != 0 ||
+      header.format != kTableFormat) {
+    return false;
+  }
+  uint64_t expected_size = sizeof(TableHeader) +
+                           uint64_t(header.n_flags) * sizeof(FlagRecord) +
+                           uint64_t(header.n_parameters) * sizeof(uint32_t) +
+                           header.strings_size;
+  if (size != expected_size || header.strings_size == 0 ||
+      getNames(data)[header.strings_size - 1] != '\0') {
+    return false;
+  }
+
+  const FlagRecord *records = getRecords(data);
+  for (uint32_t i = 0; i < header.n_flags; ++i) {
+    if (records[i].parameter >= header.n_parameters ||
+        records[i].name >= header.strings_size) {
+      return false;
+    }
+  }
+  const uint32_t *parameter_flags = getParameterFlags(data);
+  for (uint32_t i = 0; i < header.n_parameters; ++i) {
+    if (parameter_flags[i] != kNoFlag && parameter_flags[i] >= header.n_flags) {
+      return false;
+    }
+  }
+  return true;
+}
+
+unsigned FlagTable::getGCCVersion() const {
+  return getHeader(m_data).gcc_version;
+}
+
+uint64_t FlagTable::getCompilerHash() const {
+  const TableHeader &header = getHeader(m_data);
+  if (header.compiler_ino == 0 && header.compiler_mtime_sec == 0)
+    return 0;
+
+  std::vector<uint8_t> key;
+  for (uint64_t value : {header.compiler_dev, header.compiler_ino,
+                         header.compiler_size,
+                         static_cast<uint64_t>(header.compiler_mtime_sec),
+                         static_cast<uint64_t>(header.compiler_mtime_nsec),
+                         static_cast<uint64_t>(header.gcc_version)}) {
+    mageec::util::write64LE(key, value);
+  }
+  return mageec::util::crc64(key.data(), key.size());
+}
+
+mageec::util::Option<unsigned>
+FlagTable::getParameter(const std::string &flag) const {
+  const FlagRecord *begin = getRecords(m_data);
+  const FlagRecord *end = begin + getHeader(m_data).n_flags;
+  const char *names = getNames(m_data);
+
+  auto record = std::lower_bound(begin, end, flag,
+                                 [names](const FlagRecord &r,
+                                         const std::string &f) {
+    return strcmp(names + r.name, f.c_str()) < 0;
+  });
+  if (record == end || flag != names + record->name) {
+    return nullptr;
+  }
+  return static_cast<unsigned>(record->parameter);
+}
+
+const char *FlagTable::getFlag(unsigned parameter) const {
+  if (parameter >= getHeader(m_data).n_parameters) {
+    return nullptr;
+  }
+  uint32_t index = getParameterFlags(m_data)[parameter];
+  if (index == kNoFlag) {
+    return nullptr;
+  }
+  return getNames(m_data) + getRecords(m_data)[index].name;
+}
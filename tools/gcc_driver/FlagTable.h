@@ -0,0 +1,116 @@
+/*  MAGEEC GCC Flag Table
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===----------------------- MAGEEC GCC Flag Table ------------------------===//
+//
+// This defines the table of optimization flags supported by the version of
+// GCC wrapped by the driver. The table is cached on disk for each compiler,
+// so that the driver does not need to run the compiler to find its version,
+// or filter the flags by that version, every time it is invoked.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MAGEEC_GCC_FLAG_TABLE_H
+#define MAGEEC_GCC_FLAG_TABLE_H
+
+#include "mageec/Util.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/// \struct FlagInfo
+///
+/// \brief A flag known to the driver, the parameter it controls, and the
+/// gcc version in which the flag is first supported.
+struct FlagInfo {
+  const char *flag;
+  unsigned parameter;
+  unsigned gcc_version;
+};
+
+
+/// \class FlagTable
+///
+/// \brief The flags supported by a compiler, indexed both by flag and by
+/// parameter.
+///
+/// The table is held in a single compact block, which is either mapped
+/// directly from the cache file of the compiler, or built from the flags
+/// known to the driver when there is no valid cache file. The cache file is
+/// keyed by the path, inode and modification time of the compiler binary,
+/// and by the flags known to the driver, so that it is rebuilt whenever
+/// either of these change.
+class FlagTable {
+public:
+  ~FlagTable();
+
+  /// \brief Load the flag table of a compiler
+  ///
+  /// \param gcc_command  The compiler, which is searched for in PATH if it
+  /// is not a path
+  /// \param flags  All of the flags known to the driver
+  /// \param n_flags  The number of flags known to the driver
+  ///
+  /// \return The table, or nullptr if the version of the compiler could not
+  /// be determined.
+  static std::unique_ptr<FlagTable> load(const std::string &gcc_command,
+                                         const FlagInfo *flags,
+                                         size_t n_flags);
+
+  /// \brief Get the version of the compiler, as
+  /// (major * 10000) + (minor * 100) + patch
+  unsigned getGCCVersion() const;
+
+  /// \brief Get a hash identifying the compiler binary the table was built
+  /// for, from its inode, size, modification time and version.
+  ///
+  /// \return The hash, or 0 if the compiler binary could not be found
+  uint64_t getCompilerHash() const;
+
+  /// \brief Get the parameter controlled by a flag
+  ///
+  /// \return The parameter, or nothing if the flag is not supported
+  mageec::util::Option<unsigned> getParameter(const std::string &flag) const;
+
+  /// \brief Get the flag controlling a parameter
+  ///
+  /// \return The flag, or nullptr if the parameter is not supported
+  const char *getFlag(unsigned parameter) const;
+
+private:
+  FlagTable() : m_data(nullptr), m_size(0), m_mapped(false) {}
+
+  /// \brief Check that a block holds a well formed table
+  static bool isValid(const uint8_t *data, size_t size);
+
+  /// Start and size of the block holding the table
+  const uint8_t *m_data;
+  size_t m_size;
+
+  /// Whether the block is mapped from the cache file, rather than held in
+  /// m_buffer
+  bool m_mapped;
+  std::vector<uint8_t> m_buffer;
+};
+
+
+#endif // MAGEEC_GCC_FLAG_TABLE_H
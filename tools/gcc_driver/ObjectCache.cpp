@@ -0,0 +1,296 @@
+/*  MAGEEC GCC Object Cache
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===----------------------- MAGEEC GCC Object Cache ----------------------===//
+//
+// This implements the cache of the objects produced by the driver.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ObjectCache.h"
+
+#include "mageec/Util.h"
+
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/// Arguments which produce outputs other than the object, read inputs which
+/// are not seen by the preprocessor, or stop before an object is produced.
+/// A compilation with any argument starting with one of these is not cached.
+const char *const kUncacheablePrefixes[] = {
+  "-E", "-S", "-M", "-save-temps", "-Wp,", "-Wa,", "-fplugin",
+  "-fprofile", "-fauto-profile", "-fdump-", "-fstack-usage",
+  "-fcallgraph-info", "-fopt-info", "-aux-info", "@"
+};
+
+/// Extensions of the inputs which are preprocessed, so that the output of
+/// the preprocessor covers the whole of the input
+const char *const kPreprocessedExtensions[] = {
+  ".c", ".cc", ".cp", ".cxx", ".cpp", ".CPP", ".c++", ".C", ".S", ".sx"
+};
+
+bool hasPrefix(const std::string &str, const char *prefix) {
+  return str.compare(0, strlen(prefix), prefix) == 0;
+}
+
+/// \brief Read the whole of a file
+///
+/// \return true if the file could be read
+bool readFile(const std::string &path, std::string &data) {
+  std::ifstream in_file(path, std::ios::binary);
+  if (!in_file)
+    return false;
+  std::stringstream contents;
+  contents << in_file.rdbuf();
+  if (in_file.bad())
+    return false;
+  data = contents.str();
+  return true;
+}
+
+/// \brief Add the identity of a file to a digest
+///
+/// \return true if the file exists
+bool addFileIdentity(mageec::util::SHA256 &digest, const std::string &path) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0)
+    return false;
+
+  std::vector<uint8_t> identity;
+  for (uint64_t value : {static_cast<uint64_t>(file_stat.st_dev),
+                         static_cast<uint64_t>(file_stat.st_ino),
+                         static_cast<uint64_t>(file_stat.st_size),
+                         static_cast<uint64_t>(file_stat.st_mtim.tv_sec),
+                         static_cast<uint64_t>(file_stat.st_mtim.tv_nsec)}) {
+    mageec::util::write64LE(identity, value);
+  }
+  digest.update(path);
+  digest.update(identity.data(), identity.size());
+  return true;
+}
+
+/// \brief Get the program run by a command printed by -###, which is the
+/// first word of the line, quoted if it contains special characters.
+std::string getListedProgram(const std::string &line) {
+  size_t start = line.find_first_not_of(' ');
+  if (start == std::string::npos)
+    return std::string();
+  if (line[start] != '"')
+    return line.substr(start, line.find(' ', start) - start);
+
+  std::string program;
+  for (size_t i = start + 1; i < line.size() && line[i] != '"'; ++i) {
+    if (line[i] == '\\' && i + 1 < line.size())
+      ++i;
+    program.push_back(line[i]);
+  }
+  return program;
+}
+
+} // end of anonymous namespace
+
+
+bool ObjectCache::getPreprocessCommand(
+    const std::vector<std::string> &command,
+    std::vector<std::string> &preprocess_command, std::string &object_path) {
+  if (command.size() < 2)
+    return false;
+
+  const std::string &input = command.back();
+  bool preprocessed = false;
+  for (const char *ext : kPreprocessedExtensions) {
+    size_t len = strlen(ext);
+    if (input.size() > len &&
+        input.compare(input.size() - len, len, ext) == 0) {
+      preprocessed = true;
+      break;
+    }
+  }
+  if (!preprocessed)
+    return false;
+
+  // The preprocess command is the compile command run with -E in place of
+  // -c, and writing to standard output.
+  bool to_obj = false;
+  object_path.clear();
+  preprocess_command.clear();
+  preprocess_command.push_back(command[0]);
+  preprocess_command.push_back("-E");
+  for (size_t i = 1; i < command.size() - 1; ++i) {
+    const std::string &arg = command[i];
+    if (arg == "-c") {
+      to_obj = true;
+      continue;
+    }
+    if (arg == "-o") {
+      if (i + 1 == command.size() - 1)
+        return false;
+      object_path = command[++i];
+      continue;
+    }
+    if (hasPrefix(arg, "-o")) {
+      object_path = std::string(arg.begin() + 2, arg.end());
+      continue;
+    }
+    // The language of the input may be overridden, which could mean that
+    // it is not preprocessed after all.
+    if (hasPrefix(arg, "-x"))
+      return false;
+    for (const char *prefix : kUncacheablePrefixes) {
+      if (hasPrefix(arg, prefix))
+        return false;
+    }
+    preprocess_command.push_back(arg);
+  }
+  if (!to_obj)
+    return false;
+  preprocess_command.push_back(input);
+
+  // Without -o the object is written to the working directory, named after
+  // the input.
+  if (object_path.empty()) {
+    std::string base = mageec::util::getBaseName(input);
+    object_path = base.substr(0, base.rfind('.')) + ".o";
+  }
+  return true;
+}
+
+std::vector<std::string> ObjectCache::getToolchainCommand(
+    const std::vector<std::string> &preprocess_command) {
+  assert(preprocess_command.size() >= 3 && preprocess_command[1] == "-E");
+
+  std::vector<std::string> command;
+  command.push_back(preprocess_command[0]);
+  command.push_back("-###");
+  command.push_back("-c");
+  command.insert(command.end(), preprocess_command.begin() + 2,
+                 preprocess_command.end());
+  return command;
+}
+
+mageec::util::Option<std::string>
+ObjectCache::getToolchainIdentity(uint64_t compiler_hash,
+                                  const std::string &listing) {
+  mageec::util::SHA256 digest;
+  std::vector<uint8_t> compiler_data;
+  mageec::util::write64LE(compiler_data, compiler_hash);
+  digest.update(compiler_data.data(), compiler_data.size());
+
+  // Lines starting with a space are the commands which would be run, which
+  // name temporary files and so differ each time. The other lines hold the
+  // configuration of the driver, such as its version and search paths.
+  const std::string specs_prefix = "Reading specs from ";
+  std::stringstream lines(listing);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (line.empty())
+      continue;
+    if (line[0] != ' ') {
+      digest.update(line + '\n');
+      if (line.compare(0, specs_prefix.size(), specs_prefix) == 0 &&
+          !addFileIdentity(digest, line.substr(specs_prefix.size())))
+        return nullptr;
+      continue;
+    }
+
+    // Programs which are not found by the driver are run from PATH
+    std::string program = getListedProgram(line);
+    auto path = mageec::util::findProgram(program);
+    if (!path || !addFileIdentity(digest, path.get())) {
+      MAGEEC_DEBUG("Unable to find '" << program << "' run by the compiler");
+      return nullptr;
+    }
+  }
+  return digest.finish();
+}
+
+std::string ObjectCache::getKey(const std::vector<std::string> &command,
+                                const std::string &toolchain,
+                                const std::string &preprocessed) {
+  // The working directory may be recorded in the object, for example in
+  // its debug information.
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    cwd[0] = '\0';
+
+  // Each field is terminated by a null, so that the boundaries between
+  // the fields are unambiguous. The preprocessed source is last.
+  mageec::util::SHA256 digest;
+  digest.update(toolchain);
+  digest.update(reinterpret_cast<const uint8_t *>(cwd), strlen(cwd) + 1);
+  for (const auto &arg : command) {
+    digest.update(reinterpret_cast<const uint8_t *>(arg.c_str()),
+                  arg.size() + 1);
+  }
+  digest.update(preprocessed);
+  return digest.finish();
+}
+
+bool ObjectCache::fetch(const std::string &key, const std::string &object_path,
+                        std::string &diagnostics) const {
+  std::string entry_path = getEntryPath(key);
+
+  // The diagnostics are stored before the object, so if the object is
+  // present then so are the diagnostics.
+  std::string object;
+  if (!readFile(entry_path + ".o", object) ||
+      !readFile(entry_path + ".stderr", diagnostics))
+    return false;
+
+  if (!mageec::util::writeFileAtomically(object_path, object)) {
+    MAGEEC_WARN("Unable to write cached object to '" << object_path << "'");
+    return false;
+  }
+  return true;
+}
+
+void ObjectCache::store(const std::string &key, const std::string &object_path,
+                        const std::string &diagnostics) const {
+  std::string entry_path = getEntryPath(key);
+
+  std::string object;
+  if (!readFile(object_path, object)) {
+    MAGEEC_WARN("Unable to read object '" << object_path << "' to cache");
+    return;
+  }
+
+  mkdir(m_dir.c_str(), 0755);
+  mkdir(entry_path.substr(0, entry_path.rfind('/')).c_str(), 0755);
+  if (!mageec::util::writeFileAtomically(entry_path + ".stderr",
+                                         diagnostics) ||
+      !mageec::util::writeFileAtomically(entry_path + ".o", object)) {
+    MAGEEC_WARN("Unable to add object to the cache in '" << m_dir << "'");
+    return;
+  }
+  MAGEEC_DEBUG("Added '" << object_path << "' to the object cache as "
+               << key);
+}
+
+std::string ObjectCache::getEntryPath(const std::string &key) const {
+  // Entries are spread over subdirectories by the start of their key, to
+  // keep the directories small.
+  return m_dir + "/" + key.substr(0, 2) + "/" + key;
+}
@@ -0,0 +1,141 @@
+/*  MAGEEC GCC Object Cache
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===----------------------- MAGEEC GCC Object Cache ----------------------===//
+//
+// This defines a local cache of the objects produced by the compilations
+// run by the driver. When exploring the parameter space the same source
+// file is frequently compiled with exactly the same flags, in which case
+// the object is taken from the cache rather than compiling the file again.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MAGEEC_GCC_OBJECT_CACHE_H
+#define MAGEEC_GCC_OBJECT_CACHE_H
+
+#include "mageec/Util.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/// \class ObjectCache
+///
+/// \brief A directory of objects, keyed by the compilation which produced
+/// them.
+///
+/// The key of a compilation is the SHA-256 digest of the preprocessed
+/// source, the identity of the programs run by the compiler, the working
+/// directory and the exact arguments of the compilation, so that a cached
+/// object is the object the compiler would have produced. The diagnostics
+/// printed by the compiler are cached with the object, and printed again
+/// when the object is used.
+///
+/// Programs are identified by their path, inode, size and modification
+/// time rather than their contents, so a program which is modified in
+/// place without changing any of these, such as by a tool which preserves
+/// the modification time, is not noticed. The cache should be cleared by
+/// removing its directory after such a change to the toolchain.
+///
+/// Objects are copied in and out of the cache rather than linked, as the
+/// compiler rewrites an existing output file in place.
+class ObjectCache {
+public:
+  explicit ObjectCache(std::string dir) : m_dir(dir) {}
+
+  /// \brief Get the command which preprocesses the input of a compilation,
+  /// and the object the compilation produces.
+  ///
+  /// Only compilations of a single input into an object, with no other
+  /// outputs and no inputs beyond those seen by the preprocessor, can be
+  /// cached.
+  ///
+  /// \param command  The compile command, ending with its input
+  /// \param preprocess_command  Set to the command to preprocess the input
+  /// \param object_path  Set to the object produced by the command
+  ///
+  /// \return true if the compilation can be cached
+  static bool getPreprocessCommand(const std::vector<std::string> &command,
+                                   std::vector<std::string> &preprocess_command,
+                                   std::string &object_path);
+
+  /// \brief Get the command which lists the programs run by a compilation
+  ///
+  /// This is the compile command run with -###, so that the compiler driver
+  /// prints the commands it would run instead of running them.
+  ///
+  /// \param preprocess_command  The preprocess command of the compilation
+  static std::vector<std::string>
+  getToolchainCommand(const std::vector<std::string> &preprocess_command);
+
+  /// \brief Get the identity of the programs run by a compilation
+  ///
+  /// The compiler driver runs the compiler proper and the assembler, which
+  /// it finds in its own installation, through -B options or in PATH, and
+  /// reads any spec files. Each of these is identified, along with the
+  /// configuration printed by the driver.
+  ///
+  /// \param compiler_hash  Identity of the compiler driver binary
+  /// \param listing  Standard error of the toolchain command
+  ///
+  /// \return The identity, or nothing if a program or spec file could not
+  /// be found, in which case the compilation should not be cached.
+  static mageec::util::Option<std::string>
+  getToolchainIdentity(uint64_t compiler_hash, const std::string &listing);
+
+  /// \brief Get the key of a compilation
+  ///
+  /// \param command  The preprocess command of the compilation
+  /// \param toolchain  Identity of the programs run by the compilation
+  /// \param preprocessed  Output of the preprocess command
+  static std::string getKey(const std::vector<std::string> &command,
+                            const std::string &toolchain,
+                            const std::string &preprocessed);
+
+  /// \brief Copy a cached object to the output of a compilation
+  ///
+  /// \param key  Key of the compilation
+  /// \param object_path  Output of the compilation
+  /// \param diagnostics  Set to the diagnostics printed by the compiler
+  ///
+  /// \return true if the object was in the cache and has been copied
+  bool fetch(const std::string &key, const std::string &object_path,
+             std::string &diagnostics) const;
+
+  /// \brief Add the object produced by a compilation to the cache
+  ///
+  /// Failure to add the object is not an error, the compilation will just
+  /// not be cached.
+  ///
+  /// \param key  Key of the compilation
+  /// \param object_path  Output of the compilation
+  /// \param diagnostics  Diagnostics printed by the compiler
+  void store(const std::string &key, const std::string &object_path,
+             const std::string &diagnostics) const;
+
+private:
+  /// \brief Get the path of an entry in the cache, without an extension
+  std::string getEntryPath(const std::string &key) const;
+
+  /// Directory holding the cache
+  std::string m_dir;
+};
+
+
+#endif // MAGEEC_GCC_OBJECT_CACHE_H
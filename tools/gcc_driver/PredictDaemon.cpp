@@ -0,0 +1,434 @@
+/*  MAGEEC Prediction Daemon
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===---------------------- MAGEEC Prediction Daemon ----------------------===//
+//
+// mageec-predictd keeps a database, the trained machine learners loaded
+// from it, and the decisions they have made, in memory, and answers
+// requests from mageec-gcc for the decisions made for a set of features.
+// This saves each compilation from loading the framework and decoding the
+// trained models itself.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mageec/Database.h"
+#include "mageec/Decision.h"
+#include "mageec/Framework.h"
+#include "mageec/ML/C5.h"
+#include "mageec/ML/1NN.h"
+#include "mageec/ML/RandomForest.h"
+#include "mageec/TrainedML.h"
+#include "mageec/Util.h"
+#include "PredictService.h"
+
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// Time after which an idle connection is closed, so that a stalled driver
+/// does not hold up the others
+static const int kConnectionTimeoutSecs = 5;
+
+/// Maximum number of requests whose decisions are cached. Once reached, the
+/// decisions of the least recently requested are dropped.
+static const size_t kMaxCachedDecisions = 1 << 16;
+
+/// Set by the signal handler when the daemon should exit
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handleStopSignal(int) {
+  stop_requested = 1;
+}
+
+
+/// \struct CachedDecisions
+///
+/// \brief Decisions cached for a request, and its position in the order in
+/// which the cached requests were last made.
+struct CachedDecisions {
+  std::vector<PredictDecision> decisions;
+  std::list<std::vector<uint8_t>>::iterator lru_pos;
+};
+
+
+/// \struct LoadedML
+///
+/// \brief A trained machine learner loaded from the database, and the
+/// digest of the model it was loaded with.
+struct LoadedML {
+  std::unique_ptr<mageec::TrainedML> trained_ml;
+  uint64_t ml_digest;
+};
+
+
+/// \class PredictService
+///
+/// \brief Answers requests for decisions using the trained machine learners
+/// of a database.
+///
+/// Trained machine learners are loaded when first requested, and reloaded
+/// when a request is made for a model with a different digest, which
+/// happens when the machine learner is retrained. Decisions are cached for
+/// each set of features and model, up to a limit.
+class PredictService {
+public:
+  PredictService(mageec::Database &db) : m_db(db) {}
+
+  /// \brief Answer a single request
+  ///
+  /// \return The decisions, or nothing if the request could not be answered
+  mageec::util::Option<std::vector<PredictDecision>>
+  predict(const PredictRequest &request);
+
+private:
+  /// \brief Get the trained machine learner with the requested digest
+  mageec::TrainedML *getTrainedML(const std::string &ml,
+                                  const std::string &metric,
+                                  uint64_t ml_digest);
+
+  mageec::Database &m_db;
+
+  /// Loaded machine learners, by machine learner and metric
+  std::map<std::pair<std::string, std::string>, LoadedML> m_mls;
+
+  /// Cached decisions, keyed by the encoded request
+  std::map<std::vector<uint8_t>, CachedDecisions> m_decisions;
+
+  /// Keys of the cached decisions, most recently requested first
+  std::list<std::vector<uint8_t>> m_decisions_lru;
+};
+
+
+mageec::TrainedML *PredictService::getTrainedML(const std::string &ml,
+                                                const std::string &metric,
+                                                uint64_t ml_digest) {
+  auto key = std::make_pair(ml, metric);
+  auto loaded = m_mls.find(key);
+  if (loaded != m_mls.end() && loaded->second.ml_digest == ml_digest)
+    return loaded->second.trained_ml.get();
+
+  // Either the model has not been loaded, or it has been retrained since.
+  // Only load it if the database holds the requested model, otherwise the
+  // driver and the daemon disagree about the database.
+  auto db_digest = m_db.getMachineLearnerDigest(
+      ml, mageec::FeatureClass::kModule, metric);
+  if (!db_digest || db_digest.get() != ml_digest) {
+    MAGEEC_DEBUG("No trained machine learner '" << ml << "' for metric '"
+                 << metric << "' with the requested digest");
+    return nullptr;
+  }
+  auto trained_ml = m_db.getTrainedMachineLearner(
+      ml, mageec::FeatureClass::kModule, metric);
+  if (!trained_ml)
+    return nullptr;
+
+  // Decisions made by the old model will never be requested again
+  if (loaded != m_mls.end()) {
+    m_decisions.clear();
+    m_decisions_lru.clear();
+  }
+
+  MAGEEC_DEBUG("Loaded machine learner '" << ml << "' for metric '"
+               << metric << "'");
+  LoadedML &entry = m_mls[key];
+  entry.trained_ml = std::move(trained_ml);
+  entry.ml_digest = ml_digest;
+  return entry.trained_ml.get();
+}
+
+mageec::util::Option<std::vector<PredictDecision>>
+PredictService::predict(const PredictRequest &request) {
+  std::vector<uint8_t> key = encodePredictRequest(request);
+  auto cached = m_decisions.find(key);
+  if (cached != m_decisions.end()) {
+    m_decisions_lru.splice(m_decisions_lru.begin(), m_decisions_lru,
+                           cached->second.lru_pos);
+    return cached->second.decisions;
+  }
+
+  mageec::TrainedML *trained_ml =
+      getTrainedML(request.ml, request.metric, request.ml_digest);
+  if (!trained_ml)
+    return nullptr;
+
+  auto features = m_db.getFeatureSetFeatures(request.feature_set_id);
+  if (features.size() == 0) {
+    MAGEEC_DEBUG("No features for feature set "
+                 << static_cast<uint64_t>(request.feature_set_id));
+    return nullptr;
+  }
+
+  std::vector<mageec::BoolDecisionRequest> bool_requests;
+  for (unsigned param : request.parameters) {
+    bool_requests.push_back(mageec::BoolDecisionRequest(param));
+  }
+  std::vector<const mageec::DecisionRequestBase *> requests;
+  for (const auto &req : bool_requests) {
+    requests.push_back(&req);
+  }
+
+  auto results = trained_ml->makeDecisions(requests, features);
+  assert(results.size() == requests.size());
+
+  std::vector<PredictDecision> decisions;
+  for (const auto &res : results) {
+    if (res->getType() == mageec::DecisionType::kNative) {
+      decisions.push_back(PredictDecision::kNative);
+    } else {
+      auto *decision = static_cast<mageec::BoolDecision *>(res.get());
+      decisions.push_back(decision->getValue() ? PredictDecision::kEnabled
+                                               : PredictDecision::kDisabled);
+    }
+  }
+
+  if (m_decisions.size() >= kMaxCachedDecisions) {
+    m_decisions.erase(m_decisions_lru.back());
+    m_decisions_lru.pop_back();
+  }
+  m_decisions_lru.push_front(key);
+  CachedDecisions &entry = m_decisions[key];
+  entry.decisions = decisions;
+  entry.lru_pos = m_decisions_lru.begin();
+  return decisions;
+}
+
+
+/// \brief Answer the requests made on a connection until it is closed
+static void serveConnection(PredictService &service, int fd) {
+  std::vector<uint8_t> message;
+  while (!stop_requested && readPredictMessage(fd, message)) {
+    auto request = decodePredictRequest(message);
+    if (!request) {
+      MAGEEC_DEBUG("Malformed request");
+      writePredictMessage(fd, encodePredictError());
+      return;
+    }
+
+    auto decisions = service.predict(request.get());
+    bool res;
+    if (decisions) {
+      res = writePredictMessage(fd, encodePredictResponse(decisions.get()));
+    } else {
+      res = writePredictMessage(fd, encodePredictError());
+    }
+    if (!res)
+      return;
+  }
+}
+
+/// \brief Create the socket the daemon for a database listens on
+///
+/// \param db_path  Full path of the database
+///
+/// \return The socket, or -1 on error
+static int listenOnSocket(const std::string &db_path) {
+  std::string socket_path = getPredictSocketPath(db_path);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    MAGEEC_ERR("Socket path is too long: '" << socket_path << "'");
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    MAGEEC_ERR("Could not create socket: " << strerror(errno));
+    return -1;
+  }
+
+  // Only the user running the daemon may make requests. The socket is
+  // created with these permissions, so that there is no window in which
+  // another user can connect.
+  mode_t old_mask = umask(S_IRWXG | S_IRWXO);
+
+  // A socket left behind by a daemon which did not exit cleanly is removed,
+  // but a socket which is still being listened on belongs to another daemon.
+  int res = bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+  if (res != 0 && errno == EADDRINUSE) {
+    if (PredictClient::connect(db_path)) {
+      MAGEEC_ERR("Another daemon is already serving this database");
+      umask(old_mask);
+      close(fd);
+      return -1;
+    }
+    unlink(socket_path.c_str());
+    res = bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+  }
+  umask(old_mask);
+  if (res != 0) {
+    MAGEEC_ERR("Could not bind socket '" << socket_path << "': "
+               << strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, SOMAXCONN) != 0) {
+    MAGEEC_ERR("Could not listen on socket '" << socket_path << "': "
+               << strerror(errno));
+    close(fd);
+    unlink(socket_path.c_str());
+    return -1;
+  }
+  return fd;
+}
+
+/// \brief Print help output string
+static void printHelp() {
+  mageec::util::out() <<
+"Usage: mageec-predictd [options] <database>\n"
+"\n"
+"Serve decisions made by the trained machine learners of a database to\n"
+"mageec-gcc in predict mode. mageec-gcc uses the daemon for a database\n"
+"whenever one is running, and otherwise makes decisions itself.\n"
+"\n"
+"Options:\n"
+"  --help                 Print this help information\n"
+"  --debug                Enable debug output\n"
+"  --print-socket         Print the path of the socket for the database\n"
+"                         and exit\n";
+}
+
+/// \brief Entry point for the prediction daemon
+int main(int argc, const char *argv[]) {
+  bool with_debug = false;
+  bool with_print_socket = false;
+  std::string db_str;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--help") {
+      printHelp();
+      return 0;
+    } else if (arg == "--debug") {
+      with_debug = true;
+    } else if (arg == "--print-socket") {
+      with_print_socket = true;
+    } else if (db_str.empty() && arg.compare(0, 1, "-") != 0) {
+      db_str = arg;
+    } else {
+      MAGEEC_ERR("Unknown argument '" << arg << "'");
+      return -1;
+    }
+  }
+  if (db_str.empty()) {
+    MAGEEC_ERR("No database provided");
+    printHelp();
+    return -1;
+  }
+
+  // The socket is derived from the full path of the database, in the same
+  // way as by the driver.
+  if (!mageec::util::fileExists(db_str)) {
+    MAGEEC_ERR("Error retrieving database. The database '" << db_str
+               << "' does not exist");
+    return -1;
+  }
+  std::string db_path = mageec::util::getFullPath(db_str);
+  std::string socket_path = getPredictSocketPath(db_path);
+  if (with_print_socket) {
+    mageec::util::out() << socket_path << '\n';
+    return 0;
+  }
+
+  // Initialize the framework, and register the same machine learners as the
+  // driver, so that they can be requested by name. Machine learners loaded
+  // from shared objects are not served, and the driver makes their
+  // decisions itself when the daemon cannot answer.
+  mageec::Framework framework(with_debug, false);
+
+  std::unique_ptr<mageec::IMachineLearner> c5_ml(new mageec::C5Driver());
+  framework.registerMachineLearner(std::move(c5_ml));
+  std::unique_ptr<mageec::IMachineLearner> nn_ml(new mageec::OneNN());
+  framework.registerMachineLearner(std::move(nn_ml));
+  std::unique_ptr<mageec::IMachineLearner> forest_ml(
+      new mageec::RandomForest());
+  framework.registerMachineLearner(std::move(forest_ml));
+
+  // The database is only ever read by the daemon
+  std::unique_ptr<mageec::Database> db = framework.getDatabase(db_path, false);
+  if (!db) {
+    MAGEEC_ERR("Error retrieving database. The database may not exist, or "
+               "you may not have sufficient permissions to read it");
+    return -1;
+  }
+  PredictService service(*db);
+
+  int listen_fd = listenOnSocket(db_path);
+  if (listen_fd < 0)
+    return -1;
+
+  // Exit cleanly on a signal, so that the socket is removed. The handler is
+  // installed without SA_RESTART, so that accept is interrupted.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleStopSignal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  sigaction(SIGHUP, &action, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  MAGEEC_DEBUG("Serving '" << db_path << "' on '" << socket_path << "'");
+
+  // Requests are answered one connection at a time. Each driver makes all
+  // of its requests on one short-lived connection, and answering a request
+  // is much cheaper than the compilation which follows it.
+  while (!stop_requested) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      MAGEEC_ERR("Error accepting connection: " << strerror(errno));
+      break;
+    }
+    if (!isPeerUser(fd)) {
+      MAGEEC_DEBUG("Rejected connection from another user");
+      close(fd);
+      continue;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = kConnectionTimeoutSecs;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    serveConnection(service, fd);
+    close(fd);
+  }
+
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  return 0;
+}
@@ -0,0 +1,276 @@
+/*  MAGEEC Prediction Service
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===---------------------- MAGEEC Prediction Service ---------------------===//
+//
+// This implements the messages exchanged with mageec-predictd, and the
+// client used by the driver to connect to it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PredictService.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+/// Identifies a prediction service message, and the version of the protocol
+const uint32_t kPredictMagic = 0x4450474d; // "MGPD"
+const uint32_t kPredictVersion = 2;
+
+/// Status of a response
+const uint32_t kPredictOK = 0;
+const uint32_t kPredictError = 1;
+
+/// Upper bound on the size of a message, to reject garbage
+const uint32_t kMaxMessageSize = 1 << 20;
+
+/// Time after which a client gives up waiting on the daemon, and falls back
+/// to making decisions itself
+const int kClientTimeoutSecs = 5;
+
+/// \brief Read or write exactly the provided number of bytes
+bool readAll(int fd, uint8_t *buf, size_t size) {
+  while (size != 0) {
+    ssize_t res = read(fd, buf, size);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    buf += res;
+    size -= static_cast<size_t>(res);
+  }
+  return true;
+}
+
+bool writeAll(int fd, const uint8_t *buf, size_t size) {
+  while (size != 0) {
+    ssize_t res = send(fd, buf, size, MSG_NOSIGNAL);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    buf += res;
+    size -= static_cast<size_t>(res);
+  }
+  return true;
+}
+
+} // end of anonymous namespace
+
+
+std::string getPredictSocketPath(const std::string &db_path) {
+  uint64_t hash = mageec::util::crc64(
+      reinterpret_cast<const uint8_t *>(db_path.data()), db_path.size());
+
+  // Prefer the per-user runtime directory, otherwise use a name in /tmp
+  // which is specific to the user.
+  std::stringstream path;
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && runtime_dir[0] == '/') {
+    path << runtime_dir << "/mageec-predictd-";
+  } else {
+    path << "/tmp/mageec-predictd-" << getuid() << '-';
+  }
+  path << std::hex << hash << ".sock";
+  return path.str();
+}
+
+// Messages are encoded with the same little endian helpers as containers,
+// with strings and arrays preceded by their 64-bit length.
+std::vector<uint8_t> encodePredictRequest(const PredictRequest &request) {
+  std::vector<uint8_t> message;
+  mageec::util::write32LE(message, kPredictMagic);
+  mageec::util::write32LE(message, kPredictVersion);
+  mageec::util::write64LE(message,
+                          static_cast<uint64_t>(request.feature_set_id));
+  mageec::util::writeBytes(
+      message, reinterpret_cast<const uint8_t *>(request.ml.data()),
+      request.ml.size());
+  mageec::util::writeBytes(
+      message, reinterpret_cast<const uint8_t *>(request.metric.data()),
+      request.metric.size());
+  mageec::util::write64LE(message, request.ml_digest);
+  mageec::util::write64LE(message, request.parameters.size());
+  for (unsigned param : request.parameters) {
+    mageec::util::write32LE(message, param);
+  }
+  return message;
+}
+
+std::vector<uint8_t>
+encodePredictResponse(const std::vector<PredictDecision> &decisions) {
+  std::vector<uint8_t> message;
+  mageec::util::write32LE(message, kPredictMagic);
+  mageec::util::write32LE(message, kPredictOK);
+  mageec::util::writeBytes(
+      message, reinterpret_cast<const uint8_t *>(decisions.data()),
+      decisions.size());
+  return message;
+}
+
+std::vector<uint8_t> encodePredictError() {
+  std::vector<uint8_t> message;
+  mageec::util::write32LE(message, kPredictMagic);
+  mageec::util::write32LE(message, kPredictError);
+  return message;
+}
+
+mageec::util::Option<PredictRequest>
+decodePredictRequest(const std::vector<uint8_t> &message) {
+  mageec::util::SectionReader reader(message.data(), message.size());
+  if (reader.read32() != kPredictMagic || reader.read32() != kPredictVersion)
+    return nullptr;
+
+  PredictRequest request;
+  request.feature_set_id = static_cast<mageec::FeatureSetID>(reader.read64());
+  request.ml = reader.readString();
+  request.metric = reader.readString();
+  request.ml_digest = reader.read64();
+
+  size_t n_params = reader.readCount(4);
+  for (size_t i = 0; i < n_params; ++i) {
+    request.parameters.push_back(reader.read32());
+  }
+  if (!reader.atEnd())
+    return nullptr;
+  return request;
+}
+
+mageec::util::Option<std::vector<PredictDecision>>
+decodePredictResponse(const std::vector<uint8_t> &message) {
+  mageec::util::SectionReader reader(message.data(), message.size());
+  if (reader.read32() != kPredictMagic || reader.read32() != kPredictOK)
+    return nullptr;
+
+  std::vector<uint8_t> values = reader.readBytes();
+  if (!reader.atEnd())
+    return nullptr;
+
+  std::vector<PredictDecision> decisions;
+  for (uint8_t decision : values) {
+    if (decision > static_cast<uint8_t>(PredictDecision::kEnabled))
+      return nullptr;
+    decisions.push_back(static_cast<PredictDecision>(decision));
+  }
+  return decisions;
+}
+
+bool readPredictMessage(int fd, std::vector<uint8_t> &message) {
+  uint8_t size_buf[4];
+  if (!readAll(fd, size_buf, sizeof(size_buf)))
+    return false;
+
+  uint32_t size =
+      mageec::util::SectionReader(size_buf, sizeof(size_buf)).read32();
+  if (size > kMaxMessageSize)
+    return false;
+
+  message.resize(size);
+  return readAll(fd, message.data(), size);
+}
+
+bool writePredictMessage(int fd, const std::vector<uint8_t> &message) {
+  std::vector<uint8_t> buf;
+  buf.reserve(message.size() + 4);
+  mageec::util::write32LE(buf, static_cast<uint32_t>(message.size()));
+  buf.insert(buf.end(), message.begin(), message.end());
+  return writeAll(fd, buf.data(), buf.size());
+}
+
+
+bool isPeerUser(int fd) {
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+      cred_len != sizeof(cred))
+    return false;
+  return cred.uid == getuid();
+}
+
+
+//===----------------------- PredictClient implementation -----------------===//
+
+
+PredictClient::~PredictClient() {
+  close(m_fd);
+}
+
+std::unique_ptr<PredictClient>
+PredictClient::connect(const std::string &db_path) {
+  std::string socket_path = getPredictSocketPath(db_path);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path))
+    return nullptr;
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return nullptr;
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  // The socket may be in a directory shared with other users, so check that
+  // it is served by a daemon run by this user before sending it anything.
+  if (!isPeerUser(fd)) {
+    MAGEEC_WARN("Ignoring prediction service at '" << socket_path
+                << "', which is not run by this user");
+    close(fd);
+    return nullptr;
+  }
+
+  // Don't wait indefinitely on a daemon which has stopped responding
+  struct timeval timeout;
+  timeout.tv_sec = kClientTimeoutSecs;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  MAGEEC_DEBUG("Connected to prediction service at '" << socket_path << "'");
+  return std::unique_ptr<PredictClient>(new PredictClient(fd));
+}
+
+mageec::util::Option<std::vector<PredictDecision>>
+PredictClient::predict(const PredictRequest &request) {
+  if (!writePredictMessage(m_fd, encodePredictRequest(request)))
+    return nullptr;
+
+  std::vector<uint8_t> message;
+  if (!readPredictMessage(m_fd, message))
+    return nullptr;
+
+  auto decisions = decodePredictResponse(message);
+  if (!decisions || decisions.get().size() != request.parameters.size())
+    return nullptr;
+  return decisions;
+}
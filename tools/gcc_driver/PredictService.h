@@ -0,0 +1,130 @@
+/*  MAGEEC Prediction Service
+    Copyright (C) 2017 Embecosm Limited
+
+    This file is part of MAGEEC
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+//===---------------------- MAGEEC Prediction Service ---------------------===//
+//
+// This defines the protocol between mageec-predictd, which keeps a database
+// and its trained machine learners loaded, and the drivers which ask it to
+// make decisions for a set of features. The daemon for a database listens
+// on a Unix socket whose path is derived from the path of the database, so
+// drivers using the database can find it without any configuration.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MAGEEC_PREDICT_SERVICE_H
+#define MAGEEC_PREDICT_SERVICE_H
+
+#include "mageec/Types.h"
+#include "mageec/Util.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/// \brief Decision made for a boolean parameter by the prediction service
+enum class PredictDecision : uint8_t {
+  kNative   = 0,
+  kDisabled = 1,
+  kEnabled  = 2
+};
+
+
+/// \struct PredictRequest
+///
+/// \brief Request for the decisions made for the features of a module by a
+/// trained machine learner.
+struct PredictRequest {
+  /// Features of the module to make decisions for
+  mageec::FeatureSetID feature_set_id;
+  /// Name of the machine learner, and the metric it was trained against
+  std::string ml;
+  std::string metric;
+  /// Digest of the trained model the decisions should be made by, so that
+  /// a daemon holding a stale model does not answer the request.
+  uint64_t ml_digest;
+  /// The boolean parameters to decide
+  std::vector<unsigned> parameters;
+};
+
+
+/// \brief Get the path of the socket of the daemon serving a database
+///
+/// \param db_path  Full path of the database
+std::string getPredictSocketPath(const std::string &db_path);
+
+/// \brief Serialize a request or response into a message
+std::vector<uint8_t> encodePredictRequest(const PredictRequest &request);
+std::vector<uint8_t>
+encodePredictResponse(const std::vector<PredictDecision> &decisions);
+
+/// \brief Deserialize a request or response from a message
+///
+/// \return The request or response, or nothing if the message is malformed
+/// or reports an error.
+mageec::util::Option<PredictRequest>
+decodePredictRequest(const std::vector<uint8_t> &message);
+mageec::util::Option<std::vector<PredictDecision>>
+decodePredictResponse(const std::vector<uint8_t> &message);
+
+/// \brief Encode a response reporting that a request could not be answered
+std::vector<uint8_t> encodePredictError();
+
+/// \brief Read or write a single length-prefixed message on a socket
+///
+/// \return true on success, false if the socket was closed or on error.
+bool readPredictMessage(int fd, std::vector<uint8_t> &message);
+bool writePredictMessage(int fd, const std::vector<uint8_t> &message);
+
+/// \brief Check that the process at the other end of a connected socket is
+/// run by the same user as this process
+bool isPeerUser(int fd);
+
+
+/// \class PredictClient
+///
+/// \brief Connection from a driver to the daemon serving its database
+class PredictClient {
+public:
+  ~PredictClient();
+
+  /// \brief Connect to the daemon serving a database
+  ///
+  /// \param db_path  Full path of the database
+  ///
+  /// \return The connection, or nullptr if no daemon is serving the database
+  static std::unique_ptr<PredictClient> connect(const std::string &db_path);
+
+  /// \brief Ask the daemon to make decisions for a set of features
+  ///
+  /// \return The decision for each of the requested parameters, in the same
+  /// order, or nothing if the daemon could not answer the request. Once a
+  /// request has failed, the connection should not be used again.
+  mageec::util::Option<std::vector<PredictDecision>>
+  predict(const PredictRequest &request);
+
+private:
+  explicit PredictClient(int fd) : m_fd(fd) {}
+
+  /// Socket connected to the daemon
+  int m_fd;
+};
+
+
+#endif // MAGEEC_PREDICT_SERVICE_H